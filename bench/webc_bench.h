@@ -0,0 +1,73 @@
+
+#ifndef H_BENCH
+#define H_BENCH
+
+/* ***************************************************************************
+ * Helpers shared by the benchmarks in bench/. Each benchmark reports one
+ * line per measurement, in the form
+ *    <name> [<key>=<value> ...] iterations=<n> ns/op=<n> allocs/op=<n>
+ * so that runs can be compared with a script.
+ *
+ * Allocations are counted by replacing malloc(), calloc() and realloc()
+ * with versions that count the call and hand it to the glibc allocator;
+ * calls made inside the C library (strdup(), open_memstream(), ...) are
+ * counted too. This header defines those functions, so it must be
+ * included by exactly one file in each benchmark program.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+// Per thread, so that a background thread in the library does not show
+// up in the counts of the benchmark thread.
+static _Thread_local size_t g_bench_allocs = 0;
+
+void *malloc (size_t size)
+{
+   g_bench_allocs++;
+   return __libc_malloc (size);
+}
+
+void *calloc (size_t nmemb, size_t size)
+{
+   g_bench_allocs++;
+   return __libc_calloc (nmemb, size);
+}
+
+void *realloc (void *ptr, size_t size)
+{
+   g_bench_allocs++;
+   return __libc_realloc (ptr, size);
+}
+
+static inline uint64_t bench_now_ns (void)
+{
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static inline size_t bench_allocs (void)
+{
+   return g_bench_allocs;
+}
+
+// params is the optional "<key>=<value> ..." part of the line.
+static inline void bench_report (const char *name, const char *params,
+                                 size_t iterations, uint64_t elapsed_ns,
+                                 size_t allocs)
+{
+   printf ("%s%s%s iterations=%zu ns/op=%.1f allocs/op=%.2f\n",
+           name, params ? " " : "", params ? params : "", iterations,
+           (double)elapsed_ns / iterations, (double)allocs / iterations);
+   fflush (stdout);
+}
+
+#endif
+
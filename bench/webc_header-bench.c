@@ -0,0 +1,179 @@
+/* ***************************************************************************
+ * Benchmark for the header functions and the status line lookup: building
+ * a typical response header with webc_header_set(), writing it with
+ * webc_header_write() (to /dev/null, so that the cost is the calls and not
+ * the I/O), looking up request headers with headerlist_find() and looking
+ * up status lines with webc_get_http_rspstr().
+ *
+ * Output is one line per function (see webc_bench.h):
+ *    header_set headers=<n> iterations=<n> ns/op=<n> allocs/op=<n>
+ *    ...
+ *    http_rspstr iterations=<n> ns/op=<n> allocs/op=<n>
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "webc_header.h"
+#include "webc_util.h"
+
+#include "webc_bench.h"
+
+#define ITERATIONS      (1000000)
+
+static const struct {
+   enum webc_header_name_t name;
+   const char *value;
+} g_rsp_headers[] = {
+   { webc_header_CONTENT_TYPE,      "text/html; charset=utf-8"          },
+   { webc_header_CONTENT_LENGTH,    "4096"                              },
+   { webc_header_CACHE_CONTROL,     "public, max-age=3600"              },
+   { webc_header_ETAG,              "\"5f3a-1b2c\""                     },
+   { webc_header_LAST_MODIFIED,     "Tue, 15 Nov 1994 12:45:26 GMT"     },
+   { webc_header_CONNECTION,        "keep-alive"                        },
+};
+
+#define NRSP_HEADERS    (sizeof g_rsp_headers / sizeof g_rsp_headers[0])
+
+static char *g_rqst_headers[] = {
+   "Host: www.example.com",
+   "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101",
+   "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8",
+   "Accept-Language: en-GB,en;q=0.5",
+   "Accept-Encoding: gzip, deflate, br",
+   "Connection: keep-alive",
+   "If-None-Match: \"5f3a-1b2c\"",
+   NULL,
+};
+
+// Found early, found late and not found at all.
+static const enum webc_header_name_t g_lookups[] = {
+   webc_header_CONNECTION,
+   webc_header_IF_NONE_MATCH,
+   webc_header_CONTENT_LENGTH,
+};
+
+#define NLOOKUPS        (sizeof g_lookups / sizeof g_lookups[0])
+
+static const int g_statuses[] = { 200, 304, 404, 206, 500, 301 };
+
+#define NSTATUSES       (sizeof g_statuses / sizeof g_statuses[0])
+
+static webc_header_t *header_build (void)
+{
+   webc_header_t *header = webc_header_new ();
+   if (!header)
+      return NULL;
+
+   for (size_t i=0; i<NRSP_HEADERS; i++) {
+      if (!(webc_header_set (header, g_rsp_headers[i].name,
+                                     g_rsp_headers[i].value))) {
+         webc_header_del (header);
+         return NULL;
+      }
+   }
+
+   return header;
+}
+
+static bool bench_header_set (void)
+{
+   char params[32];
+
+   snprintf (params, sizeof params, "headers=%zu", NRSP_HEADERS);
+
+   size_t allocs = bench_allocs ();
+   uint64_t start = bench_now_ns ();
+   for (size_t i=0; i<ITERATIONS; i++) {
+      webc_header_t *header = header_build ();
+      if (!header) {
+         fprintf (stderr, "Failed to build the header\n");
+         return false;
+      }
+      webc_header_del (header);
+   }
+   bench_report ("header_set", params, ITERATIONS, bench_now_ns () - start,
+                 bench_allocs () - allocs);
+
+   return true;
+}
+
+static bool bench_header_write (void)
+{
+   bool error = true;
+   webc_header_t *header = NULL;
+   int fd = -1;
+   char params[32];
+
+   snprintf (params, sizeof params, "headers=%zu", NRSP_HEADERS);
+
+   if ((fd = open ("/dev/null", O_WRONLY))<0) {
+      perror ("/dev/null");
+      goto errorexit;
+   }
+
+   if (!(header = header_build ())) {
+      fprintf (stderr, "Failed to build the header\n");
+      goto errorexit;
+   }
+
+   size_t allocs = bench_allocs ();
+   uint64_t start = bench_now_ns ();
+   for (size_t i=0; i<ITERATIONS; i++) {
+      if (!(webc_header_write (header, fd))) {
+         fprintf (stderr, "Failed to write the header\n");
+         goto errorexit;
+      }
+   }
+   bench_report ("header_write", params, ITERATIONS, bench_now_ns () - start,
+                 bench_allocs () - allocs);
+
+   error = false;
+
+errorexit:
+   webc_header_del (header);
+   if (fd >= 0)
+      close (fd);
+   return !error;
+}
+
+static void bench_lookups (void)
+{
+   volatile uintptr_t sink = 0;
+   size_t allocs;
+   uint64_t start;
+
+   allocs = bench_allocs ();
+   start = bench_now_ns ();
+   for (size_t i=0; i<ITERATIONS; i++) {
+      sink += (uintptr_t)headerlist_find (g_rqst_headers, g_lookups[i % NLOOKUPS]);
+   }
+   bench_report ("headerlist_find", NULL, ITERATIONS, bench_now_ns () - start,
+                 bench_allocs () - allocs);
+
+   allocs = bench_allocs ();
+   start = bench_now_ns ();
+   for (size_t i=0; i<ITERATIONS; i++) {
+      sink += (uintptr_t)webc_get_http_rspstr (g_statuses[i % NSTATUSES]);
+   }
+   bench_report ("http_rspstr", NULL, ITERATIONS, bench_now_ns () - start,
+                 bench_allocs () - allocs);
+
+   (void)sink;
+}
+
+int main (void)
+{
+   if (!(bench_header_set ()) || !(bench_header_write ()))
+      return EXIT_FAILURE;
+
+   bench_lookups ();
+
+   return EXIT_SUCCESS;
+}
+
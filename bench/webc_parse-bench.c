@@ -0,0 +1,165 @@
+/* ***************************************************************************
+ * Benchmark for the request parser: the request-line functions that
+ * webc_serve_conn() calls on every request, over a fixed mix of request
+ * lines, and webc_util_read_line() reading a typical request from one end
+ * of a socketpair. Only the reads are timed; the request is written into
+ * the socket between rounds.
+ *
+ * Output is one line per function (see webc_bench.h):
+ *    rqst_method iterations=<n> ns/op=<n> allocs/op=<n>
+ *    ...
+ *    read_line bytes/line=<n> iterations=<n> ns/op=<n> allocs/op=<n>
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "webc_util.h"
+
+#include "webc_bench.h"
+
+#define ITERATIONS      (1000000)
+#define READ_ROUNDS     (20000)
+
+static const char *g_rqst_lines[] = {
+   "GET / HTTP/1.1",
+   "GET /index.html HTTP/1.1",
+   "HEAD /static/css/site.css HTTP/1.1",
+   "GET /api/v42/users/123/orders?page=2&limit=50 HTTP/1.1",
+   "POST /api/v42/users HTTP/1.1",
+   "GET /docs//guide//intro.html HTTP/1.0",
+   "OPTIONS * HTTP/1.1",
+   "PATCH /api/v42/users/123 HTTP/1.1",
+};
+
+#define NLINES          (sizeof g_rqst_lines / sizeof g_rqst_lines[0])
+
+static const char g_rqst[] =
+   "GET /api/v42/users/123/orders?page=2&limit=50 HTTP/1.1\r\n"
+   "Host: www.example.com\r\n"
+   "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101\r\n"
+   "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+   "Accept-Language: en-GB,en;q=0.5\r\n"
+   "Accept-Encoding: gzip, deflate, br\r\n"
+   "Connection: keep-alive\r\n"
+   "If-None-Match: \"5f3a-1b2c\"\r\n"
+   "\r\n";
+
+#define RQST_LINES      (9)
+
+static void bench_rqst_line (void)
+{
+   volatile uintptr_t sink = 0;
+   size_t allocs;
+   uint64_t start;
+
+   allocs = bench_allocs ();
+   start = bench_now_ns ();
+   for (size_t i=0; i<ITERATIONS; i++) {
+      sink += webc_util_rqst_method (g_rqst_lines[i % NLINES]);
+   }
+   bench_report ("rqst_method", NULL, ITERATIONS, bench_now_ns () - start,
+                 bench_allocs () - allocs);
+
+   allocs = bench_allocs ();
+   start = bench_now_ns ();
+   for (size_t i=0; i<ITERATIONS; i++) {
+      sink += webc_util_rqst_version (g_rqst_lines[i % NLINES]);
+   }
+   bench_report ("rqst_version", NULL, ITERATIONS, bench_now_ns () - start,
+                 bench_allocs () - allocs);
+
+   allocs = bench_allocs ();
+   start = bench_now_ns ();
+   for (size_t i=0; i<ITERATIONS; i++) {
+      char *resource = webc_util_rqst_resource (g_rqst_lines[i % NLINES]);
+      sink += (uintptr_t)resource;
+      free (resource);
+   }
+   bench_report ("rqst_resource", NULL, ITERATIONS, bench_now_ns () - start,
+                 bench_allocs () - allocs);
+
+   allocs = bench_allocs ();
+   start = bench_now_ns ();
+   for (size_t i=0; i<ITERATIONS; i++) {
+      char *getvars = webc_util_rqst_getvars (g_rqst_lines[i % NLINES]);
+      sink += (uintptr_t)getvars;
+      free (getvars);
+   }
+   bench_report ("rqst_getvars", NULL, ITERATIONS, bench_now_ns () - start,
+                 bench_allocs () - allocs);
+
+   (void)sink;
+}
+
+static bool bench_read_line (void)
+{
+   bool error = true;
+   int fds[2] = { -1, -1 };
+   char *line = NULL;
+   size_t line_len = 0;
+   uint64_t elapsed = 0;
+   size_t allocs = 0;
+
+   if ((socketpair (AF_UNIX, SOCK_STREAM, 0, fds))!=0) {
+      perror ("socketpair");
+      goto errorexit;
+   }
+
+   for (size_t r=0; r<READ_ROUNDS; r++) {
+      if ((write (fds[1], g_rqst, sizeof g_rqst - 1))
+            != (ssize_t)(sizeof g_rqst - 1)) {
+         perror ("write");
+         goto errorexit;
+      }
+
+      size_t allocs_start = bench_allocs ();
+      uint64_t start = bench_now_ns ();
+      for (size_t i=0; i<RQST_LINES; i++) {
+         if (!(webc_util_read_line (fds[0], &line, &line_len))) {
+            fprintf (stderr, "Failed to read line %zu\n", i);
+            goto errorexit;
+         }
+      }
+      elapsed += bench_now_ns () - start;
+      allocs += bench_allocs () - allocs_start;
+
+      if (line_len != 0) {
+         fprintf (stderr, "Lost track of the request boundary\n");
+         goto errorexit;
+      }
+   }
+
+   char params[32];
+   snprintf (params, sizeof params, "bytes/line=%zu",
+             (sizeof g_rqst - 1) / RQST_LINES);
+   bench_report ("read_line", params, READ_ROUNDS * RQST_LINES, elapsed,
+                 allocs);
+
+   error = false;
+
+errorexit:
+   free (line);
+   if (fds[0] >= 0)
+      close (fds[0]);
+   if (fds[1] >= 0)
+      close (fds[1]);
+   return !error;
+}
+
+int main (void)
+{
+   bench_rqst_line ();
+
+   if (!(bench_read_line ()))
+      return EXIT_FAILURE;
+
+   return EXIT_SUCCESS;
+}
+
@@ -0,0 +1,114 @@
+/* ***************************************************************************
+ * Benchmark for webc_resource_handler_find(). Registers routes in steps up
+ * to 1000 (a third each of exact, prefix and suffix patterns, on top of the
+ * defaults the server registers) and times lookups for a fixed mix of
+ * resources after each step. The time per lookup should not grow with the
+ * number of routes.
+ *
+ * Output is one line per step (see webc_bench.h):
+ *    route_find routes=<n> iterations=<n> ns/op=<n> allocs/op=<n>
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "webc_resource.h"
+#include "webc_handler.h"
+
+#include "webc_bench.h"
+
+#define MAX_ROUTES      (1000)
+#define ITERATIONS      (1000000)
+
+static const char *g_resources[] = {
+   "/index.html",
+   "/docs/",
+   "/static/css/site.css",
+   "/app/r17/items",
+   "/app/r999/items",
+   "/api/v42/users/123/orders",
+   "/files/report.e333",
+   "/some/long/path/that/matches/nothing/in/particular.bin",
+};
+
+#define NRESOURCES      (sizeof g_resources / sizeof g_resources[0])
+
+static bool add_routes (size_t from, size_t to)
+{
+   char pattern[64];
+
+   for (size_t i=from; i<to; i++) {
+      bool ok = false;
+      switch (i % 3) {
+         case 0:
+            snprintf (pattern, sizeof pattern, "/app/r%zu/items", i);
+            ok = webc_resource_global_handler_add ("bench", pattern,
+                                                   pattern_EXACT,
+                                                   webc_handler_none);
+            break;
+         case 1:
+            snprintf (pattern, sizeof pattern, "/api/v%zu/", i);
+            ok = webc_resource_global_handler_add ("bench", pattern,
+                                                   pattern_PREFIX,
+                                                   webc_handler_none);
+            break;
+         case 2:
+            snprintf (pattern, sizeof pattern, ".e%zu", i);
+            ok = webc_resource_global_handler_add ("bench", pattern,
+                                                   pattern_SUFFIX,
+                                                   webc_handler_none);
+            break;
+      }
+      if (!ok)
+         return false;
+   }
+
+   return true;
+}
+
+int main (void)
+{
+   static const size_t steps[] = { 10, 100, 1000 };
+   size_t nroutes = 0;
+   volatile uintptr_t sink = 0;
+
+   if (!(webc_resource_global_handler_lock ()) ||
+       !(webc_resource_global_handler_add ("none", "", pattern_SUFFIX,
+                                           webc_handler_none)) ||
+       !(webc_resource_global_handler_add ("dir", "/", pattern_SUFFIX,
+                                           webc_handler_dir)) ||
+       !(webc_resource_global_handler_add ("html", ".html", pattern_SUFFIX,
+                                           webc_handler_html)) ||
+       !(webc_resource_global_handler_unlock ())) {
+      fprintf (stderr, "Failed to register the default routes\n");
+      return EXIT_FAILURE;
+   }
+
+   for (size_t s=0; s<sizeof steps / sizeof steps[0]; s++) {
+      if (!(webc_resource_global_handler_lock ()) ||
+          !(add_routes (nroutes, steps[s])) ||
+          !(webc_resource_global_handler_unlock ())) {
+         fprintf (stderr, "Failed to register %zu routes\n", steps[s]);
+         return EXIT_FAILURE;
+      }
+      nroutes = steps[s];
+
+      char params[32];
+      snprintf (params, sizeof params, "routes=%zu", nroutes);
+
+      size_t allocs = bench_allocs ();
+      uint64_t start = bench_now_ns ();
+      for (size_t i=0; i<ITERATIONS; i++) {
+         sink += (uintptr_t)webc_resource_handler_find (g_resources[i % NRESOURCES]);
+      }
+      uint64_t elapsed = bench_now_ns () - start;
+
+      bench_report ("route_find", params, ITERATIONS, elapsed,
+                    bench_allocs () - allocs);
+   }
+
+   (void)sink;
+   return EXIT_SUCCESS;
+}
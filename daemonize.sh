@@ -5,8 +5,32 @@ if [ -z "$1" ]; then
    exit 127;
 fi
 
-until $1; do
-    echo "Server '$1' crashed with exit code $?.  Respawning..." >&2
+# The server is started with --pidfile so that it can be followed across
+# upgrades (SIGUSR2): the old server exits with 0 once the new one, which
+# is not a child of this script, has written its pid to the file. Send
+# signals to the pid in the file. A server that stops cleanly removes the
+# file; if the server named in it is gone and the file is still there, it
+# died and is respawned.
+PIDFILE=${2:-webc.pid}
+
+while true; do
+    $1 --pidfile="$PIDFILE"
+    status=$?
+
+    while [ $status -eq 0 ] && pid=$(cat "$PIDFILE" 2>/dev/null) &&
+          kill -0 "$pid" 2>/dev/null; do
+        sleep 1
+    done
+
+    if [ $status -eq 0 ] && [ ! -e "$PIDFILE" ]; then
+        break
+    fi
+
+    if [ $status -eq 0 ]; then
+        echo "Server '$1' (pid $pid) died after an upgrade.  Respawning..." >&2
+    else
+        echo "Server '$1' crashed with exit code $status.  Respawning..." >&2
+    fi
+    rm -f "$PIDFILE"
     sleep 1
 done
-
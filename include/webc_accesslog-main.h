@@ -0,0 +1,15 @@
+
+#ifndef H_ACCESSLOG_MAIN
+#define H_ACCESSLOG_MAIN
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#ifdef __cplusplus
+};
+#endif
+
+
+#endif
@@ -0,0 +1,104 @@
+
+#ifndef H_ACCESSLOG
+#define H_ACCESSLOG
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "webc_util.h"
+
+/* The access log: one fixed-layout binary record per request, appended by
+ * the request thread to a memory-mapped file without taking a lock. A file
+ * holds ACCESSLOG_FILE_SIZE bytes (webc_config.h); when it is full the log
+ * moves on to a new file, and the old one is cut to the length that was
+ * used once the last record in flight has been written.
+ *
+ * A file is a webc_accesslog_header_t followed by entries, each of which
+ * starts with its type and its length and is a multiple of 8 bytes long.
+ * Paths are interned: the first request for a path in a file is preceded
+ * by a STRING entry that gives the path an id, and REQUEST entries refer
+ * to paths by id. Because requests are written concurrently, a REQUEST can
+ * come before the STRING it refers to, and a path can have more than one
+ * STRING entry with the same id: until one of them has been written, for
+ * instance when the first had no room at the end of the file, every
+ * request for the path writes one. An entry of type END, or the end of
+ * the file, ends the log. All fields are in host byte order.
+ *
+ * webc_accesslog-main decodes the files to text or CSV, and computes
+ * latency percentiles.
+ */
+
+#define WEBC_ACCESSLOG_MAGIC     ("WEBCALOG")
+#define WEBC_ACCESSLOG_VERSION   (1)
+
+enum webc_accesslog_type_t {
+   webc_accesslog_END = 0,
+   webc_accesslog_STRING,
+   webc_accesslog_REQUEST,
+};
+
+struct webc_accesslog_header_t {
+   char        magic[8];
+   uint32_t    version;
+   uint32_t    header_len;
+   // The wall-clock time and the monotonic time, both in ns, at which the
+   // file was created. Timestamps in the records are monotonic.
+   uint64_t    wall_ns;
+   uint64_t    mono_ns;
+};
+
+struct webc_accesslog_entry_t {
+   uint16_t    type;
+   uint16_t    len;
+};
+
+struct webc_accesslog_string_t {
+   uint16_t    type;
+   uint16_t    len;
+   uint32_t    id;
+   uint32_t    str_len;
+   char        str[];      // Not terminated
+};
+
+struct webc_accesslog_request_t {
+   uint16_t    type;
+   uint16_t    len;
+   uint16_t    status;
+   uint8_t     method;     // enum webc_method_t
+   uint8_t     family;     // 4 or 6, or 0 if the address is unknown
+   uint32_t    path_id;
+   uint16_t    port;
+   uint16_t    reserved;
+   uint64_t    timestamp_ns;
+   uint64_t    latency_ns;
+   uint64_t    bytes;
+   uint8_t     addr[16];
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Start logging to files named <prefix>.<YYYYMMDDhhmmss>.<n>.alog.
+   // Until this is called webc_accesslog_write() does nothing.
+   bool webc_accesslog_open (const char *prefix);
+   void webc_accesslog_close (void);
+
+   // Records a completed request. start_ns is the monotonic time at which
+   // the request started (see webc_accesslog_now()). path may be NULL.
+   void webc_accesslog_write (uint64_t start_ns, const char *remote_addr,
+                              uint16_t remote_port, enum webc_method_t method,
+                              const char *path, int status, uint64_t bytes);
+
+   uint64_t webc_accesslog_now (void);
+
+   // The number of records that could not be written.
+   uint64_t webc_accesslog_dropped (void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
@@ -0,0 +1,15 @@
+
+#ifndef H_BUNDLE_MAIN
+#define H_BUNDLE_MAIN
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#ifdef __cplusplus
+};
+#endif
+
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef H_CONFIG
+#define H_CONFIG
+
+/* This file contains all the configuration defaults for the server.
+ */
+
+// This is the port that will be listened on if the user does not
+// specify a port.
+#define DEFAULT_LISTEN_PORT      "5998"
+
+// The maximum number of connections to hold in the queue while we
+// start up the thread to service a client.
+#define DEFAULT_BACKLOG          "50"
+
+// How often, in seconds, the server program frees old plugin versions and
+// checks that the server is still accepting. Signals are handled as soon
+// as they arrive.
+#define TIMEOUT_TO_SHUTDOWN      (1)
+
+// Each connection is served on a thread of its own unless this is not
+// zero, in which case a pool of this many threads serves them all (see
+// webc_server.h). --threads changes it.
+#define SERVER_POOL_SIZE         (0)
+
+// The most connections served at once; above this no more are accepted
+// until one ends, and the rest wait in the listen backlog. 0 for no limit.
+// --max-conns changes it.
+#define SERVER_MAX_CONNS         (0)
+
+// On shutdown the connections in progress have this many seconds to finish
+// before they are closed; 0 waits for them all. --drain-secs changes it.
+#define SERVER_DRAIN_SECS        (10)
+
+// On an upgrade (SIGUSR2, see webc_upgrade.h) the new server has this many
+// seconds to start accepting on the listeners it is handed, after which it
+// is killed and the old server carries on.
+#define UPGRADE_TIMEOUT_SECS     (30)
+
+// The maximum line length for HTTP requests and HTTP headers. Most
+// webservers impose a maximum length of 4096 bytes for each line in the
+// request or the header. This is usually sufficient.
+// #define MAX_HTTP_LINE_LENGTH     (4096)
+
+// The maximum number of headers to process before giving up.
+#define MAX_HTTP_HEADERS         (125)
+
+// The default web-root directory. Note that this can be either absolute
+// (using a leading "/") or relative to the current directory.
+#define DEFAULT_WEB_ROOT         ("www-root")
+
+// The default patterns that we handle
+#define EXTENSION_HTML           (".html")
+#define EXTENSION_TEXT           (".txt")
+#define EXTENSION_DIR            ("/")
+#define EXTENSION_NONE           ("")
+
+// The administrative endpoints (see webc_admin.h) are served below this
+// prefix, to clients on the loopback interface that send the admin token.
+#define ADMIN_PREFIX             ("/_webc/")
+
+// The server metrics (see webc_metrics.h) are served here, in the
+// Prometheus text format. Up to METRICS_MAX_SLOTS threads record into slots
+// of their own; any more share one slot.
+#define METRICS_PATH             ("/metrics")
+#define METRICS_MAX_SLOTS        (512)
+
+// Requests that take at least this many milliseconds are kept, with their
+// details, in the slow-request log (see webc_slowlog.h); --slowlog and the
+// admin endpoint change it, and 0 turns the log off. The log holds the
+// last SLOWLOG_SIZE such requests, with the request headers named in
+// SLOWLOG_HEADERS.
+#define SLOWLOG_DEFAULT_THRESHOLD_MS   (1000)
+#define SLOWLOG_SIZE                   (64)
+#define SLOWLOG_HEADERS                { "Host", "User-Agent", "Referer",\
+                                         "Content-Length", "Range" }
+
+
+// Do we follow links or not? Resources are opened with
+// openat2(RESOLVE_BENEATH), so a followed symlink must still point somewhere
+// beneath the webserver root; with this off symlinks are not followed at
+// all. On kernels without openat2() the beneath check is not available, and
+// a careless administrator can let the client go below the directories in
+// the webserver root.
+#define FOLLOW_SYMLINKS          (1)
+
+
+// The default index file to use when the client does a GET on a directory
+// name.
+#define DEFAULT_INDEX_FILE       ("/index.html")
+
+
+// The maximum amount of memory, in bytes, used to cache rendered directory
+// listings. The least recently used listings are evicted when this is
+// exceeded. Set to zero to disable the cache.
+#define DIRCACHE_MAX_BYTES       (32 * 1024 * 1024)
+
+
+// Directory listings can be paginated with "?offset=N&limit=M", which
+// streams the entries in directory order instead of reading and sorting
+// the whole directory. This is the page size when only an offset is given.
+#define DIRLIST_PAGE_SIZE        (1000)
+
+
+// Caches over the web root are invalidated by a filesystem watcher. When
+// the watcher cannot cover the whole tree (for example when the inotify
+// watch limit is reached) cached entries older than this many seconds are
+// revalidated with stat() instead.
+#define FSWATCH_TTL_SECS         (2)
+
+
+// The number of parent directory fds kept open so that deep paths do not
+// have to be resolved from the web root on every request.
+#define PATH_DIRFD_CACHE_SIZE    (256)
+
+
+// File bodies are sent in chunks of at most this many bytes, with the
+// socket non-blocking so that the sending thread waits for the client in
+// poll() rather than in a single long sendfile().
+#define XMIT_CHUNK_SIZE          (512 * 1024)
+
+// A client that accepts no data for this many seconds while a response is
+// being sent is disconnected.
+#define XMIT_STALL_TIMEOUT_SECS  (30)
+
+// A client that takes less than XMIT_MIN_RATE bytes a second of a file
+// body, averaged over each XMIT_RATE_WINDOW_SECS, is disconnected; this
+// replaces the stall timeout for file bodies. 0 for no minimum.
+#define XMIT_MIN_RATE            (4 * 1024)
+#define XMIT_RATE_WINDOW_SECS    (10)
+
+
+// Each version of a plugin is loaded from a copy of the plugin file, made
+// in this directory and removed as soon as it is loaded.
+#define PLUGIN_COPY_DIR          ("/tmp")
+
+
+// Each thread logs into a ring of this many bytes, which the log writer
+// drains every LOG_FLUSH_INTERVAL_MS milliseconds. Records that do not fit
+// are dropped and counted. Records are cut short at LOG_RECORD_MAX bytes,
+// and at most LOG_MAX_RINGS threads have a ring at a time; the records of
+// any others are dropped.
+#define LOG_RING_SIZE            (16 * 1024)
+#define LOG_RECORD_MAX           (1024)
+#define LOG_MAX_RINGS            (512)
+#define LOG_FLUSH_INTERVAL_MS    (10)
+
+// With --logfile the log moves on to a new file once the current one is
+// this many bytes long or this many seconds old; 0 turns either limit off.
+// SIGUSR1 moves it on at once.
+#define LOGFILE_ROTATE_SIZE      (256 * 1024 * 1024)
+#define LOGFILE_ROTATE_SECS      (24 * 60 * 60)
+
+// The runtime log level at startup (see webc_log.h), which --loglevel and
+// the admin endpoint change.
+#define LOG_DEFAULT_LEVEL        (WEBC_LOG_INFO)
+
+
+// The access log (--accesslog) moves on to a new file after this many
+// bytes. Each file interns at most ACCESSLOG_MAX_PATHS paths; requests for
+// other paths carry the path with every record.
+#define ACCESSLOG_FILE_SIZE      (64 * 1024 * 1024)
+#define ACCESSLOG_MAX_PATHS      (64 * 1024)
+
+
+// With --capture=<file> the request bytes of each connection are recorded
+// for webc_replay-main (see webc_capture.h), up to this many bytes of
+// record per connection.
+#define CAPTURE_MAX_CONN_BYTES   (64 * 1024)
+
+
+// The application identifier, and the version string
+#define APPLICATION_ID           "Web.c"
+#define VERSION_STRING           webc_version
+
+
+#endif
+
@@ -0,0 +1,73 @@
+
+#ifndef H_DIRCACHE
+#define H_DIRCACHE
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/stat.h>
+
+/* A cache of fully-rendered directory listings. Entries are keyed by the
+ * directory path (a trailing '/' is ignored, and "." is the root) and
+ * carry the directory's device, inode, mtime and ctime.
+ *
+ * Entries are invalidated by the filesystem watcher (webc_fswatch.h), so
+ * while the watcher is reliable a lookup needs no stat() at all. When it
+ * is not, entries are trusted for FSWATCH_TTL_SECS after they were last
+ * checked against a stat buffer.
+ *
+ * Total memory is capped at DIRCACHE_MAX_BYTES (webc_config.h); the least
+ * recently used entries are evicted to make room for new ones.
+ *
+ * Each server (see webc_server.h) has a cache of its own.
+ */
+
+#include "webc_fswatch.h"
+
+typedef struct webc_dircache_t webc_dircache_t;
+typedef struct webc_dircache_entry_t webc_dircache_entry_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // A cache invalidated by fswatch, which must outlive it; with a NULL
+   // fswatch every entry is revalidated once it is FSWATCH_TTL_SECS old.
+   // Every entry must be released before the cache is deleted.
+   webc_dircache_t *webc_dircache_new (webc_fswatch_t *fswatch);
+   void webc_dircache_del (webc_dircache_t *dc);
+
+   // Returns the cached listing for path, or NULL if there is none. With
+   // a NULL sb only an entry that can be trusted without a stat() is
+   // returned; callers that get NULL should stat() the directory and call
+   // again with the result, which returns the entry if it still matches.
+   // A returned entry must be released with webc_dircache_release(). A
+   // NULL dc is a cache that is always empty.
+   webc_dircache_entry_t *webc_dircache_find (webc_dircache_t *dc,
+                                              const char *path,
+                                              const struct stat *sb);
+
+   // Store a listing for path, replacing any older one. generation must be
+   // the value of webc_fswatch_generation() for the cache's watcher from
+   // before the directory was read. On success the cache takes ownership of html (which must have
+   // been malloc()ed) and returns the new entry, which must be released by
+   // the caller. Returns NULL if the listing could not be cached (too
+   // large, or OOM), in which case html still belongs to the caller.
+   webc_dircache_entry_t *webc_dircache_insert (webc_dircache_t *dc,
+                                                const char *path,
+                                                const struct stat *sb,
+                                                uint64_t generation,
+                                                char *html, size_t html_len);
+
+   const char *webc_dircache_html (webc_dircache_entry_t *entry,
+                                   size_t *html_len);
+
+   void webc_dircache_release (webc_dircache_entry_t *entry);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
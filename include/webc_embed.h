@@ -0,0 +1,52 @@
+
+#ifndef H_EMBED
+#define H_EMBED
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Static assets compiled into the server. Every file below EMBED_ASSETS_DIR
+ * (build.config) is turned into a C array by tools/webc_embedgen.c, along
+ * with its response header lines (Content-Type, Content-Length, ETag and
+ * so on, each ending in CRLF, without the blank line that ends the
+ * header), into src/webc_embed_table.c. head holds no status line:
+ * webc_handler_embedded() writes that itself, as it answers 304 as well
+ * as 200. The table is sorted by path so that lookups are a binary
+ * search.
+ *
+ * With EMBED_ASSETS_DIR empty the table is empty and nothing is served
+ * from it.
+ */
+
+struct webc_embed_entry_t {
+   const char           *path;
+   size_t                path_len;
+   const char           *head;
+   size_t                head_len;
+   const unsigned char  *body;
+   size_t                body_len;
+   const char           *etag;
+};
+
+// Generated into src/webc_embed_table.c.
+extern const struct webc_embed_entry_t webc_embed_table[];
+extern const size_t webc_embed_table_nentries;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // The entry for path (relative to the web root, without a leading '/'),
+   // or NULL if no such file was embedded.
+   const struct webc_embed_entry_t *webc_embed_find (const char *path,
+                                                     size_t path_len);
+
+   // The number of embedded files.
+   size_t webc_embed_count (void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
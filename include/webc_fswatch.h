@@ -0,0 +1,63 @@
+
+#ifndef H_FSWATCH
+#define H_FSWATCH
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A background watcher over the web root. Caches over the filesystem
+ * subscribe to it to be told when something under the root changes, so
+ * that they do not need to stat() on every request to revalidate.
+ *
+ * The watcher uses recursive inotify watches. When it cannot watch the
+ * whole tree (watch limits hit, inotify unavailable, or directories
+ * reached through symlinks) it reports itself as unreliable, and caches
+ * must fall back to revalidating entries that are older than
+ * FSWATCH_TTL_SECS (webc_config.h).
+ *
+ * Each server (see webc_server.h) has a watcher over its own root. The
+ * functions below take NULL for no watcher, which is never reliable.
+ */
+
+typedef struct webc_fswatch_t webc_fswatch_t;
+
+// Called from the watcher thread. dir is the directory, relative to the
+// watched root and without a leading or trailing '/' ("" for the root),
+// whose entry name changed. name is NULL when dir itself changed. When
+// both are NULL events were lost and everything must be invalidated.
+typedef void (webc_fswatch_cb_t) (const char *dir, const char *name,
+                                  void *udata);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Start watching root in a background thread. Returns NULL if the
+   // watcher could not be started at all; the server can continue without
+   // it, revalidating as if it were unreliable.
+   webc_fswatch_t *webc_fswatch_new (const char *root);
+
+   // Stops the watcher thread. The subscribers are not called once this
+   // returns.
+   void webc_fswatch_del (webc_fswatch_t *fsw);
+
+   // Subscribers may be added at any time. There is no unsubscribe; the
+   // callback and udata must stay valid until the watcher is deleted.
+   bool webc_fswatch_subscribe (webc_fswatch_t *fsw,
+                                webc_fswatch_cb_t *cb, void *udata);
+
+   // Incremented before every batch of events is delivered to the
+   // subscribers. A cache that reads the generation before building an
+   // entry, and finds it unchanged when storing the entry, knows that no
+   // invalidation was missed in between.
+   uint64_t webc_fswatch_generation (webc_fswatch_t *fsw);
+
+   // True only while the entire tree is watched and no events were lost.
+   bool webc_fswatch_reliable (webc_fswatch_t *fsw);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
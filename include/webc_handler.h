@@ -0,0 +1,46 @@
+
+#ifndef H_HANDLER
+#define H_HANDLER
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "webc_resource.h"
+
+#define WEBC_HANDLER(x)   int x (int                       fd,            \
+                                 char                     *remote_addr,   \
+                                 uint16_t                  remote_port,   \
+                                 enum webc_method_t        method,        \
+                                 enum webc_http_version_t  version,       \
+                                 const char               *resource,      \
+                                 char                    **rqst_headers,  \
+                                 webc_header_t            *rsp_headers,   \
+                                 char                     *vars)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+   WEBC_HANDLER (webc_handler_static_file);
+   WEBC_HANDLER (webc_handler_html);
+   WEBC_HANDLER (webc_handler_none);
+   WEBC_HANDLER (webc_handler_dir);
+   WEBC_HANDLER (webc_handler_dirlist);
+
+   // Serves from the site bundle opened with webc_bundle_open(), and from
+   // the filesystem (as webc_handler_none) for anything not in it. Can be
+   // registered in place of any of the handlers above.
+   WEBC_HANDLER (webc_handler_bundle);
+
+   // Serves the assets compiled into the server (webc_embed.h), and falls
+   // through to webc_handler_bundle for anything not among them.
+   WEBC_HANDLER (webc_handler_embedded);
+
+#undef WEBC_HANDLER
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef H_LOADGEN_MAIN
+#define H_LOADGEN_MAIN
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#ifdef __cplusplus
+};
+#endif
+
+
+#endif
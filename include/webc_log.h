@@ -0,0 +1,83 @@
+
+#ifndef H_LOG
+#define H_LOG
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/* The backend of the WEBC_*_LOG macros (webc_util.h). Each thread formats
+ * its records into a ring of its own, which a background writer drains to
+ * stderr in batches, so logging threads do not contend on a lock or wait
+ * for the write. A record that does not fit in its thread's ring is
+ * dropped and counted, and the writer reports the count.
+ *
+ * Until webc_log_start() is called, and after webc_log_stop(), records are
+ * written to stderr directly.
+ *
+ * With webc_log_file() stderr is a logfile, which the writer replaces with
+ * a new one when it reaches LOGFILE_ROTATE_SIZE bytes, when it is
+ * LOGFILE_ROTATE_SECS old (webc_config.h), or when webc_log_reopen() is
+ * called. Logging threads are never held up by this.
+ *
+ * Every record has a level. Records below WEBC_LOG_FLOOR, which is set at
+ * build time (for example -DWEBC_LOG_FLOOR=WEBC_LOG_INFO), are compiled
+ * out. The others are written if they are at or above the runtime level,
+ * which costs one relaxed atomic load when they are not.
+ */
+
+#define WEBC_LOG_DEBUG     (0)
+#define WEBC_LOG_INFO      (1)
+#define WEBC_LOG_WARN      (2)
+#define WEBC_LOG_ERROR     (3)
+
+#ifndef WEBC_LOG_FLOOR
+#define WEBC_LOG_FLOOR     WEBC_LOG_DEBUG
+#endif
+
+#define WEBC_LOG_ENABLED(level)     ((level) >= WEBC_LOG_FLOOR &&\
+      (level) >= atomic_load_explicit (&webc_log_level_g, memory_order_relaxed))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Read by the WEBC_*_LOG macros; use webc_log_level_set() to change it.
+   extern atomic_int webc_log_level_g;
+
+   bool webc_log_start (void);
+   void webc_log_stop (void);
+
+   // Log to files named <prefix>.YYYYMMDDhhmmss in place of stderr. Must
+   // be called before webc_log_start().
+   bool webc_log_file (const char *prefix);
+
+   // Asks the writer to move on to a new logfile. This only sets a flag,
+   // so it can be called from a signal handler.
+   void webc_log_reopen (void);
+
+   // The number of records dropped since the start, which is also logged.
+   uint64_t webc_log_dropped (void);
+
+   // The runtime level, and the level named "debug", "info", "warn" or
+   // "error" (-1 if there is no such level).
+   void webc_log_level_set (int level);
+   int webc_log_level_get (void);
+   int webc_log_level_parse (const char *name);
+   const char *webc_log_level_name (int level);
+
+   void webc_log_util (const char *file, int line, const char *fmts, ...)
+      __attribute__ ((format (printf, 3, 4)));
+   void webc_log_thrd (const char *file, int line, const char *addr,
+                       unsigned port, const char *fmts, ...)
+      __attribute__ ((format (printf, 5, 6)));
+   void webc_log_ts (const char *fmts, ...)
+      __attribute__ ((format (printf, 1, 2)));
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
@@ -0,0 +1,60 @@
+
+#ifndef H_MIME
+#define H_MIME
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// The type that is returned for files with no extension, or with an
+// extension that is not in the table.
+#define WEBC_MIME_DEFAULT     ("application/octet-stream")
+
+struct webc_mime_entry_t {
+   const char *ext;
+   const char *type;
+};
+
+/* The hash used both by the build-time generator (tools/webc_mimegen.c)
+ * and by the runtime lookup. Extensions are hashed case-insensitively. If
+ * this is changed then the generated table must be rebuilt, which the
+ * Makefile does automatically.
+ */
+static inline uint32_t webc_mime_hash (const char *ext, size_t len,
+                                                        uint32_t seed)
+{
+   uint32_t h = seed ^ 2166136261u;
+   for (size_t i=0; i<len; i++) {
+      uint8_t c = (uint8_t)ext[i];
+      if (c >= 'A' && c <= 'Z')
+         c += 'a' - 'A';
+      h ^= c;
+      h *= 16777619u;
+   }
+   h ^= h >> 15;
+   h *= 0x2c1b3c6du;
+   h ^= h >> 12;
+   return h;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Returns the content type for the filename, using the extension after
+   // the last '.' in the last path component. Never returns NULL; unknown
+   // extensions get WEBC_MIME_DEFAULT.
+   const char *webc_mime_type (const char *fname);
+
+   // Load a mime.types-style file (one type per line followed by zero or
+   // more extensions, '#' starts a comment). Entries in this file override
+   // the built-in table. This must be called during startup, before any
+   // requests are served, as the override table is not locked.
+   bool webc_mime_load (const char *fname);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
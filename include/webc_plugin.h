@@ -0,0 +1,57 @@
+
+#ifndef H_PLUGIN
+#define H_PLUGIN
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A plugin is a shared object that adds handlers to the running server.
+ * It exports, with C linkage:
+ *
+ *    bool webc_plugin_load_handlers (void);     Required.
+ *    bool webc_plugin_init (void);              Optional, called first.
+ *    void webc_plugin_unload (void);            Optional, called before the
+ *                                               plugin is closed.
+ *
+ * webc_plugin_load_handlers() registers its routes with the usual
+ * webc_resource_global_handler_add*() functions, which the server exports
+ * to plugins (see EXTRA_PROG_LDFLAGS in build.config). The plugin is
+ * called with the route lock already held, and must not take it itself.
+ *
+ * A reload opens the current version of each plugin file alongside the
+ * version that is serving, and swaps all the routes of the old version for
+ * those of the new one in a single change. If the new version fails to
+ * load, the old one keeps serving. An old version is closed only when the
+ * last request that is running one of its handlers has finished.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Loads the plugin in fname and registers its handlers. The caller must
+   // hold the route lock (see webc_resource_global_handler_lock()).
+   bool webc_plugin_load (const char *fname);
+
+   // Loads a new version of every plugin, taking the route lock. Returns
+   // false if any plugin failed to reload; those keep their old version.
+   bool webc_plugin_reload (void);
+
+   // Closes the old versions that are no longer in use. Does not block.
+   void webc_plugin_reap (void);
+
+   // Calls fptr for each loaded plugin. Returns the number of plugins.
+   typedef void (webc_plugin_list_cb_t) (void *ctx, const char *fname,
+                                         unsigned generation, size_t refs);
+   size_t webc_plugin_list (webc_plugin_list_cb_t *fptr, void *ctx);
+
+   // The number of old versions that are still waiting for requests to
+   // finish.
+   size_t webc_plugin_retired (void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
@@ -0,0 +1,139 @@
+
+#ifndef H_UTIL
+#define H_UTIL
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "webc_log.h"
+
+struct webc_resource_table_t;
+
+// The records are written by a background thread (see webc_log.h). The
+// _AT variants log at the given level, the others at WEBC_LOG_INFO.
+#define WEBC_UTIL_LOG_AT(level,...)       do {\
+   if (WEBC_LOG_ENABLED (level))\
+      webc_log_util (__FILE__, __LINE__, __VA_ARGS__);\
+} while (0)
+
+#define WEBC_THRD_LOG_AT(level,addr,port,...)      do {\
+   if (WEBC_LOG_ENABLED (level))\
+      webc_log_thrd (__FILE__, __LINE__, addr, port, __VA_ARGS__);\
+} while (0)
+
+#define WEBC_TS_LOG_AT(level,...)         do {\
+   if (WEBC_LOG_ENABLED (level))\
+      webc_log_ts (__VA_ARGS__);\
+} while (0)
+
+#define WEBC_UTIL_LOG(...)                WEBC_UTIL_LOG_AT (WEBC_LOG_INFO, __VA_ARGS__)
+#define WEBC_THRD_LOG(addr,port,...)      WEBC_THRD_LOG_AT (WEBC_LOG_INFO, addr, port, __VA_ARGS__)
+#define WEBC_TS_LOG(...)                  WEBC_TS_LOG_AT (WEBC_LOG_INFO, __VA_ARGS__)
+
+
+
+enum webc_method_t {
+   webc_method_UNKNOWN = 0,
+   webc_method_GET,
+   webc_method_HEAD,
+   webc_method_POST,
+   webc_method_PUT,
+   webc_method_DELETE,
+   webc_method_TRACE,
+   webc_method_OPTIONS,
+   webc_method_CONNECT,
+   webc_method_PATCH
+};
+
+enum webc_http_version_t {
+   webc_http_version_UNKNOWN = 0,
+   webc_http_version_0_9,
+   webc_http_version_1_0,
+   webc_http_version_1_1,
+   webc_http_version_2_0,
+   webc_http_version_3_0,
+};
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   /* ******************************************************************* *
+    * Utility functions for callers to use
+    */
+
+   // Print the formatted string into dst, which the caller must free. If
+   // dst_len is not NULL it is populated with the length of the resulting
+   // string.
+   bool webc_util_sprintf (char **dst, size_t *dst_len, const char *fmts, ...);
+   bool webc_util_vsprintf (char **dst, size_t *dst_len, const char *fmts, va_list ap);
+
+   // The value of the command-line option --name=value in argv, "" for a
+   // bare --name, or NULL if it is not there. The name must
+   // match exactly, so --threadsX is not --threads. The argument found is
+   // blanked (its first character set to 0), so that the arguments still
+   // set once every option has been read are the unknown ones.
+   const char *webc_util_cline_opt (int argc, char **argv,
+                                   const char *name);
+
+#if 1
+   // These two must be commented out if your linker fails with "multiple
+   // references" errors. Don't forget to comment them out in the util.c
+   // implementation as well.
+   int stricmp (const char *s1, const char *s2);
+   int strnicmp (const char *s1, const char *s2, size_t n);
+#endif
+
+
+   /* ******************************************************************* *
+    * Functions used by the web-server itself. Having them in the .so file
+    * reduces the memory load when multiple instances of the web server is
+    * running.
+    */
+   int webc_create_listener (uint32_t portnum, int backlog);
+
+   int webc_accept_conn (int listenfd, size_t timeout,
+                                  char **remote_addr,
+                                  uint16_t *remote_port);
+
+   // As webc_accept_conn(), without waiting: for a listener that poll()
+   // reported readable.
+   int webc_util_accept (int listenfd, char **remote_addr,
+                                       uint16_t *remote_port);
+
+   // Reads the request on fd, a connection accepted at accept_ns (see
+   // webc_accesslog_now()), routes it through routes (NULL for the global
+   // table, see webc_resource.h), sends the response and shuts fd down;
+   // the caller closes it. The servers in webc_server.h call this on a
+   // thread of their own.
+   void webc_serve_conn (struct webc_resource_table_t *routes, int fd,
+                         char *remote_addr, uint16_t remote_port,
+                         uint64_t accept_ns);
+
+   const char *webc_get_http_rspstr (int status);
+
+   // The request parser used by webc_serve_conn(), exposed for the
+   // benchmarks in bench/. The resource and the GET variables are
+   // returned in new strings, which the caller must free; the GET variables
+   // are NULL if there are none.
+   enum webc_method_t webc_util_rqst_method (const char *rqst_line);
+   enum webc_http_version_t webc_util_rqst_version (const char *rqst_line);
+   char *webc_util_rqst_resource (const char *rqst_line);
+   char *webc_util_rqst_getvars (const char *rqst_line);
+
+   // Reads one CRLF-terminated line from fd into *dst, without the CRLF,
+   // replacing (and freeing) whatever *dst held.
+   bool webc_util_read_line (int fd, char **dst, size_t *dstlen);
+
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
@@ -0,0 +1,22 @@
+
+#ifndef H_WEB_ADD
+#define H_WEB_ADD
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   bool webc_web_add_init (void);
+   bool webc_web_add_load_handlers (void);
+
+#ifdef __cplusplus
+};
+#endif
+
+
+#endif
+
+
+
@@ -0,0 +1,16 @@
+
+#ifndef H_WEB_MAIN
+#define H_WEB_MAIN
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#ifdef __cplusplus
+};
+#endif
+
+
+#endif
+
@@ -0,0 +1,67 @@
+/* ***************************************************************************
+ * An example plugin (see webc_plugin.h). Serves "/hello" with the time this
+ * version was built and the number of requests it has served, which starts
+ * again from zero when a new version is loaded with SIGHUP or by POSTing
+ * to /_webc/plugins/reload.
+ */
+#define _POSIX_C_SOURCE    200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include <unistd.h>
+
+#include "webc_util.h"
+#include "webc_resource.h"
+#include "webc_plugin.h"
+
+static atomic_ulong g_nrequests;
+
+static int hello_handler (int                      fd,
+                          char                    *remote_addr,
+                          uint16_t                 remote_port,
+                          enum webc_method_t       method,
+                          enum webc_http_version_t version,
+                          const char              *resource,
+                          char                   **rqst_headers,
+                          webc_header_t           *rsp_headers,
+                          char                    *vars)
+{
+   (void)remote_addr;
+   (void)remote_port;
+   (void)method;
+   (void)version;
+   (void)resource;
+   (void)rqst_headers;
+   (void)vars;
+
+   unsigned long n = atomic_fetch_add (&g_nrequests, 1) + 1;
+
+   webc_header_set (rsp_headers, webc_header_CONTENT_TYPE, "text/plain");
+   write (fd, webc_get_http_rspstr (200), strlen (webc_get_http_rspstr (200)));
+   webc_header_write (rsp_headers, fd);
+
+   dprintf (fd, "Hello from a plugin built at %s, request %lu\n",
+                BUILD_TIMESTAMP, n);
+
+   return 200;
+}
+
+bool webc_plugin_init (void)
+{
+   atomic_init (&g_nrequests, 0);
+   return true;
+}
+
+bool webc_plugin_load_handlers (void)
+{
+   return webc_resource_global_handler_add ("hello", "/hello", pattern_EXACT,
+                                            hello_handler);
+}
+
+void webc_plugin_unload (void)
+{
+   WEBC_UTIL_LOG ("Hello plugin unloading after %lu requests\n",
+                  (unsigned long)atomic_load (&g_nrequests));
+}
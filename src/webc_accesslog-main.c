@@ -0,0 +1,320 @@
+/* ***************************************************************************
+ * Decodes access log files (see webc_accesslog.h):
+ *
+ *    webc_accesslog-main [--csv | --summary] <file>...
+ *
+ * Prints one line per request, as text or, with --csv, as CSV with a
+ * header row. With --summary it prints only the number of requests and
+ * bytes, the requests by status class and the latency percentiles over
+ * all the files.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "webc_accesslog-main.h"
+#include "webc_accesslog.h"
+
+enum output_t {
+   output_TEXT,
+   output_CSV,
+   output_SUMMARY,
+};
+
+struct string_t {
+   const char  *str;
+   size_t       len;
+};
+
+static const char *g_methods[] = {
+   "-", "GET", "HEAD", "POST", "PUT", "DELETE", "TRACE", "OPTIONS",
+   "CONNECT", "PATCH",
+};
+
+#define NMETHODS     (sizeof g_methods / sizeof g_methods[0])
+
+// Over all the files, for the summary.
+static uint64_t *g_latencies = NULL;
+static size_t g_nrequests = 0;
+static size_t g_latencies_size = 0;
+static uint64_t g_bytes = 0;
+static size_t g_classes[6];
+
+
+/* *************************************************************** */
+
+// The next entry at *offset, or NULL at the end of the log.
+static const struct webc_accesslog_entry_t *next_entry (const unsigned char *base,
+                                                        size_t size,
+                                                        size_t *offset)
+{
+   if (*offset + sizeof (struct webc_accesslog_entry_t) > size)
+      return NULL;
+
+   const struct webc_accesslog_entry_t *ret = (const void *)&base[*offset];
+   if (ret->type == webc_accesslog_END || ret->len < sizeof *ret ||
+       ret->len % 8 || *offset + ret->len > size)
+      return NULL;
+
+   *offset += ret->len;
+   return ret;
+}
+
+static bool strings_collect (const unsigned char *base, size_t size,
+                             size_t header_len, struct string_t **strings,
+                             size_t *nstrings)
+{
+   const struct webc_accesslog_entry_t *entry;
+   size_t offset = header_len;
+
+   while ((entry = next_entry (base, size, &offset))) {
+      if (entry->type != webc_accesslog_STRING)
+         continue;
+
+      const struct webc_accesslog_string_t *str = (const void *)entry;
+      if (sizeof *str + str->str_len > entry->len)
+         continue;
+
+      if (str->id >= *nstrings) {
+         size_t n = str->id + 1024;
+         struct string_t *tmp = realloc (*strings, n * sizeof *tmp);
+         if (!tmp)
+            return false;
+         memset (&tmp[*nstrings], 0, (n - *nstrings) * sizeof *tmp);
+         *strings = tmp;
+         *nstrings = n;
+      }
+      (*strings)[str->id].str = str->str;
+      (*strings)[str->id].len = str->str_len;
+   }
+
+   return true;
+}
+
+static void print_csv_string (const char *str, size_t len)
+{
+   putchar ('"');
+   for (size_t i=0; i<len; i++) {
+      if (str[i] == '"')
+         putchar ('"');
+      putchar (str[i]);
+   }
+   putchar ('"');
+}
+
+static bool print_request (const struct webc_accesslog_request_t *rec,
+                           const struct webc_accesslog_header_t *header,
+                           const struct string_t *strings, size_t nstrings,
+                           enum output_t output)
+{
+   char addr[INET6_ADDRSTRLEN] = "-";
+   const char *method = rec->method < NMETHODS ? g_methods[rec->method] : "?";
+   struct string_t path = { "?", 1 };
+
+   if (rec->family == 4)
+      inet_ntop (AF_INET, rec->addr, addr, sizeof addr);
+   else if (rec->family == 6)
+      inet_ntop (AF_INET6, rec->addr, addr, sizeof addr);
+
+   if (rec->path_id < nstrings && strings[rec->path_id].str)
+      path = strings[rec->path_id];
+
+   uint64_t wall_ns = header->wall_ns + (rec->timestamp_ns - header->mono_ns);
+
+   if (output == output_CSV) {
+      printf ("%" PRIu64 ",%s,%u,%s,%u,%" PRIu64 ",%" PRIu64 ",", wall_ns, addr,
+              rec->port, method, rec->status, rec->bytes, rec->latency_ns);
+      print_csv_string (path.str, path.len);
+      putchar ('\n');
+      return true;
+   }
+
+   struct tm time_fields;
+   char stamp[32];
+   time_t secs = wall_ns / 1000000000u;
+   if (!(gmtime_r (&secs, &time_fields)) ||
+       !(strftime (stamp, sizeof stamp, "%Y-%m-%dT%H:%M:%S", &time_fields)))
+      return false;
+
+   printf ("%s.%06" PRIu64 "Z %s:%u %s %u %" PRIu64 " %.3fms %.*s\n", stamp,
+           (wall_ns % 1000000000u) / 1000, addr, rec->port, method,
+           rec->status, rec->bytes, rec->latency_ns / 1e6, (int)path.len,
+           path.str);
+   return true;
+}
+
+static bool summary_add (const struct webc_accesslog_request_t *rec)
+{
+   if (g_nrequests >= g_latencies_size) {
+      size_t n = g_latencies_size ? g_latencies_size * 2 : 64 * 1024;
+      uint64_t *tmp = realloc (g_latencies, n * sizeof *tmp);
+      if (!tmp)
+         return false;
+      g_latencies = tmp;
+      g_latencies_size = n;
+   }
+
+   g_latencies[g_nrequests++] = rec->latency_ns;
+   g_bytes += rec->bytes;
+   g_classes[rec->status / 100 < 6 ? rec->status / 100 : 0]++;
+   return true;
+}
+
+static bool decode (const char *fname, enum output_t output)
+{
+   bool error = true;
+   int fd = -1;
+   unsigned char *base = MAP_FAILED;
+   size_t size = 0;
+   struct string_t *strings = NULL;
+   size_t nstrings = 0;
+   struct stat sb;
+
+   if ((fd = open (fname, O_RDONLY))<0 || (fstat (fd, &sb))!=0) {
+      fprintf (stderr, "Failed to open [%s]: %m\n", fname);
+      goto errorexit;
+   }
+
+   size = sb.st_size;
+   const struct webc_accesslog_header_t *header = NULL;
+   if (size < sizeof *header ||
+       (base = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+      fprintf (stderr, "Failed to read [%s]\n", fname);
+      goto errorexit;
+   }
+
+   header = (const void *)base;
+   if ((memcmp (header->magic, WEBC_ACCESSLOG_MAGIC, sizeof header->magic))!=0 ||
+       header->version != WEBC_ACCESSLOG_VERSION ||
+       header->header_len < sizeof *header || header->header_len > size) {
+      fprintf (stderr, "[%s] is not a version %i access log\n", fname,
+               WEBC_ACCESSLOG_VERSION);
+      goto errorexit;
+   }
+
+   // Requests can come before the path they refer to, so all the paths are
+   // collected first.
+   if (!(strings_collect (base, size, header->header_len, &strings,
+                          &nstrings))) {
+      fprintf (stderr, "OOM error reading [%s]\n", fname);
+      goto errorexit;
+   }
+
+   const struct webc_accesslog_entry_t *entry;
+   size_t offset = header->header_len;
+   while ((entry = next_entry (base, size, &offset))) {
+      if (entry->type != webc_accesslog_REQUEST ||
+          entry->len < sizeof (struct webc_accesslog_request_t))
+         continue;
+
+      const struct webc_accesslog_request_t *rec = (const void *)entry;
+      bool ok = output == output_SUMMARY
+              ? summary_add (rec)
+              : print_request (rec, header, strings, nstrings, output);
+      if (!ok) {
+         fprintf (stderr, "Failed to decode a request in [%s]\n", fname);
+         goto errorexit;
+      }
+   }
+
+   error = false;
+
+errorexit:
+   if (base != MAP_FAILED)
+      munmap (base, size);
+   if (fd >= 0)
+      close (fd);
+   free (strings);
+   return !error;
+}
+
+static int cb_u64_cmp (const void *lhs, const void *rhs)
+{
+   uint64_t l = *(const uint64_t *)lhs, r = *(const uint64_t *)rhs;
+   return (l > r) - (l < r);
+}
+
+static void summary_print (void)
+{
+   static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+
+   printf ("requests %zu\n", g_nrequests);
+   printf ("bytes %" PRIu64 "\n", g_bytes);
+   for (size_t i=1; i<6; i++)
+      printf ("status %zuxx %zu\n", i, g_classes[i]);
+   if (g_classes[0])
+      printf ("status other %zu\n", g_classes[0]);
+
+   if (!g_nrequests)
+      return;
+
+   qsort (g_latencies, g_nrequests, sizeof *g_latencies, cb_u64_cmp);
+   for (size_t i=0; i<sizeof percentiles / sizeof percentiles[0]; i++) {
+      size_t rank = (size_t)(percentiles[i] / 100.0 * g_nrequests + 0.5);
+      if (rank)
+         rank--;
+      printf ("latency p%g %.3fms\n", percentiles[i],
+              g_latencies[rank] / 1e6);
+   }
+   printf ("latency max %.3fms\n", g_latencies[g_nrequests - 1] / 1e6);
+}
+
+/* *************************************************************** */
+
+int main (int argc, char **argv)
+{
+   int ret = EXIT_FAILURE;
+   enum output_t output = output_TEXT;
+   size_t nfiles = 0;
+
+   if (webc_util_cline_opt (argc, argv, "csv"))
+      output = output_CSV;
+   if (webc_util_cline_opt (argc, argv, "summary"))
+      output = output_SUMMARY;
+
+   bool opt_unknown = false;
+   for (size_t i=1; argv[i]; i++) {
+      if ((strncmp (argv[i], "--", 2))==0) {
+         fprintf (stderr, "Unknown option [%s]\n", argv[i]);
+         opt_unknown = true;
+      }
+      if (argv[i][0])
+         nfiles++;
+   }
+
+   if (opt_unknown || !nfiles) {
+      fprintf (stderr, "Usage: %s [--csv | --summary] <file>...\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   if (output == output_CSV)
+      printf ("timestamp_ns,client,port,method,status,bytes,latency_ns,path\n");
+
+   for (size_t i=1; argv[i]; i++) {
+      if (argv[i][0] && !(decode (argv[i], output)))
+         goto errorexit;
+   }
+
+   if (output == output_SUMMARY)
+      summary_print ();
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   free (g_latencies);
+   return ret;
+}
+
@@ -0,0 +1,372 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <pthread.h>
+
+#include "webc_accesslog.h"
+#include "webc_config.h"
+
+// Longer paths are cut short in the log.
+#define MAX_PATH_LEN    (4096)
+
+#define ENTRY_LEN(n)    (((n) + 7) & ~(size_t)7)
+
+struct intern_t {
+   uint64_t    hash;
+   uint32_t    id;
+   // Set once a STRING entry for the path has been written. Until then
+   // every request for the path writes one, as the thread that interned it
+   // may have found no room for it at the end of the file.
+   atomic_bool written;
+   size_t      len;
+   char        path[];
+};
+
+/* A file is written by any number of request threads at once: each one
+ * reserves the space for its entries by advancing used, and then fills it
+ * in. refs counts the threads writing to the file, plus one while it is
+ * the current file, and whoever drops it to zero finalises the file. The
+ * structure itself is never freed, so that a thread that loaded it just
+ * before it was replaced can still look at refs.
+ */
+struct alog_file_t {
+   int                        fd;
+   char                      *fname;
+   unsigned char             *base;
+   size_t                     size;
+   atomic_size_t              used;
+   atomic_size_t              refs;
+   atomic_bool                finalised;
+
+   // Interned paths, by hash. Slots are only ever filled in.
+   struct intern_t *_Atomic  *paths;
+   size_t                     paths_mask;
+   atomic_size_t              npaths;
+   atomic_uint_fast32_t       next_id;
+};
+
+static struct alog_file_t *_Atomic g_file = NULL;
+static pthread_mutex_t g_rotate_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *g_prefix = NULL;
+static unsigned g_seq = 0;
+static time_t g_last_failure = 0;
+static atomic_uint_fast64_t g_dropped = 0;
+
+/* *************************************************************** */
+
+static uint64_t fnv1a (const char *s, size_t len)
+{
+   uint64_t hash = 0xcbf29ce484222325ull;
+   for (size_t i=0; i<len; i++) {
+      hash ^= (unsigned char)s[i];
+      hash *= 0x100000001b3ull;
+   }
+   return hash;
+}
+
+static void file_finalise (struct alog_file_t *file)
+{
+   if (atomic_exchange (&file->finalised, true))
+      return;
+
+   size_t used = atomic_load (&file->used);
+   if (used > file->size)
+      used = file->size;
+
+   munmap (file->base, file->size);
+   if ((ftruncate (file->fd, used))!=0)
+      WEBC_UTIL_LOG ("Failed to truncate access log [%s]: %m\n", file->fname);
+   close (file->fd);
+
+   for (size_t i=0; i<=file->paths_mask; i++)
+      free (atomic_load (&file->paths[i]));
+   free (file->paths);
+   file->paths = NULL;
+}
+
+static void file_release (struct alog_file_t *file)
+{
+   if (atomic_fetch_sub (&file->refs, 1) == 1)
+      file_finalise (file);
+}
+
+static struct alog_file_t *file_acquire (void)
+{
+   struct alog_file_t *ret;
+
+   while ((ret = atomic_load (&g_file))) {
+      atomic_fetch_add (&ret->refs, 1);
+      if (ret == atomic_load (&g_file))
+         break;
+      file_release (ret);
+   }
+
+   return ret;
+}
+
+// Called with g_rotate_lock held.
+static struct alog_file_t *file_open (void)
+{
+   struct alog_file_t *ret = NULL;
+   char stamp[16];
+   struct timespec wall, mono;
+   struct tm time_fields;
+
+   clock_gettime (CLOCK_REALTIME, &wall);
+   clock_gettime (CLOCK_MONOTONIC, &mono);
+   if (!(localtime_r (&wall.tv_sec, &time_fields)) ||
+       !(strftime (stamp, sizeof stamp, "%Y%m%d%H%M%S", &time_fields)))
+      return NULL;
+
+   if (!(ret = calloc (1, sizeof *ret)))
+      goto errorexit;
+   ret->fd = -1;
+   ret->size = ACCESSLOG_FILE_SIZE;
+   ret->paths_mask = ACCESSLOG_MAX_PATHS * 2 - 1;
+   atomic_init (&ret->used, sizeof (struct webc_accesslog_header_t));
+   atomic_init (&ret->refs, 1);
+   atomic_init (&ret->finalised, false);
+   atomic_init (&ret->npaths, 0);
+   atomic_init (&ret->next_id, 0);
+
+   if (!(ret->paths = calloc (ret->paths_mask + 1, sizeof *ret->paths)) ||
+       !(webc_util_sprintf (&ret->fname, NULL, "%s.%s.%u.alog", g_prefix,
+                            stamp, g_seq++))) {
+      WEBC_UTIL_LOG ("OOM error opening the access log\n");
+      goto errorexit;
+   }
+
+   if ((ret->fd = open (ret->fname, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+                        S_IRUSR | S_IWUSR | S_IRGRP)) < 0 ||
+       (ftruncate (ret->fd, ret->size))!=0 ||
+       (ret->base = mmap (NULL, ret->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          ret->fd, 0)) == MAP_FAILED) {
+      WEBC_UTIL_LOG ("Failed to create access log [%s]: %m\n", ret->fname);
+      ret->base = NULL;
+      goto errorexit;
+   }
+
+   struct webc_accesslog_header_t *header = (void *)ret->base;
+   memcpy (header->magic, WEBC_ACCESSLOG_MAGIC, sizeof header->magic);
+   header->version = WEBC_ACCESSLOG_VERSION;
+   header->header_len = sizeof *header;
+   header->wall_ns = (uint64_t)wall.tv_sec * 1000000000u + wall.tv_nsec;
+   header->mono_ns = (uint64_t)mono.tv_sec * 1000000000u + mono.tv_nsec;
+
+   WEBC_UTIL_LOG ("Access log is [%s]\n", ret->fname);
+   return ret;
+
+errorexit:
+   if (ret) {
+      if (ret->fd >= 0) {
+         close (ret->fd);
+         unlink (ret->fname);
+      }
+      free (ret->fname);
+      free (ret->paths);
+      free (ret);
+   }
+   return NULL;
+}
+
+// Replaces full with a new file, unless another thread already has.
+static void file_rotate (struct alog_file_t *full)
+{
+   pthread_mutex_lock (&g_rotate_lock);
+
+   time_t now = time (NULL);
+   if (atomic_load (&g_file) == full && now != g_last_failure) {
+      struct alog_file_t *file = file_open ();
+      if (file) {
+         atomic_store (&g_file, file);
+         file_release (full);
+      } else {
+         g_last_failure = now;
+      }
+   }
+
+   pthread_mutex_unlock (&g_rotate_lock);
+}
+
+// The id of path in file, and in *interned its entry in the table, or
+// NULL if the table is full, in which case the id is used only once.
+static uint32_t intern (struct alog_file_t *file, const char *path,
+                        size_t len, struct intern_t **interned)
+{
+   uint64_t hash = fnv1a (path, len);
+   struct intern_t *entry = NULL;
+
+   *interned = NULL;
+   for (size_t i=0; i<=file->paths_mask; i++) {
+      struct intern_t *_Atomic *slot = &file->paths[(hash + i) & file->paths_mask];
+      struct intern_t *cur = atomic_load (slot);
+
+      if (!cur) {
+         if (atomic_load (&file->npaths) >= ACCESSLOG_MAX_PATHS)
+            break;
+         if (!entry && !(entry = malloc (sizeof *entry + len)))
+            break;
+         entry->hash = hash;
+         entry->len = len;
+         entry->id = atomic_fetch_add (&file->next_id, 1);
+         atomic_init (&entry->written, false);
+         memcpy (entry->path, path, len);
+         if (atomic_compare_exchange_strong (slot, &cur, entry)) {
+            atomic_fetch_add (&file->npaths, 1);
+            *interned = entry;
+            return entry->id;
+         }
+      }
+
+      if (cur->hash == hash && cur->len == len &&
+          (memcmp (cur->path, path, len))==0) {
+         free (entry);
+         *interned = cur;
+         return cur->id;
+      }
+   }
+
+   free (entry);
+   return atomic_fetch_add (&file->next_id, 1);
+}
+
+static void addr_parse (struct webc_accesslog_request_t *rec,
+                        const char *remote_addr)
+{
+   if (!remote_addr)
+      return;
+   if ((inet_pton (AF_INET, remote_addr, rec->addr))==1)
+      rec->family = 4;
+   else if ((inet_pton (AF_INET6, remote_addr, rec->addr))==1)
+      rec->family = 6;
+}
+
+/* *************************************************************** */
+
+bool webc_accesslog_open (const char *prefix)
+{
+   pthread_mutex_lock (&g_rotate_lock);
+
+   bool ret = false;
+   free (g_prefix);
+   if (!(g_prefix = malloc (strlen (prefix) + 1)))
+      goto errorexit;
+   strcpy (g_prefix, prefix);
+
+   struct alog_file_t *file = file_open ();
+   if (!file)
+      goto errorexit;
+
+   struct alog_file_t *old = atomic_exchange (&g_file, file);
+   if (old)
+      file_release (old);
+   ret = true;
+
+errorexit:
+   pthread_mutex_unlock (&g_rotate_lock);
+   return ret;
+}
+
+void webc_accesslog_close (void)
+{
+   pthread_mutex_lock (&g_rotate_lock);
+   struct alog_file_t *old = atomic_exchange (&g_file, NULL);
+   if (old)
+      file_release (old);
+   pthread_mutex_unlock (&g_rotate_lock);
+}
+
+uint64_t webc_accesslog_now (void)
+{
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+uint64_t webc_accesslog_dropped (void)
+{
+   return atomic_load (&g_dropped);
+}
+
+void webc_accesslog_write (uint64_t start_ns, const char *remote_addr,
+                           uint16_t remote_port, enum webc_method_t method,
+                           const char *path, int status, uint64_t bytes)
+{
+   if (!atomic_load_explicit (&g_file, memory_order_relaxed))
+      return;
+
+   uint64_t now = webc_accesslog_now ();
+   struct webc_accesslog_request_t rec = {
+      .type = webc_accesslog_REQUEST,
+      .len = sizeof rec,
+      .status = status,
+      .method = method,
+      .port = remote_port,
+      .timestamp_ns = now,
+      .latency_ns = now - start_ns,
+      .bytes = bytes,
+   };
+   addr_parse (&rec, remote_addr);
+
+   if (!path)
+      path = "";
+   size_t path_len = strlen (path);
+   if (path_len > MAX_PATH_LEN)
+      path_len = MAX_PATH_LEN;
+
+   // Two attempts: one on the current file, and one on the file that
+   // replaces it if it is full.
+   for (int attempt=0; attempt<2; attempt++) {
+      struct alog_file_t *file = file_acquire ();
+      if (!file)
+         return;
+
+      struct intern_t *interned;
+      rec.path_id = intern (file, path, path_len, &interned);
+      bool need_string = !interned || !atomic_load (&interned->written);
+
+      size_t string_len = need_string
+                        ? ENTRY_LEN (sizeof (struct webc_accesslog_string_t) + path_len)
+                        : 0;
+      size_t len = string_len + sizeof rec;
+      size_t offset = atomic_fetch_add (&file->used, len);
+
+      if (offset + len <= file->size) {
+         if (string_len) {
+            struct webc_accesslog_string_t *str = (void *)&file->base[offset];
+            str->type = webc_accesslog_STRING;
+            str->len = string_len;
+            str->id = rec.path_id;
+            str->str_len = path_len;
+            memcpy (str->str, path, path_len);
+            if (interned)
+               atomic_store (&interned->written, true);
+         }
+         memcpy (&file->base[offset + string_len], &rec, sizeof rec);
+         file_release (file);
+         return;
+      }
+
+      // Mark the end for readers that do not know the final length.
+      if (offset + sizeof (struct webc_accesslog_entry_t) <= file->size)
+         memset (&file->base[offset], 0, sizeof (struct webc_accesslog_entry_t));
+
+      file_release (file);
+      file_rotate (file);
+   }
+
+   atomic_fetch_add (&g_dropped, 1);
+}
+
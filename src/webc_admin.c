@@ -0,0 +1,559 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <ctype.h>
+
+#include <sys/stat.h>
+
+#include "webc_admin.h"
+#include "webc_handler.h"
+#include "webc_plugin.h"
+#include "webc_metrics.h"
+#include "webc_slowlog.h"
+#include "webc_conn.h"
+#include "webc_server.h"
+#include "webc_config.h"
+
+static const struct {
+   const char                 *name;
+   webc_resource_handler_t    *handler;
+} g_handlers[] = {
+   { "none",         webc_handler_none         },
+   { "dir",          webc_handler_dir          },
+   { "dirlist",      webc_handler_dirlist      },
+   { "static_file",  webc_handler_static_file  },
+   { "html",         webc_handler_html         },
+   { "bundle",       webc_handler_bundle       },
+   { "embedded",     webc_handler_embedded     },
+   { "admin",        webc_admin_handler        },
+   { "metrics",      webc_metrics_handler      },
+};
+
+static const char *g_types[] = {
+   [pattern_SUFFIX] = "suffix",
+   [pattern_PREFIX] = "prefix",
+   [pattern_EXACT]  = "exact",
+   [pattern_TEMPLATE] = "template",
+};
+
+static const char *g_methods[] = {
+   [webc_method_UNKNOWN]   = "*",
+   [webc_method_GET]       = "GET",
+   [webc_method_HEAD]      = "HEAD",
+   [webc_method_POST]      = "POST",
+   [webc_method_PUT]       = "PUT",
+   [webc_method_DELETE]    = "DELETE",
+   [webc_method_TRACE]     = "TRACE",
+   [webc_method_OPTIONS]   = "OPTIONS",
+   [webc_method_CONNECT]   = "CONNECT",
+   [webc_method_PATCH]     = "PATCH",
+};
+
+// Set once at startup, before any request is served.
+static char *g_token = NULL;
+
+#define MAX_TOKEN_LEN   (256)
+
+#define NHANDLERS    (sizeof g_handlers / sizeof g_handlers[0])
+#define NTYPES       (sizeof g_types / sizeof g_types[0])
+#define NMETHODS     (sizeof g_methods / sizeof g_methods[0])
+
+/* *************************************************************** */
+
+static bool is_loopback (const char *addr)
+{
+   return (strncmp (addr, "127.", 4))==0 ||
+          (strcmp (addr, "::1"))==0 ||
+          (strncmp (addr, "::ffff:127.", 11))==0;
+}
+
+// Compares the bearer token in the request with g_token, in a time that
+// does not depend on how much of it matches.
+static bool is_authorised (char **rqst_headers)
+{
+   const char *auth = headerlist_find (rqst_headers, webc_header_AUTHORIZATION);
+   static const char scheme[] = "Bearer ";
+
+   if (!g_token || !auth)
+      return false;
+
+   while (*auth == ' ' || *auth == '\t')
+      auth++;
+   if ((strnicmp (auth, scheme, strlen (scheme)))!=0)
+      return false;
+   auth += strlen (scheme);
+   while (*auth == ' ' || *auth == '\t')
+      auth++;
+
+   size_t len = strlen (auth);
+   while (len && isspace ((unsigned char)auth[len - 1]))
+      len--;
+   if (len != strlen (g_token))
+      return false;
+
+   unsigned char diff = 0;
+   for (size_t i=0; i<len; i++) {
+      diff |= (unsigned char)auth[i] ^ (unsigned char)g_token[i];
+   }
+   return diff == 0;
+}
+
+// Changes must be POSTed, so that they cannot be made by a link or an
+// image in a page; everything else is read with GET or HEAD.
+static bool method_allowed (enum webc_method_t method, bool change)
+{
+   if (change)
+      return method == webc_method_POST;
+   return method == webc_method_GET || method == webc_method_HEAD;
+}
+
+static int hexval (int c)
+{
+   if (c >= '0' && c <= '9')
+      return c - '0';
+   c = tolower (c);
+   if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+   return -1;
+}
+
+// Copies the url-decoded value of "name=<value>" from a query string into
+// dst. Returns false if name is not present or its value does not fit.
+static bool vars_get (const char *vars, const char *name, char *dst,
+                      size_t dstlen)
+{
+   size_t name_len = strlen (name);
+
+   for (const char *ptr = vars; ptr && *ptr; ptr = strchr (ptr, '&')) {
+      if (*ptr == '&')
+         ptr++;
+      if ((strncmp (ptr, name, name_len))!=0 || ptr[name_len] != '=')
+         continue;
+
+      size_t n = 0;
+      for (ptr += name_len + 1; *ptr && *ptr != '&'; ptr++) {
+         char c = *ptr;
+         if (c == '+') {
+            c = ' ';
+         } else if (c == '%' && hexval (ptr[1]) >= 0 && hexval (ptr[2]) >= 0) {
+            c = (char)(hexval (ptr[1]) * 16 + hexval (ptr[2]));
+            ptr += 2;
+         }
+         if (n + 1 >= dstlen)
+            return false;
+         dst[n++] = c;
+      }
+      dst[n] = 0;
+      return true;
+   }
+
+   return false;
+}
+
+static bool vars_get_type (const char *vars, enum webc_pattern_type_t *dst)
+{
+   char tmp[16];
+
+   if (!(vars_get (vars, "type", tmp, sizeof tmp)))
+      return false;
+
+   for (size_t i=0; i<NTYPES; i++) {
+      if ((strcmp (tmp, g_types[i]))==0) {
+         *dst = i;
+         return true;
+      }
+   }
+   return false;
+}
+
+// The method is optional, and defaults to any method.
+static bool vars_get_method (const char *vars, enum webc_method_t *dst)
+{
+   char tmp[16];
+
+   *dst = webc_method_UNKNOWN;
+   if (!(vars_get (vars, "method", tmp, sizeof tmp)))
+      return true;
+
+   for (size_t i=0; i<NMETHODS; i++) {
+      if ((strcmp (tmp, g_methods[i]))==0) {
+         *dst = i;
+         return true;
+      }
+   }
+   return false;
+}
+
+static int send_text (int fd, webc_header_t *rsp_headers, const char *body,
+                      size_t body_len)
+{
+   char slen[25];
+   snprintf (slen, sizeof slen, "%zu", body_len);
+   webc_header_set (rsp_headers, webc_header_CONTENT_TYPE, "text/plain");
+   webc_header_set (rsp_headers, webc_header_CONTENT_LENGTH, slen);
+
+   const char *rsp = webc_get_http_rspstr (200);
+   if (!(webc_conn_write (fd, rsp, strlen (rsp))) ||
+       !(webc_header_write (rsp_headers, fd)) ||
+       !(webc_conn_write (fd, body, body_len)))
+      WEBC_UTIL_LOG ("Failed to send admin response\n");
+
+   return 200;
+}
+
+struct route_list_t {
+   char     *buf;
+   size_t    len;
+   size_t    n;
+   bool      error;
+};
+
+static void cb_route_list (void *ctx, const char *name,
+                           enum webc_method_t method, const char *pattern,
+                           enum webc_pattern_type_t type,
+                           webc_resource_handler_t *handler)
+{
+   struct route_list_t *list = ctx;
+   char *line = NULL;
+
+   if (list->error)
+      return;
+
+   if (!(webc_util_sprintf (&line, NULL, "%zu\t%s\t%s\t[%s]\t%s\t%s\n",
+                            list->n++, g_methods[method], g_types[type], pattern,
+                            webc_admin_handler_name (handler), name))) {
+      list->error = true;
+      return;
+   }
+
+   size_t line_len = strlen (line);
+   char *tmp = realloc (list->buf, list->len + line_len + 1);
+   if (!tmp) {
+      free (line);
+      list->error = true;
+      return;
+   }
+   memcpy (&tmp[list->len], line, line_len + 1);
+   list->buf = tmp;
+   list->len += line_len;
+   free (line);
+}
+
+static int routes_list (int fd, webc_header_t *rsp_headers)
+{
+   struct route_list_t list = { NULL, 0, 0, false };
+
+   webc_resource_table_list (webc_server_routes (webc_server_current ()),
+                             cb_route_list, &list);
+   if (list.error) {
+      free (list.buf);
+      return 500;
+   }
+
+   int ret = send_text (fd, rsp_headers, list.buf ? list.buf : "", list.len);
+   free (list.buf);
+   return ret;
+}
+
+// Applies one change to the routes and publishes it.
+static int routes_change (int fd, const char *action, const char *vars,
+                          webc_header_t *rsp_headers)
+{
+   char pattern[256], hname[64];
+   enum webc_pattern_type_t type;
+   enum webc_method_t method;
+   webc_resource_handler_t *handler = NULL;
+   bool remove = (strcmp (action, "remove"))==0;
+
+   if (!(vars_get (vars, "pattern", pattern, sizeof pattern)) ||
+       !(vars_get_type (vars, &type)) ||
+       !(vars_get_method (vars, &method))) {
+      WEBC_UTIL_LOG ("Admin: [%s] needs a pattern, a type and a valid "
+                     "method\n", action);
+      return 400;
+   }
+
+   if (!remove && (!(vars_get (vars, "handler", hname, sizeof hname)) ||
+                   !(handler = webc_admin_handler_lookup (hname)))) {
+      WEBC_UTIL_LOG ("Admin: [%s] needs a known handler\n", action);
+      return 400;
+   }
+
+   // The routes of the server that is serving this request.
+   webc_resource_table_t *routes = webc_server_routes (webc_server_current ());
+
+   if (!(webc_resource_table_lock (routes)))
+      return 500;
+
+   bool ok;
+   if (remove) {
+      ok = webc_resource_table_remove (routes, method, pattern, type);
+   } else if ((strcmp (action, "add"))==0) {
+      ok = webc_resource_table_add (routes, hname, method, pattern, type,
+                                    handler);
+   } else {
+      ok = webc_resource_table_replace (routes, hname, method, pattern, type,
+                                        handler);
+   }
+
+   if (!(webc_resource_table_unlock (routes)))
+      ok = false;
+
+   if (!ok) {
+      WEBC_UTIL_LOG ("Admin: failed to %s %s route [%s]\n", action,
+                     g_types[type], pattern);
+      return remove ? 404 : 500;
+   }
+
+   WEBC_UTIL_LOG ("Admin: %s %s route [%s]\n", action, g_types[type], pattern);
+   return send_text (fd, rsp_headers, "OK\n", 3);
+}
+
+static void cb_plugin_list (void *ctx, const char *fname, unsigned generation,
+                            size_t refs)
+{
+   struct route_list_t *list = ctx;
+   char *line = NULL;
+
+   if (list->error)
+      return;
+
+   if (!(webc_util_sprintf (&line, NULL, "%s\t%u\t%zu\n", fname, generation,
+                            refs))) {
+      list->error = true;
+      return;
+   }
+
+   size_t line_len = strlen (line);
+   char *tmp = realloc (list->buf, list->len + line_len + 1);
+   if (!tmp) {
+      free (line);
+      list->error = true;
+      return;
+   }
+   memcpy (&tmp[list->len], line, line_len + 1);
+   list->buf = tmp;
+   list->len += line_len;
+   list->n++;
+   free (line);
+}
+
+static int plugins_list (int fd, webc_header_t *rsp_headers)
+{
+   struct route_list_t list = { NULL, 0, 0, false };
+   char *body = NULL;
+
+   webc_plugin_list (cb_plugin_list, &list);
+   if (list.error ||
+       !(webc_util_sprintf (&body, NULL, "%sretired\t%zu\n",
+                            list.buf ? list.buf : "",
+                            webc_plugin_retired ()))) {
+      free (list.buf);
+      return 500;
+   }
+
+   int ret = send_text (fd, rsp_headers, body, strlen (body));
+   free (list.buf);
+   free (body);
+   return ret;
+}
+
+// Shows the log level, or sets it if there is a level= variable.
+static int log_level (int fd, enum webc_method_t method, const char *vars,
+                      webc_header_t *rsp_headers)
+{
+   char name[16];
+   char body[32];
+   bool change = vars_get (vars, "level", name, sizeof name);
+
+   if (!(method_allowed (method, change)))
+      return 405;
+
+   if (change) {
+      int level = webc_log_level_parse (name);
+      if (level < 0) {
+         WEBC_UTIL_LOG ("Admin: unknown log level [%s]\n", name);
+         return 400;
+      }
+      webc_log_level_set (level);
+      WEBC_UTIL_LOG ("Admin: log level set to [%s]\n", name);
+   }
+
+   int len = snprintf (body, sizeof body, "%s\n",
+                       webc_log_level_name (webc_log_level_get ()));
+   return send_text (fd, rsp_headers, body, len);
+}
+
+// Shows the slow requests, or sets the threshold if there is a ms=
+// variable.
+static int slowlog (int fd, enum webc_method_t method, const char *vars,
+                    webc_header_t *rsp_headers)
+{
+   char value[24];
+   char *body = NULL;
+   size_t body_len = 0;
+   bool change = vars_get (vars, "ms", value, sizeof value);
+
+   if (!(method_allowed (method, change)))
+      return 405;
+
+   if (change) {
+      char *end;
+      unsigned long long ms = strtoull (value, &end, 10);
+      if (!value[0] || *end) {
+         WEBC_UTIL_LOG ("Admin: bad slowlog threshold [%s]\n", value);
+         return 400;
+      }
+      webc_slowlog_threshold_set (ms);
+      WEBC_UTIL_LOG ("Admin: slowlog threshold set to %llums\n", ms);
+   }
+
+   if (!(webc_slowlog_dump (&body, &body_len)))
+      return 500;
+
+   char *tmp = NULL;
+   if (!(webc_util_sprintf (&tmp, &body_len, "threshold %" PRIu64 "ms\n%s",
+                            webc_slowlog_threshold_get (), body))) {
+      free (body);
+      return 500;
+   }
+
+   int ret = send_text (fd, rsp_headers, tmp, body_len);
+   free (tmp);
+   free (body);
+   return ret;
+}
+
+static int plugins_reload (int fd, webc_header_t *rsp_headers)
+{
+   WEBC_UTIL_LOG ("Admin: reloading plugins\n");
+   if (!(webc_plugin_reload ()))
+      return 500;
+   return send_text (fd, rsp_headers, "OK\n", 3);
+}
+
+/* *************************************************************** */
+
+int webc_admin_handler (int                       fd,
+                        char                     *remote_addr,
+                        uint16_t                  remote_port,
+                        enum webc_method_t        method,
+                        enum webc_http_version_t  version,
+                        const char               *resource,
+                        char                    **rqst_headers,
+                        webc_header_t            *rsp_headers,
+                        char                     *vars)
+{
+   (void) version;
+
+   if (!(is_loopback (remote_addr)) || !(is_authorised (rqst_headers))) {
+      WEBC_THRD_LOG (remote_addr, remote_port, "Refused admin request [%s]\n",
+                     resource);
+      return 403;
+   }
+
+   // resource has no leading '/', ADMIN_PREFIX does.
+   size_t prefix_len = strlen (ADMIN_PREFIX) - 1;
+   if ((strncmp (resource, &ADMIN_PREFIX[1], prefix_len))!=0)
+      return 404;
+   const char *cmd = &resource[prefix_len];
+
+   if ((strcmp (cmd, "routes"))==0)
+      return method_allowed (method, false) ? routes_list (fd, rsp_headers)
+                                            : 405;
+
+   if ((strcmp (cmd, "routes/add"))==0 ||
+       (strcmp (cmd, "routes/replace"))==0 ||
+       (strcmp (cmd, "routes/remove"))==0)
+      return method_allowed (method, true)
+               ? routes_change (fd, &cmd[strlen ("routes/")], vars, rsp_headers)
+               : 405;
+
+   if ((strcmp (cmd, "loglevel"))==0)
+      return log_level (fd, method, vars, rsp_headers);
+
+   if ((strcmp (cmd, "slowlog"))==0)
+      return slowlog (fd, method, vars, rsp_headers);
+
+   if ((strcmp (cmd, "plugins"))==0)
+      return method_allowed (method, false) ? plugins_list (fd, rsp_headers)
+                                            : 405;
+
+   if ((strcmp (cmd, "plugins/reload"))==0)
+      return method_allowed (method, true) ? plugins_reload (fd, rsp_headers)
+                                           : 405;
+
+   return 404;
+}
+
+bool webc_admin_token_load (const char *fname)
+{
+   bool error = true;
+   FILE *inf = NULL;
+   char line[MAX_TOKEN_LEN + 2];
+   struct stat sb;
+
+   if (!(inf = fopen (fname, "r"))) {
+      WEBC_UTIL_LOG ("Failed to open admin token file [%s]: %m\n", fname);
+      goto errorexit;
+   }
+
+   if ((fstat (fileno (inf), &sb))==0 && (sb.st_mode & (S_IRWXG | S_IRWXO)))
+      WEBC_UTIL_LOG ("Admin token file [%s] is accessible to other users\n",
+                     fname);
+
+   if (!(fgets (line, sizeof line, inf)))
+      line[0] = 0;
+
+   char *start = line;
+   while (isspace ((unsigned char)*start))
+      start++;
+   size_t len = strlen (start);
+   while (len && isspace ((unsigned char)start[len - 1]))
+      len--;
+   start[len] = 0;
+
+   if (!len || len > MAX_TOKEN_LEN) {
+      WEBC_UTIL_LOG ("Admin token in [%s] must be 1 to %i characters\n",
+                     fname, MAX_TOKEN_LEN);
+      goto errorexit;
+   }
+
+   char *tmp = strdup (start);
+   if (!tmp) {
+      WEBC_UTIL_LOG ("OOM error loading admin token\n");
+      goto errorexit;
+   }
+   free (g_token);
+   g_token = tmp;
+
+   error = false;
+
+errorexit:
+   memset (line, 0, sizeof line);
+   if (inf)
+      fclose (inf);
+   return !error;
+}
+
+webc_resource_handler_t *webc_admin_handler_lookup (const char *name)
+{
+   for (size_t i=0; i<NHANDLERS; i++) {
+      if ((strcmp (g_handlers[i].name, name))==0)
+         return g_handlers[i].handler;
+   }
+   return NULL;
+}
+
+const char *webc_admin_handler_name (webc_resource_handler_t *handler)
+{
+   for (size_t i=0; i<NHANDLERS; i++) {
+      if (g_handlers[i].handler == handler)
+         return g_handlers[i].name;
+   }
+   return "?";
+}
+
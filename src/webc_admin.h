@@ -0,0 +1,77 @@
+
+#ifndef H_ADMIN
+#define H_ADMIN
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "webc_resource.h"
+
+/* Administrative endpoints, registered under ADMIN_PREFIX (webc_config.h).
+ * They are only served to clients connecting from the loopback interface
+ * that send the token loaded by webc_admin_token_load() as
+ * "Authorization: Bearer <token>"; with no token loaded every request is
+ * refused. Being on the loopback interface is not authentication: behind
+ * a reverse proxy on the same host every client connects from there, and
+ * any page open in a browser on the host can send requests to it.
+ *
+ * The endpoints that change something (marked POST) must be requested
+ * with POST, and the others with GET or HEAD; the parameters are in the
+ * query string either way. Anything else gets 405.
+ *
+ *    routes                     List the routes, most recently added first
+ *    routes/add?pattern=P&type=T&handler=H[&method=M]              (POST)
+ *    routes/replace?pattern=P&type=T&handler=H[&method=M]          (POST)
+ *    routes/remove?pattern=P&type=T[&method=M]                     (POST)
+ *    loglevel                   Show the log level
+ *    loglevel?level=L           Set the log level to L, one of "debug",
+ *                               "info", "warn" or "error"          (POST)
+ *    slowlog                    Show the slow-request log
+ *    slowlog?ms=N               Set the slow-request threshold to N ms (0
+ *                               turns it off), and show the log    (POST)
+ *    plugins                    List the plugins: file, generation and the
+ *                               requests in flight, then the number of old
+ *                               versions still draining
+ *    plugins/reload             Load a new version of every plugin, as
+ *                               SIGHUP does                        (POST)
+ *
+ * T is one of "suffix", "prefix", "exact" or "template", H is the name of
+ * a handler known to webc_admin_handler_lookup(), and M is a method such
+ * as "GET" (the default, "*", is any method). Changes take effect for the
+ * next request, without a restart. The routes are those of the server
+ * that serves the admin request (see webc_server.h); everything else is
+ * process-wide.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   int webc_admin_handler (int                       fd,
+                           char                     *remote_addr,
+                           uint16_t                  remote_port,
+                           enum webc_method_t        method,
+                           enum webc_http_version_t  version,
+                           const char               *resource,
+                           char                    **rqst_headers,
+                           webc_header_t            *rsp_headers,
+                           char                     *vars);
+
+   // Reads the admin token from the first line of fname, which should be
+   // readable by the server's user only. Surrounding whitespace is not
+   // part of the token.
+   bool webc_admin_token_load (const char *fname);
+
+   // The built-in handler with this name ("none", "dir", "dirlist",
+   // "static_file", "html", "bundle" or "embedded"), or NULL.
+   webc_resource_handler_t *webc_admin_handler_lookup (const char *name);
+
+   // The name of handler, or "?" if it is not a built-in handler.
+   const char *webc_admin_handler_name (webc_resource_handler_t *handler);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
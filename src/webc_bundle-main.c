@@ -0,0 +1,419 @@
+/* ***************************************************************************
+ * Builds a site bundle (see webc_bundle.h) from a web root:
+ *
+ *    webc_bundle-main --root=<dir> --output=<file> [--mimetypes=<file>]
+ *
+ * Every regular file below the root is added. A file "<name>.gz" next to
+ * "<name>" is also added as the gzip variant of "<name>". The bundle is
+ * written to a temporary file that replaces the output only once it is
+ * complete, so a running server never sees a partial bundle.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+
+#include "webc_bundle-main.h"
+#include "webc_bundle.h"
+#include "webc_mime.h"
+#include "webc_util.h"
+
+struct variant_t {
+   char       *fname;
+   uint64_t    size;
+   char        etag[WEBC_BUNDLE_ETAG_LEN];
+   char       *headers;
+   size_t      headers_len;
+};
+
+struct file_t {
+   char             *path;
+   bool              has_gzip;
+   struct variant_t  plain;
+   struct variant_t  gzip;
+};
+
+static struct file_t *g_files = NULL;
+static size_t g_nfiles = 0;
+
+
+/* *************************************************************** */
+
+static void files_del (void)
+{
+   for (size_t i=0; i<g_nfiles; i++) {
+      free (g_files[i].path);
+      free (g_files[i].plain.fname);
+      free (g_files[i].plain.headers);
+      free (g_files[i].gzip.fname);
+      free (g_files[i].gzip.headers);
+   }
+   free (g_files);
+   g_files = NULL;
+   g_nfiles = 0;
+}
+
+static bool file_add (const char *root, const char *relpath)
+{
+   struct file_t *tmp = realloc (g_files, (g_nfiles + 1) * sizeof *tmp);
+   if (!tmp)
+      return false;
+   g_files = tmp;
+
+   struct file_t *file = &g_files[g_nfiles];
+   memset (file, 0, sizeof *file);
+
+   if (!(file->path = strdup (relpath)) ||
+       !(webc_util_sprintf (&file->plain.fname, NULL, "%s/%s", root, relpath))) {
+      free (file->path);
+      return false;
+   }
+
+   g_nfiles++;
+   return true;
+}
+
+// Adds every regular file below root/relpath. Symlinks to files are added
+// as files; symlinks to directories are skipped, as they may loop.
+static bool collect (const char *root, const char *relpath)
+{
+   bool error = true;
+   char *dirname = NULL;
+   DIR *dirp = NULL;
+   struct dirent *de;
+
+   if (!(webc_util_sprintf (&dirname, NULL, "%s/%s", root, relpath)) ||
+       !(dirp = opendir (dirname))) {
+      fprintf (stderr, "Failed to open directory [%s]: %m\n", dirname);
+      goto errorexit;
+   }
+
+   while ((de = readdir (dirp))) {
+      char *child = NULL, *fname = NULL;
+      struct stat sb;
+
+      if ((strcmp (de->d_name, "."))==0 || (strcmp (de->d_name, ".."))==0)
+         continue;
+
+      bool ok = relpath[0]
+              ? webc_util_sprintf (&child, NULL, "%s/%s", relpath, de->d_name)
+              : webc_util_sprintf (&child, NULL, "%s", de->d_name);
+      if (!ok || !(webc_util_sprintf (&fname, NULL, "%s/%s", root, child))) {
+         free (child);
+         goto errorexit;
+      }
+
+      if ((lstat (fname, &sb))==0 && S_ISDIR (sb.st_mode)) {
+         ok = collect (root, child);
+      } else if ((stat (fname, &sb))==0 && S_ISREG (sb.st_mode)) {
+         ok = file_add (root, child);
+      }
+
+      free (child);
+      free (fname);
+      if (!ok)
+         goto errorexit;
+   }
+
+   error = false;
+
+errorexit:
+   if (dirp)
+      closedir (dirp);
+   free (dirname);
+   return !error;
+}
+
+static int cb_file_cmp (const void *lhs, const void *rhs)
+{
+   const struct file_t *flhs = lhs, *frhs = rhs;
+   return strcmp (flhs->path, frhs->path);
+}
+
+// Reads the file once to find its size and ETag.
+static bool variant_scan (struct variant_t *var)
+{
+   char buf[64 * 1024];
+   uint64_t hash = 14695981039346656037u;
+   FILE *inf = fopen (var->fname, "rb");
+
+   if (!inf) {
+      fprintf (stderr, "Failed to open [%s]: %m\n", var->fname);
+      return false;
+   }
+
+   var->size = 0;
+   size_t nbytes;
+   while ((nbytes = fread (buf, 1, sizeof buf, inf)) > 0) {
+      for (size_t i=0; i<nbytes; i++) {
+         hash ^= (uint8_t)buf[i];
+         hash *= 1099511628211u;
+      }
+      var->size += nbytes;
+   }
+
+   bool ret = !ferror (inf);
+   fclose (inf);
+
+   snprintf (var->etag, sizeof var->etag, "\"%016" PRIx64 "\"", hash);
+   return ret;
+}
+
+static bool variant_render (const struct file_t *file, struct variant_t *var,
+                            bool gzip)
+{
+   const char *type = webc_mime_type (file->path);
+   bool attach = (strcmp (type, WEBC_MIME_DEFAULT))==0;
+
+   return webc_util_sprintf (&var->headers, &var->headers_len,
+                             "Content-Type: %s\r\n"
+                             "Content-Length: %" PRIu64 "\r\n"
+                             "ETag: %s\r\n"
+                             "%s%s%s",
+                             type, var->size, var->etag,
+                             gzip ? "Content-Encoding: gzip\r\n" : "",
+                             file->has_gzip ? "Vary: Accept-Encoding\r\n" : "",
+                             attach ? "Content-Disposition: attachment;\r\n" : "");
+}
+
+static bool copy_body (FILE *outf, const struct variant_t *var)
+{
+   char buf[64 * 1024];
+   uint64_t total = 0;
+   FILE *inf = fopen (var->fname, "rb");
+
+   if (!inf) {
+      fprintf (stderr, "Failed to open [%s]: %m\n", var->fname);
+      return false;
+   }
+
+   size_t nbytes;
+   while ((nbytes = fread (buf, 1, sizeof buf, inf)) > 0) {
+      if ((fwrite (buf, 1, nbytes, outf))!=nbytes) {
+         fclose (inf);
+         return false;
+      }
+      total += nbytes;
+   }
+
+   bool ret = !ferror (inf) && total == var->size;
+   fclose (inf);
+
+   if (total != var->size)
+      fprintf (stderr, "[%s] changed while the bundle was built\n", var->fname);
+
+   return ret;
+}
+
+static void variant_place (struct webc_bundle_variant_t *dst,
+                           const struct variant_t *var,
+                           uint64_t *headers_offset, uint64_t *body_offset)
+{
+   dst->headers_offset = *headers_offset;
+   dst->headers_len = var->headers_len;
+   dst->body_offset = *body_offset;
+   dst->body_len = var->size;
+   memcpy (dst->etag, var->etag, sizeof dst->etag);
+
+   *headers_offset += var->headers_len;
+   *body_offset += var->size;
+}
+
+static bool bundle_write (const char *fname)
+{
+   bool error = true;
+   char *tmpname = NULL;
+   FILE *outf = NULL;
+   struct webc_bundle_entry_t *entries = NULL;
+   struct webc_bundle_header_t hdr;
+
+   // Everything is placed before anything is written, so the index can go
+   // at the front.
+   uint64_t paths_offset = sizeof hdr + g_nfiles * sizeof *entries;
+   uint64_t headers_offset = paths_offset;
+   for (size_t i=0; i<g_nfiles; i++) {
+      headers_offset += strlen (g_files[i].path);
+   }
+   uint64_t body_offset = headers_offset;
+   for (size_t i=0; i<g_nfiles; i++) {
+      body_offset += g_files[i].plain.headers_len;
+      if (g_files[i].has_gzip)
+         body_offset += g_files[i].gzip.headers_len;
+   }
+
+   if (!(entries = calloc (g_nfiles ? g_nfiles : 1, sizeof *entries))) {
+      fprintf (stderr, "OOM error building index\n");
+      goto errorexit;
+   }
+
+   uint64_t offset = paths_offset;
+   for (size_t i=0; i<g_nfiles; i++) {
+      entries[i].path_offset = offset;
+      entries[i].path_len = strlen (g_files[i].path);
+      offset += entries[i].path_len;
+
+      variant_place (&entries[i].plain, &g_files[i].plain,
+                     &headers_offset, &body_offset);
+      if (g_files[i].has_gzip) {
+         entries[i].has_gzip = 1;
+         variant_place (&entries[i].gzip, &g_files[i].gzip,
+                        &headers_offset, &body_offset);
+      }
+   }
+
+   memset (&hdr, 0, sizeof hdr);
+   memcpy (hdr.magic, WEBC_BUNDLE_MAGIC, sizeof hdr.magic);
+   hdr.version = WEBC_BUNDLE_VERSION;
+   hdr.nentries = g_nfiles;
+   hdr.index_offset = sizeof hdr;
+   hdr.file_size = body_offset;
+
+   if (!(webc_util_sprintf (&tmpname, NULL, "%s.tmp", fname)) ||
+       !(outf = fopen (tmpname, "wb"))) {
+      fprintf (stderr, "Failed to create [%s]: %m\n", tmpname);
+      goto errorexit;
+   }
+
+   if ((fwrite (&hdr, sizeof hdr, 1, outf))!=1 ||
+       (g_nfiles && (fwrite (entries, sizeof *entries, g_nfiles, outf))!=g_nfiles))
+      goto errorexit;
+
+   for (size_t i=0; i<g_nfiles; i++) {
+      if ((fputs (g_files[i].path, outf)) < 0)
+         goto errorexit;
+   }
+
+   for (size_t i=0; i<g_nfiles; i++) {
+      const struct variant_t *plain = &g_files[i].plain,
+                             *gzip = &g_files[i].gzip;
+      if ((fwrite (plain->headers, 1, plain->headers_len, outf))!=plain->headers_len ||
+          (g_files[i].has_gzip &&
+           (fwrite (gzip->headers, 1, gzip->headers_len, outf))!=gzip->headers_len))
+         goto errorexit;
+   }
+
+   for (size_t i=0; i<g_nfiles; i++) {
+      if (!(copy_body (outf, &g_files[i].plain)) ||
+          (g_files[i].has_gzip && !(copy_body (outf, &g_files[i].gzip))))
+         goto errorexit;
+   }
+
+   if ((fclose (outf))!=0) {
+      outf = NULL;
+      goto errorexit;
+   }
+   outf = NULL;
+
+   if ((rename (tmpname, fname))!=0) {
+      fprintf (stderr, "Failed to rename [%s] to [%s]: %m\n", tmpname, fname);
+      goto errorexit;
+   }
+
+   printf ("Wrote %zu files (%" PRIu64 " bytes) to [%s]\n", g_nfiles,
+           body_offset, fname);
+
+   error = false;
+
+errorexit:
+   if (outf)
+      fclose (outf);
+   if (error && tmpname) {
+      fprintf (stderr, "Failed to write bundle [%s]\n", fname);
+      unlink (tmpname);
+   }
+   free (tmpname);
+   free (entries);
+   return !error;
+}
+
+/* *************************************************************** */
+
+int main (int argc, char **argv)
+{
+   int ret = EXIT_FAILURE;
+
+   const char *opt_root = webc_util_cline_opt (argc, argv, "root");
+   const char *opt_output = webc_util_cline_opt (argc, argv, "output");
+   const char *opt_mimetypes = webc_util_cline_opt (argc, argv, "mimetypes");
+
+   bool opt_unknown = false;
+   for (size_t i=1; argv[i]; i++) {
+      if (argv[i][0]) {
+         fprintf (stderr, "Unknown option [%s]\n", argv[i]);
+         opt_unknown = true;
+      }
+   }
+
+   if (opt_unknown || !opt_root || !opt_output) {
+      fprintf (stderr, "Usage: %s --root=<dir> --output=<file> "
+                       "[--mimetypes=<file>]\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   if (opt_mimetypes && !(webc_mime_load (opt_mimetypes))) {
+      fprintf (stderr, "Failed to load mime types from [%s]\n", opt_mimetypes);
+      goto errorexit;
+   }
+
+   if (!(collect (opt_root, "")))
+      goto errorexit;
+
+   qsort (g_files, g_nfiles, sizeof *g_files, cb_file_cmp);
+
+   // Pair each "<name>.gz" with "<name>". The .gz file stays in the bundle
+   // under its own name as well.
+   for (size_t i=0; i<g_nfiles; i++) {
+      size_t len = strlen (g_files[i].path);
+      if (len <= 3 || (strcmp (&g_files[i].path[len - 3], ".gz"))!=0)
+         continue;
+
+      struct file_t key = { .path = strndup (g_files[i].path, len - 3) };
+      if (!key.path) {
+         fprintf (stderr, "OOM error\n");
+         goto errorexit;
+      }
+      struct file_t *base = bsearch (&key, g_files, g_nfiles, sizeof *g_files,
+                                     cb_file_cmp);
+      free (key.path);
+
+      if (base && !base->has_gzip) {
+         if (!(base->gzip.fname = strdup (g_files[i].plain.fname))) {
+            fprintf (stderr, "OOM error\n");
+            goto errorexit;
+         }
+         base->has_gzip = true;
+      }
+   }
+
+   for (size_t i=0; i<g_nfiles; i++) {
+      struct file_t *file = &g_files[i];
+      if (!(variant_scan (&file->plain)) ||
+          (file->has_gzip && !(variant_scan (&file->gzip))) ||
+          !(variant_render (file, &file->plain, false)) ||
+          (file->has_gzip && !(variant_render (file, &file->gzip, true)))) {
+         fprintf (stderr, "Failed to add [%s]\n", file->path);
+         goto errorexit;
+      }
+   }
+
+   if (!(bundle_write (opt_output)))
+      goto errorexit;
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   files_del ();
+   return ret;
+}
+
@@ -0,0 +1,169 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "webc_bundle.h"
+#include "webc_util.h"
+
+static int g_fd = -1;
+static const char *g_base = NULL;
+static size_t g_size = 0;
+static const struct webc_bundle_entry_t *g_entries = NULL;
+static uint32_t g_nentries = 0;
+
+/* *************************************************************** */
+
+static bool range_ok (uint64_t offset, uint64_t len)
+{
+   return offset <= g_size && len <= g_size - offset;
+}
+
+static bool variant_ok (const struct webc_bundle_variant_t *var)
+{
+   return range_ok (var->headers_offset, var->headers_len)
+       && range_ok (var->body_offset, var->body_len)
+       && memchr (var->etag, 0, sizeof var->etag) != NULL;
+}
+
+// Everything that is later used without checks is checked once here, so
+// that a truncated or corrupt bundle is refused at startup.
+static bool bundle_validate (const char *fname)
+{
+   const struct webc_bundle_header_t *hdr = (const void *)g_base;
+
+   if (g_size < sizeof *hdr ||
+       (memcmp (hdr->magic, WEBC_BUNDLE_MAGIC, sizeof hdr->magic))!=0 ||
+       hdr->version != WEBC_BUNDLE_VERSION) {
+      WEBC_UTIL_LOG ("[%s] is not a version %i bundle\n", fname,
+                     WEBC_BUNDLE_VERSION);
+      return false;
+   }
+
+   if (hdr->file_size != g_size ||
+       hdr->index_offset % sizeof (uint64_t) ||
+       !range_ok (hdr->index_offset,
+                  (uint64_t)hdr->nentries * sizeof *g_entries)) {
+      WEBC_UTIL_LOG ("Bundle [%s] is truncated or corrupt\n", fname);
+      return false;
+   }
+
+   g_entries = (const void *)&g_base[hdr->index_offset];
+   g_nentries = hdr->nentries;
+
+   for (uint32_t i=0; i<g_nentries; i++) {
+      const struct webc_bundle_entry_t *entry = &g_entries[i];
+      if (!range_ok (entry->path_offset, entry->path_len) ||
+          !variant_ok (&entry->plain) ||
+          (entry->has_gzip && !variant_ok (&entry->gzip))) {
+         WEBC_UTIL_LOG ("Bundle [%s] has a corrupt entry at %u\n", fname, i);
+         return false;
+      }
+   }
+
+   return true;
+}
+
+static int entry_cmp (const struct webc_bundle_entry_t *entry,
+                      const char *path, size_t path_len)
+{
+   size_t len = entry->path_len < path_len ? entry->path_len : path_len;
+   int rc = memcmp (&g_base[entry->path_offset], path, len);
+   if (rc)
+      return rc;
+   return entry->path_len < path_len ? -1 : entry->path_len > path_len ? 1 : 0;
+}
+
+/* *************************************************************** */
+
+bool webc_bundle_open (const char *fname)
+{
+   struct stat sb;
+
+   webc_bundle_close ();
+
+   if ((g_fd = open (fname, O_RDONLY | O_CLOEXEC)) < 0) {
+      WEBC_UTIL_LOG ("Failed to open bundle [%s]: %m\n", fname);
+      goto errorexit;
+   }
+
+   if ((fstat (g_fd, &sb))!=0) {
+      WEBC_UTIL_LOG ("Failed to stat bundle [%s]: %m\n", fname);
+      goto errorexit;
+   }
+
+   g_size = sb.st_size;
+   if (g_size == 0) {
+      WEBC_UTIL_LOG ("Bundle [%s] is empty\n", fname);
+      goto errorexit;
+   }
+
+   void *base = mmap (NULL, g_size, PROT_READ, MAP_SHARED, g_fd, 0);
+   if (base == MAP_FAILED) {
+      WEBC_UTIL_LOG ("Failed to map bundle [%s]: %m\n", fname);
+      goto errorexit;
+   }
+   g_base = base;
+
+   if (!(bundle_validate (fname)))
+      goto errorexit;
+
+   WEBC_UTIL_LOG ("Serving %u files from bundle [%s]\n", g_nentries, fname);
+   return true;
+
+errorexit:
+   webc_bundle_close ();
+   return false;
+}
+
+void webc_bundle_close (void)
+{
+   if (g_base)
+      munmap ((void *)g_base, g_size);
+   if (g_fd >= 0)
+      close (g_fd);
+
+   g_fd = -1;
+   g_base = NULL;
+   g_size = 0;
+   g_entries = NULL;
+   g_nentries = 0;
+}
+
+const struct webc_bundle_entry_t *webc_bundle_find (const char *path,
+                                                    size_t path_len)
+{
+   size_t lo = 0, hi = g_nentries;
+
+   while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      int rc = entry_cmp (&g_entries[mid], path, path_len);
+      if (rc == 0)
+         return &g_entries[mid];
+      if (rc < 0)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   return NULL;
+}
+
+const char *webc_bundle_data (uint64_t offset)
+{
+   return g_base ? &g_base[offset] : NULL;
+}
+
+int webc_bundle_fd (void)
+{
+   return g_fd;
+}
+
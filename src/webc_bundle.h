@@ -0,0 +1,82 @@
+
+#ifndef H_BUNDLE
+#define H_BUNDLE
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A site bundle is the whole web root packed into one immutable file by
+ * webc_bundle-main, which the server maps at startup and serves from
+ * without any stat() or open() per request.
+ *
+ * Layout (all integers in host byte order, all offsets from the start of
+ * the file):
+ *
+ *    struct webc_bundle_header_t
+ *    struct webc_bundle_entry_t[nentries], sorted by path with memcmp()
+ *    paths, headers and bodies, referred to by offset from the entries
+ *
+ * Each entry has the plain file, and optionally a gzip variant taken from
+ * a "<name>.gz" file next to it when the bundle was built. For each variant
+ * the header lines (Content-Type, Content-Length, ETag and so on, each
+ * ending in "\r\n" but without the blank line that ends the header) are
+ * rendered when the bundle is built.
+ */
+
+#define WEBC_BUNDLE_MAGIC        "WEBCBNDL"
+#define WEBC_BUNDLE_VERSION      (1)
+
+// A quoted 64-bit hex ETag, and its terminator.
+#define WEBC_BUNDLE_ETAG_LEN     (24)
+
+struct webc_bundle_header_t {
+   char        magic[8];
+   uint32_t    version;
+   uint32_t    nentries;
+   uint64_t    index_offset;
+   uint64_t    file_size;
+};
+
+struct webc_bundle_variant_t {
+   uint64_t    headers_offset;
+   uint64_t    body_offset;
+   uint64_t    body_len;
+   uint32_t    headers_len;
+   uint32_t    reserved;
+   char        etag[WEBC_BUNDLE_ETAG_LEN];
+};
+
+struct webc_bundle_entry_t {
+   uint64_t                      path_offset;
+   uint32_t                      path_len;
+   uint32_t                      has_gzip;
+   struct webc_bundle_variant_t  plain;
+   struct webc_bundle_variant_t  gzip;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Map the bundle in fname. Only one bundle can be open at a time.
+   bool webc_bundle_open (const char *fname);
+   void webc_bundle_close (void);
+
+   // The entry for path (relative to the web root, without a leading
+   // '/'), or NULL if there is no open bundle or it has no such file.
+   const struct webc_bundle_entry_t *webc_bundle_find (const char *path,
+                                                       size_t path_len);
+
+   // Pointer to the bytes at offset in the open bundle.
+   const char *webc_bundle_data (uint64_t offset);
+
+   // The fd of the open bundle, for sendfile().
+   int webc_bundle_fd (void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
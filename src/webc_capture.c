@@ -0,0 +1,212 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <pthread.h>
+
+#include "webc_capture.h"
+#include "webc_accesslog.h"
+#include "webc_config.h"
+#include "webc_util.h"
+
+#define ENTRY_LEN(n)    (((n) + 7) & ~(size_t)7)
+
+// The record being built for the connection on this thread. Space for the
+// webc_capture_conn_t is kept at the start of buf.
+struct pending_t {
+   char       *buf;
+   size_t      len;
+   size_t      size;
+   uint16_t    nchunks;
+};
+
+static atomic_bool g_on = false;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_fd = -1;
+
+static _Thread_local struct pending_t g_pending;
+
+/* *************************************************************** */
+
+static bool write_all (int fd, const void *buf, size_t len)
+{
+   const char *ptr = buf;
+   while (len) {
+      ssize_t rc = write (fd, ptr, len);
+      if (rc < 0 && errno == EINTR)
+         continue;
+      if (rc <= 0)
+         return false;
+      ptr += rc;
+      len -= rc;
+   }
+   return true;
+}
+
+static void pending_reset (void)
+{
+   free (g_pending.buf);
+   memset (&g_pending, 0, sizeof g_pending);
+}
+
+/* *************************************************************** */
+
+bool webc_capture_open (const char *fname, bool append)
+{
+   bool error = true;
+   struct webc_capture_header_t header;
+   struct timespec wall, mono;
+   struct stat sb;
+   int fd = -1;
+
+   // Each record goes out in one write, and with O_APPEND the writes of
+   // two servers sharing the file across an upgrade do not overwrite each
+   // other.
+   int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+   if (!append)
+      flags |= O_TRUNC;
+
+   // The requests hold credentials and cookies, so only the server's user
+   // may read them, even when an existing file is reused.
+   if ((fd = open (fname, flags, 0600))<0) {
+      WEBC_UTIL_LOG ("Failed to create capture file [%s]: %m\n", fname);
+      goto errorexit;
+   }
+   if ((fchmod (fd, 0600))!=0) {
+      WEBC_UTIL_LOG ("Failed to restrict capture file [%s]: %m\n", fname);
+      goto errorexit;
+   }
+
+   if ((fstat (fd, &sb))!=0) {
+      WEBC_UTIL_LOG ("Failed to stat capture file [%s]: %m\n", fname);
+      goto errorexit;
+   }
+
+   // A file that is appended to already has its header. Timestamps are
+   // monotonic, so those of this process and of the one before it agree.
+   if (sb.st_size > 0)
+      goto opened;
+
+   clock_gettime (CLOCK_REALTIME, &wall);
+   clock_gettime (CLOCK_MONOTONIC, &mono);
+
+   memset (&header, 0, sizeof header);
+   memcpy (header.magic, WEBC_CAPTURE_MAGIC, sizeof header.magic);
+   header.version = WEBC_CAPTURE_VERSION;
+   header.header_len = sizeof header;
+   header.wall_ns = (uint64_t)wall.tv_sec * 1000000000u + wall.tv_nsec;
+   header.mono_ns = (uint64_t)mono.tv_sec * 1000000000u + mono.tv_nsec;
+
+   if (!(write_all (fd, &header, sizeof header))) {
+      WEBC_UTIL_LOG ("Failed to write capture file [%s]: %m\n", fname);
+      goto errorexit;
+   }
+
+opened:
+   webc_capture_close ();
+
+   pthread_mutex_lock (&g_lock);
+   g_fd = fd;
+   fd = -1;
+   pthread_mutex_unlock (&g_lock);
+   atomic_store (&g_on, true);
+
+   WEBC_UTIL_LOG ("Capturing requests to [%s]\n", fname);
+   error = false;
+
+errorexit:
+   if (fd >= 0)
+      close (fd);
+   return !error;
+}
+
+void webc_capture_close (void)
+{
+   atomic_store (&g_on, false);
+
+   pthread_mutex_lock (&g_lock);
+   if (g_fd >= 0)
+      close (g_fd);
+   g_fd = -1;
+   pthread_mutex_unlock (&g_lock);
+}
+
+void webc_capture_data (const struct webc_conn_t *conn,
+                        const void *data, size_t len)
+{
+   if (!conn || !len ||
+       !(atomic_load_explicit (&g_on, memory_order_relaxed)))
+      return;
+
+   size_t need = (g_pending.len ? 0 : sizeof (struct webc_capture_conn_t))
+               + sizeof (struct webc_capture_chunk_t) + ENTRY_LEN (len);
+
+   // The chunk that would go over the limit is dropped, and so is
+   // everything after it.
+   if (g_pending.len + need > CAPTURE_MAX_CONN_BYTES ||
+       g_pending.nchunks == UINT16_MAX)
+      return;
+
+   if (g_pending.len + need > g_pending.size) {
+      size_t size = g_pending.size ? g_pending.size * 2 : 1024;
+      while (size < g_pending.len + need)
+         size *= 2;
+      char *tmp = realloc (g_pending.buf, size);
+      if (!tmp)
+         return;
+      g_pending.buf = tmp;
+      g_pending.size = size;
+   }
+
+   if (!g_pending.len)
+      g_pending.len = sizeof (struct webc_capture_conn_t);
+
+   struct webc_capture_chunk_t *chunk =
+      (struct webc_capture_chunk_t *)&g_pending.buf[g_pending.len];
+   memset (chunk, 0, sizeof *chunk + ENTRY_LEN (len));
+   chunk->len = len;
+   chunk->offset_ns = webc_accesslog_now () - conn->stamps[webc_conn_ACCEPTED];
+   memcpy (chunk->data, data, len);
+
+   g_pending.len += sizeof *chunk + ENTRY_LEN (len);
+   g_pending.nchunks++;
+}
+
+void webc_capture_conn_end (const struct webc_conn_t *conn, int status)
+{
+   if (!g_pending.len)
+      return;
+
+   uint64_t end = conn->stamps[webc_conn_LAST_BYTE];
+   struct webc_capture_conn_t *rec = (struct webc_capture_conn_t *)g_pending.buf;
+
+   rec->len = g_pending.len;
+   rec->status = status;
+   rec->nchunks = g_pending.nchunks;
+   rec->accept_ns = conn->stamps[webc_conn_ACCEPTED];
+   rec->latency_ns = (end ? end : webc_accesslog_now ()) - rec->accept_ns;
+   rec->bytes_sent = conn->bytes_sent;
+   rec->bytes_received = conn->bytes_received;
+
+   pthread_mutex_lock (&g_lock);
+   if (g_fd >= 0 && !(write_all (g_fd, g_pending.buf, g_pending.len))) {
+      WEBC_UTIL_LOG ("Failed to write to the capture file: %m, stopping\n");
+      atomic_store (&g_on, false);
+      close (g_fd);
+      g_fd = -1;
+   }
+   pthread_mutex_unlock (&g_lock);
+
+   pending_reset ();
+}
+
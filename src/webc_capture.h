@@ -0,0 +1,82 @@
+
+#ifndef H_CAPTURE
+#define H_CAPTURE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "webc_conn.h"
+
+/* Traffic capture (--capture=<file>), for webc_replay-main to play the
+ * requests back against a server later. The bytes of each request are
+ * recorded as the request is read, one chunk per line with the time it
+ * arrived, in a buffer belonging to the connection's thread. When the
+ * connection ends its record is appended to the file in a single write, so
+ * a capture costs one short lock per connection. At most
+ * CAPTURE_MAX_CONN_BYTES (webc_config.h) of a connection are kept.
+ *
+ * The requests are kept as they arrived, Authorization and Cookie headers
+ * included, so the file is created (or truncated) with mode 0600.
+ *
+ * A file is a webc_capture_header_t followed by one record per connection,
+ * in the order in which the connections ended. A record is a
+ * webc_capture_conn_t followed by its chunks, each a webc_capture_chunk_t
+ * followed by the data padded to a multiple of 8 bytes. All fields are in
+ * host byte order.
+ */
+
+#define WEBC_CAPTURE_MAGIC       ("WEBCCAPT")
+#define WEBC_CAPTURE_VERSION     (1)
+
+struct webc_capture_header_t {
+   char        magic[8];
+   uint32_t    version;
+   uint32_t    header_len;
+   // The wall-clock time and the monotonic time, both in ns, at which the
+   // file was created. Timestamps in the records are monotonic.
+   uint64_t    wall_ns;
+   uint64_t    mono_ns;
+};
+
+struct webc_capture_conn_t {
+   uint32_t    len;              // Of the record, chunks included
+   uint16_t    status;
+   uint16_t    nchunks;
+   uint64_t    accept_ns;
+   uint64_t    latency_ns;       // From accept() to the last byte sent
+   uint64_t    bytes_sent;
+   uint64_t    bytes_received;   // More than captured if it was cut short
+};
+
+struct webc_capture_chunk_t {
+   uint32_t    len;              // Of the data, without the padding
+   uint32_t    reserved;
+   uint64_t    offset_ns;        // From accept()
+   char        data[];
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Start capturing to fname, which is truncated unless append is set.
+   // A server started by an upgrade (see webc_upgrade.h) appends, as the
+   // server it replaces may still be writing to the file. Until this is
+   // called the functions below do nothing.
+   bool webc_capture_open (const char *fname, bool append);
+   void webc_capture_close (void);
+
+   // Records that data arrived on conn.
+   void webc_capture_data (const struct webc_conn_t *conn,
+                           const void *data, size_t len);
+
+   // Writes out the record for conn, which is ending with status.
+   void webc_capture_conn_end (const struct webc_conn_t *conn, int status);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
@@ -0,0 +1,281 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+
+#include <sys/types.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include "webc_conn.h"
+#include "webc_accesslog.h"
+#include "webc_config.h"
+#include "webc_util.h"
+
+static _Thread_local struct webc_conn_t *g_current = NULL;
+static bool g_server_timing = false;
+
+/* *************************************************************** */
+
+static void account (int fd, size_t nbytes)
+{
+   if (g_current && g_current->fd == fd) {
+      g_current->bytes_sent += nbytes;
+      webc_conn_stamp (g_current, webc_conn_LAST_BYTE);
+   }
+}
+
+// Waits until fd can take more data. Returns false if the client has gone,
+// or has not accepted anything for XMIT_STALL_TIMEOUT_SECS.
+static bool wait_writable (int fd)
+{
+   struct pollfd pfd = { fd, POLLOUT, 0 };
+
+   for (;;) {
+      int rc = poll (&pfd, 1, XMIT_STALL_TIMEOUT_SECS * 1000);
+      if (rc < 0 && errno == EINTR)
+         continue;
+      if (rc < 0) {
+         WEBC_UTIL_LOG ("poll() failed on fd %i: %m\n", fd);
+         return false;
+      }
+      if (rc == 0) {
+         WEBC_UTIL_LOG ("Client on fd %i stalled for %i seconds\n", fd,
+                        XMIT_STALL_TIMEOUT_SECS);
+         return false;
+      }
+      return !(pfd.revents & (POLLERR | POLLHUP | POLLNVAL));
+   }
+}
+
+// What a client has taken of a file body since the start of the current
+// XMIT_RATE_WINDOW_SECS.
+struct xmit_rate_t {
+   uint64_t    window_start;
+   uint64_t    nbytes;
+};
+
+// Like wait_writable(), but returns false instead once a whole window has
+// gone by in which the client took less than XMIT_MIN_RATE bytes a second,
+// so that a client trickling a large body cannot hold its thread for as
+// long as it likes.
+static bool wait_writable_rate (int fd, struct xmit_rate_t *rate)
+{
+   static const uint64_t window_ns = XMIT_RATE_WINDOW_SECS * 1000000000ULL;
+
+   if (!XMIT_MIN_RATE)
+      return wait_writable (fd);
+
+   for (;;) {
+      uint64_t elapsed = webc_accesslog_now () - rate->window_start;
+      if (elapsed >= window_ns) {
+         if (rate->nbytes < (uint64_t)XMIT_MIN_RATE * XMIT_RATE_WINDOW_SECS) {
+            WEBC_UTIL_LOG ("Client on fd %i took %" PRIu64 " bytes in %i "
+                           "seconds, below the minimum of %i a second\n", fd,
+                           rate->nbytes, XMIT_RATE_WINDOW_SECS, XMIT_MIN_RATE);
+            return false;
+         }
+         rate->window_start += elapsed;
+         rate->nbytes = 0;
+         elapsed = 0;
+      }
+
+      struct pollfd pfd = { fd, POLLOUT, 0 };
+      int rc = poll (&pfd, 1, (int)((window_ns - elapsed) / 1000000) + 1);
+      if (rc < 0 && errno == EINTR)
+         continue;
+      if (rc < 0) {
+         WEBC_UTIL_LOG ("poll() failed on fd %i: %m\n", fd);
+         return false;
+      }
+      if (rc > 0)
+         return !(pfd.revents & (POLLERR | POLLHUP | POLLNVAL));
+   }
+}
+
+/* *************************************************************** */
+
+void webc_conn_begin (struct webc_conn_t *conn, int fd,
+                      const char *remote_addr, uint16_t remote_port)
+{
+   memset (conn, 0, sizeof *conn);
+   conn->fd = fd;
+   conn->remote_addr = remote_addr;
+   conn->remote_port = remote_port;
+   g_current = conn;
+}
+
+void webc_conn_end (struct webc_conn_t *conn)
+{
+   WEBC_THRD_LOG_AT (WEBC_LOG_DEBUG, conn->remote_addr, conn->remote_port,
+                     "Sent %" PRIu64 " bytes\n", conn->bytes_sent);
+   if (g_current == conn)
+      g_current = NULL;
+}
+
+struct webc_conn_t *webc_conn_current (void)
+{
+   return g_current;
+}
+
+void webc_conn_stamp (struct webc_conn_t *conn, enum webc_conn_stamp_t stage)
+{
+   conn->stamps[stage] = webc_accesslog_now ();
+}
+
+void webc_conn_server_timing_enable (bool enable)
+{
+   g_server_timing = enable;
+}
+
+bool webc_conn_server_timing (const struct webc_conn_t *conn,
+                              webc_header_t *rsp_headers)
+{
+   static const struct {
+      const char                *name;
+      enum webc_conn_stamp_t     from;
+      enum webc_conn_stamp_t     to;
+   } phases[] = {
+      { "queue",     webc_conn_ACCEPTED,     webc_conn_FIRST_BYTE },
+      { "headers",   webc_conn_FIRST_BYTE,   webc_conn_HEADERS    },
+      { "route",     webc_conn_HEADERS,      webc_conn_ROUTED     },
+   };
+
+   if (!g_server_timing)
+      return true;
+
+   char value[128];
+   size_t len = 0;
+   for (size_t i=0; i<sizeof phases/sizeof phases[0]; i++) {
+      uint64_t from = conn->stamps[phases[i].from],
+               to = conn->stamps[phases[i].to];
+      if (!from || !to)
+         continue;
+      len += snprintf (&value[len], sizeof value - len, "%s%s;dur=%.3f",
+                       len ? ", " : "", phases[i].name, (to - from) / 1e6);
+   }
+
+   return len ? webc_header_set (rsp_headers, webc_header_SERVER_TIMING, value)
+              : true;
+}
+
+bool webc_conn_write (int fd, const void *buf, size_t len)
+{
+   const char *ptr = buf;
+   while (len) {
+      ssize_t rc = write (fd, ptr, len);
+      if (rc < 0 && errno == EINTR)
+         continue;
+      if (rc < 0 && errno == EAGAIN && wait_writable (fd))
+         continue;
+      if (rc <= 0)
+         return false;
+      account (fd, rc);
+      ptr += rc;
+      len -= rc;
+   }
+   return true;
+}
+
+bool webc_conn_writev (int fd, struct iovec *iov, int iovcnt)
+{
+   while (iovcnt > 0) {
+      ssize_t rc = writev (fd, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
+      if (rc < 0 && errno == EINTR)
+         continue;
+      if (rc < 0 && errno == EAGAIN && wait_writable (fd))
+         continue;
+      if (rc < 0 || (rc == 0 && iov->iov_len))
+         return false;
+      account (fd, rc);
+
+      // Step over what was written, which may end part way into an iovec.
+      size_t nbytes = rc;
+      while (iovcnt > 0 && nbytes >= iov->iov_len) {
+         nbytes -= iov->iov_len;
+         iov++;
+         iovcnt--;
+      }
+      if (iovcnt > 0) {
+         iov->iov_base = (char *)iov->iov_base + nbytes;
+         iov->iov_len -= nbytes;
+      }
+   }
+   return true;
+}
+
+bool webc_conn_sendfile (int fd, int in_fd, uint64_t offset, uint64_t count)
+{
+   bool ret = false;
+   off_t offs = (off_t)offset;
+   uint64_t remaining = count;
+   struct xmit_rate_t rate = { webc_accesslog_now (), 0 };
+
+   int flags = fcntl (fd, F_GETFL);
+   if (flags < 0) {
+      WEBC_UTIL_LOG ("Failed to get flags for fd %i: %m\n", fd);
+      return false;
+   }
+
+   if (!(flags & O_NONBLOCK) && (fcntl (fd, F_SETFL, flags | O_NONBLOCK))!=0) {
+      WEBC_UTIL_LOG ("Failed to make fd %i non-blocking: %m\n", fd);
+      return false;
+   }
+
+   // The whole range is read once, front to back. Readahead is requested
+   // one chunk ahead of what sendfile() is reading, so that the disk is
+   // busy while the network drains the previous chunk.
+   off_t advised = offs + (off_t)(count < XMIT_CHUNK_SIZE ? count : XMIT_CHUNK_SIZE);
+   posix_fadvise (in_fd, offs, count, POSIX_FADV_SEQUENTIAL);
+   posix_fadvise (in_fd, offs, advised - offs, POSIX_FADV_WILLNEED);
+
+   while (remaining) {
+      size_t chunk = remaining < XMIT_CHUNK_SIZE ? remaining : XMIT_CHUNK_SIZE;
+
+      if (advised < (off_t)(offset + count) && offs + (off_t)chunk >= advised) {
+         posix_fadvise (in_fd, advised, XMIT_CHUNK_SIZE, POSIX_FADV_WILLNEED);
+         advised += XMIT_CHUNK_SIZE;
+      }
+
+      ssize_t rc = sendfile (fd, in_fd, &offs, chunk);
+      if (rc > 0) {
+         account (fd, rc);
+         remaining -= rc;
+         rate.nbytes += rc;
+         continue;
+      }
+
+      if (rc == 0) {
+         // The file is shorter than it was when its size was sent.
+         WEBC_UTIL_LOG ("Unexpected end of file on fd %i, %" PRIu64
+                        " bytes not sent\n", in_fd, remaining);
+         goto errorexit;
+      }
+
+      if (errno == EINTR)
+         continue;
+
+      if (errno != EAGAIN) {
+         WEBC_UTIL_LOG ("sendfile() failed on fd %i: %m\n", fd);
+         goto errorexit;
+      }
+
+      if (!(wait_writable_rate (fd, &rate)))
+         goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   if (!(flags & O_NONBLOCK))
+      fcntl (fd, F_SETFL, flags);
+
+   return ret;
+}
+
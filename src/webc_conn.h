@@ -0,0 +1,95 @@
+
+#ifndef H_CONN
+#define H_CONN
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/uio.h>
+
+#include "webc_header.h"
+
+/* Per-connection state, and the functions that send data on a connection.
+ *
+ * Each connection is serviced by its own thread, which makes the state for
+ * the connection current for the thread while it runs. Anything that
+ * writes to the client through the functions here is accounted to it.
+ *
+ * File bodies are sent by webc_conn_sendfile() in chunks of at most
+ * XMIT_CHUNK_SIZE bytes (webc_config.h) with the socket switched to
+ * non-blocking, waiting for the socket to become writable whenever the
+ * client falls behind. A client that accepts nothing for
+ * XMIT_STALL_TIMEOUT_SECS, or that takes a file body at less than
+ * XMIT_MIN_RATE, is dropped instead of holding its thread. The thread is
+ * still held for the whole of a transfer at any rate above that.
+ *
+ * The connection also carries the monotonic time (webc_accesslog_now()) at
+ * which the request reached each stage, 0 for a stage it did not reach.
+ * Handlers can read them through webc_conn_current(); they are folded into
+ * the per-phase metrics when the request completes.
+ */
+
+enum webc_conn_stamp_t {
+   webc_conn_ACCEPTED,     // accept() returned
+   webc_conn_FIRST_BYTE,   // The first byte of the request was read
+   webc_conn_HEADERS,      // The blank line after the headers was read
+   webc_conn_ROUTED,       // The handler was found
+   webc_conn_HANDLED,      // The handler returned
+   webc_conn_LAST_BYTE,    // The last byte of the response was written
+   webc_conn_NSTAMPS,
+};
+
+struct webc_conn_t {
+   int            fd;
+   const char    *remote_addr;
+   uint16_t       remote_port;
+
+   uint64_t       bytes_sent;
+   uint64_t       bytes_received;
+
+   uint64_t       stamps[webc_conn_NSTAMPS];
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Make conn the current connection for the calling thread, and the end
+   // of it. webc_conn_end() logs the number of bytes sent.
+   void webc_conn_begin (struct webc_conn_t *conn, int fd,
+                         const char *remote_addr, uint16_t remote_port);
+   void webc_conn_end (struct webc_conn_t *conn);
+
+   // The current connection for the calling thread, or NULL.
+   struct webc_conn_t *webc_conn_current (void);
+
+   // Record that conn reached stage now.
+   void webc_conn_stamp (struct webc_conn_t *conn, enum webc_conn_stamp_t stage);
+
+   // With this on (--server-timing), webc_conn_server_timing() sets a
+   // Server-Timing header on rsp_headers with the time spent in each phase
+   // before the handler was called. Off by default.
+   void webc_conn_server_timing_enable (bool enable);
+   bool webc_conn_server_timing (const struct webc_conn_t *conn,
+                                 webc_header_t *rsp_headers);
+
+   // Write all of buf to fd. Returns false if the client went away.
+   bool webc_conn_write (int fd, const void *buf, size_t len);
+
+   // Write all of the iovcnt buffers in iov to fd, in as few system calls
+   // as the socket allows. The array is modified as partial writes are
+   // stepped over. Returns false if the client went away.
+   bool webc_conn_writev (int fd, struct iovec *iov, int iovcnt);
+
+   // Send count bytes starting at offset from in_fd to fd. Returns false
+   // if not all of them could be sent; the caller cannot know how many
+   // were, and should close the connection.
+   bool webc_conn_sendfile (int fd, int in_fd, uint64_t offset, uint64_t count);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
@@ -0,0 +1,371 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <limits.h>
+
+#include <pthread.h>
+
+#include "webc_dircache.h"
+#include "webc_fswatch.h"
+#include "webc_config.h"
+#include "webc_util.h"
+
+// Number of hash chains. Must be a power of two.
+#define DIRCACHE_NBUCKETS     (1024)
+
+struct webc_dircache_entry_t {
+   char                          *path;
+   char                          *html;
+   size_t                         html_len;
+   size_t                         nbytes;
+
+   dev_t                          dev;
+   ino_t                          ino;
+   struct timespec                mtime;
+   struct timespec                ctime;
+
+   // Set when no filesystem event could have been missed since the entry
+   // was last checked, so that it may be used without a stat().
+   bool                           trusted;
+   time_t                         checked;
+
+   // Held by the cache while linked in, and by every caller that has the
+   // entry from _find() or _insert().
+   size_t                         refcount;
+
+   struct webc_dircache_t        *cache;
+   struct webc_dircache_entry_t  *hash_next;
+   struct webc_dircache_entry_t  *lru_prev;
+   struct webc_dircache_entry_t  *lru_next;
+};
+
+struct webc_dircache_t {
+   webc_fswatch_t                *fswatch;
+
+   pthread_mutex_t                lock;
+
+   struct webc_dircache_entry_t  *buckets[DIRCACHE_NBUCKETS];
+
+   // Most recently used at the head, eviction from the tail.
+   struct webc_dircache_entry_t  *lru_head;
+   struct webc_dircache_entry_t  *lru_tail;
+
+   size_t                         nbytes;
+};
+
+/* *************************************************************** */
+
+static time_t now_secs (void)
+{
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec;
+}
+
+// Copies path into dst without any trailing '/', mapping "." to "", which
+// is the form the filesystem watcher reports directories in. Returns false
+// if dst is too small.
+static bool path_key (char *dst, size_t dst_len, const char *path)
+{
+   size_t len = strlen (path);
+   while (len && path[len - 1] == '/')
+      len--;
+   if (len == 1 && path[0] == '.')
+      len = 0;
+   if (len >= dst_len)
+      return false;
+   memcpy (dst, path, len);
+   dst[len] = 0;
+   return true;
+}
+
+static size_t path_hash (const char *path)
+{
+   uint32_t h = 2166136261u;
+   while (*path) {
+      h ^= (uint8_t)*path++;
+      h *= 16777619u;
+   }
+   return h & (DIRCACHE_NBUCKETS - 1);
+}
+
+static bool entry_valid (const struct webc_dircache_entry_t *entry,
+                         const struct stat *sb)
+{
+   return entry->dev == sb->st_dev
+       && entry->ino == sb->st_ino
+       && entry->mtime.tv_sec == sb->st_mtim.tv_sec
+       && entry->mtime.tv_nsec == sb->st_mtim.tv_nsec
+       && entry->ctime.tv_sec == sb->st_ctim.tv_sec
+       && entry->ctime.tv_nsec == sb->st_ctim.tv_nsec;
+}
+
+static void entry_del (struct webc_dircache_entry_t *entry)
+{
+   if (entry) {
+      free (entry->path);
+      free (entry->html);
+      free (entry);
+   }
+}
+
+static void entry_unref (struct webc_dircache_entry_t *entry)
+{
+   if (--entry->refcount == 0)
+      entry_del (entry);
+}
+
+static void lru_unlink (webc_dircache_t *dc,
+                        struct webc_dircache_entry_t *entry)
+{
+   if (entry->lru_prev)
+      entry->lru_prev->lru_next = entry->lru_next;
+   else
+      dc->lru_head = entry->lru_next;
+
+   if (entry->lru_next)
+      entry->lru_next->lru_prev = entry->lru_prev;
+   else
+      dc->lru_tail = entry->lru_prev;
+
+   entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void lru_push (webc_dircache_t *dc,
+                      struct webc_dircache_entry_t *entry)
+{
+   entry->lru_prev = NULL;
+   entry->lru_next = dc->lru_head;
+   if (dc->lru_head)
+      dc->lru_head->lru_prev = entry;
+   dc->lru_head = entry;
+   if (!dc->lru_tail)
+      dc->lru_tail = entry;
+}
+
+// Removes the entry from the cache. Callers still holding a reference
+// keep a valid entry until they release it.
+static void cache_remove (webc_dircache_t *dc,
+                          struct webc_dircache_entry_t *entry)
+{
+   struct webc_dircache_entry_t **pp = &dc->buckets[path_hash (entry->path)];
+   while (*pp && *pp != entry)
+      pp = &(*pp)->hash_next;
+   if (*pp)
+      *pp = entry->hash_next;
+
+   lru_unlink (dc, entry);
+   dc->nbytes -= entry->nbytes;
+   entry_unref (entry);
+}
+
+static struct webc_dircache_entry_t *cache_lookup (webc_dircache_t *dc,
+                                                   const char *path)
+{
+   struct webc_dircache_entry_t *entry = dc->buckets[path_hash (path)];
+   while (entry && (strcmp (entry->path, path))!=0)
+      entry = entry->hash_next;
+   return entry;
+}
+
+static void cache_invalidate (webc_dircache_t *dc, const char *key)
+{
+   struct webc_dircache_entry_t *entry = cache_lookup (dc, key);
+   if (entry)
+      cache_remove (dc, entry);
+}
+
+// Called by the filesystem watcher. A change to an entry changes the
+// listing of the directory it is in, and if the entry is itself a
+// directory its own listing may be gone too.
+static void cb_fswatch (const char *dir, const char *name, void *udata)
+{
+   webc_dircache_t *dc = udata;
+
+   pthread_mutex_lock (&dc->lock);
+
+   if (!dir) {
+      while (dc->lru_tail)
+         cache_remove (dc, dc->lru_tail);
+   } else {
+      cache_invalidate (dc, dir);
+      if (name) {
+         char *child = NULL;
+         if (!dir[0])
+            cache_invalidate (dc, name);
+         else if ((webc_util_sprintf (&child, NULL, "%s/%s", dir, name)))
+            cache_invalidate (dc, child);
+         else
+            while (dc->lru_tail)
+               cache_remove (dc, dc->lru_tail);
+         free (child);
+      }
+   }
+
+   pthread_mutex_unlock (&dc->lock);
+}
+
+/* *************************************************************** */
+
+webc_dircache_t *webc_dircache_new (webc_fswatch_t *fswatch)
+{
+   webc_dircache_t *ret = calloc (1, sizeof *ret);
+   if (!ret) {
+      WEBC_UTIL_LOG ("OOM error creating the directory cache\n");
+      return NULL;
+   }
+
+   pthread_mutex_init (&ret->lock, NULL);
+   ret->fswatch = fswatch;
+
+   if (fswatch && !(webc_fswatch_subscribe (fswatch, cb_fswatch, ret))) {
+      WEBC_UTIL_LOG ("Failed to subscribe to filesystem changes, directory "
+                     "listings will use %i-second revalidation\n",
+                     FSWATCH_TTL_SECS);
+      // Nothing would invalidate the entries, so they are revalidated as
+      // if there were no watcher.
+      ret->fswatch = NULL;
+   }
+
+   return ret;
+}
+
+void webc_dircache_del (webc_dircache_t *dc)
+{
+   if (!dc)
+      return;
+
+   while (dc->lru_tail)
+      cache_remove (dc, dc->lru_tail);
+   pthread_mutex_destroy (&dc->lock);
+   free (dc);
+}
+
+webc_dircache_entry_t *webc_dircache_find (webc_dircache_t *dc,
+                                           const char *path,
+                                           const struct stat *sb)
+{
+   struct webc_dircache_entry_t *ret = NULL;
+   char key[PATH_MAX];
+
+   if (!dc || !path || DIRCACHE_MAX_BYTES == 0 ||
+       !(path_key (key, sizeof key, path)))
+      return NULL;
+
+   pthread_mutex_lock (&dc->lock);
+
+   struct webc_dircache_entry_t *entry = cache_lookup (dc, key);
+   if (entry && !sb) {
+      bool reliable = webc_fswatch_reliable (dc->fswatch);
+      if ((reliable && entry->trusted) ||
+          (!reliable && now_secs () - entry->checked < FSWATCH_TTL_SECS))
+         ret = entry;
+   }
+
+   if (entry && sb) {
+      if (entry_valid (entry, sb)) {
+         // Any change made before the stat() above has already been
+         // delivered, or will remove the entry when it is.
+         entry->trusted = webc_fswatch_reliable (dc->fswatch);
+         entry->checked = now_secs ();
+         ret = entry;
+      } else {
+         cache_remove (dc, entry);
+      }
+   }
+
+   if (ret) {
+      lru_unlink (dc, ret);
+      lru_push (dc, ret);
+      ret->refcount++;
+   }
+
+   pthread_mutex_unlock (&dc->lock);
+
+   return ret;
+}
+
+webc_dircache_entry_t *webc_dircache_insert (webc_dircache_t *dc,
+                                             const char *path,
+                                             const struct stat *sb,
+                                             uint64_t generation,
+                                             char *html, size_t html_len)
+{
+   struct webc_dircache_entry_t *entry = NULL;
+   char key[PATH_MAX];
+
+   if (!dc || !path || !sb || !html ||
+       !(path_key (key, sizeof key, path)))
+      return NULL;
+
+   size_t nbytes = sizeof *entry + strlen (key) + 1 + html_len;
+   if (nbytes > DIRCACHE_MAX_BYTES)
+      return NULL;
+
+   if (!(entry = calloc (1, sizeof *entry)) ||
+       !(entry->path = strdup (key))) {
+      WEBC_UTIL_LOG ("OOM error caching listing for [%s]\n", path);
+      free (entry);
+      return NULL;
+   }
+
+   entry->html = html;
+   entry->html_len = html_len;
+   entry->nbytes = nbytes;
+   entry->dev = sb->st_dev;
+   entry->ino = sb->st_ino;
+   entry->mtime = sb->st_mtim;
+   entry->ctime = sb->st_ctim;
+   entry->checked = now_secs ();
+   entry->refcount = 2; // One for the cache, one for the caller
+   entry->cache = dc;
+
+   pthread_mutex_lock (&dc->lock);
+
+   // If any events were delivered while the listing was being rendered
+   // one of them may have been for this directory, and was missed.
+   entry->trusted = webc_fswatch_reliable (dc->fswatch)
+                 && webc_fswatch_generation (dc->fswatch) == generation;
+
+   cache_invalidate (dc, key);
+
+   while (dc->lru_tail && dc->nbytes + nbytes > DIRCACHE_MAX_BYTES)
+      cache_remove (dc, dc->lru_tail);
+
+   size_t bucket = path_hash (key);
+   entry->hash_next = dc->buckets[bucket];
+   dc->buckets[bucket] = entry;
+   lru_push (dc, entry);
+   dc->nbytes += nbytes;
+
+   pthread_mutex_unlock (&dc->lock);
+
+   return entry;
+}
+
+const char *webc_dircache_html (webc_dircache_entry_t *entry, size_t *html_len)
+{
+   if (!entry)
+      return NULL;
+
+   if (html_len)
+      *html_len = entry->html_len;
+
+   return entry->html;
+}
+
+void webc_dircache_release (webc_dircache_entry_t *entry)
+{
+   if (!entry)
+      return;
+
+   webc_dircache_t *dc = entry->cache;
+
+   pthread_mutex_lock (&dc->lock);
+   entry_unref (entry);
+   pthread_mutex_unlock (&dc->lock);
+}
+
@@ -0,0 +1,42 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+
+#include "webc_embed.h"
+
+static int entry_cmp (const struct webc_embed_entry_t *entry,
+                      const char *path, size_t path_len)
+{
+   size_t len = entry->path_len < path_len ? entry->path_len : path_len;
+   int rc = memcmp (entry->path, path, len);
+   if (rc)
+      return rc;
+   return entry->path_len < path_len ? -1 : entry->path_len > path_len ? 1 : 0;
+}
+
+/* *************************************************************** */
+
+const struct webc_embed_entry_t *webc_embed_find (const char *path,
+                                                  size_t path_len)
+{
+   size_t lo = 0, hi = webc_embed_table_nentries;
+
+   while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      int rc = entry_cmp (&webc_embed_table[mid], path, path_len);
+      if (rc == 0)
+         return &webc_embed_table[mid];
+      if (rc < 0)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   return NULL;
+}
+
+size_t webc_embed_count (void)
+{
+   return webc_embed_table_nentries;
+}
+
@@ -0,0 +1,411 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include <pthread.h>
+
+#include "webc_fswatch.h"
+#include "webc_config.h"
+#include "webc_util.h"
+
+#define WATCH_MASK      (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB |\
+                         IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO |\
+                         IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR |\
+                         IN_DONT_FOLLOW)
+
+// Maximum number of subscribers.
+#define MAX_SUBSCRIBERS (16)
+
+struct webc_fswatch_t {
+   struct {
+      webc_fswatch_cb_t *cb;
+      void *udata;
+   } subscribers[MAX_SUBSCRIBERS];
+   size_t nsubscribers;
+   pthread_mutex_t subscribers_lock;
+
+   atomic_uint_fast64_t generation;
+   atomic_bool reliable;
+   // Set by mark_unreliable(), and never cleared. Only the watcher thread
+   // (and webc_fswatch_new()) touches this.
+   bool degraded;
+
+   char *root;
+   int inotify_fd;
+   int stop_fd;
+   pthread_t thread;
+   bool running;
+
+   // Watch descriptors are small, increasing integers, so the path for
+   // each one is kept in an array indexed by the descriptor. Only the
+   // watcher thread (and webc_fswatch_new(), before the thread exists)
+   // touches this.
+   char **wd_paths;
+   size_t wd_paths_len;
+
+   // Enough for a large batch of events; the kernel guarantees that each
+   // event fits into sizeof (struct inotify_event) + NAME_MAX + 1 bytes.
+   char buf[64 * 1024]
+      __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+};
+
+/* *************************************************************** */
+
+static void notify (webc_fswatch_t *fsw, const char *dir, const char *name)
+{
+   pthread_mutex_lock (&fsw->subscribers_lock);
+   for (size_t i=0; i<fsw->nsubscribers; i++) {
+      fsw->subscribers[i].cb (dir, name, fsw->subscribers[i].udata);
+   }
+   pthread_mutex_unlock (&fsw->subscribers_lock);
+}
+
+static void mark_unreliable (webc_fswatch_t *fsw, const char *reason,
+                             const char *path)
+{
+   fsw->degraded = true;
+   if (atomic_exchange (&fsw->reliable, false)) {
+      WEBC_UTIL_LOG ("Filesystem watcher degraded to %i-second revalidation: "
+                     "%s [%s]\n", FSWATCH_TTL_SECS, reason, path);
+   }
+}
+
+static char *path_join (const char *dir, const char *name)
+{
+   char *ret = NULL;
+   if (!dir[0])
+      ret = strdup (name);
+   else
+      webc_util_sprintf (&ret, NULL, "%s/%s", dir, name);
+   return ret;
+}
+
+static bool wd_set (webc_fswatch_t *fsw, int wd, const char *relpath)
+{
+   if ((size_t)wd >= fsw->wd_paths_len) {
+      size_t newlen = fsw->wd_paths_len ? fsw->wd_paths_len : 64;
+      while ((size_t)wd >= newlen)
+         newlen *= 2;
+      char **tmp = realloc (fsw->wd_paths, newlen * sizeof *tmp);
+      if (!tmp)
+         return false;
+      memset (&tmp[fsw->wd_paths_len], 0, (newlen - fsw->wd_paths_len) * sizeof *tmp);
+      fsw->wd_paths = tmp;
+      fsw->wd_paths_len = newlen;
+   }
+
+   char *tmp = strdup (relpath);
+   if (!tmp)
+      return false;
+
+   free (fsw->wd_paths[wd]);
+   fsw->wd_paths[wd] = tmp;
+   return true;
+}
+
+static const char *wd_get (webc_fswatch_t *fsw, int wd)
+{
+   if (wd < 0 || (size_t)wd >= fsw->wd_paths_len)
+      return NULL;
+   return fsw->wd_paths[wd];
+}
+
+static void wd_clear (webc_fswatch_t *fsw, int wd)
+{
+   if (wd >= 0 && (size_t)wd < fsw->wd_paths_len) {
+      free (fsw->wd_paths[wd]);
+      fsw->wd_paths[wd] = NULL;
+   }
+}
+
+// Adds a watch to relpath and to every directory below it. With announce,
+// which is for directories that are new, each directory is invalidated
+// once it is watched: anything created in it before that raised no event,
+// so what was cached from it in the meantime cannot be trusted.
+static void watch_tree (webc_fswatch_t *fsw, const char *relpath,
+                        bool announce)
+{
+   char *fullpath = NULL;
+   DIR *dirp = NULL;
+   struct dirent *de;
+
+   if (!(webc_util_sprintf (&fullpath, NULL, "%s/%s", fsw->root, relpath))) {
+      mark_unreliable (fsw, "OOM error", relpath);
+      return;
+   }
+
+   int wd = inotify_add_watch (fsw->inotify_fd, fullpath, WATCH_MASK);
+   if (wd < 0) {
+      // The directory may already be gone, which is not an error.
+      if (errno != ENOENT && errno != ENOTDIR)
+         mark_unreliable (fsw, errno == ENOSPC ? "watch limit reached"
+                                          : strerror (errno), fullpath);
+      goto errorexit;
+   }
+
+   if (!(wd_set (fsw, wd, relpath))) {
+      mark_unreliable (fsw, "OOM error", relpath);
+      goto errorexit;
+   }
+
+   if (announce) {
+      atomic_fetch_add (&fsw->generation, 1);
+      notify (fsw, relpath, NULL);
+   }
+
+   if (!(dirp = opendir (fullpath))) {
+      // Its subdirectories, if it still has any, go unwatched.
+      if (errno != ENOENT && errno != ENOTDIR)
+         mark_unreliable (fsw, strerror (errno), fullpath);
+      goto errorexit;
+   }
+
+   while ((de = readdir (dirp))) {
+      if (de->d_name[0] == '.' &&
+            (de->d_name[1] == 0 || (de->d_name[1] == '.' && de->d_name[2] == 0)))
+         continue;
+
+      unsigned char type = de->d_type;
+      if (type == DT_UNKNOWN || type == DT_LNK) {
+         struct stat sb;
+         int flags = type == DT_LNK ? 0 : AT_SYMLINK_NOFOLLOW;
+         if ((fstatat (dirfd (dirp), de->d_name, &sb, flags))!=0)
+            continue;
+         if (!S_ISDIR (sb.st_mode))
+            continue;
+         if (type == DT_LNK) {
+            // inotify does not see changes made through the link target,
+            // so anything below a followed symlink may go stale.
+            if (FOLLOW_SYMLINKS)
+               mark_unreliable (fsw, "symlinked directory", de->d_name);
+            continue;
+         }
+         type = DT_DIR;
+      }
+
+      if (type != DT_DIR)
+         continue;
+
+      char *child = path_join (relpath, de->d_name);
+      if (!child) {
+         mark_unreliable (fsw, "OOM error", relpath);
+         break;
+      }
+      watch_tree (fsw, child, announce);
+      free (child);
+   }
+
+errorexit:
+   if (dirp)
+      closedir (dirp);
+   free (fullpath);
+}
+
+static void handle_event (webc_fswatch_t *fsw, const struct inotify_event *ev)
+{
+   if (ev->mask & IN_Q_OVERFLOW) {
+      // The lost events may include new directories, which are not
+      // watched, so nothing is trusted until the tree has been watched
+      // again. The walk only adds what is missing; existing watches keep
+      // their descriptors.
+      WEBC_UTIL_LOG ("Filesystem watcher queue overflowed, rewatching and "
+                     "invalidating all\n");
+      bool was_reliable = atomic_exchange (&fsw->reliable, false);
+      watch_tree (fsw, "", false);
+      atomic_fetch_add (&fsw->generation, 1);
+      notify (fsw, NULL, NULL);
+      if (was_reliable && !fsw->degraded)
+         atomic_store (&fsw->reliable, true);
+      return;
+   }
+
+   const char *dir = wd_get (fsw, ev->wd);
+   if (!dir)
+      return;
+
+   if (ev->mask & IN_IGNORED) {
+      wd_clear (fsw, ev->wd);
+      return;
+   }
+
+   if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+      notify (fsw, dir, NULL);
+      return;
+   }
+
+   const char *name = ev->len ? ev->name : NULL;
+
+   notify (fsw, dir, name);
+
+   if (name && (ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO))) {
+      char *child = path_join (dir, name);
+      if (!child) {
+         mark_unreliable (fsw, "OOM error", dir);
+         return;
+      }
+      watch_tree (fsw, child, true);
+      free (child);
+   }
+}
+
+static void *watcher_thread (void *arg)
+{
+   webc_fswatch_t *fsw = arg;
+   char *buf = fsw->buf;
+
+   struct pollfd pfds[2] = {
+      { fsw->inotify_fd, POLLIN, 0 },
+      { fsw->stop_fd,    POLLIN, 0 },
+   };
+
+   for (;;) {
+      int rc = poll (pfds, 2, -1);
+      if (rc < 0) {
+         if (errno == EINTR)
+            continue;
+         WEBC_UTIL_LOG ("poll() failed in filesystem watcher: %m\n");
+         break;
+      }
+
+      if (pfds[1].revents)
+         break;
+
+      ssize_t nbytes = read (fsw->inotify_fd, buf, sizeof fsw->buf);
+      if (nbytes <= 0) {
+         if (nbytes < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+         WEBC_UTIL_LOG ("read() failed in filesystem watcher: %m\n");
+         break;
+      }
+
+      // Bumped before the subscribers are told, so that an entry built
+      // while this batch is being delivered is never mistaken for fresh.
+      atomic_fetch_add (&fsw->generation, 1);
+
+      for (char *ptr = buf; ptr < buf + nbytes; ) {
+         const struct inotify_event *ev = (const struct inotify_event *)ptr;
+         handle_event (fsw, ev);
+         ptr += sizeof *ev + ev->len;
+      }
+   }
+
+   atomic_store (&fsw->reliable, false);
+   return NULL;
+}
+
+/* *************************************************************** */
+
+webc_fswatch_t *webc_fswatch_new (const char *root)
+{
+   webc_fswatch_t *fsw = calloc (1, sizeof *fsw);
+   if (!fsw || !(fsw->root = strdup (root))) {
+      WEBC_UTIL_LOG ("OOM error starting filesystem watcher\n");
+      free (fsw);
+      return NULL;
+   }
+
+   fsw->inotify_fd = fsw->stop_fd = -1;
+   pthread_mutex_init (&fsw->subscribers_lock, NULL);
+
+   if ((fsw->inotify_fd = inotify_init1 (IN_CLOEXEC)) < 0) {
+      WEBC_UTIL_LOG ("Failed to initialise inotify: %m\n");
+      goto errorexit;
+   }
+
+   if ((fsw->stop_fd = eventfd (0, EFD_CLOEXEC)) < 0) {
+      WEBC_UTIL_LOG ("Failed to create eventfd: %m\n");
+      goto errorexit;
+   }
+
+   atomic_store (&fsw->reliable, true);
+   watch_tree (fsw, "", false);
+
+   if ((pthread_create (&fsw->thread, NULL, watcher_thread, fsw))!=0) {
+      WEBC_UTIL_LOG ("Failed to start filesystem watcher thread\n");
+      goto errorexit;
+   }
+
+   fsw->running = true;
+
+   WEBC_UTIL_LOG ("Watching [%s] for changes (%s)\n", root,
+                  atomic_load (&fsw->reliable) ? "reliable" : "degraded");
+   return fsw;
+
+errorexit:
+   webc_fswatch_del (fsw);
+   return NULL;
+}
+
+void webc_fswatch_del (webc_fswatch_t *fsw)
+{
+   if (!fsw)
+      return;
+
+   if (fsw->running) {
+      uint64_t one = 1;
+      if ((write (fsw->stop_fd, &one, sizeof one)) == sizeof one)
+         pthread_join (fsw->thread, NULL);
+   }
+
+   if (fsw->inotify_fd >= 0)
+      close (fsw->inotify_fd);
+   if (fsw->stop_fd >= 0)
+      close (fsw->stop_fd);
+
+   for (size_t i=0; i<fsw->wd_paths_len; i++) {
+      free (fsw->wd_paths[i]);
+   }
+   free (fsw->wd_paths);
+
+   pthread_mutex_destroy (&fsw->subscribers_lock);
+   free (fsw->root);
+   free (fsw);
+}
+
+bool webc_fswatch_subscribe (webc_fswatch_t *fsw,
+                             webc_fswatch_cb_t *cb, void *udata)
+{
+   bool ret = false;
+
+   if (!fsw)
+      return false;
+
+   pthread_mutex_lock (&fsw->subscribers_lock);
+   if (cb && fsw->nsubscribers < MAX_SUBSCRIBERS) {
+      fsw->subscribers[fsw->nsubscribers].cb = cb;
+      fsw->subscribers[fsw->nsubscribers].udata = udata;
+      fsw->nsubscribers++;
+      ret = true;
+   }
+   pthread_mutex_unlock (&fsw->subscribers_lock);
+
+   return ret;
+}
+
+uint64_t webc_fswatch_generation (webc_fswatch_t *fsw)
+{
+   if (!fsw)
+      return 0;
+   return atomic_load (&fsw->generation);
+}
+
+bool webc_fswatch_reliable (webc_fswatch_t *fsw)
+{
+   if (!fsw)
+      return false;
+   return atomic_load_explicit (&fsw->reliable, memory_order_relaxed);
+}
+
@@ -1,80 +1,134 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <errno.h>
 #include <stdint.h>
 #include <inttypes.h>
 #include <string.h>
+#include <stdarg.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <limits.h>
 
-#include <sys/sendfile.h>
+#include <sys/syscall.h>
 
 #include "webc_handler.h"
 #include "webc_header.h"
+#include "webc_mime.h"
+#include "webc_dircache.h"
+#include "webc_fswatch.h"
+#include "webc_path.h"
+#include "webc_server.h"
+#include "webc_conn.h"
+#include "webc_bundle.h"
+#include "webc_embed.h"
 #include "webc_config.h"
 
-static int get_filesize (const char *fname, char *dst_sizestr,
-                                            uint64_t *dst_size64)
+// Size of the buffer that directory entries are read into, which is also
+// how much of a paginated listing is buffered before it is sent.
+#define DIRENT_BUFSIZE     (32 * 1024)
+
+// Opens resource beneath the web root and fstat()s it. Returns the fd, or
+// -1 with *status set to the HTTP status to send.
+static int open_resource (const char *addr, uint16_t port, const char *resource,
+                          int flags, struct stat *sb, int *status)
 {
-   struct stat sb;
+   int fd = webc_path_open (webc_server_path (webc_server_current ()),
+                            resource, flags);
+   if (fd < 0) {
+      WEBC_THRD_LOG (addr, port, "Failed to open [%s]: %m\n", resource);
+      *status = webc_path_errno_status (errno);
+      return -1;
+   }
 
-   if ((stat (fname, &sb))!=0) {
-      WEBC_UTIL_LOG ("Failed to stat [%s]: %m\n", fname);
-      if (errno == EACCES) {
-         return 403;
-      } else {
-         return 404;
-      }
+   if ((fstat (fd, sb))!=0) {
+      WEBC_THRD_LOG (addr, port, "Failed to stat [%s]: %m\n", resource);
+      close (fd);
+      *status = 500;
+      return -1;
+   }
+
+   return fd;
+}
+
+// Sends the file open on in_fd, which was fstat()ed into sb, as the
+// response.
+static int send_file (int fd, const char *addr, uint16_t port,
+                      const char *resource, int in_fd, const struct stat *sb,
+                      const char *content_type, webc_header_t *rsp_headers)
+{
+   char slen[25];
+
+   if (!(S_ISREG (sb->st_mode))) {
+      WEBC_THRD_LOG (addr, port, "Not a regular file [%s]\n", resource);
+      return 404;
    }
 
-   uint64_t st_size = sb.st_size;
+   sprintf (slen, "%" PRIu64, (uint64_t)sb->st_size);
 
-   if (dst_sizestr)
-      sprintf (dst_sizestr, "%" PRIu64, st_size);
+   webc_header_set (rsp_headers, webc_header_CONTENT_TYPE, content_type);
+   webc_header_set (rsp_headers, webc_header_CONTENT_LENGTH, slen);
+   if ((strcmp (content_type, WEBC_MIME_DEFAULT))==0)
+      webc_header_set (rsp_headers, webc_header_CONTENT_DISPOSITION, "attachment;");
 
-   if (dst_size64)
-      *dst_size64 = st_size;
+   const char *rsp = webc_get_http_rspstr (200);
+   webc_conn_write (fd, rsp, strlen (rsp));
+   webc_header_write (rsp_headers, fd);
+
+   if (!(webc_conn_sendfile (fd, in_fd, 0, sb->st_size))) {
+      WEBC_THRD_LOG (addr, port, "Did not transmit all of [%s]\n", resource);
+      return 500;
+   }
 
    return 200;
 }
 
-static int local_sendfile (int fd, const char *fname, uint64_t offset,
-                                                      uint64_t count)
+static int send_dirlist (int fd, char *remote_addr, uint16_t remote_port,
+                         const char *resource, webc_header_t *rsp_headers,
+                         char *vars, int dirfd);
+
+// Sends the index file in the directory open on dirfd if there is one,
+// and the listing otherwise.
+static int send_dir (int fd, char *remote_addr, uint16_t remote_port,
+                     const char *resource, webc_header_t *rsp_headers,
+                     char *vars, int dirfd)
 {
+   struct stat sb;
+   char *index_html = NULL;
    int ret = 500;
 
-   int in_fd = -1;
-   off_t offs = (off_t)offset;
-   size_t nbytes = count;
-   ssize_t rc = 0;
+   int dirlen = (int)strlen (resource);
+   while (dirlen && resource[dirlen - 1] == '/')
+      dirlen--;
 
-   if ((in_fd = open (fname, O_RDONLY, 0)) < 0) {
-      WEBC_UTIL_LOG ("Failed to open [%s]: %m\n", fname);
-      if (errno == EACCES)
-         ret = 403;
-      goto errorexit;
+   if (!(webc_util_sprintf (&index_html, NULL, "%.*s%s", dirlen, resource,
+                            DEFAULT_INDEX_FILE))) {
+      WEBC_THRD_LOG (remote_addr, remote_port, "Out of memory [%s]\n", resource);
+      return 500;
    }
 
-   // TODO: This must be done in a loop.
-   while ((rc = sendfile (fd, in_fd, &offs, nbytes)) != (ssize_t)nbytes) {
-      if (rc == -1) {
-         WEBC_UTIL_LOG ("Did not transmit all bytes\n");
-         goto errorexit;
-      }
-      nbytes -= rc;
+   WEBC_THRD_LOG_AT (WEBC_LOG_DEBUG, remote_addr, remote_port, "Trying [%s]\n",
+                     index_html);
+
+   // The parent is the directory just opened, so its fd is cached and only
+   // the index file itself is looked up.
+   int index_fd = webc_path_open (webc_server_path (webc_server_current ()),
+                                  index_html, O_RDONLY);
+   if (index_fd < 0 || (fstat (index_fd, &sb))!=0 || !(S_ISREG (sb.st_mode))) {
+      ret = send_dirlist (fd, remote_addr, remote_port, resource, rsp_headers,
+                          vars, dirfd);
+   } else {
+      ret = send_file (fd, remote_addr, remote_port, index_html, index_fd, &sb,
+                       "text/html", rsp_headers);
    }
 
-   ret = 200;
-
-errorexit:
-   if (in_fd >= 0)
-      close (in_fd);
-
+   if (index_fd >= 0)
+      close (index_fd);
+   free (index_html);
    return ret;
 }
 
@@ -97,25 +151,21 @@ int webc_handler_static_file (int                         fd,
    version = version;
    rqst_headers = rqst_headers;
 
-   char slen[25];
-   uint64_t st_size;
-   if ((statcode = get_filesize (resource, slen, &st_size))!=200) {
+   struct stat sb;
+   int in_fd = open_resource (remote_addr, remote_port, resource, O_RDONLY,
+                              &sb, &statcode);
+   if (in_fd < 0) {
       WEBC_THRD_LOG (remote_addr, remote_port, "Failed to access file [%s]\n",
                                           resource);
       return statcode;
    }
 
-   webc_header_set (rsp_headers, webc_header_CONTENT_TYPE, "application/octet-stream");
-   webc_header_set (rsp_headers, webc_header_CONTENT_LENGTH, slen);
-   webc_header_set (rsp_headers, webc_header_CONTENT_DISPOSITION, "attachment;");
-
-   write (fd, webc_get_http_rspstr (200), strlen (webc_get_http_rspstr (200)));
+   WEBC_UTIL_LOG_AT (WEBC_LOG_DEBUG, "Sending static file\n");
 
-   webc_header_write (rsp_headers, fd);
-
-   WEBC_UTIL_LOG ("Sending static file\n");
-
-   return local_sendfile (fd, resource, 0, st_size);
+   statcode = send_file (fd, remote_addr, remote_port, resource, in_fd, &sb,
+                         webc_mime_type (resource), rsp_headers);
+   close (in_fd);
+   return statcode;
 }
 
 int webc_handler_html (int                       fd,
@@ -130,30 +180,25 @@ int webc_handler_html (int                       fd,
 {
    (void) method;
    (void) version;
-   (void) resource;
    (void) rqst_headers;
-   (void) rsp_headers;
    (void) vars;
 
-   WEBC_UTIL_LOG ("Sending html page\n");
+   WEBC_UTIL_LOG_AT (WEBC_LOG_DEBUG, "Sending html page\n");
 
-   char slen[25];
-   uint64_t st_size;
+   struct stat sb;
    int statcode = 0;
-   if ((statcode = get_filesize (resource, slen, &st_size))!=200) {
+   int in_fd = open_resource (remote_addr, remote_port, resource, O_RDONLY,
+                              &sb, &statcode);
+   if (in_fd < 0) {
       WEBC_THRD_LOG (remote_addr, remote_port, "Failed to access file [%s]\n",
                                           resource);
       return statcode;
    }
 
-   webc_header_set (rsp_headers, webc_header_CONTENT_TYPE, "text/html");
-   webc_header_set (rsp_headers, webc_header_CONTENT_LENGTH, slen);
-
-   const char *rsp = webc_get_http_rspstr (200);
-   write (fd, rsp, strlen (rsp));
-   webc_header_write (rsp_headers, fd);
-
-   return local_sendfile (fd, resource, 0, st_size);
+   statcode = send_file (fd, remote_addr, remote_port, resource, in_fd, &sb,
+                         "text/html", rsp_headers);
+   close (in_fd);
+   return statcode;
 }
 
 int webc_handler_none (int                          fd,
@@ -166,32 +211,32 @@ int webc_handler_none (int                          fd,
                        webc_header_t               *rsp_headers,
                        char                        *vars)
 {
-   struct stat sb;
-   int (*statfunc) (const char *pathname, struct stat *statbuf);
+   (void) method;
+   (void) version;
+   (void) rqst_headers;
 
-   statfunc = FOLLOW_SYMLINKS ? lstat : stat;
+   struct stat sb;
+   int statcode = 500;
 
-   if ((statfunc (resource, &sb))!=0) {
-      WEBC_THRD_LOG (remote_addr, remote_port, "Failed to stat [%s]\n", resource);
-      return 404;
-   }
+   // One open() serves for both files and directories, and whether a
+   // symlink may be followed is decided by the kernel during the open.
+   int in_fd = open_resource (remote_addr, remote_port, resource, O_RDONLY,
+                              &sb, &statcode);
+   if (in_fd < 0)
+      return statcode;
 
    if (S_ISREG (sb.st_mode)) {
-      return webc_handler_static_file (fd, remote_addr, remote_port, method,
-                                       version, resource,
-                                       rqst_headers, rsp_headers,
-                                       vars);
+      statcode = send_file (fd, remote_addr, remote_port, resource, in_fd, &sb,
+                            webc_mime_type (resource), rsp_headers);
+   } else if (S_ISDIR (sb.st_mode)) {
+      statcode = send_dir (fd, remote_addr, remote_port, resource, rsp_headers,
+                           vars, in_fd);
+   } else {
+      statcode = 500;
    }
 
-   if (S_ISDIR (sb.st_mode)) {
-      return webc_handler_dir (fd, remote_addr, remote_port, method,
-                               version, resource,
-                               rqst_headers,
-                               rsp_headers,
-                               vars);
-   }
-
-   return 500;
+   close (in_fd);
+   return statcode;
 }
 
 int webc_handler_dir (int                         fd,
@@ -204,123 +249,532 @@ int webc_handler_dir (int                         fd,
                       webc_header_t              *rsp_headers,
                       char                       *vars)
 {
+   (void) method;
+   (void) version;
+   (void) rqst_headers;
 
    struct stat sb;
-   char *index_html = NULL;
-   size_t index_html_len = 0;
+   int statcode = 500;
+
+   int dirfd = open_resource (remote_addr, remote_port, resource,
+                              O_RDONLY | O_DIRECTORY, &sb, &statcode);
+   if (dirfd < 0)
+      return statcode;
+
+   statcode = send_dir (fd, remote_addr, remote_port, resource, rsp_headers,
+                        vars, dirfd);
+
+   close (dirfd);
+   return statcode;
+}
+
+/* ******************************************************************
+ * Directory enumeration. Entries are read in large batches straight from
+ * getdents64(), and d_type is used to tell directories apart so that the
+ * only per-entry system calls are fstatat() (relative to the directory fd)
+ * for filesystems that report DT_UNKNOWN, and for symlinks, which are
+ * listed as directories when they point at one.
+ */
+
+struct linux_dirent64_t {
+   uint64_t          d_ino;
+   int64_t           d_off;
+   unsigned short    d_reclen;
+   unsigned char     d_type;
+   char              d_name[];
+};
+
+// Called for each entry except "."; returning false stops the enumeration.
+typedef bool (dirent_cb_t) (const char *name, size_t name_len, bool is_dir,
+                            void *udata);
+
+static bool dirent_is_dir (int dirfd, const struct linux_dirent64_t *de)
+{
+   if (de->d_type == DT_DIR)
+      return true;
+
+   if (de->d_type != DT_UNKNOWN && de->d_type != DT_LNK)
+      return false;
+
+   struct stat sb;
+   return fstatat (dirfd, de->d_name, &sb, 0) == 0 && S_ISDIR (sb.st_mode);
+}
+
+static bool dir_enumerate (int dirfd, dirent_cb_t *cb, void *udata)
+{
+   char buf[DIRENT_BUFSIZE]
+      __attribute__ ((aligned (__alignof__ (struct linux_dirent64_t))));
+
+   for (;;) {
+      long nbytes = syscall (SYS_getdents64, dirfd, buf, sizeof buf);
+      if (nbytes < 0 && errno == EINTR)
+         continue;
+      if (nbytes < 0)
+         return false;
+      if (nbytes == 0)
+         return true;
+
+      for (long pos = 0; pos < nbytes; ) {
+         const struct linux_dirent64_t *de = (const void *)&buf[pos];
+         pos += de->d_reclen;
+
+         if (de->d_name[0] == '.' && de->d_name[1] == 0)
+            continue;
 
-   if (resource[0] == 0) {
-      resource = ".";
+         if (!(cb (de->d_name, strlen (de->d_name), dirent_is_dir (dirfd, de),
+                   udata)))
+            return true;
+      }
    }
+}
 
-   if ((stat (resource, &sb))!=0) {
-      WEBC_THRD_LOG (remote_addr, remote_port,
-                  "In dir [%s] Failed to stat [%s]: %m\n", getenv ("PWD"), resource);
-      return 404;
+/* All the names in a directory, in one contiguous buffer. Directories have
+ * a '/' appended. The index is only built once enumeration is complete,
+ * as the buffer may move while it grows.
+ */
+struct dirlist_t {
+   char     *names;
+   size_t    names_len;
+   size_t    names_cap;
+   size_t    nentries;
+   char    **index;
+   bool      error;
+};
+
+static bool cb_dirlist_add (const char *name, size_t name_len, bool is_dir,
+                            void *udata)
+{
+   struct dirlist_t *dl = udata;
+   size_t needed = name_len + (is_dir ? 1 : 0) + 1;
+
+   if (dl->names_len + needed > dl->names_cap) {
+      size_t newcap = dl->names_cap ? dl->names_cap : 16 * 1024;
+      while (dl->names_len + needed > newcap)
+         newcap *= 2;
+      char *tmp = realloc (dl->names, newcap);
+      if (!tmp) {
+         dl->error = true;
+         return false;
+      }
+      dl->names = tmp;
+      dl->names_cap = newcap;
    }
 
-   if (!(S_ISDIR (sb.st_mode))) {
-      WEBC_THRD_LOG (remote_addr, remote_port, "Not a directory [%s]\n", resource);
-      return 500;
+   char *dst = &dl->names[dl->names_len];
+   memcpy (dst, name, name_len);
+   if (is_dir)
+      dst[name_len++] = '/';
+   dst[name_len] = 0;
+
+   dl->names_len += needed;
+   dl->nentries++;
+   return true;
+}
+
+static void dirlist_free (struct dirlist_t *dl)
+{
+   free (dl->names);
+   free (dl->index);
+}
+
+static bool get_dirlist (const char *addr, uint16_t port, int dirfd,
+                         const char *path, struct dirlist_t *dl)
+{
+   memset (dl, 0, sizeof *dl);
+
+   bool rc = dir_enumerate (dirfd, cb_dirlist_add, dl);
+
+   if (!rc || dl->error) {
+      WEBC_THRD_LOG (addr, port, "Unable to read directory [%s]\n", path);
+      dirlist_free (dl);
+      return false;
    }
 
-   index_html_len = strlen (resource) + 1 + strlen (DEFAULT_INDEX_FILE) + 1;
-   if (!(index_html = malloc (index_html_len))) {
-      WEBC_THRD_LOG (remote_addr, remote_port, "Out of memory [%s]\n", resource);
-      return 500;
+   if (!(dl->index = malloc ((dl->nentries + 1) * sizeof *dl->index))) {
+      WEBC_THRD_LOG (addr, port, "OOM error listing [%s]\n", path);
+      dirlist_free (dl);
+      return false;
+   }
+
+   char *name = dl->names;
+   for (size_t i=0; i<dl->nentries; i++) {
+      dl->index[i] = name;
+      name += strlen (name) + 1;
+   }
+   dl->index[dl->nentries] = NULL;
+
+   return true;
+}
+
+static int cb_strsort (const void *lhs, const void *rhs)
+{
+   const char * const *slhs = lhs,
+              * const *srhs = rhs;
+   return strcmp (*slhs, *srhs);
+}
+
+/* A growable buffer that listings are rendered into, so that they can be
+ * sent with a Content-Length and cached.
+ */
+struct html_buf_t {
+   char     *buf;
+   size_t    len;
+   size_t    cap;
+   bool      error;
+};
+
+static void html_buf_printf (struct html_buf_t *hb, const char *fmts, ...)
+{
+   va_list ap;
+
+   if (hb->error)
+      return;
+
+   va_start (ap, fmts);
+   int nbytes = vsnprintf (NULL, 0, fmts, ap);
+   va_end (ap);
+
+   if (nbytes < 0) {
+      hb->error = true;
+      return;
    }
 
-   strcpy (index_html, resource);
-   strcat (index_html, DEFAULT_INDEX_FILE);
+   if (hb->len + nbytes + 1 > hb->cap) {
+      size_t newcap = hb->cap ? hb->cap : 4096;
+      while (hb->len + nbytes + 1 > newcap)
+         newcap *= 2;
+      char *tmp = realloc (hb->buf, newcap);
+      if (!tmp) {
+         hb->error = true;
+         return;
+      }
+      hb->buf = tmp;
+      hb->cap = newcap;
+   }
 
-   WEBC_THRD_LOG (remote_addr, remote_port, "Trying [%s]\n", index_html);
+   va_start (ap, fmts);
+   vsnprintf (&hb->buf[hb->len], nbytes + 1, fmts, ap);
+   va_end (ap);
 
-   if ((stat (index_html, &sb))!=0) {
-      int ret = webc_handler_dirlist (fd, remote_addr, remote_port, method, version,
-                                      resource,
-                                      rqst_headers,
-                                      rsp_headers,
-                                      vars);
-      free (index_html);
-      return ret;
+   hb->len += nbytes;
+}
+
+static const char *dirlist_header =
+   "<html>"
+   "  <body>"
+   " <p style='font-size:large'>Directory index for <b><em>%s</b></em></p>"
+   "  <hr>"
+   "  <table>";
+
+static const char *dirlist_footer =
+   "  <hr>"
+   "  <p><em>Powered by " APPLICATION_ID "/" VERSION_STRING "</em>"
+   "  </body>"
+   "</html>";
+
+// dir is the resource being listed, without any trailing '/'.
+static void render_row (struct html_buf_t *hb, const char *dir, const char *name)
+{
+   if ((memcmp (name, "../", 4))!=0) {
+      html_buf_printf (hb, "<tr><td>"
+                           "<a href='/%s/%s'>%s</a>"
+                           "</td></tr>\n",
+                           dir, name, name);
+      return;
    }
 
-   int ret =  webc_handler_html (fd, remote_addr, remote_port, method, version,
-                                 index_html,
-                                 rqst_headers,
-                                 rsp_headers,
-                                 vars);
+   char *parent = malloc (strlen (dir) + 2);
+   if (!parent) {
+      hb->error = true;
+      return;
+   }
+   strcpy (parent, dir);
+   char *term = strrchr (parent, '/');
+   if (term)
+      *term = 0;
+   else
+      *parent = 0;
+
+   if (!*parent) {
+      parent[0] = '/';
+      parent[1] = 0;
+   }
 
-   free (index_html);
+   const char *fmts = "<tr><td><a href='%s'>%s</a></td></tr>\n";
+   if (!(strchr (parent, '/')))
+      fmts = "<tr><td><a href='/%s/'>%s</a></td></tr>\n";
 
-   return ret;
+   html_buf_printf (hb, fmts, parent, name);
+   free (parent);
 }
 
-char **get_dirlist (const char *addr, uint16_t port, const char *path)
+static char *render_dirlist (const char *remote_addr, uint16_t remote_port,
+                             int dirfd, const char *resource, size_t *html_len)
 {
-   DIR *dirp = NULL;
-   struct dirent *de = NULL;
-   size_t nrecs = 0;
+   struct html_buf_t hb = { NULL, 0, 0, false };
+   struct dirlist_t dl;
 
-   if (!(dirp = opendir (path))) {
-      WEBC_THRD_LOG (addr, port, "Unable to opendir [%s]\n", path);
+   if (!(get_dirlist (remote_addr, remote_port, dirfd, resource, &dl)))
+      return NULL;
+
+   char *dir = strdup (resource);
+   if (!dir) {
+      WEBC_THRD_LOG (remote_addr, remote_port, "OOM error [%s]\n", resource);
+      dirlist_free (&dl);
       return NULL;
    }
 
-   while ((de = readdir (dirp)))
-      nrecs++;
+   size_t dirlen = strlen (dir);
+   if (dirlen && dir[dirlen-1] == '/')
+      dir[dirlen-1] = 0;
+
+   qsort (dl.index, dl.nentries, sizeof dl.index[0], cb_strsort);
+
+   html_buf_printf (&hb, dirlist_header, resource);
+   for (size_t i=0; i<dl.nentries && !hb.error; i++) {
+      render_row (&hb, dir, dl.index[i]);
+   }
+   html_buf_printf (&hb, "  </table>%s\n", dirlist_footer);
 
-   rewinddir (dirp);
+   free (dir);
+   dirlist_free (&dl);
 
-   char **ret = calloc (nrecs + 1, sizeof *ret);
-   if (!ret) {
-      closedir (dirp);
+   if (hb.error) {
+      WEBC_THRD_LOG (remote_addr, remote_port, "OOM error rendering [%s]\n", resource);
+      free (hb.buf);
       return NULL;
    }
 
-   size_t idx = 0;
-   while ((de = readdir (dirp))) {
-      if ((memcmp (de->d_name, ".", 2))==0)
-         continue;
+   *html_len = hb.len;
+   return hb.buf;
+}
 
-      if (!(ret[idx] = malloc (strlen (de->d_name) + 2))) {
-         for (size_t i=0; ret[i]; i++)
-            free (ret[i]);
-         free (ret);
-         closedir (dirp);
-         return NULL;
-      }
+/* ******************************************************************
+ * Paginated listings, selected with "?offset=N&limit=M". Rows are streamed
+ * to the client in directory order as they are read, so memory use does
+ * not depend on the size of the directory. Pages are not cached.
+ */
+
+struct dirlist_page_t {
+   int                  fd;
+   const char          *dir;
+   struct html_buf_t    hb;
+   size_t               offset;
+   size_t               limit;
+   size_t               seen;
+   bool                 more;
+   bool                 error;
+};
+
+static bool cb_dirlist_page (const char *name, size_t name_len, bool is_dir,
+                             void *udata)
+{
+   struct dirlist_page_t *page = udata;
+   char entry[NAME_MAX + 2];
 
-      struct stat sb;
-      char *tmp = malloc (strlen (path) + '/' + strlen (de->d_name) + 1);
-      if (!tmp) {
-         free (ret);
-         closedir (dirp);
-         return NULL;
+   if (page->seen++ < page->offset)
+      return true;
+
+   // seen is past offset here, so this cannot wrap as offset + limit can.
+   if (page->seen - page->offset > page->limit) {
+      page->more = true;
+      return false;
+   }
+
+   memcpy (entry, name, name_len);
+   if (is_dir)
+      entry[name_len++] = '/';
+   entry[name_len] = 0;
+
+   render_row (&page->hb, page->dir, entry);
+
+   if (page->hb.error) {
+      page->error = true;
+      return false;
+   }
+
+   if (page->hb.len >= DIRENT_BUFSIZE) {
+      if (!(webc_conn_write (page->fd, page->hb.buf, page->hb.len))) {
+         page->error = true;
+         return false;
       }
-      strcpy (tmp, path);
-      strcat (tmp, "/");
-      strcat (tmp, de->d_name);
-      memset (&sb, 0, sizeof sb);
-      stat (tmp, &sb);
-      free (tmp);
-
-      strcpy (ret[idx], de->d_name);
-      if (S_ISDIR (sb.st_mode)) {
-         strcat (ret[idx], "/");
+      page->hb.len = 0;
+   }
+
+   return true;
+}
+
+// Reads "name=<number>" from a query string. Returns false if name is not
+// present.
+static bool vars_get_size (const char *vars, const char *name, size_t *dst)
+{
+   size_t name_len = strlen (name);
+
+   for (const char *ptr = vars; ptr && *ptr; ptr = strchr (ptr, '&')) {
+      if (*ptr == '&')
+         ptr++;
+      if ((strncmp (ptr, name, name_len))==0 && ptr[name_len] == '=') {
+         char *end = NULL;
+         unsigned long long value = strtoull (&ptr[name_len + 1], &end, 10);
+         if (end == &ptr[name_len + 1])
+            return false;
+         *dst = (size_t)value;
+         return true;
       }
-      idx++;
    }
+   return false;
+}
+
+static int send_dirlist_page (int fd, char *remote_addr, uint16_t remote_port,
+                              int dirfd, const char *resource,
+                              webc_header_t *rsp_headers,
+                              size_t offset, size_t limit)
+{
+   struct dirlist_page_t page;
+   int ret = 500;
+
+   // So that the offset of the next page does not wrap.
+   if (limit > SIZE_MAX - offset)
+      limit = SIZE_MAX - offset;
+
+   memset (&page, 0, sizeof page);
+   page.fd = fd;
+   page.offset = offset;
+   page.limit = limit;
+
+   char *dir = strdup (resource);
+   if (!dir) {
+      WEBC_THRD_LOG (remote_addr, remote_port, "OOM error [%s]\n", resource);
+      goto errorexit;
+   }
+   size_t dirlen = strlen (dir);
+   if (dirlen && dir[dirlen-1] == '/')
+      dir[dirlen-1] = 0;
+   page.dir = dir;
 
-   closedir (dirp);
+   // Once the status line is out errors can only be logged; the client
+   // sees a truncated page.
+   webc_header_set (rsp_headers, webc_header_CONTENT_TYPE, "text/html");
+
+   const char *rsp = webc_get_http_rspstr (200);
+   webc_conn_write (fd, rsp, strlen (rsp));
+   webc_header_write (rsp_headers, fd);
+   ret = 200;
+
+   html_buf_printf (&page.hb, dirlist_header, resource);
+
+   if (!(dir_enumerate (dirfd, cb_dirlist_page, &page)) || page.error) {
+      WEBC_THRD_LOG (remote_addr, remote_port, "Failed to list [%s]\n", resource);
+      goto errorexit;
+   }
+
+   html_buf_printf (&page.hb, "  </table>");
+   if (page.more && limit) {
+      html_buf_printf (&page.hb, "  <p><a href='/%s/?offset=%zu&limit=%zu'>"
+                                 "Next page</a></p>",
+                                 dir, offset + limit, limit);
+   }
+   html_buf_printf (&page.hb, "%s\n", dirlist_footer);
+
+   if (page.hb.error ||
+       !(webc_conn_write (fd, page.hb.buf, page.hb.len))) {
+      WEBC_THRD_LOG (remote_addr, remote_port, "Failed to send listing [%s]\n",
+                     resource);
+   }
+
+errorexit:
+   free (page.hb.buf);
+   free (dir);
    return ret;
 }
 
-static int cb_strsort (const void *lhs, const void *rhs)
+// Sends the listing for resource. dirfd may be -1, in which case the
+// directory is only opened if the listing is not cached.
+static int send_dirlist (int fd, char *remote_addr, uint16_t remote_port,
+                         const char *resource, webc_header_t *rsp_headers,
+                         char *vars, int dirfd)
 {
-   const char * const *slhs = lhs,
-              * const *srhs = rhs;
-   return strcmp (*slhs, *srhs);
+   struct stat sb;
+   webc_dircache_entry_t *entry = NULL;
+   char *html = NULL;
+   size_t html_len = 0;
+   const char *body = NULL;
+   char slen[25];
+   uint64_t generation = 0;
+   int own_fd = -1;
+   int ret = 500;
+
+   webc_server_t *server = webc_server_current ();
+   webc_dircache_t *dircache = webc_server_dircache (server);
+
+   size_t offset = 0, limit = DIRLIST_PAGE_SIZE;
+   bool has_offset = vars_get_size (vars, "offset", &offset);
+   bool has_limit = vars_get_size (vars, "limit", &limit);
+   bool paginate = has_offset || has_limit;
+
+   if (!paginate && (entry = webc_dircache_find (dircache, resource, NULL)))
+      goto send;
+
+   generation = webc_fswatch_generation (webc_server_fswatch (server));
+
+   if (dirfd < 0) {
+      if ((dirfd = own_fd = webc_path_open (webc_server_path (server), resource,
+                                            O_RDONLY | O_DIRECTORY)) < 0) {
+         WEBC_THRD_LOG (remote_addr, remote_port, "Unable to open directory [%s]: %m\n",
+                        resource);
+         return webc_path_errno_status (errno);
+      }
+   }
+
+   if (paginate) {
+      if (!limit)
+         limit = DIRLIST_PAGE_SIZE;
+      ret = send_dirlist_page (fd, remote_addr, remote_port, dirfd, resource,
+                               rsp_headers, offset, limit);
+      goto errorexit;
+   }
+
+   if ((fstat (dirfd, &sb))!=0) {
+      WEBC_THRD_LOG (remote_addr, remote_port, "Failed to stat [%s]: %m\n",
+                     resource);
+      goto errorexit;
+   }
+
+   if (!(entry = webc_dircache_find (dircache, resource, &sb))) {
+      if (!(html = render_dirlist (remote_addr, remote_port, dirfd, resource,
+                                   &html_len)))
+         goto errorexit;
+
+      // If the listing could not be cached we still own it, and send it
+      // directly.
+      if ((entry = webc_dircache_insert (dircache, resource, &sb, generation,
+                                         html, html_len)))
+         html = NULL;
+   }
+
+send:
+   body = entry ? webc_dircache_html (entry, &html_len) : html;
+
+   snprintf (slen, sizeof slen, "%zu", html_len);
+   webc_header_set (rsp_headers, webc_header_CONTENT_TYPE, "text/html");
+   webc_header_set (rsp_headers, webc_header_CONTENT_LENGTH, slen);
+
+   const char *rsp = webc_get_http_rspstr (200);
+   webc_conn_write (fd, rsp, strlen (rsp));
+   webc_header_write (rsp_headers, fd);
+
+   if (!(webc_conn_write (fd, body, html_len)))
+      WEBC_THRD_LOG (remote_addr, remote_port, "Failed to send listing [%s]\n", resource);
+
+   ret = 200;
+
+errorexit:
+   webc_dircache_release (entry);
+   free (html);
+   if (own_fd >= 0)
+      close (own_fd);
+
+   return ret;
 }
 
 int webc_handler_dirlist (int                       fd,
@@ -336,107 +790,204 @@ int webc_handler_dirlist (int                       fd,
    (void) method;
    (void) version;
    (void) rqst_headers;
-   (void) rsp_headers;
-   (void) vars;
 
-   static const char *header =
-      "<html>"
-      "  <body>"
-      " <p style='font-size:large'>Directory index for <b><em>%s</b></em></p>"
-      "  <hr>"
-      "  <table>";
+   return send_dirlist (fd, remote_addr, remote_port, resource, rsp_headers,
+                        vars, -1);
+}
 
-   static const char *footer =
-      "  </table>"
-      "  <hr>"
-      "  <p><em>Powered by " APPLICATION_ID "/" VERSION_STRING "</em>"
-      "  </body>"
-      "</html>";
+/* ******************************************************************
+ * Serving from a site bundle (webc_bundle.h). Everything needed for the
+ * response is in the mapped bundle, so a hit costs no system calls beyond
+ * the writes; a miss falls through to the filesystem.
+ */
 
-   char *row = NULL;
-   size_t rowlen = 0;
+// The path that resource is packed under: directories are served by their
+// index file. Returns the length of the path, or 0 if it does not fit.
+static size_t packed_path (const char *resource, char *path, size_t path_size)
+{
+   size_t path_len = strlen (resource);
 
-   char **dirlist = get_dirlist (remote_addr, remote_port, resource);
-   char *tmp_resource = strdup (resource);
+   if (path_len == 0 || resource[path_len - 1] == '/') {
+      int rc = snprintf (path, path_size, "%s%s", resource,
+                         &DEFAULT_INDEX_FILE[1]);
+      return rc > 0 && (size_t)rc < path_size ? (size_t)rc : 0;
+   }
 
-   const char *rsp = webc_get_http_rspstr (200);
-   write (fd, rsp, strlen (rsp));
+   if (path_len >= path_size)
+      return 0;
 
-   write (fd, "Content-type: text/html\r\n\r\n", 27);
+   memcpy (path, resource, path_len + 1);
+   return path_len;
+}
 
-   if (!dirlist || !tmp_resource) {
-      dprintf (fd, "Unrecoverable error\n");
-      return 500;
+// True if the Accept-Encoding value lists gzip with a non-zero q-value.
+static bool accepts_gzip (const char *accept_encoding)
+{
+   const char *ptr = accept_encoding;
+
+   while (ptr && *ptr) {
+      ptr += strspn (ptr, " \t,");
+      size_t len = strcspn (ptr, ",");
+      size_t name_len = strcspn (ptr, " \t;,");
+
+      if (name_len == 4 && (strnicmp (ptr, "gzip", 4))==0) {
+         const char *q = memchr (ptr, ';', len);
+         if (!q)
+            return true;
+         q += strspn (q, "; \t");
+         if ((strnicmp (q, "q=", 2))!=0)
+            return true;
+         return strtod (&q[2], NULL) > 0;
+      }
+
+      ptr += len;
    }
 
-   size_t nrecs = 0;
-   for (size_t i=0; dirlist[i]; i++)
-      nrecs++;
-
-   qsort (dirlist, nrecs, sizeof dirlist[0], cb_strsort);
-
-   dprintf (fd, header, resource);
-
-   size_t reslen = strlen (tmp_resource);
-
-   if (tmp_resource[reslen-1] == '/')
-      tmp_resource[reslen-1] = 0;
-
-   for (size_t i=0; dirlist[i]; i++) {
-      bool rc;
-      if ((memcmp (dirlist[i], "..", 3))==0) {
-         char *parent = strdup (tmp_resource);
-         if (!parent) {
-            WEBC_THRD_LOG (remote_addr, remote_port, "OOM error [%s]\n", dirlist[i]);
-            free (tmp_resource);
-            return 500;
-         }
-         char *term = strrchr (parent, '/');
-         if (term)
-            *term = 0;
-         else
-            *parent = 0;
-
-         if (!*parent) {
-            parent[0] = '/';
-            parent[1] = 0;
-         }
-
-         const char *fmts = "<tr><td><a href='%s'>%s</a></td></tr>\n";
-         if (!(strchr (parent, '/')))
-            fmts = "<tr><td><a href='/%s/'>%s</a></td></tr>\n";
-
-         rc = webc_util_sprintf (&row, &rowlen, fmts,
-                                 parent,
-                                 dirlist[i]);
-         free (parent);
-      } else {
-         rc = webc_util_sprintf (&row, &rowlen, "<tr><td>"
-                                 "<a href='/%s/%s'>%s</a>"
-                                 "</td></tr>\n",
-                                 tmp_resource,
-                                 dirlist[i],
-                                 dirlist[i]);
-      }
+   return false;
+}
 
-      dprintf (fd, "%s", row); // Will get printed twice in case of error.
-      free (row);
-      row = NULL;
-      if (!rc) {
-         WEBC_THRD_LOG (remote_addr, remote_port, "OOM error [%s]\n", dirlist[i]);
-         free (tmp_resource);
-         return 500;
-      }
+// True if the If-None-Match value lists etag, or is "*".
+static bool etag_matches (const char *if_none_match, const char *etag)
+{
+   size_t etag_len = strlen (etag);
+   const char *ptr = if_none_match;
+
+   while (ptr && *ptr) {
+      ptr += strspn (ptr, " \t,");
+      if ((strncmp (ptr, "W/", 2))==0)
+         ptr += 2;
+      size_t len = strcspn (ptr, " \t,");
+      if ((len == 1 && ptr[0] == '*') ||
+          (len == etag_len && (memcmp (ptr, etag, len))==0))
+         return true;
+      ptr += len;
+   }
+
+   return false;
+}
+
+int webc_handler_bundle (int                       fd,
+                         char                     *remote_addr,
+                         uint16_t                  remote_port,
+                         enum webc_method_t        method,
+                         enum webc_http_version_t  version,
+                         const char               *resource,
+                         char                    **rqst_headers,
+                         webc_header_t            *rsp_headers,
+                         char                     *vars)
+{
+   char path[PATH_MAX];
+   size_t path_len = packed_path (resource, path, sizeof path);
+
+   const struct webc_bundle_entry_t *entry =
+      path_len ? webc_bundle_find (path, path_len) : NULL;
+
+   if (!entry) {
+      return webc_handler_none (fd, remote_addr, remote_port, method, version,
+                                resource, rqst_headers, rsp_headers, vars);
+   }
+
+   const struct webc_bundle_variant_t *var = &entry->plain;
+   if (entry->has_gzip &&
+       accepts_gzip (headerlist_find (rqst_headers, webc_header_ACCEPT_ENCODING)))
+      var = &entry->gzip;
+
+   int status = 200;
+   if (etag_matches (headerlist_find (rqst_headers, webc_header_IF_NONE_MATCH),
+                     var->etag))
+      status = 304;
+
+   const char *rsp = webc_get_http_rspstr (status);
+   if (!(webc_conn_write (fd, rsp, strlen (rsp))) ||
+       !(webc_conn_write (fd, webc_bundle_data (var->headers_offset),
+                          var->headers_len)) ||
+       !(webc_header_write (rsp_headers, fd))) {
+      WEBC_THRD_LOG (remote_addr, remote_port, "Failed to send [%s]\n", path);
+      return status;
    }
-   dprintf (fd, "%s\n", footer);
 
-   free (tmp_resource);
+   if (status == 304)
+      return status;
 
-   for (size_t i=0; dirlist[i]; i++) {
-      free (dirlist[i]);
+   if (!(webc_conn_sendfile (fd, webc_bundle_fd (), var->body_offset,
+                             var->body_len))) {
+      WEBC_THRD_LOG (remote_addr, remote_port, "Did not transmit all of [%s]\n",
+                     path);
+      return 500;
    }
-   free (dirlist);
 
    return 200;
 }
 
+/* *************************************************************** *
+ * Serving the assets compiled into the server (webc_embed.h). The head
+ * and body of every file are in read-only memory, so a hit is a single
+ * writev() and does not touch the filesystem at all.
+ */
+
+// Enough for the status line, the embedded header lines, the body and the
+// fields a handler chain is likely to have added to rsp_headers.
+#define EMBED_IOV_MAX      (32)
+
+int webc_handler_embedded (int                       fd,
+                           char                     *remote_addr,
+                           uint16_t                  remote_port,
+                           enum webc_method_t        method,
+                           enum webc_http_version_t  version,
+                           const char               *resource,
+                           char                    **rqst_headers,
+                           webc_header_t            *rsp_headers,
+                           char                     *vars)
+{
+   char path[PATH_MAX];
+   size_t path_len = packed_path (resource, path, sizeof path);
+
+   const struct webc_embed_entry_t *entry =
+      path_len ? webc_embed_find (path, path_len) : NULL;
+
+   if (!entry) {
+      return webc_handler_bundle (fd, remote_addr, remote_port, method,
+                                  version, resource, rqst_headers,
+                                  rsp_headers, vars);
+   }
+
+   int status = 200;
+   if (etag_matches (headerlist_find (rqst_headers, webc_header_IF_NONE_MATCH),
+                     entry->etag))
+      status = 304;
+
+   const char *rsp = webc_get_http_rspstr (status);
+   struct iovec iov[EMBED_IOV_MAX];
+   int iovcnt = 0;
+
+   iov[iovcnt].iov_base = (char *)rsp;
+   iov[iovcnt++].iov_len = strlen (rsp);
+   iov[iovcnt].iov_base = (char *)entry->head;
+   iov[iovcnt++].iov_len = entry->head_len;
+
+   size_t nfields = webc_header_iov (rsp_headers, &iov[iovcnt],
+                                     EMBED_IOV_MAX - iovcnt - 1);
+   if (nfields == 0) {
+      // Too many fields to send in one go.
+      if (!(webc_conn_writev (fd, iov, iovcnt)) ||
+          !(webc_header_write (rsp_headers, fd))) {
+         WEBC_THRD_LOG (remote_addr, remote_port, "Failed to send [%s]\n", path);
+         return status;
+      }
+      iovcnt = 0;
+   } else {
+      iovcnt += nfields;
+   }
+
+   if (status == 200) {
+      iov[iovcnt].iov_base = (void *)entry->body;
+      iov[iovcnt++].iov_len = entry->body_len;
+   }
+
+   if (!(webc_conn_writev (fd, iov, iovcnt))) {
+      WEBC_THRD_LOG (remote_addr, remote_port, "Failed to send [%s]\n", path);
+      return status == 200 ? 500 : status;
+   }
+
+   return status;
+}
@@ -28,6 +28,15 @@ extern "C" {
    WEBC_HANDLER (webc_handler_dir);
    WEBC_HANDLER (webc_handler_dirlist);
 
+   // Serves from the site bundle opened with webc_bundle_open(), and from
+   // the filesystem (as webc_handler_none) for anything not in it. Can be
+   // registered in place of any of the handlers above.
+   WEBC_HANDLER (webc_handler_bundle);
+
+   // Serves the assets compiled into the server (webc_embed.h), and falls
+   // through to webc_handler_bundle for anything not among them.
+   WEBC_HANDLER (webc_handler_embedded);
+
 #undef WEBC_HANDLER
 
 #ifdef __cplusplus
@@ -4,9 +4,11 @@
 #include <string.h>
 
 #include <unistd.h>
+#include <sys/uio.h>
 
 #include "webc_header.h"
 #include "webc_util.h"
+#include "webc_conn.h"
 
 struct webc_header_t {
    char **fields;
@@ -87,6 +89,7 @@ static const char *find_namestring (enum webc_header_name_t name)
 { webc_header_REFRESH,                          "Refresh"                          },
 { webc_header_STATUS,                           "Status"                           },
 { webc_header_TIMING_ALLOW_ORIGIN,              "Timing-Allow-Origin"              },
+{ webc_header_SERVER_TIMING,                    "Server-Timing"                    },
 { webc_header_X_CONTENT_DURATION,               "X-Content-Duration"               },
 { webc_header_X_CONTENT_TYPE_OPTIONS,           "X-Content-Type-Options"           },
 { webc_header_X_POWERED_BY,                     "X-Powered-By"                     },
@@ -94,6 +97,10 @@ static const char *find_namestring (enum webc_header_name_t name)
 { webc_header_X_CORRELATION_ID,                 "X-Correlation-ID"                 },
 { webc_header_X_UA_COMPATIBLE,                  "X-UA-Compatible"                  },
 { webc_header_X_XSS_PROTECTION,                 "X-XSS-Protection"                 },
+
+{ webc_header_ACCEPT_ENCODING,                  "Accept-Encoding"                  },
+{ webc_header_IF_NONE_MATCH,                    "If-None-Match"                    },
+{ webc_header_AUTHORIZATION,                    "Authorization"                    },
    };
 
    for (size_t i=0; i<sizeof names/sizeof names[0]; i++) {
@@ -191,20 +198,43 @@ bool webc_header_write (webc_header_t *header, int fd)
    if (!header || fd < 0)
       return false;
 
-   for (size_t i=0; header->fields[i]; i++) {
-      size_t slen = strlen (header->fields[i]);
-      size_t nbytes = write (fd, header->fields[i], slen);
-      if (nbytes!=slen)
+   for (size_t i=0; header->fields && header->fields[i]; i++) {
+      if (!(webc_conn_write (fd, header->fields[i], strlen (header->fields[i]))))
          return false;
    }
 
-   if ((write (fd, "\r\n", 2))!=2)
+   if (!(webc_conn_write (fd, "\r\n", 2)))
       return false;
 
    return true;
 }
 
 
+size_t webc_header_iov (webc_header_t *header, struct iovec *iov, size_t max)
+{
+   static char crlf[] = "\r\n";
+   size_t n = 0;
+
+   if (!header)
+      return 0;
+
+   for (size_t i=0; header->fields && header->fields[i]; i++) {
+      if (n >= max)
+         return 0;
+      iov[n].iov_base = header->fields[i];
+      iov[n].iov_len = strlen (header->fields[i]);
+      n++;
+   }
+
+   if (n >= max)
+      return 0;
+   iov[n].iov_base = crlf;
+   iov[n].iov_len = 2;
+
+   return n + 1;
+}
+
+
 const char *headerlist_find (char **headers, enum webc_header_name_t name)
 {
    const char *str_name = find_namestring (name);
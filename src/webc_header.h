@@ -3,6 +3,9 @@
 #define H_HEADER
 
 #include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/uio.h>
 
 
 typedef struct webc_header_t webc_header_t;
@@ -60,6 +63,7 @@ enum webc_header_name_t {
   webc_header_REFRESH,
   webc_header_STATUS,
   webc_header_TIMING_ALLOW_ORIGIN,
+  webc_header_SERVER_TIMING,
   webc_header_X_CONTENT_DURATION,
   webc_header_X_CONTENT_TYPE_OPTIONS,
   webc_header_X_POWERED_BY,
@@ -67,6 +71,11 @@ enum webc_header_name_t {
   webc_header_X_CORRELATION_ID,
   webc_header_X_UA_COMPATIBLE,
   webc_header_X_XSS_PROTECTION,
+
+  // Request headers
+  webc_header_ACCEPT_ENCODING,
+  webc_header_IF_NONE_MATCH,
+  webc_header_AUTHORIZATION,
 };
 
 #ifdef __cplusplus
@@ -82,6 +91,11 @@ extern "C" {
 
    bool webc_header_write (webc_header_t *header, int fd);
 
+   // Point up to max entries of iov at the fields of header, followed by
+   // the blank line that ends the header, for webc_conn_writev(). Returns
+   // the number of entries used, or 0 if max is too small.
+   size_t webc_header_iov (webc_header_t *header, struct iovec *iov, size_t max);
+
    const char *headerlist_find (char **headers, enum webc_header_name_t name);
 
 
@@ -0,0 +1,870 @@
+/* ***************************************************************************
+ * An HTTP load generator, for driving the server on localhost:
+ *
+ *    webc_loadgen-main [--host=<addr>] [--port=<n>] [--connections=<n>]
+ *                      [--threads=<n>] [--duration=<secs>] [--rate=<rps>]
+ *                      [--keepalive] [--pipeline=<n>] [--urls=<file>]
+ *
+ * Each thread drives its share of the connections from one epoll loop.
+ * Without --rate the load is a closed loop: every connection keeps
+ * --pipeline requests outstanding and sends the next one as soon as a
+ * response arrives. With --rate the load is an open loop: requests fall
+ * due at a fixed rate, spread over the connections, whether or not the
+ * earlier ones have been answered, and wait on their connection if it
+ * already has --pipeline requests outstanding.
+ *
+ * Without --keepalive every request is sent on a new connection. With it
+ * requests are sent with "Connection: keep-alive", and a connection that
+ * the server closes anyway is reopened, with the requests it had not
+ * answered sent again.
+ *
+ * The urls file has one path per line; blank lines and lines starting with
+ * '#' are skipped. Each request picks a line at random, so a path that is
+ * listed twice is requested twice as often. The default is "/".
+ *
+ * Output is one line of key=value pairs per item: the settings, the
+ * totals, then the latency percentiles in milliseconds, as measured and
+ * corrected for coordinated omission. In an open loop the corrected
+ * latency of a request runs from when it fell due rather than from when
+ * it was sent. In a closed loop it is corrected as HdrHistogram does:
+ * every measured latency L longer than the mean M adds samples of L - M,
+ * L - 2M, ... for the requests that a stalled connection did not send.
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <pthread.h>
+
+#include "webc_loadgen-main.h"
+#include "webc_config.h"
+#include "webc_util.h"
+
+#define RBUF_SIZE       (16 * 1024)
+#define WBUF_SIZE       (16 * 1024)
+#define MAX_PIPELINE    (64)
+#define MAX_EVENTS      (256)
+#define MAX_URL_LEN     (2048)
+
+struct rqst_t {
+   uint64_t    due;
+   uint64_t    sent;
+};
+
+struct conn_t {
+   int               fd;
+   bool              connecting;
+   bool              want_out;
+
+   // The requests issued on this connection and not yet answered, oldest
+   // first. The first nsent of them have been written.
+   struct rqst_t    *queue;
+   size_t            head;
+   size_t            count;
+   size_t            size;
+   size_t            nsent;
+
+   // Open loop only: when the next request falls due.
+   uint64_t          next_due;
+
+   char              wbuf[WBUF_SIZE];
+   size_t            wlen;
+   size_t            woff;
+
+   // The response being read.
+   char              rbuf[RBUF_SIZE];
+   size_t            rlen;
+   bool              in_body;
+   bool              body_to_close;
+   bool              server_close;
+   uint64_t          body_left;
+   int               status;
+};
+
+struct samples_t {
+   uint64_t   *values;
+   size_t      count;
+   size_t      size;
+   bool        error;
+};
+
+struct worker_t {
+   pthread_t         thread;
+   int               epfd;
+   struct conn_t    *conns;
+   size_t            nconns;
+   uint64_t          interval_ns;      // Per connection, in an open loop
+   uint64_t          seed;
+
+   struct samples_t  measured;
+   struct samples_t  corrected;
+   uint64_t          completed;
+   uint64_t          errors;
+   uint64_t          incomplete;
+   uint64_t          bytes;
+   uint64_t          classes[6];
+};
+
+static struct sockaddr_in g_addr;
+static char g_host[64];
+static size_t g_connections = 16;
+static size_t g_threads = 1;
+static double g_duration = 10.0;
+static double g_rate = 0.0;
+static bool g_keepalive = false;
+static size_t g_pipeline = 1;
+
+static char **g_urls = NULL;
+static size_t g_nurls = 0;
+
+static uint64_t g_start_ns;
+static uint64_t g_end_ns;
+
+
+/* *************************************************************** */
+
+static uint64_t now_ns (void)
+{
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static uint64_t xorshift (uint64_t *state)
+{
+   uint64_t x = *state;
+   x ^= x << 13;
+   x ^= x >> 7;
+   x ^= x << 17;
+   return *state = x;
+}
+
+static void samples_add (struct samples_t *samples, uint64_t value)
+{
+   if (samples->count >= samples->size) {
+      size_t n = samples->size ? samples->size * 2 : 64 * 1024;
+      uint64_t *tmp = realloc (samples->values, n * sizeof *tmp);
+      if (!tmp) {
+         samples->error = true;
+         return;
+      }
+      samples->values = tmp;
+      samples->size = n;
+   }
+   samples->values[samples->count++] = value;
+}
+
+static bool samples_merge (struct samples_t *dst, const struct samples_t *src)
+{
+   for (size_t i=0; i<src->count; i++)
+      samples_add (dst, src->values[i]);
+   return !dst->error && !src->error;
+}
+
+static bool urls_load (const char *fname)
+{
+   bool error = true;
+   FILE *inf = NULL;
+   char line[MAX_URL_LEN];
+
+   if (!(inf = fopen (fname, "r"))) {
+      fprintf (stderr, "Failed to open [%s]: %m\n", fname);
+      goto errorexit;
+   }
+
+   while (fgets (line, sizeof line, inf)) {
+      line[strcspn (line, "\r\n")] = 0;
+      if (!line[0] || line[0] == '#')
+         continue;
+
+      char **tmp = realloc (g_urls, (g_nurls + 1) * sizeof *tmp);
+      if (!tmp || !(tmp[g_nurls] = strdup (line))) {
+         fprintf (stderr, "OOM error reading [%s]\n", fname);
+         if (tmp)
+            g_urls = tmp;
+         goto errorexit;
+      }
+      g_urls = tmp;
+      g_nurls++;
+   }
+
+   if (!g_nurls) {
+      fprintf (stderr, "No urls in [%s]\n", fname);
+      goto errorexit;
+   }
+
+   error = false;
+
+errorexit:
+   if (inf)
+      fclose (inf);
+   return !error;
+}
+
+/* *************************************************************** *
+ * The requests queued on a connection.
+ */
+
+static bool queue_push (struct conn_t *conn, uint64_t due)
+{
+   if (conn->count >= conn->size) {
+      size_t n = conn->size ? conn->size * 2 : 16;
+      struct rqst_t *tmp = malloc (n * sizeof *tmp);
+      if (!tmp)
+         return false;
+      for (size_t i=0; i<conn->count; i++)
+         tmp[i] = conn->queue[(conn->head + i) % conn->size];
+      free (conn->queue);
+      conn->queue = tmp;
+      conn->size = n;
+      conn->head = 0;
+   }
+
+   struct rqst_t *rqst = &conn->queue[(conn->head + conn->count) % conn->size];
+   rqst->due = due;
+   rqst->sent = 0;
+   conn->count++;
+   return true;
+}
+
+static struct rqst_t queue_pop (struct conn_t *conn)
+{
+   struct rqst_t ret = conn->queue[conn->head];
+   conn->head = (conn->head + 1) % conn->size;
+   conn->count--;
+   if (conn->nsent)
+      conn->nsent--;
+   return ret;
+}
+
+static struct rqst_t *queue_at (struct conn_t *conn, size_t i)
+{
+   return &conn->queue[(conn->head + i) % conn->size];
+}
+
+/* *************************************************************** *
+ * Connections.
+ */
+
+static void conn_events (struct worker_t *w, struct conn_t *conn, bool want_out)
+{
+   if (conn->fd < 0 || conn->want_out == want_out)
+      return;
+
+   struct epoll_event ev = { .events = EPOLLIN | (want_out ? EPOLLOUT : 0),
+                             .data.ptr = conn };
+   epoll_ctl (w->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+   conn->want_out = want_out;
+}
+
+static void conn_open (struct worker_t *w, struct conn_t *conn)
+{
+   int one = 1;
+
+   conn->rlen = 0;
+   conn->wlen = conn->woff = 0;
+   conn->in_body = conn->body_to_close = conn->server_close = false;
+   conn->nsent = 0;
+
+   if ((conn->fd = socket (AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                           0)) < 0) {
+      w->errors++;
+      return;
+   }
+   setsockopt (conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+   if ((connect (conn->fd, (struct sockaddr *)&g_addr, sizeof g_addr))!=0 &&
+       errno != EINPROGRESS) {
+      close (conn->fd);
+      conn->fd = -1;
+      w->errors++;
+      return;
+   }
+
+   struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT, .data.ptr = conn };
+   epoll_ctl (w->epfd, EPOLL_CTL_ADD, conn->fd, &ev);
+   conn->connecting = true;
+   conn->want_out = true;
+}
+
+// Closes the connection; the requests that were sent and not answered are
+// sent again on the next one. On an error the oldest of them is given up
+// on instead, so that a request the server cannot answer is not retried
+// for ever. In a closed loop it is replaced, to keep the pipeline full.
+static void conn_close (struct worker_t *w, struct conn_t *conn, bool error)
+{
+   if (conn->fd >= 0)
+      close (conn->fd);
+   conn->fd = -1;
+   conn->connecting = false;
+
+   if (error) {
+      w->errors++;
+      if (conn->count) {
+         queue_pop (conn);
+         if (g_rate <= 0 && !(queue_push (conn, 0)))
+            w->errors++;
+      }
+   }
+   conn->nsent = 0;
+}
+
+static void conn_flush (struct worker_t *w, struct conn_t *conn)
+{
+   while (conn->woff < conn->wlen) {
+      // The server may close the connection with requests still to send.
+      ssize_t rc = send (conn->fd, &conn->wbuf[conn->woff],
+                         conn->wlen - conn->woff, MSG_NOSIGNAL);
+      if (rc < 0 && errno == EINTR)
+         continue;
+      if (rc < 0 && errno == EAGAIN) {
+         conn_events (w, conn, true);
+         return;
+      }
+      if (rc <= 0) {
+         conn_close (w, conn, true);
+         return;
+      }
+      conn->woff += rc;
+   }
+
+   conn->woff = conn->wlen = 0;
+   conn_events (w, conn, false);
+}
+
+// Writes as many of the queued requests as the pipeline depth allows.
+static void conn_fill (struct worker_t *w, struct conn_t *conn, uint64_t now)
+{
+   if (conn->fd < 0 && now < g_end_ns)
+      conn_open (w, conn);
+   if (conn->fd < 0 || conn->connecting)
+      return;
+
+   while (conn->nsent < conn->count && conn->nsent < g_pipeline) {
+      const char *url = g_nurls ? g_urls[xorshift (&w->seed) % g_nurls] : "/";
+      int n = snprintf (&conn->wbuf[conn->wlen], WBUF_SIZE - conn->wlen,
+                        "GET %s HTTP/1.1\r\n"
+                        "Host: %s\r\n"
+                        "Connection: %s\r\n"
+                        "\r\n",
+                        url, g_host, g_keepalive ? "keep-alive" : "close");
+      if (n < 0 || (size_t)n >= WBUF_SIZE - conn->wlen)
+         break;
+      conn->wlen += n;
+
+      struct rqst_t *rqst = queue_at (conn, conn->nsent++);
+      rqst->sent = now;
+      if (g_rate <= 0)
+         rqst->due = now;
+   }
+
+   conn_flush (w, conn);
+}
+
+// The response to the oldest request is complete.
+static void conn_complete (struct worker_t *w, struct conn_t *conn,
+                           uint64_t now)
+{
+   struct rqst_t rqst = queue_pop (conn);
+
+   if (now <= g_end_ns) {
+      w->completed++;
+      w->classes[conn->status >= 100 && conn->status < 600
+                 ? conn->status / 100 : 0]++;
+      samples_add (&w->measured, now - rqst.sent);
+      if (g_rate > 0)
+         samples_add (&w->corrected, now - rqst.due);
+   }
+
+   conn->in_body = conn->body_to_close = false;
+   if (g_rate <= 0 && now < g_end_ns && !(queue_push (conn, now)))
+      w->errors++;
+
+   // The caller reopens the connection.
+   if (!g_keepalive || conn->server_close)
+      conn_close (w, conn, false);
+}
+
+// Finds the value of header name in the header block of a response.
+static const char *header_find (const char *hdrs, size_t len, const char *name)
+{
+   size_t name_len = strlen (name);
+
+   for (const char *ptr = hdrs; ptr < hdrs + len; ) {
+      const char *eol = memchr (ptr, '\n', hdrs + len - ptr);
+      if (!eol)
+         break;
+      if ((size_t)(eol - ptr) > name_len && ptr[name_len] == ':' &&
+          (strncasecmp (ptr, name, name_len))==0) {
+         ptr += name_len + 1;
+         while (*ptr == ' ' || *ptr == '\t')
+            ptr++;
+         return ptr;
+      }
+      ptr = eol + 1;
+   }
+   return NULL;
+}
+
+// Consumes what it can of the bytes read. Returns false on a malformed
+// response.
+static bool conn_parse (struct worker_t *w, struct conn_t *conn, uint64_t now)
+{
+   size_t off = 0;
+
+   while (off < conn->rlen && conn->fd >= 0) {
+      if (!conn->count)
+         return false;
+
+      if (!conn->in_body) {
+         char *start = &conn->rbuf[off];
+         size_t avail = conn->rlen - off;
+         char *end = memmem (start, avail, "\r\n\r\n", 4);
+         if (!end)
+            break;
+
+         size_t hdr_len = end - start + 4;
+         if (avail < 12 || (strncmp (start, "HTTP/1.", 7))!=0)
+            return false;
+         conn->status = atoi (&start[9]);
+
+         const char *value;
+         conn->server_close = (value = header_find (start, hdr_len, "Connection"))
+                            && (strncasecmp (value, "close", 5))==0;
+
+         conn->in_body = true;
+         conn->body_to_close = false;
+         conn->body_left = 0;
+         if ((value = header_find (start, hdr_len, "Content-Length")))
+            conn->body_left = strtoull (value, NULL, 10);
+         else if (conn->status >= 200 && conn->status != 204 &&
+                  conn->status != 304)
+            conn->body_to_close = true;
+         off += hdr_len;
+      }
+
+      if (conn->body_to_close) {
+         off = conn->rlen;
+         break;
+      }
+
+      size_t n = conn->rlen - off;
+      if (n > conn->body_left)
+         n = conn->body_left;
+      conn->body_left -= n;
+      off += n;
+      if (!conn->body_left)
+         conn_complete (w, conn, now);
+   }
+
+   if (conn->fd < 0) {
+      conn->rlen = 0;
+      return true;
+   }
+
+   memmove (conn->rbuf, &conn->rbuf[off], conn->rlen - off);
+   conn->rlen -= off;
+   if (conn->rlen == RBUF_SIZE)
+      return false;
+   return true;
+}
+
+static void conn_read (struct worker_t *w, struct conn_t *conn, uint64_t now)
+{
+   while (conn->fd >= 0) {
+      ssize_t rc = read (conn->fd, &conn->rbuf[conn->rlen],
+                         RBUF_SIZE - conn->rlen);
+      if (rc < 0 && errno == EINTR)
+         continue;
+      if (rc < 0 && errno == EAGAIN)
+         return;
+
+      if (rc < 0) {
+         conn_close (w, conn, true);
+         break;
+      }
+
+      if (rc == 0) {
+         // A response that runs to the close is complete; any other partial
+         // response is an error. A close between responses is not: the
+         // requests that were outstanding are sent again.
+         if (conn->in_body && conn->body_to_close && conn->count) {
+            conn_complete (w, conn, now);
+            conn_close (w, conn, false);
+         } else {
+            conn_close (w, conn, conn->in_body || conn->rlen);
+         }
+         break;
+      }
+
+      w->bytes += rc;
+      conn->rlen += rc;
+      if (!(conn_parse (w, conn, now))) {
+         conn_close (w, conn, true);
+         break;
+      }
+   }
+
+   if (now < g_end_ns && conn->fd < 0) {
+      conn_open (w, conn);
+   }
+}
+
+static void conn_event (struct worker_t *w, struct conn_t *conn,
+                        uint32_t events, uint64_t now)
+{
+   if (conn->connecting) {
+      int err = 0;
+      socklen_t len = sizeof err;
+      if ((events & (EPOLLERR | EPOLLHUP)) ||
+          (getsockopt (conn->fd, SOL_SOCKET, SO_ERROR, &err, &len))!=0 || err) {
+         conn_close (w, conn, true);
+         if (now < g_end_ns)
+            conn_open (w, conn);
+         return;
+      }
+      if (!(events & EPOLLOUT))
+         return;
+      conn->connecting = false;
+      conn_fill (w, conn, now);
+      return;
+   }
+
+   if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+      conn_read (w, conn, now);
+   if (conn->fd >= 0 && !conn->connecting && (events & EPOLLOUT))
+      conn_flush (w, conn);
+   conn_fill (w, conn, now);
+}
+
+/* *************************************************************** */
+
+static void *worker_run (void *arg)
+{
+   struct worker_t *w = arg;
+   struct epoll_event events[MAX_EVENTS];
+
+   uint64_t now = now_ns ();
+   for (size_t i=0; i<w->nconns; i++) {
+      struct conn_t *conn = &w->conns[i];
+      conn->fd = -1;
+      if (g_rate > 0) {
+         conn->next_due = g_start_ns + xorshift (&w->seed) % w->interval_ns;
+      } else {
+         for (size_t j=0; j<g_pipeline; j++)
+            queue_push (conn, now);
+      }
+      conn_open (w, conn);
+   }
+
+   while ((now = now_ns ()) < g_end_ns) {
+      // In an open loop, queue whatever has fallen due, and sleep until
+      // the next request does.
+      uint64_t wake = g_end_ns;
+      if (g_rate > 0) {
+         for (size_t i=0; i<w->nconns; i++) {
+            struct conn_t *conn = &w->conns[i];
+            bool queued = false;
+            while (conn->next_due <= now) {
+               if (!(queue_push (conn, conn->next_due)))
+                  w->errors++;
+               conn->next_due += w->interval_ns;
+               queued = true;
+            }
+            if (queued)
+               conn_fill (w, conn, now);
+            if (conn->next_due < wake)
+               wake = conn->next_due;
+         }
+      }
+
+      int timeout = (int)((wake - now) / 1000000);
+      int n = epoll_wait (w->epfd, events, MAX_EVENTS, timeout > 100 ? 100 : timeout);
+      if (n < 0 && errno != EINTR) {
+         fprintf (stderr, "epoll_wait() failed: %m\n");
+         break;
+      }
+
+      now = now_ns ();
+      for (int i=0; i<n; i++)
+         conn_event (w, events[i].data.ptr, events[i].events, now);
+   }
+
+   for (size_t i=0; i<w->nconns; i++) {
+      struct conn_t *conn = &w->conns[i];
+      for (size_t j=0; j<conn->count; j++) {
+         if (queue_at (conn, j)->due < g_end_ns)
+            w->incomplete++;
+      }
+      if (conn->fd >= 0)
+         close (conn->fd);
+      free (conn->queue);
+   }
+
+   return NULL;
+}
+
+/* *************************************************************** */
+
+static int cb_u64_cmp (const void *lhs, const void *rhs)
+{
+   uint64_t l = *(const uint64_t *)lhs, r = *(const uint64_t *)rhs;
+   return (l > r) - (l < r);
+}
+
+// Adds the samples that the requests held up behind each long one would
+// have had, taking the mean as the expected interval between requests.
+static void samples_correct (struct samples_t *dst, const struct samples_t *src)
+{
+   uint64_t sum = 0;
+
+   for (size_t i=0; i<src->count; i++)
+      sum += src->values[i];
+   if (!src->count || !(sum /= src->count))
+      return;
+
+   for (size_t i=0; i<src->count; i++) {
+      samples_add (dst, src->values[i]);
+      for (uint64_t v = src->values[i]; v > sum * 2; ) {
+         v -= sum;
+         samples_add (dst, v);
+      }
+   }
+}
+
+static void percentiles_print (const char *name, struct samples_t *samples)
+{
+   static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9, 99.99 };
+
+   printf ("loadgen %s", name);
+   if (!samples->count) {
+      printf (" samples=0\n");
+      return;
+   }
+
+   qsort (samples->values, samples->count, sizeof *samples->values,
+          cb_u64_cmp);
+   for (size_t i=0; i<sizeof percentiles / sizeof percentiles[0]; i++) {
+      size_t rank = (size_t)(percentiles[i] / 100.0 * samples->count + 0.5);
+      if (rank)
+         rank--;
+      printf (" p%g=%.3f", percentiles[i], samples->values[rank] / 1e6);
+   }
+   printf (" max=%.3f samples=%zu\n",
+           samples->values[samples->count - 1] / 1e6, samples->count);
+}
+
+static bool parse_size (const char *value, size_t *dst, size_t max)
+{
+   char *end;
+   unsigned long long tmp = strtoull (value, &end, 10);
+   if (!value[0] || *end || !tmp || tmp > max)
+      return false;
+   *dst = tmp;
+   return true;
+}
+
+static bool parse_double (const char *value, double *dst)
+{
+   char *end;
+   double tmp = strtod (value, &end);
+   if (!value[0] || *end || tmp <= 0)
+      return false;
+   *dst = tmp;
+   return true;
+}
+
+int main (int argc, char **argv)
+{
+   int ret = EXIT_FAILURE;
+   struct worker_t *workers = NULL;
+   struct samples_t measured = { NULL }, corrected = { NULL };
+   uint64_t completed = 0, errors = 0, incomplete = 0, bytes = 0;
+   uint64_t classes[6] = { 0 };
+   size_t started = 0;
+
+   const char *opt_host = webc_util_cline_opt (argc, argv, "host");
+   const char *opt_port = webc_util_cline_opt (argc, argv, "port");
+   const char *opt_connections = webc_util_cline_opt (argc, argv, "connections");
+   const char *opt_threads = webc_util_cline_opt (argc, argv, "threads");
+   const char *opt_duration = webc_util_cline_opt (argc, argv, "duration");
+   const char *opt_rate = webc_util_cline_opt (argc, argv, "rate");
+   const char *opt_keepalive = webc_util_cline_opt (argc, argv, "keepalive");
+   const char *opt_pipeline = webc_util_cline_opt (argc, argv, "pipeline");
+   const char *opt_urls = webc_util_cline_opt (argc, argv, "urls");
+
+   bool opt_error = false;
+   for (size_t i=1; argv[i]; i++) {
+      if (argv[i][0]) {
+         fprintf (stderr, "Unknown option [%s]\n", argv[i]);
+         opt_error = true;
+      }
+   }
+
+   size_t port = 0;
+   if (!opt_host)
+      opt_host = "127.0.0.1";
+   if (!opt_port)
+      opt_port = DEFAULT_LISTEN_PORT;
+   if (!(parse_size (opt_port, &port, 65535))) {
+      fprintf (stderr, "Invalid port [%s]\n", opt_port);
+      opt_error = true;
+   }
+   if (opt_connections && !(parse_size (opt_connections, &g_connections, 100000))) {
+      fprintf (stderr, "Invalid number of connections [%s]\n", opt_connections);
+      opt_error = true;
+   }
+   if (opt_threads && !(parse_size (opt_threads, &g_threads, 1024))) {
+      fprintf (stderr, "Invalid number of threads [%s]\n", opt_threads);
+      opt_error = true;
+   }
+   if (opt_duration && !(parse_double (opt_duration, &g_duration))) {
+      fprintf (stderr, "Invalid duration [%s]\n", opt_duration);
+      opt_error = true;
+   }
+   if (opt_rate && !(parse_double (opt_rate, &g_rate))) {
+      fprintf (stderr, "Invalid rate [%s]\n", opt_rate);
+      opt_error = true;
+   }
+   if (opt_pipeline && !(parse_size (opt_pipeline, &g_pipeline, MAX_PIPELINE))) {
+      fprintf (stderr, "Invalid pipeline depth [%s], the most is %i\n",
+               opt_pipeline, MAX_PIPELINE);
+      opt_error = true;
+   }
+   g_keepalive = opt_keepalive != NULL;
+   if (g_pipeline > 1 && !g_keepalive) {
+      fprintf (stderr, "--pipeline needs --keepalive\n");
+      opt_error = true;
+   }
+
+   if (opt_error) {
+      fprintf (stderr, "Usage: %s [--host=<addr>] [--port=<n>] "
+                       "[--connections=<n>] [--threads=<n>] "
+                       "[--duration=<secs>] [--rate=<rps>] [--keepalive] "
+                       "[--pipeline=<n>] [--urls=<file>]\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   memset (&g_addr, 0, sizeof g_addr);
+   g_addr.sin_family = AF_INET;
+   g_addr.sin_port = htons (port);
+   if ((inet_pton (AF_INET, opt_host, &g_addr.sin_addr))!=1) {
+      fprintf (stderr, "Invalid IPv4 address [%s]\n", opt_host);
+      return EXIT_FAILURE;
+   }
+   snprintf (g_host, sizeof g_host, "%s:%zu", opt_host, port);
+
+   if (opt_urls && !(urls_load (opt_urls)))
+      goto errorexit;
+
+   if (g_threads > g_connections)
+      g_threads = g_connections;
+
+   if (!(workers = calloc (g_threads, sizeof *workers))) {
+      fprintf (stderr, "OOM error\n");
+      goto errorexit;
+   }
+   for (size_t i=0; i<g_threads; i++)
+      workers[i].epfd = -1;
+
+   g_start_ns = now_ns ();
+   g_end_ns = g_start_ns + (uint64_t)(g_duration * 1e9);
+
+   for (size_t i=0; i<g_threads; i++) {
+      struct worker_t *w = &workers[i];
+      w->nconns = g_connections / g_threads + (i < g_connections % g_threads);
+      w->seed = 0x9e3779b97f4a7c15ull * (i + 1);
+      if (g_rate > 0)
+         w->interval_ns = (uint64_t)(1e9 * g_connections / g_rate);
+      if (!w->interval_ns)
+         w->interval_ns = 1;
+
+      if (!(w->conns = calloc (w->nconns, sizeof *w->conns)) ||
+          (w->epfd = epoll_create1 (EPOLL_CLOEXEC)) < 0) {
+         fprintf (stderr, "Failed to set up thread %zu: %m\n", i);
+         goto errorexit;
+      }
+      if ((pthread_create (&w->thread, NULL, worker_run, w))!=0) {
+         fprintf (stderr, "Failed to start thread %zu\n", i);
+         goto errorexit;
+      }
+      started++;
+   }
+
+   for (size_t i=0; i<started; i++) {
+      struct worker_t *w = &workers[i];
+      pthread_join (w->thread, NULL);
+      completed += w->completed;
+      errors += w->errors;
+      incomplete += w->incomplete;
+      bytes += w->bytes;
+      for (size_t c=0; c<6; c++)
+         classes[c] += w->classes[c];
+      if (!(samples_merge (&measured, &w->measured)) ||
+          !(samples_merge (&corrected, &w->corrected))) {
+         fprintf (stderr, "OOM error collecting the latencies\n");
+         goto errorexit;
+      }
+   }
+   started = 0;
+
+   if (g_rate <= 0)
+      samples_correct (&corrected, &measured);
+   if (corrected.error) {
+      fprintf (stderr, "OOM error correcting the latencies\n");
+      goto errorexit;
+   }
+
+   printf ("loadgen connections=%zu threads=%zu seconds=%.2f rate=%.0f "
+           "keepalive=%i pipeline=%zu urls=%zu\n",
+           g_connections, g_threads, g_duration, g_rate, g_keepalive,
+           g_pipeline, g_nurls ? g_nurls : 1);
+   printf ("loadgen requests=%" PRIu64 " rps=%.1f bytes=%" PRIu64
+           " errors=%" PRIu64 " incomplete=%" PRIu64 " 1xx=%" PRIu64
+           " 2xx=%" PRIu64 " 3xx=%" PRIu64 " 4xx=%" PRIu64 " 5xx=%" PRIu64
+           " other=%" PRIu64 "\n",
+           completed, completed / g_duration, bytes, errors, incomplete,
+           classes[1], classes[2], classes[3], classes[4], classes[5],
+           classes[0]);
+   percentiles_print ("latency_ms", &measured);
+   percentiles_print ("corrected_ms", &corrected);
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   if (workers) {
+      // Threads that did start are stopped by the deadline.
+      for (size_t i=0; i<started; i++)
+         pthread_join (workers[i].thread, NULL);
+      for (size_t i=0; i<g_threads; i++) {
+         if (workers[i].epfd >= 0)
+            close (workers[i].epfd);
+         free (workers[i].conns);
+         free (workers[i].measured.values);
+         free (workers[i].corrected.values);
+      }
+      free (workers);
+   }
+   for (size_t i=0; i<g_nurls; i++)
+      free (g_urls[i]);
+   free (g_urls);
+   free (measured.values);
+   free (corrected.values);
+   return ret;
+}
+
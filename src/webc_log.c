@@ -0,0 +1,472 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <pthread.h>
+
+#include "webc_log.h"
+#include "webc_util.h"
+#include "webc_config.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX      (1024)
+#endif
+
+/* *************************************************************** *
+ * A ring has a single producer, the thread that owns it, and a single
+ * consumer, the writer. head and tail count bytes since the ring was
+ * created, so head - tail is the number of bytes waiting. The producer
+ * publishes a whole record with one release store of head, and the writer
+ * hands the space back with one release store of tail.
+ *
+ * Threads come and go with connections, so a ring is not freed when its
+ * thread ends: the thread gives up ownership and the next thread to log
+ * takes it over, together with anything still waiting in it.
+ */
+struct log_ring_t {
+   atomic_bool          owned;
+   atomic_size_t        head;
+   atomic_size_t        tail;
+   atomic_size_t        dropped;
+   char                 buf[LOG_RING_SIZE];
+};
+
+static struct log_ring_t g_rings[LOG_MAX_RINGS];
+static atomic_size_t g_nrings = 0;
+static atomic_size_t g_no_ring_dropped = 0;
+static atomic_uint_fast64_t g_dropped = 0;
+
+static _Thread_local struct log_ring_t *g_ring = NULL;
+static pthread_key_t g_ring_key;
+static pthread_once_t g_ring_key_once = PTHREAD_ONCE_INIT;
+
+atomic_int webc_log_level_g = LOG_DEFAULT_LEVEL;
+
+static const char *g_level_names[] = {
+   [WEBC_LOG_DEBUG]  = "debug",
+   [WEBC_LOG_INFO]   = "info",
+   [WEBC_LOG_WARN]   = "warn",
+   [WEBC_LOG_ERROR]  = "error",
+};
+
+#define NLEVELS      (sizeof g_level_names / sizeof g_level_names[0])
+
+// The logfile is replaced by the writer, so only the writer (or the thread
+// that calls webc_log_file() before the writer starts) touches these.
+static char *g_logfile_prefix = NULL;
+static uint64_t g_logfile_bytes = 0;
+static time_t g_logfile_opened = 0;
+static atomic_bool g_reopen = false;
+
+static atomic_bool g_running = false;
+static atomic_bool g_stop = false;
+static pthread_t g_writer;
+
+/* *************************************************************** */
+
+static void ring_release (void *ring)
+{
+   atomic_store_explicit (&((struct log_ring_t *)ring)->owned, false,
+                          memory_order_release);
+}
+
+static void ring_key_create (void)
+{
+   pthread_key_create (&g_ring_key, ring_release);
+}
+
+static struct log_ring_t *ring_claim (void)
+{
+   if (g_ring)
+      return g_ring;
+
+   pthread_once (&g_ring_key_once, ring_key_create);
+
+   for (size_t i=0; i<LOG_MAX_RINGS; i++) {
+      bool expected = false;
+      if (!(atomic_compare_exchange_strong_explicit (&g_rings[i].owned,
+                                                     &expected, true,
+                                                     memory_order_acquire,
+                                                     memory_order_relaxed)))
+         continue;
+
+      // The writer only looks at the rings below g_nrings.
+      size_t n = atomic_load (&g_nrings);
+      while (n <= i && !(atomic_compare_exchange_weak (&g_nrings, &n, i + 1)))
+         ;
+
+      pthread_setspecific (g_ring_key, &g_rings[i]);
+      return g_ring = &g_rings[i];
+   }
+
+   return NULL;
+}
+
+static bool ring_put (struct log_ring_t *ring, const char *rec, size_t len)
+{
+   size_t head = atomic_load_explicit (&ring->head, memory_order_relaxed);
+   size_t tail = atomic_load_explicit (&ring->tail, memory_order_acquire);
+
+   if (LOG_RING_SIZE - (head - tail) < len) {
+      atomic_fetch_add_explicit (&ring->dropped, 1, memory_order_relaxed);
+      return false;
+   }
+
+   size_t offset = head % LOG_RING_SIZE;
+   size_t first = LOG_RING_SIZE - offset;
+   if (first > len)
+      first = len;
+   memcpy (&ring->buf[offset], rec, first);
+   memcpy (ring->buf, &rec[first], len - first);
+
+   atomic_store_explicit (&ring->head, head + len, memory_order_release);
+   return true;
+}
+
+static void write_all (struct iovec *iov, int iovcnt)
+{
+   while (iovcnt > 0) {
+      ssize_t nbytes = writev (STDERR_FILENO, iov, iovcnt);
+      if (nbytes < 0) {
+         if (errno == EINTR)
+            continue;
+         return;
+      }
+      g_logfile_bytes += nbytes;
+      while (iovcnt > 0 && (size_t)nbytes >= iov->iov_len) {
+         nbytes -= iov->iov_len;
+         iov++;
+         iovcnt--;
+      }
+      if (iovcnt > 0) {
+         iov->iov_base = (char *)iov->iov_base + nbytes;
+         iov->iov_len -= nbytes;
+      }
+   }
+}
+
+// Writes everything that is waiting in the rings, with one writev() for
+// up to IOV_MAX / 2 rings. Only the writer thread, or webc_log_stop() once
+// the writer has ended, calls this.
+static void drain (void)
+{
+   struct iovec iov[IOV_MAX];
+   size_t heads[IOV_MAX / 2];
+   size_t rings[IOV_MAX / 2];
+   size_t nrings = atomic_load (&g_nrings);
+   size_t dropped = atomic_exchange (&g_no_ring_dropped, 0);
+
+   for (size_t i=0; i<nrings; ) {
+      int iovcnt = 0;
+      size_t nbatch = 0;
+
+      for (; i<nrings && nbatch < IOV_MAX / 2; i++) {
+         struct log_ring_t *ring = &g_rings[i];
+         size_t head = atomic_load_explicit (&ring->head, memory_order_acquire);
+         size_t tail = atomic_load_explicit (&ring->tail, memory_order_relaxed);
+
+         dropped += atomic_exchange_explicit (&ring->dropped, 0,
+                                              memory_order_relaxed);
+         if (head == tail)
+            continue;
+
+         size_t offset = tail % LOG_RING_SIZE;
+         size_t len = head - tail;
+         size_t first = LOG_RING_SIZE - offset;
+         if (first > len)
+            first = len;
+
+         iov[iovcnt].iov_base = &ring->buf[offset];
+         iov[iovcnt++].iov_len = first;
+         if (len > first) {
+            iov[iovcnt].iov_base = ring->buf;
+            iov[iovcnt++].iov_len = len - first;
+         }
+         heads[nbatch] = head;
+         rings[nbatch++] = i;
+      }
+
+      write_all (iov, iovcnt);
+
+      for (size_t j=0; j<nbatch; j++)
+         atomic_store_explicit (&g_rings[rings[j]].tail, heads[j],
+                                memory_order_release);
+   }
+
+   if (dropped) {
+      char msg[64];
+      atomic_fetch_add (&g_dropped, dropped);
+      int len = snprintf (msg, sizeof msg, "webc_log: dropped %zu records\n",
+                          dropped);
+      if (len > 0 && (size_t)len < sizeof msg)
+         write_all (&(struct iovec) { msg, len }, 1);
+   }
+}
+
+// Opens <prefix>.YYYYMMDDhhmmss and puts it in place of stderr. dup2()
+// replaces the descriptor atomically, so a write to stderr goes either to
+// the old file or to the new one.
+static bool logfile_open (void)
+{
+   bool ret = false;
+   char stamp[16];
+   char *fname = NULL;
+   struct tm time_fields;
+   time_t now = time (NULL);
+   int fd = -1;
+
+   if (!(localtime_r (&now, &time_fields)) ||
+       !(strftime (stamp, sizeof stamp, "%Y%m%d%H%M%S", &time_fields))) {
+      WEBC_UTIL_LOG ("Failed to get local time: %m\n");
+      goto errorexit;
+   }
+
+   if (!(webc_util_sprintf (&fname, NULL, "%s.%s", g_logfile_prefix, stamp))) {
+      WEBC_UTIL_LOG ("OOM error constructing logfile name\n");
+      goto errorexit;
+   }
+
+   if ((fd = open (fname, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                   S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP)) < 0) {
+      WEBC_UTIL_LOG ("Cannot open logfile [%s]: %m\n", fname);
+      goto errorexit;
+   }
+
+   if ((dup2 (fd, STDERR_FILENO)) != STDERR_FILENO) {
+      WEBC_UTIL_LOG ("Failed to dup() file descriptors for logging: %m\n");
+      goto errorexit;
+   }
+
+   g_logfile_bytes = 0;
+   g_logfile_opened = now;
+   WEBC_UTIL_LOG ("Logging to [%s]\n", fname);
+   ret = true;
+
+errorexit:
+   if (fd >= 0)
+      close (fd);
+   free (fname);
+   return ret;
+}
+
+// Moves on to a new logfile when one was asked for, or when the current
+// one is too big or too old. Called by the writer between drains.
+static void logfile_check (void)
+{
+   bool reopen = atomic_exchange (&g_reopen, false);
+
+   if (!g_logfile_prefix)
+      return;
+
+   if (!reopen &&
+       !(LOGFILE_ROTATE_SIZE && g_logfile_bytes >= LOGFILE_ROTATE_SIZE) &&
+       !(LOGFILE_ROTATE_SECS && time (NULL) - g_logfile_opened >= LOGFILE_ROTATE_SECS))
+      return;
+
+   // Whatever is waiting belongs to the old file.
+   drain ();
+   logfile_open ();
+}
+
+static void *writer_func (void *arg)
+{
+   (void)arg;
+   struct timespec interval = {
+      LOG_FLUSH_INTERVAL_MS / 1000,
+      (LOG_FLUSH_INTERVAL_MS % 1000) * 1000000L,
+   };
+
+   while (!atomic_load (&g_stop)) {
+      drain ();
+      logfile_check ();
+      nanosleep (&interval, NULL);
+   }
+
+   return NULL;
+}
+
+static void append (const char *rec, size_t len)
+{
+   if (!atomic_load_explicit (&g_running, memory_order_relaxed)) {
+      write_all (&(struct iovec) { (void *)rec, len }, 1);
+      return;
+   }
+
+   struct log_ring_t *ring = ring_claim ();
+   if (!ring) {
+      atomic_fetch_add_explicit (&g_no_ring_dropped, 1, memory_order_relaxed);
+      return;
+   }
+   ring_put (ring, rec, len);
+}
+
+// Formats the message after the prefix already in rec, and appends the
+// record. Records that are too long are cut short, keeping the newline.
+static void vrecord (char *rec, int prefix_len, const char *fmts, va_list ap)
+{
+   if (prefix_len < 0)
+      return;
+   if (prefix_len >= LOG_RECORD_MAX)
+      prefix_len = LOG_RECORD_MAX - 1;
+
+   int len = vsnprintf (&rec[prefix_len], LOG_RECORD_MAX - prefix_len, fmts,
+                        ap);
+   if (len < 0)
+      return;
+
+   len += prefix_len;
+   if (len >= LOG_RECORD_MAX) {
+      len = LOG_RECORD_MAX - 1;
+      rec[len - 1] = '\n';
+   }
+
+   append (rec, len);
+}
+
+/* *************************************************************** */
+
+bool webc_log_start (void)
+{
+   if (atomic_load (&g_running))
+      return true;
+
+   atomic_store (&g_stop, false);
+   if ((pthread_create (&g_writer, NULL, writer_func, NULL))!=0)
+      return false;
+
+   atomic_store (&g_running, true);
+   return true;
+}
+
+bool webc_log_file (const char *prefix)
+{
+   if (atomic_load (&g_running))
+      return false;
+
+   free (g_logfile_prefix);
+   if (!(webc_util_sprintf (&g_logfile_prefix, NULL, "%s", prefix)))
+      return false;
+
+   return logfile_open ();
+}
+
+void webc_log_reopen (void)
+{
+   atomic_store (&g_reopen, true);
+}
+
+void webc_log_stop (void)
+{
+   if (!atomic_exchange (&g_running, false))
+      return;
+
+   atomic_store (&g_stop, true);
+   pthread_join (g_writer, NULL);
+   drain ();
+}
+
+uint64_t webc_log_dropped (void)
+{
+   return atomic_load (&g_dropped);
+}
+
+void webc_log_level_set (int level)
+{
+   atomic_store_explicit (&webc_log_level_g, level, memory_order_relaxed);
+}
+
+int webc_log_level_get (void)
+{
+   return atomic_load_explicit (&webc_log_level_g, memory_order_relaxed);
+}
+
+int webc_log_level_parse (const char *name)
+{
+   for (size_t i=0; i<NLEVELS; i++) {
+      if ((strcmp (name, g_level_names[i]))==0)
+         return i;
+   }
+   return -1;
+}
+
+const char *webc_log_level_name (int level)
+{
+   if (level < 0 || (size_t)level >= NLEVELS)
+      return "?";
+   return g_level_names[level];
+}
+
+void webc_log_util (const char *file, int line, const char *fmts, ...)
+{
+   char rec[LOG_RECORD_MAX];
+   int errno_saved = errno;
+   int prefix_len = snprintf (rec, sizeof rec, "%s:%d: ", file, line);
+
+   va_list ap;
+   va_start (ap, fmts);
+   errno = errno_saved; // For %m
+   vrecord (rec, prefix_len, fmts, ap);
+   va_end (ap);
+   errno = errno_saved;
+}
+
+void webc_log_thrd (const char *file, int line, const char *addr,
+                    unsigned port, const char *fmts, ...)
+{
+   char rec[LOG_RECORD_MAX];
+   int errno_saved = errno;
+   int prefix_len = snprintf (rec, sizeof rec, "%s:%d: [%s:%u] ", file, line,
+                              addr, port);
+
+   va_list ap;
+   va_start (ap, fmts);
+   errno = errno_saved;
+   vrecord (rec, prefix_len, fmts, ap);
+   va_end (ap);
+   errno = errno_saved;
+}
+
+void webc_log_ts (const char *fmts, ...)
+{
+   // localtime_r() is only called once a second per thread.
+   static _Thread_local time_t last = 0;
+   static _Thread_local char stamp[16] = "";
+
+   char rec[LOG_RECORD_MAX];
+   int errno_saved = errno;
+   time_t now = time (NULL);
+
+   if (now != last) {
+      struct tm time_fields;
+      if (!(localtime_r (&now, &time_fields)) ||
+          !(strftime (stamp, sizeof stamp, "%Y%m%d%H%M%S", &time_fields))) {
+         errno = errno_saved;
+         webc_log_util (__FILE__, __LINE__, "Failed to get local time: %m\n");
+         return;
+      }
+      last = now;
+   }
+
+   int prefix_len = snprintf (rec, sizeof rec, "%s: ", stamp);
+
+   va_list ap;
+   va_start (ap, fmts);
+   errno = errno_saved;
+   vrecord (rec, prefix_len, fmts, ap);
+   va_end (ap);
+   errno = errno_saved;
+}
+
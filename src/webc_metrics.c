@@ -0,0 +1,390 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+
+#include <pthread.h>
+
+#include "webc_metrics.h"
+#include "webc_accesslog.h"
+#include "webc_conn.h"
+#include "webc_log.h"
+#include "webc_config.h"
+#include "webc_util.h"
+
+#define NMETHODS        (webc_method_PATCH + 1)
+#define NCLASSES        (6)      // 1xx to 5xx, and anything else in 0
+
+// Bucket 0 holds everything below 2^HIST_MIN_SHIFT ns, and the last bucket
+// everything from 2^(HIST_MIN_SHIFT + HIST_OCTAVES) ns up.
+#define HIST_SUB_BITS   (2)
+#define HIST_MIN_SHIFT  (10)
+#define HIST_OCTAVES    (27)
+#define HIST_NBUCKETS   (2 + (HIST_OCTAVES << HIST_SUB_BITS))
+
+static const struct {
+   const char                *name;
+   enum webc_conn_stamp_t     from;
+   enum webc_conn_stamp_t     to;
+} g_phases[] = {
+   { "queue",     webc_conn_ACCEPTED,     webc_conn_FIRST_BYTE },
+   { "headers",   webc_conn_FIRST_BYTE,   webc_conn_HEADERS    },
+   { "route",     webc_conn_HEADERS,      webc_conn_ROUTED     },
+   { "handler",   webc_conn_ROUTED,       webc_conn_HANDLED    },
+   { "send",      webc_conn_HANDLED,      webc_conn_LAST_BYTE  },
+};
+
+#define NPHASES         (sizeof g_phases / sizeof g_phases[0])
+
+typedef atomic_uint_fast64_t counter_t;
+
+struct hist_t {
+   counter_t         buckets[HIST_NBUCKETS];
+   counter_t         sum_ns;
+};
+
+struct slot_t {
+   _Alignas (64)
+   atomic_bool       owned;
+   bool              shared;
+
+   counter_t         requests[NMETHODS][NCLASSES];
+   counter_t         bytes_in;
+   counter_t         bytes_out;
+   counter_t         active;     // Goes down as well as up; wraps
+   counter_t         accept_errors;
+   struct hist_t     latency;
+   struct hist_t     phases[NPHASES];
+};
+
+static struct slot_t g_slots[METRICS_MAX_SLOTS];
+static atomic_size_t g_nslots = 0;
+
+// Threads that find no free slot share this one, with atomic adds.
+static struct slot_t g_shared = { .shared = true };
+
+static _Thread_local struct slot_t *g_slot = NULL;
+static pthread_key_t g_slot_key;
+static pthread_once_t g_slot_key_once = PTHREAD_ONCE_INIT;
+
+static const char *g_methods[] = {
+   [webc_method_UNKNOWN]   = "UNKNOWN",
+   [webc_method_GET]       = "GET",
+   [webc_method_HEAD]      = "HEAD",
+   [webc_method_POST]      = "POST",
+   [webc_method_PUT]       = "PUT",
+   [webc_method_DELETE]    = "DELETE",
+   [webc_method_TRACE]     = "TRACE",
+   [webc_method_OPTIONS]   = "OPTIONS",
+   [webc_method_CONNECT]   = "CONNECT",
+   [webc_method_PATCH]     = "PATCH",
+};
+
+/* *************************************************************** */
+
+static void slot_release (void *slot)
+{
+   atomic_store_explicit (&((struct slot_t *)slot)->owned, false,
+                          memory_order_release);
+}
+
+static void slot_key_create (void)
+{
+   pthread_key_create (&g_slot_key, slot_release);
+}
+
+static struct slot_t *slot_get (void)
+{
+   if (g_slot)
+      return g_slot;
+
+   pthread_once (&g_slot_key_once, slot_key_create);
+
+   for (size_t i=0; i<METRICS_MAX_SLOTS; i++) {
+      bool expected = false;
+      if (!(atomic_compare_exchange_strong_explicit (&g_slots[i].owned,
+                                                     &expected, true,
+                                                     memory_order_acquire,
+                                                     memory_order_relaxed)))
+         continue;
+
+      size_t n = atomic_load (&g_nslots);
+      while (n <= i && !(atomic_compare_exchange_weak (&g_nslots, &n, i + 1)))
+         ;
+
+      pthread_setspecific (g_slot_key, &g_slots[i]);
+      return g_slot = &g_slots[i];
+   }
+
+   return g_slot = &g_shared;
+}
+
+// Only the owner of a slot writes to it, so a load and a store will do;
+// they are atomic only so that the handler can read the counter at any
+// time.
+static void add (struct slot_t *slot, counter_t *counter, uint64_t n)
+{
+   if (slot->shared) {
+      atomic_fetch_add_explicit (counter, n, memory_order_relaxed);
+   } else {
+      atomic_store_explicit (counter,
+                             atomic_load_explicit (counter,
+                                                   memory_order_relaxed) + n,
+                             memory_order_relaxed);
+   }
+}
+
+static uint64_t get (counter_t *counter)
+{
+   return atomic_load_explicit (counter, memory_order_relaxed);
+}
+
+static size_t hist_bucket (uint64_t ns)
+{
+   if (ns < (1ull << HIST_MIN_SHIFT))
+      return 0;
+
+   int msb = 63 - __builtin_clzll (ns);
+   size_t sub = (ns >> (msb - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1);
+   size_t ret = 1 + ((size_t)(msb - HIST_MIN_SHIFT) << HIST_SUB_BITS) + sub;
+
+   return ret < HIST_NBUCKETS ? ret : HIST_NBUCKETS - 1;
+}
+
+// The values in bucket are below this. The last bucket has no bound.
+static uint64_t hist_bound (size_t bucket)
+{
+   if (bucket == 0)
+      return 1ull << HIST_MIN_SHIFT;
+
+   size_t octave = (bucket - 1) >> HIST_SUB_BITS;
+   size_t sub = (bucket - 1) & ((1 << HIST_SUB_BITS) - 1);
+   int msb = HIST_MIN_SHIFT + octave;
+
+   return (1ull << msb) + ((uint64_t)(sub + 1) << (msb - HIST_SUB_BITS));
+}
+
+static void hist_add (struct slot_t *slot, struct hist_t *hist, uint64_t ns)
+{
+   add (slot, &hist->buckets[hist_bucket (ns)], 1);
+   add (slot, &hist->sum_ns, ns);
+}
+
+/* *************************************************************** *
+ * The handler adds up every slot into one of these.
+ */
+struct totals_t {
+   uint64_t    requests[NMETHODS][NCLASSES];
+   uint64_t    bytes_in;
+   uint64_t    bytes_out;
+   uint64_t    active;
+   uint64_t    accept_errors;
+   struct {
+      uint64_t    buckets[HIST_NBUCKETS];
+      uint64_t    sum_ns;
+   }           latency, phases[NPHASES];
+};
+
+static void totals_add (struct totals_t *totals, struct slot_t *slot)
+{
+   for (size_t m=0; m<NMETHODS; m++) {
+      for (size_t c=0; c<NCLASSES; c++)
+         totals->requests[m][c] += get (&slot->requests[m][c]);
+   }
+   totals->bytes_in += get (&slot->bytes_in);
+   totals->bytes_out += get (&slot->bytes_out);
+   totals->active += get (&slot->active);
+   totals->accept_errors += get (&slot->accept_errors);
+   for (size_t b=0; b<HIST_NBUCKETS; b++)
+      totals->latency.buckets[b] += get (&slot->latency.buckets[b]);
+   totals->latency.sum_ns += get (&slot->latency.sum_ns);
+   for (size_t p=0; p<NPHASES; p++) {
+      for (size_t b=0; b<HIST_NBUCKETS; b++)
+         totals->phases[p].buckets[b] += get (&slot->phases[p].buckets[b]);
+      totals->phases[p].sum_ns += get (&slot->phases[p].sum_ns);
+   }
+}
+
+// labels is either empty or ends in a comma, so that le can follow it.
+static void hist_print (FILE *outf, const char *name, const char *labels,
+                        const uint64_t *buckets, uint64_t sum_ns)
+{
+   uint64_t count = 0;
+
+   for (size_t b=0; b<HIST_NBUCKETS - 1; b++) {
+      count += buckets[b];
+      fprintf (outf, "%s_bucket{%sle=\"%.9g\"} %" PRIu64 "\n", name, labels,
+               hist_bound (b) / 1e9, count);
+   }
+   count += buckets[HIST_NBUCKETS - 1];
+   fprintf (outf, "%s_bucket{%sle=\"+Inf\"} %" PRIu64 "\n", name, labels,
+            count);
+
+   // The series without le take the labels without the trailing comma.
+   char braced[64] = "";
+   int len = (int)strlen (labels);
+   if (len)
+      snprintf (braced, sizeof braced, "{%.*s}", len - 1, labels);
+   fprintf (outf, "%s_sum%s %.9f\n", name, braced, sum_ns / 1e9);
+   fprintf (outf, "%s_count%s %" PRIu64 "\n", name, braced, count);
+}
+
+static void totals_print (FILE *outf, const struct totals_t *totals)
+{
+   fprintf (outf, "# TYPE webc_requests_total counter\n");
+   for (size_t m=0; m<NMETHODS; m++) {
+      for (size_t c=0; c<NCLASSES; c++) {
+         if (!totals->requests[m][c])
+            continue;
+         if (c)
+            fprintf (outf, "webc_requests_total{method=\"%s\",status=\"%zuxx\"} "
+                           "%" PRIu64 "\n", g_methods[m], c,
+                     totals->requests[m][c]);
+         else
+            fprintf (outf, "webc_requests_total{method=\"%s\",status=\"other\"} "
+                           "%" PRIu64 "\n", g_methods[m],
+                     totals->requests[m][c]);
+      }
+   }
+
+   fprintf (outf, "# TYPE webc_received_bytes_total counter\n"
+                  "webc_received_bytes_total %" PRIu64 "\n"
+                  "# TYPE webc_sent_bytes_total counter\n"
+                  "webc_sent_bytes_total %" PRIu64 "\n"
+                  "# TYPE webc_active_connections gauge\n"
+                  "webc_active_connections %" PRId64 "\n"
+                  "# TYPE webc_accept_errors_total counter\n"
+                  "webc_accept_errors_total %" PRIu64 "\n"
+                  "# TYPE webc_log_dropped_total counter\n"
+                  "webc_log_dropped_total %" PRIu64 "\n"
+                  "# TYPE webc_accesslog_dropped_total counter\n"
+                  "webc_accesslog_dropped_total %" PRIu64 "\n",
+            totals->bytes_in, totals->bytes_out, (int64_t)totals->active,
+            totals->accept_errors, webc_log_dropped (),
+            webc_accesslog_dropped ());
+
+   fprintf (outf, "# TYPE webc_request_duration_seconds histogram\n");
+   hist_print (outf, "webc_request_duration_seconds", "",
+               totals->latency.buckets, totals->latency.sum_ns);
+
+   fprintf (outf, "# TYPE webc_request_phase_seconds histogram\n");
+   for (size_t p=0; p<NPHASES; p++) {
+      char labels[32];
+      snprintf (labels, sizeof labels, "phase=\"%s\",", g_phases[p].name);
+      hist_print (outf, "webc_request_phase_seconds", labels,
+                  totals->phases[p].buckets, totals->phases[p].sum_ns);
+   }
+}
+
+/* *************************************************************** */
+
+void webc_metrics_conn_begin (void)
+{
+   struct slot_t *slot = slot_get ();
+   add (slot, &slot->active, 1);
+}
+
+void webc_metrics_conn_end (void)
+{
+   struct slot_t *slot = slot_get ();
+   add (slot, &slot->active, (uint64_t)-1);
+}
+
+void webc_metrics_accept_error (void)
+{
+   struct slot_t *slot = slot_get ();
+   add (slot, &slot->accept_errors, 1);
+}
+
+void webc_metrics_request (enum webc_method_t method, int status,
+                           const struct webc_conn_t *conn)
+{
+   struct slot_t *slot = slot_get ();
+   size_t class = status >= 100 && status < 600 ? status / 100 : 0;
+   const uint64_t *stamps = conn->stamps;
+
+   if ((size_t)method >= NMETHODS)
+      method = webc_method_UNKNOWN;
+
+   add (slot, &slot->requests[method][class], 1);
+   add (slot, &slot->bytes_in, conn->bytes_received);
+   add (slot, &slot->bytes_out, conn->bytes_sent);
+
+   uint64_t end = stamps[webc_conn_LAST_BYTE];
+   if (!end)
+      end = webc_accesslog_now ();
+   hist_add (slot, &slot->latency, end - stamps[webc_conn_ACCEPTED]);
+
+   // A phase is recorded only if the request got to both ends of it. The
+   // handler usually writes all of the response, so send is then 0.
+   for (size_t p=0; p<NPHASES; p++) {
+      uint64_t from = stamps[g_phases[p].from], to = stamps[g_phases[p].to];
+      if (from && to)
+         hist_add (slot, &slot->phases[p], to > from ? to - from : 0);
+   }
+}
+
+int webc_metrics_handler (int                       fd,
+                          char                     *remote_addr,
+                          uint16_t                  remote_port,
+                          enum webc_method_t        method,
+                          enum webc_http_version_t  version,
+                          const char               *resource,
+                          char                    **rqst_headers,
+                          webc_header_t            *rsp_headers,
+                          char                     *vars)
+{
+   (void)remote_addr;
+   (void)remote_port;
+   (void)method;
+   (void)version;
+   (void)resource;
+   (void)rqst_headers;
+   (void)vars;
+
+   struct totals_t *totals = calloc (1, sizeof *totals);
+   char *body = NULL;
+   size_t body_len = 0;
+   FILE *outf = NULL;
+   int ret = 500;
+
+   if (!totals || !(outf = open_memstream (&body, &body_len)))
+      goto errorexit;
+
+   size_t nslots = atomic_load (&g_nslots);
+   for (size_t i=0; i<nslots; i++)
+      totals_add (totals, &g_slots[i]);
+   totals_add (totals, &g_shared);
+
+   totals_print (outf, totals);
+   if ((fclose (outf))!=0) {
+      outf = NULL;
+      goto errorexit;
+   }
+   outf = NULL;
+
+   char slen[25];
+   snprintf (slen, sizeof slen, "%zu", body_len);
+   webc_header_set (rsp_headers, webc_header_CONTENT_TYPE,
+                    "text/plain; version=0.0.4");
+   webc_header_set (rsp_headers, webc_header_CONTENT_LENGTH, slen);
+
+   const char *rsp = webc_get_http_rspstr (200);
+   if (!(webc_conn_write (fd, rsp, strlen (rsp))) ||
+       !(webc_header_write (rsp_headers, fd)) ||
+       !(webc_conn_write (fd, body, body_len)))
+      WEBC_UTIL_LOG ("Failed to send metrics\n");
+
+   ret = 200;
+
+errorexit:
+   if (outf)
+      fclose (outf);
+   free (body);
+   free (totals);
+   return ret;
+}
+
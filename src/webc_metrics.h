@@ -0,0 +1,56 @@
+
+#ifndef H_METRICS
+#define H_METRICS
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "webc_resource.h"
+#include "webc_conn.h"
+
+/* Server metrics, served in the Prometheus text format by
+ * webc_metrics_handler() (registered at METRICS_PATH, webc_config.h).
+ *
+ * Each thread records into a slot of its own, padded to a cache line, and
+ * is the only writer of that slot, so recording takes no lock and no
+ * atomic read-modify-write. A slot is kept when its thread ends and taken
+ * over by the next thread, so nothing is lost. The handler adds up all
+ * the slots when it is asked for the metrics.
+ *
+ * Latencies are kept in log-bucketed histograms: every power of two from
+ * 1us up is split into four buckets, so a bucket is at most a quarter of
+ * its value wide. Besides the whole request, from accept() to the last
+ * byte sent, there is one histogram for each phase between the stamps of
+ * webc_conn_t: queue (accepted to first byte read), headers, route,
+ * handler and send (handler return to last byte, for what the server
+ * itself writes after the handler).
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   void webc_metrics_conn_begin (void);
+   void webc_metrics_conn_end (void);
+   void webc_metrics_accept_error (void);
+
+   // A completed request, with the bytes and stamps from conn.
+   void webc_metrics_request (enum webc_method_t method, int status,
+                              const struct webc_conn_t *conn);
+
+   int webc_metrics_handler (int                       fd,
+                             char                     *remote_addr,
+                             uint16_t                  remote_port,
+                             enum webc_method_t        method,
+                             enum webc_http_version_t  version,
+                             const char               *resource,
+                             char                    **rqst_headers,
+                             webc_header_t            *rsp_headers,
+                             char                     *vars);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
@@ -0,0 +1,184 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "webc_mime.h"
+#include "webc_util.h"
+
+/* The built-in table, generated from mime.types by tools/webc_mimegen.c
+ * into webc_mime_table.c at build time.
+ */
+extern const size_t webc_mime_table_nentries;
+extern const size_t webc_mime_table_nbuckets;
+extern const size_t webc_mime_table_nslots;
+extern const uint32_t webc_mime_table_seeds[];
+extern const struct webc_mime_entry_t webc_mime_table_slots[];
+
+// Longest extension we will look up; anything longer cannot be in either
+// table.
+#define MAX_EXT_LEN     (31)
+
+/* *************************************************************** */
+
+/* Overrides loaded at startup from a config file. This is a plain open
+ * addressing table; it is written only before the server starts and is
+ * read-only afterwards.
+ */
+static struct webc_mime_entry_t *g_overrides = NULL;
+static size_t g_overrides_len = 0;
+static size_t g_overrides_count = 0;
+
+static void webc_mime_overrides_free (void)
+{
+   for (size_t i=0; i<g_overrides_len; i++) {
+      free ((char *)g_overrides[i].ext);
+      free ((char *)g_overrides[i].type);
+   }
+   free (g_overrides);
+   g_overrides = NULL;
+   g_overrides_len = 0;
+   g_overrides_count = 0;
+}
+
+static struct webc_mime_entry_t *overrides_slot (struct webc_mime_entry_t *table,
+                                                 size_t table_len,
+                                                 const char *ext, size_t ext_len)
+{
+   size_t idx = webc_mime_hash (ext, ext_len, 0) & (table_len - 1);
+   while (table[idx].ext) {
+      if ((stricmp (table[idx].ext, ext))==0)
+         break;
+      idx = (idx + 1) & (table_len - 1);
+   }
+   return &table[idx];
+}
+
+static bool overrides_set (const char *ext, const char *type)
+{
+   size_t ext_len = strlen (ext);
+
+   if (ext_len > MAX_EXT_LEN) {
+      WEBC_UTIL_LOG ("Ignoring mime extension [%s], too long\n", ext);
+      return true;
+   }
+
+   if ((g_overrides_count + 1) * 2 > g_overrides_len) {
+      size_t newlen = g_overrides_len ? g_overrides_len * 2 : 64;
+      struct webc_mime_entry_t *tmp = calloc (newlen, sizeof *tmp);
+      if (!tmp)
+         return false;
+      for (size_t i=0; i<g_overrides_len; i++) {
+         if (!g_overrides[i].ext)
+            continue;
+         *overrides_slot (tmp, newlen, g_overrides[i].ext,
+                          strlen (g_overrides[i].ext)) = g_overrides[i];
+      }
+      free (g_overrides);
+      g_overrides = tmp;
+      g_overrides_len = newlen;
+   }
+
+   struct webc_mime_entry_t *slot = overrides_slot (g_overrides, g_overrides_len,
+                                                    ext, ext_len);
+   char *newtype = strdup (type);
+   char *newext = slot->ext ? NULL : strdup (ext);
+   if (!newtype || (!slot->ext && !newext)) {
+      free (newtype);
+      free (newext);
+      return false;
+   }
+
+   if (!slot->ext) {
+      slot->ext = newext;
+      g_overrides_count++;
+   }
+   free ((char *)slot->type);
+   slot->type = newtype;
+
+   return true;
+}
+
+bool webc_mime_load (const char *fname)
+{
+   static bool registered = false;
+   bool error = true;
+   char *line = NULL;
+   size_t line_len = 0;
+
+   FILE *inf = fopen (fname, "r");
+   if (!inf) {
+      WEBC_UTIL_LOG ("Failed to open mime types file [%s]: %m\n", fname);
+      return false;
+   }
+
+   if (!registered) {
+      atexit (webc_mime_overrides_free);
+      registered = true;
+   }
+
+   while ((getline (&line, &line_len, inf)) > 0) {
+      char *tmp = strchr (line, '#');
+      if (tmp)
+         *tmp = 0;
+
+      char *saveptr = NULL;
+      char *type = strtok_r (line, " \t\r\n", &saveptr);
+      if (!type)
+         continue;
+
+      char *ext;
+      while ((ext = strtok_r (NULL, " \t\r\n", &saveptr))) {
+         if (!(overrides_set (ext, type))) {
+            WEBC_UTIL_LOG ("OOM error loading mime types\n");
+            goto errorexit;
+         }
+      }
+   }
+
+   WEBC_UTIL_LOG ("Loaded %zu mime type overrides from [%s]\n",
+                  g_overrides_count, fname);
+   error = false;
+
+errorexit:
+   free (line);
+   fclose (inf);
+   return !error;
+}
+
+/* *************************************************************** */
+
+const char *webc_mime_type (const char *fname)
+{
+   if (!fname)
+      return WEBC_MIME_DEFAULT;
+
+   const char *ext = strrchr (fname, '.');
+   if (!ext || strchr (ext, '/'))
+      return WEBC_MIME_DEFAULT;
+
+   ext++;
+   size_t ext_len = strlen (ext);
+   if (!ext_len || ext_len > MAX_EXT_LEN)
+      return WEBC_MIME_DEFAULT;
+
+   if (g_overrides_count) {
+      struct webc_mime_entry_t *slot = overrides_slot (g_overrides,
+                                                       g_overrides_len,
+                                                       ext, ext_len);
+      if (slot->ext)
+         return slot->type;
+   }
+
+   size_t bucket = webc_mime_hash (ext, ext_len, 0) % webc_mime_table_nbuckets;
+   size_t idx = webc_mime_hash (ext, ext_len, webc_mime_table_seeds[bucket])
+                  % webc_mime_table_nslots;
+
+   const struct webc_mime_entry_t *entry = &webc_mime_table_slots[idx];
+   if (entry->ext && (stricmp (entry->ext, ext))==0)
+      return entry->type;
+
+   return WEBC_MIME_DEFAULT;
+}
+
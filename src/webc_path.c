@@ -0,0 +1,397 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <limits.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#ifdef SYS_openat2
+#include <linux/openat2.h>
+#endif
+
+#include <pthread.h>
+
+#include "webc_path.h"
+#include "webc_fswatch.h"
+#include "webc_config.h"
+#include "webc_util.h"
+
+// How often openat2() is retried when the kernel reports a concurrent
+// rename that it could not safely resolve across.
+#define OPENAT2_RETRIES       (4)
+
+/* The cache of parent directory fds is direct-mapped: each path hashes to
+ * exactly one slot, and a new entry replaces whatever was there. Entries
+ * are refcounted so that a replaced or invalidated fd is only closed once
+ * the last request using it is done with it.
+ */
+struct dirfd_entry_t {
+   char     *path;
+   int       fd;
+   time_t    opened;
+
+   // Set when no filesystem event could have been missed between opening
+   // the fd and storing the entry.
+   bool      trusted;
+
+   size_t    refcount;
+};
+
+struct webc_path_t {
+   int                     root_fd;
+   webc_fswatch_t         *fswatch;
+
+   pthread_mutex_t         lock;
+   struct dirfd_entry_t   *slots[PATH_DIRFD_CACHE_SIZE];
+};
+
+static atomic_bool g_no_openat2 = false;
+
+/* *************************************************************** */
+
+static time_t now_secs (void)
+{
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec;
+}
+
+static size_t path_hash (const char *path)
+{
+   uint32_t h = 2166136261u;
+   while (*path) {
+      h ^= (uint8_t)*path++;
+      h *= 16777619u;
+   }
+   return h % PATH_DIRFD_CACHE_SIZE;
+}
+
+// Opens path component by component, for kernels without openat2(). ".."
+// is refused outright, so that the result is always beneath dirfd unless
+// a symlink is followed.
+static int resolve_walk (int dirfd, const char *path, int flags)
+{
+   char buf[PATH_MAX];
+   char *saveptr = NULL;
+   int cur = dirfd;
+
+   if (strlen (path) >= sizeof buf) {
+      errno = ENAMETOOLONG;
+      return -1;
+   }
+   strcpy (buf, path);
+
+   char *comp = strtok_r (buf, "/", &saveptr);
+   if (!comp)
+      return openat (dirfd, ".", flags);
+
+   while (comp) {
+      char *next = strtok_r (NULL, "/", &saveptr);
+
+      if ((strcmp (comp, ".."))==0) {
+         errno = EXDEV;
+         break;
+      }
+
+      int oflags = next ? O_PATH | O_DIRECTORY | O_CLOEXEC : flags;
+      if (!FOLLOW_SYMLINKS)
+         oflags |= O_NOFOLLOW;
+
+      int fd = openat (cur, comp, oflags);
+      if (cur != dirfd) {
+         int errnum = errno;
+         close (cur);
+         errno = errnum;
+      }
+
+      if (fd < 0 || !next) {
+         return fd;
+      }
+
+      cur = fd;
+      comp = next;
+   }
+
+   if (cur != dirfd) {
+      int errnum = errno;
+      close (cur);
+      errno = errnum;
+   }
+
+   return -1;
+}
+
+static int resolve (int dirfd, const char *path, int flags)
+{
+   flags |= O_CLOEXEC;
+
+#ifdef SYS_openat2
+   if (!atomic_load_explicit (&g_no_openat2, memory_order_relaxed)) {
+      struct open_how how;
+      memset (&how, 0, sizeof how);
+      how.flags = flags;
+      how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+      if (!FOLLOW_SYMLINKS)
+         how.resolve |= RESOLVE_NO_SYMLINKS;
+
+      long fd = -1;
+      for (int i=0; i<OPENAT2_RETRIES; i++) {
+         fd = syscall (SYS_openat2, dirfd, path, &how, sizeof how);
+         if (fd >= 0 || (errno != EAGAIN && errno != EINTR))
+            break;
+      }
+
+      if (fd >= 0 || errno != ENOSYS)
+         return (int)fd;
+
+      if (!atomic_exchange (&g_no_openat2, true)) {
+         WEBC_UTIL_LOG ("openat2() is not available, resolving paths with "
+                        "openat()%s\n",
+                        FOLLOW_SYMLINKS ? "; symlinks may leave the web root"
+                                        : "");
+      }
+   }
+#endif
+
+   return resolve_walk (dirfd, path, flags);
+}
+
+static void entry_unref (struct dirfd_entry_t *entry)
+{
+   if (entry && --entry->refcount == 0) {
+      close (entry->fd);
+      free (entry->path);
+      free (entry);
+   }
+}
+
+static void slot_clear (webc_path_t *wp, size_t slot)
+{
+   entry_unref (wp->slots[slot]);
+   wp->slots[slot] = NULL;
+}
+
+// Called by the filesystem watcher. Any change to a directory entry may be
+// a rename or removal of a directory, which makes the fds for it and for
+// everything below it stale.
+static void cb_fswatch (const char *dir, const char *name, void *udata)
+{
+   webc_path_t *wp = udata;
+   char *prefix = NULL;
+
+   if (dir && name && dir[0])
+      webc_util_sprintf (&prefix, NULL, "%s/%s", dir, name);
+
+   const char *key = !dir ? "" : !name ? dir : dir[0] ? prefix : name;
+   if (!key) // OOM, so flush everything
+      key = "";
+
+   size_t key_len = strlen (key);
+
+   pthread_mutex_lock (&wp->lock);
+   for (size_t i=0; i<PATH_DIRFD_CACHE_SIZE; i++) {
+      struct dirfd_entry_t *entry = wp->slots[i];
+      if (!entry)
+         continue;
+      if (key_len == 0 ||
+            ((strncmp (entry->path, key, key_len))==0 &&
+             (entry->path[key_len] == 0 || entry->path[key_len] == '/')))
+         slot_clear (wp, i);
+   }
+   pthread_mutex_unlock (&wp->lock);
+
+   free (prefix);
+}
+
+// Returns an fd for the directory path, which is relative to the root. If
+// *entry is set on return the fd belongs to that entry, which must be
+// released; otherwise the caller must close the fd.
+static int dirfd_get (webc_path_t *wp, const char *path,
+                      struct dirfd_entry_t **entry)
+{
+   size_t slot = path_hash (path);
+
+   *entry = NULL;
+
+   pthread_mutex_lock (&wp->lock);
+   struct dirfd_entry_t *cur = wp->slots[slot];
+   if (cur && (strcmp (cur->path, path))==0) {
+      bool reliable = webc_fswatch_reliable (wp->fswatch);
+      if ((reliable && cur->trusted) ||
+          now_secs () - cur->opened < FSWATCH_TTL_SECS) {
+         cur->refcount++;
+         *entry = cur;
+      }
+   }
+   pthread_mutex_unlock (&wp->lock);
+
+   if (*entry)
+      return (*entry)->fd;
+
+   uint64_t generation = webc_fswatch_generation (wp->fswatch);
+
+   int fd = resolve (wp->root_fd, path, O_PATH | O_DIRECTORY);
+   if (fd < 0)
+      return -1;
+
+   struct dirfd_entry_t *newent = calloc (1, sizeof *newent);
+   if (!newent || !(newent->path = strdup (path))) {
+      // Not cached, but the request can still go ahead.
+      free (newent);
+      return fd;
+   }
+
+   newent->fd = fd;
+   newent->opened = now_secs ();
+   newent->refcount = 2; // One for the cache, one for the caller
+
+   pthread_mutex_lock (&wp->lock);
+   newent->trusted = webc_fswatch_reliable (wp->fswatch)
+                  && webc_fswatch_generation (wp->fswatch) == generation;
+   slot_clear (wp, slot);
+   wp->slots[slot] = newent;
+   pthread_mutex_unlock (&wp->lock);
+
+   *entry = newent;
+   return fd;
+}
+
+static void dirfd_put (webc_path_t *wp, int fd, struct dirfd_entry_t *entry)
+{
+   if (!entry) {
+      close (fd);
+      return;
+   }
+
+   pthread_mutex_lock (&wp->lock);
+   entry_unref (entry);
+   pthread_mutex_unlock (&wp->lock);
+}
+
+/* *************************************************************** */
+
+webc_path_t *webc_path_new (int root_fd, webc_fswatch_t *fswatch)
+{
+   webc_path_t *ret = calloc (1, sizeof *ret);
+   if (!ret) {
+      WEBC_UTIL_LOG ("OOM error opening the web root\n");
+      return NULL;
+   }
+
+   if ((ret->root_fd = fcntl (root_fd, F_DUPFD_CLOEXEC, 0)) < 0) {
+      WEBC_UTIL_LOG ("Failed to duplicate the web root fd %i: %m\n", root_fd);
+      free (ret);
+      return NULL;
+   }
+
+   pthread_mutex_init (&ret->lock, NULL);
+   ret->fswatch = fswatch;
+
+   if (fswatch && !(webc_fswatch_subscribe (fswatch, cb_fswatch, ret))) {
+      WEBC_UTIL_LOG ("Failed to subscribe to filesystem changes, directory fds "
+                     "will use %i-second revalidation\n", FSWATCH_TTL_SECS);
+      // Nothing would invalidate the entries, so they are revalidated as
+      // if there were no watcher.
+      ret->fswatch = NULL;
+   }
+
+   return ret;
+}
+
+void webc_path_del (webc_path_t *wp)
+{
+   if (!wp)
+      return;
+
+   for (size_t i=0; i<PATH_DIRFD_CACHE_SIZE; i++) {
+      slot_clear (wp, i);
+   }
+   pthread_mutex_destroy (&wp->lock);
+   close (wp->root_fd);
+   free (wp);
+}
+
+int webc_path_open (webc_path_t *wp, const char *resource, int flags)
+{
+   char path[PATH_MAX];
+
+   if (!wp) {
+      errno = ENOENT;
+      return -1;
+   }
+
+   while (*resource == '/')
+      resource++;
+
+   size_t len = strlen (resource);
+   while (len && resource[len - 1] == '/')
+      len--;
+
+   if (len >= sizeof path) {
+      errno = ENAMETOOLONG;
+      return -1;
+   }
+
+   if (len == 0)
+      return resolve (wp->root_fd, ".", flags);
+
+   memcpy (path, resource, len);
+   path[len] = 0;
+
+   char *leaf = strrchr (path, '/');
+   if (!leaf)
+      return resolve (wp->root_fd, path, flags);
+
+   *leaf++ = 0;
+
+   struct dirfd_entry_t *entry = NULL;
+   int dirfd = dirfd_get (wp, path, &entry);
+   if (dirfd < 0)
+      return -1;
+
+   int ret = resolve (dirfd, leaf, flags);
+
+   int errnum = errno;
+   dirfd_put (wp, dirfd, entry);
+   errno = errnum;
+
+   // Resolving beneath the parent refuses a symlink that climbs out of it
+   // even if it stays beneath the root, so that case is decided from the
+   // root.
+   if (ret < 0 && errnum == EXDEV && FOLLOW_SYMLINKS) {
+      leaf[-1] = '/';
+      ret = resolve (wp->root_fd, path, flags);
+   }
+
+   return ret;
+}
+
+int webc_path_errno_status (int errnum)
+{
+   switch (errnum) {
+      case EACCES:
+      case EPERM:
+      case EXDEV:
+      case ELOOP:
+         return 403;
+
+      case EMFILE:
+      case ENFILE:
+      case ENOMEM:
+         return 500;
+
+      default:
+         return 404;
+   }
+}
+
@@ -0,0 +1,54 @@
+
+#ifndef H_PATH
+#define H_PATH
+
+#include <stdbool.h>
+
+/* Resolution of resources against the web root. A directory fd for the
+ * root is held open and every resource is opened relative to it with
+ * openat2(RESOLVE_BENEATH), so the kernel refuses any path (including
+ * one through a symlink) that would leave the root. When FOLLOW_SYMLINKS
+ * is off, RESOLVE_NO_SYMLINKS is added as well.
+ *
+ * The directory fds of recently used parent directories are cached, so
+ * that resolving "a/b/c/file" only walks "file" on a hit. Cached fds are
+ * invalidated by the filesystem watcher (webc_fswatch.h).
+ *
+ * On kernels without openat2() the path is walked one component at a time
+ * with openat(), refusing "..". In that case symlinks are either refused
+ * (FOLLOW_SYMLINKS off) or followed without the beneath check.
+ *
+ * Each server (see webc_server.h) has one of these over its own root.
+ */
+
+#include "webc_fswatch.h"
+
+typedef struct webc_path_t webc_path_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Resolves resources beneath root_fd, a directory fd that the caller
+   // keeps (this holds a duplicate of it). fswatch, if not NULL, must be
+   // watching the same directory and must outlive the webc_path_t.
+   webc_path_t *webc_path_new (int root_fd, webc_fswatch_t *fswatch);
+   void webc_path_del (webc_path_t *wp);
+
+   // Open resource, which is relative to the web root (a leading '/' is
+   // ignored, and "" is the root itself), with the given open() flags.
+   // O_CLOEXEC is always added. Returns the fd, or -1 with errno set; an
+   // attempt to leave the root fails with EXDEV, and a refused symlink
+   // with ELOOP. With no web root (wp NULL) every resource fails with
+   // ENOENT.
+   int webc_path_open (webc_path_t *wp, const char *resource, int flags);
+
+   // The HTTP status to report for an errno from the functions above.
+   int webc_path_errno_status (int errnum);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
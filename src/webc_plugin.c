@@ -0,0 +1,300 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+
+#include <pthread.h>
+
+#include "webc_plugin.h"
+#include "webc_resource.h"
+#include "webc_config.h"
+#include "webc_util.h"
+
+typedef bool (plugin_init_t) (void);
+typedef bool (plugin_load_handlers_t) (void);
+typedef void (plugin_unload_t) (void);
+
+struct plugin_t {
+   char                    *fname;
+   unsigned                 generation;
+   void                    *handle;
+   plugin_init_t           *init;
+   plugin_load_handlers_t  *load_handlers;
+   plugin_unload_t         *unload;
+
+   // The number of requests running one of this version's handlers, which
+   // is the owner of its routes (see webc_resource_global_handler_owner()).
+   atomic_size_t            refs;
+
+   struct plugin_t         *next;
+};
+
+// The loaded plugins, and the old versions that are draining. Both lists
+// are only changed with g_lock held.
+static struct plugin_t *g_plugins = NULL;
+static struct plugin_t *g_retired = NULL;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* *************************************************************** */
+
+static void plugin_del (struct plugin_t *plugin)
+{
+   if (!plugin)
+      return;
+
+   if (plugin->handle) {
+      if (plugin->unload)
+         plugin->unload ();
+      dlclose (plugin->handle);
+   }
+   free (plugin->fname);
+   free (plugin);
+}
+
+// dlopen() returns the handle it already has for a file that is still
+// open, so each version is loaded from a copy of its own, which is removed
+// as soon as it is mapped.
+static char *plugin_copy (const char *fname)
+{
+   char *ret = NULL;
+   int fd_src = -1, fd_dst = -1;
+   char buf[64 * 1024];
+   ssize_t nbytes;
+
+   if (!(webc_util_sprintf (&ret, NULL, "%s/webc-plugin-XXXXXX.so",
+                            PLUGIN_COPY_DIR)))
+      return NULL;
+
+   if ((fd_src = open (fname, O_RDONLY | O_CLOEXEC)) < 0) {
+      WEBC_UTIL_LOG ("Failed to open plugin [%s]: %m\n", fname);
+      goto errorexit;
+   }
+
+   if ((fd_dst = mkostemps (ret, 3, O_CLOEXEC)) < 0) {
+      WEBC_UTIL_LOG ("Failed to create [%s]: %m\n", ret);
+      goto errorexit;
+   }
+
+   while ((nbytes = read (fd_src, buf, sizeof buf)) > 0) {
+      if ((write (fd_dst, buf, nbytes)) != nbytes) {
+         WEBC_UTIL_LOG ("Failed to write [%s]: %m\n", ret);
+         goto errorexit;
+      }
+   }
+   if (nbytes < 0) {
+      WEBC_UTIL_LOG ("Failed to read plugin [%s]: %m\n", fname);
+      goto errorexit;
+   }
+
+   close (fd_src);
+   if ((close (fd_dst))!=0) {
+      WEBC_UTIL_LOG ("Failed to write [%s]: %m\n", ret);
+      unlink (ret);
+      free (ret);
+      return NULL;
+   }
+
+   return ret;
+
+errorexit:
+   if (fd_src >= 0)
+      close (fd_src);
+   if (fd_dst >= 0) {
+      close (fd_dst);
+      unlink (ret);
+   }
+   free (ret);
+   return NULL;
+}
+
+static struct plugin_t *plugin_open (const char *fname, unsigned generation)
+{
+   struct plugin_t *ret = NULL;
+   char *copy = NULL;
+
+   if (!(ret = calloc (1, sizeof *ret)) ||
+       !(ret->fname = strdup (fname))) {
+      WEBC_UTIL_LOG ("OOM error loading plugin [%s]\n", fname);
+      goto errorexit;
+   }
+   ret->generation = generation;
+   atomic_init (&ret->refs, 0);
+
+   if (!(copy = plugin_copy (fname)))
+      goto errorexit;
+
+   ret->handle = dlopen (copy, RTLD_NOW | RTLD_LOCAL);
+   unlink (copy);
+   if (!ret->handle) {
+      WEBC_UTIL_LOG ("Failed to load plugin [%s]: %s\n", fname, dlerror ());
+      goto errorexit;
+   }
+
+   // POSIX has no way to convert the void * from dlsym() to a function
+   // pointer, but requires that this works.
+   *(void **)&ret->init = dlsym (ret->handle, "webc_plugin_init");
+   *(void **)&ret->load_handlers = dlsym (ret->handle,
+                                          "webc_plugin_load_handlers");
+   *(void **)&ret->unload = dlsym (ret->handle, "webc_plugin_unload");
+   if (!ret->load_handlers) {
+      WEBC_UTIL_LOG ("Plugin [%s] has no webc_plugin_load_handlers()\n",
+                     fname);
+      goto errorexit;
+   }
+
+   free (copy);
+   return ret;
+
+errorexit:
+   // The plugin was not initialised, so it must not be told to unload.
+   if (ret)
+      ret->unload = NULL;
+   plugin_del (ret);
+   free (copy);
+   return NULL;
+}
+
+// Registers the routes of plugin, which all belong to it. On failure none
+// of them are left. The caller holds the route lock.
+static bool plugin_register (struct plugin_t *plugin)
+{
+   bool ok;
+
+   webc_resource_global_handler_owner (&plugin->refs);
+   ok = (!plugin->init || plugin->init ()) && plugin->load_handlers ();
+   webc_resource_global_handler_owner (NULL);
+
+   if (!ok) {
+      WEBC_UTIL_LOG ("Plugin [%s] failed to load its handlers\n",
+                     plugin->fname);
+      webc_resource_global_handler_remove_owner (&plugin->refs);
+   }
+
+   return ok;
+}
+
+/* *************************************************************** */
+
+bool webc_plugin_load (const char *fname)
+{
+   struct plugin_t *plugin = plugin_open (fname, 1);
+   if (!plugin)
+      return false;
+
+   if (!(plugin_register (plugin))) {
+      plugin_del (plugin);
+      return false;
+   }
+
+   pthread_mutex_lock (&g_lock);
+   plugin->next = g_plugins;
+   g_plugins = plugin;
+   pthread_mutex_unlock (&g_lock);
+
+   WEBC_UTIL_LOG ("Loaded plugin [%s]\n", fname);
+   return true;
+}
+
+bool webc_plugin_reload (void)
+{
+   bool ret = true;
+
+   // The route lock is always taken before g_lock, as webc_plugin_load()
+   // is called with it held.
+   if (!(webc_resource_global_handler_lock ()))
+      return false;
+
+   pthread_mutex_lock (&g_lock);
+
+   for (struct plugin_t **cur = &g_plugins; *cur; cur = &(*cur)->next) {
+      struct plugin_t *old = *cur;
+      struct plugin_t *new = plugin_open (old->fname, old->generation + 1);
+
+      if (!new || !(plugin_register (new))) {
+         WEBC_UTIL_LOG ("Keeping generation %u of plugin [%s]\n",
+                        old->generation, old->fname);
+         plugin_del (new);
+         ret = false;
+         continue;
+      }
+
+      webc_resource_global_handler_remove_owner (&old->refs);
+
+      new->next = old->next;
+      *cur = new;
+      old->next = g_retired;
+      g_retired = old;
+
+      WEBC_UTIL_LOG ("Reloaded plugin [%s], generation %u\n", new->fname,
+                     new->generation);
+   }
+
+   // Once this returns no request can find the routes of the retired
+   // versions, so their reference counts only go down from here. Until
+   // then they must not be reaped.
+   if (!(webc_resource_global_handler_unlock ()))
+      ret = false;
+
+   pthread_mutex_unlock (&g_lock);
+
+   webc_plugin_reap ();
+
+   return ret;
+}
+
+void webc_plugin_reap (void)
+{
+   pthread_mutex_lock (&g_lock);
+
+   struct plugin_t **cur = &g_retired;
+   while (*cur) {
+      struct plugin_t *plugin = *cur;
+      if (atomic_load (&plugin->refs)) {
+         cur = &plugin->next;
+         continue;
+      }
+
+      *cur = plugin->next;
+      WEBC_UTIL_LOG ("Unloading generation %u of plugin [%s]\n",
+                     plugin->generation, plugin->fname);
+      plugin_del (plugin);
+   }
+
+   pthread_mutex_unlock (&g_lock);
+}
+
+size_t webc_plugin_list (webc_plugin_list_cb_t *fptr, void *ctx)
+{
+   size_t ret = 0;
+
+   pthread_mutex_lock (&g_lock);
+   for (struct plugin_t *plugin = g_plugins; plugin; plugin = plugin->next) {
+      fptr (ctx, plugin->fname, plugin->generation,
+            atomic_load (&plugin->refs));
+      ret++;
+   }
+   pthread_mutex_unlock (&g_lock);
+
+   return ret;
+}
+
+size_t webc_plugin_retired (void)
+{
+   size_t ret = 0;
+
+   pthread_mutex_lock (&g_lock);
+   for (struct plugin_t *plugin = g_retired; plugin; plugin = plugin->next)
+      ret++;
+   pthread_mutex_unlock (&g_lock);
+
+   return ret;
+}
+
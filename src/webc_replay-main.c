@@ -0,0 +1,567 @@
+/* ***************************************************************************
+ * Plays back a capture made with the server's --capture=<file> option
+ * (see webc_capture.h) against a server:
+ *
+ *    webc_replay-main [--host=<addr>] [--port=<n>] [--threads=<n>] [--fast]
+ *                     [--diffs=<n>] <capture-file>
+ *
+ * Each captured connection is opened again and sent the same bytes, and
+ * the response is read until the server closes the connection. By default
+ * the connections are opened at the same offsets from the first one as
+ * they were when captured, and each chunk of a request is sent at its
+ * offset from the start of its connection. With --fast the connections
+ * are opened as soon as a thread is free and each request is sent whole.
+ * Connections are played by --threads threads (default 16), each playing
+ * one connection at a time, so a capture with more connections open at
+ * once than that is played back late; the late count says how often.
+ *
+ * Output is one line of key=value pairs per item: the settings and totals,
+ * then the latency percentiles in milliseconds as captured (from accept()
+ * to the last byte sent, measured by the server), as replayed (from
+ * connect() to the close, measured here) and the difference between the
+ * two for each connection. Then comes one line for each of the first
+ * --diffs (default 20) connections whose status or response size differed.
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <pthread.h>
+
+#include "webc_replay-main.h"
+#include "webc_capture.h"
+#include "webc_config.h"
+#include "webc_util.h"
+
+#define RBUF_SIZE          (16 * 1024)
+#define RECV_TIMEOUT_SECS  (10)
+#define LATE_NS            (1000000)
+#define MAX_RQST_LINE      (80)
+
+#define ENTRY_LEN(n)       (((n) + 7) & ~(size_t)7)
+
+struct replay_t {
+   const struct webc_capture_conn_t   *rec;
+   size_t                              id;      // Position in the file
+
+   bool        error;
+   bool        late;
+   int         status;
+   uint64_t    bytes;
+   uint64_t    latency_ns;
+};
+
+static struct sockaddr_in g_addr;
+static size_t g_threads = 16;
+static bool g_fast = false;
+static size_t g_diffs = 20;
+
+static struct replay_t *g_replays = NULL;
+static size_t g_nreplays = 0;
+static atomic_size_t g_next = 0;
+
+static uint64_t g_start_ns;
+static uint64_t g_first_accept_ns;
+
+
+/* *************************************************************** */
+
+static uint64_t now_ns (void)
+{
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void sleep_until (uint64_t ns)
+{
+   struct timespec ts = {
+      .tv_sec = ns / 1000000000u,
+      .tv_nsec = ns % 1000000000u,
+   };
+   while ((clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))==EINTR)
+      ;
+}
+
+static const struct webc_capture_chunk_t *chunk_first (const struct webc_capture_conn_t *rec)
+{
+   return rec->nchunks ? (const void *)&rec[1] : NULL;
+}
+
+static const struct webc_capture_chunk_t *chunk_next (const struct webc_capture_chunk_t *chunk)
+{
+   return (const void *)&chunk->data[ENTRY_LEN (chunk->len)];
+}
+
+/* *************************************************************** */
+
+static char *capture_load (const char *fname, size_t *len)
+{
+   bool error = true;
+   FILE *inf = NULL;
+   char *buf = NULL;
+   struct stat sb;
+
+   if (!(inf = fopen (fname, "rb")) || (fstat (fileno (inf), &sb))!=0) {
+      fprintf (stderr, "Failed to open [%s]: %m\n", fname);
+      goto errorexit;
+   }
+
+   if (!(buf = malloc (sb.st_size + 1))) {
+      fprintf (stderr, "OOM error reading [%s]\n", fname);
+      goto errorexit;
+   }
+
+   if ((fread (buf, 1, sb.st_size, inf))!=(size_t)sb.st_size) {
+      fprintf (stderr, "Failed to read [%s]\n", fname);
+      goto errorexit;
+   }
+
+   *len = sb.st_size;
+   error = false;
+
+errorexit:
+   if (inf)
+      fclose (inf);
+   if (error) {
+      free (buf);
+      buf = NULL;
+   }
+   return buf;
+}
+
+// Checks that each chunk of rec lies within it.
+static bool record_valid (const struct webc_capture_conn_t *rec)
+{
+   const char *end = (const char *)rec + rec->len;
+   const struct webc_capture_chunk_t *chunk = chunk_first (rec);
+
+   for (size_t i=0; i<rec->nchunks; i++) {
+      if ((const char *)chunk->data > end ||
+          (size_t)(end - chunk->data) < ENTRY_LEN (chunk->len))
+         return false;
+      chunk = chunk_next (chunk);
+   }
+   return true;
+}
+
+static int cb_replay_cmp (const void *lhs, const void *rhs)
+{
+   const struct replay_t *l = lhs, *r = rhs;
+   if (l->rec->accept_ns != r->rec->accept_ns)
+      return l->rec->accept_ns < r->rec->accept_ns ? -1 : 1;
+   return (l->id > r->id) - (l->id < r->id);
+}
+
+static bool replays_index (const char *fname, const char *buf, size_t len)
+{
+   const struct webc_capture_header_t *header = (const void *)buf;
+
+   if (len < sizeof *header ||
+       (memcmp (header->magic, WEBC_CAPTURE_MAGIC, sizeof header->magic))!=0 ||
+       header->header_len < sizeof *header || header->header_len > len) {
+      fprintf (stderr, "[%s] is not a capture file\n", fname);
+      return false;
+   }
+   if (header->version != WEBC_CAPTURE_VERSION) {
+      fprintf (stderr, "[%s] is version %" PRIu32 ", expected %i\n",
+               fname, header->version, WEBC_CAPTURE_VERSION);
+      return false;
+   }
+
+   for (size_t offs = header->header_len; offs < len; ) {
+      const struct webc_capture_conn_t *rec = (const void *)&buf[offs];
+
+      if (len - offs < sizeof *rec || rec->len < sizeof *rec ||
+          rec->len % 8 || rec->len > len - offs || !(record_valid (rec))) {
+         // A server that was killed can leave a record cut short.
+         fprintf (stderr, "[%s] is damaged at offset %zu, ignoring the rest\n",
+                  fname, offs);
+         break;
+      }
+
+      struct replay_t *tmp = realloc (g_replays, (g_nreplays + 1) * sizeof *tmp);
+      if (!tmp) {
+         fprintf (stderr, "OOM error reading [%s]\n", fname);
+         return false;
+      }
+      g_replays = tmp;
+      memset (&g_replays[g_nreplays], 0, sizeof g_replays[g_nreplays]);
+      g_replays[g_nreplays].rec = rec;
+      g_replays[g_nreplays].id = g_nreplays;
+      g_nreplays++;
+
+      offs += rec->len;
+   }
+
+   // Records are written as connections end; they are played back in the
+   // order they started.
+   qsort (g_replays, g_nreplays, sizeof *g_replays, cb_replay_cmp);
+   return true;
+}
+
+/* *************************************************************** */
+
+static bool send_all (int fd, const char *buf, size_t len)
+{
+   while (len) {
+      ssize_t rc = send (fd, buf, len, MSG_NOSIGNAL);
+      if (rc < 0 && errno == EINTR)
+         continue;
+      if (rc <= 0)
+         return false;
+      buf += rc;
+      len -= rc;
+   }
+   return true;
+}
+
+static void replay_play (struct replay_t *replay, char *rbuf, char *wbuf)
+{
+   const struct webc_capture_conn_t *rec = replay->rec;
+   const struct webc_capture_chunk_t *chunk = chunk_first (rec);
+   struct timeval tv = { .tv_sec = RECV_TIMEOUT_SECS };
+   int one = 1;
+   int fd = -1;
+
+   replay->error = true;
+
+   uint64_t start = now_ns ();
+
+   if ((fd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0))<0 ||
+       (connect (fd, (struct sockaddr *)&g_addr, sizeof g_addr))!=0)
+      goto errorexit;
+   setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+   setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+
+   // Chunks that are already due when one is sent go with it.
+   for (size_t i=0; i<rec->nchunks; ) {
+      size_t wlen = 0;
+
+      if (!g_fast)
+         sleep_until (start + chunk->offset_ns);
+      do {
+         memcpy (&wbuf[wlen], chunk->data, chunk->len);
+         wlen += chunk->len;
+         chunk = chunk_next (chunk);
+         i++;
+      } while (i<rec->nchunks && (g_fast || start + chunk->offset_ns <= now_ns ()));
+
+      if (!(send_all (fd, wbuf, wlen)))
+         goto errorexit;
+   }
+
+   size_t head_len = 0;
+   char head[16];
+   ssize_t rc;
+   while ((rc = recv (fd, rbuf, RBUF_SIZE, 0))!=0) {
+      if (rc < 0 && errno == EINTR)
+         continue;
+      if (rc < 0)
+         goto errorexit;
+      if (head_len < sizeof head - 1) {
+         size_t n = sizeof head - 1 - head_len;
+         if (n > (size_t)rc)
+            n = rc;
+         memcpy (&head[head_len], rbuf, n);
+         head_len += n;
+      }
+      replay->bytes += rc;
+   }
+
+   replay->latency_ns = now_ns () - start;
+   head[head_len] = 0;
+   if ((sscanf (head, "HTTP/%*u.%*u %i", &replay->status))!=1)
+      replay->status = 0;
+   replay->error = false;
+
+errorexit:
+   if (fd >= 0)
+      close (fd);
+}
+
+static void *worker_run (void *arg)
+{
+   char *rbuf = malloc (RBUF_SIZE);
+   char *wbuf = NULL;
+   size_t wbuf_size = 0;
+   size_t i;
+
+   (void)arg;
+   if (!rbuf) {
+      fprintf (stderr, "OOM error starting a thread\n");
+      goto errorexit;
+   }
+
+   while ((i = atomic_fetch_add (&g_next, 1)) < g_nreplays) {
+      struct replay_t *replay = &g_replays[i];
+
+      // A request takes less room than the record it is in.
+      if (replay->rec->len > wbuf_size) {
+         char *tmp = realloc (wbuf, replay->rec->len);
+         if (!tmp) {
+            fprintf (stderr, "OOM error replaying connection %zu\n", replay->id);
+            replay->error = true;
+            continue;
+         }
+         wbuf = tmp;
+         wbuf_size = replay->rec->len;
+      }
+
+      if (!g_fast) {
+         uint64_t due = g_start_ns + replay->rec->accept_ns - g_first_accept_ns;
+         sleep_until (due);
+         replay->late = now_ns () > due + LATE_NS;
+      }
+      replay_play (replay, rbuf, wbuf);
+   }
+
+errorexit:
+   free (rbuf);
+   free (wbuf);
+   return NULL;
+}
+
+/* *************************************************************** */
+
+static int cb_i64_cmp (const void *lhs, const void *rhs)
+{
+   int64_t l = *(const int64_t *)lhs, r = *(const int64_t *)rhs;
+   return (l > r) - (l < r);
+}
+
+static void percentiles_print (const char *name, int64_t *values, size_t count)
+{
+   static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+
+   printf ("replay %s", name);
+   if (!count) {
+      printf (" samples=0\n");
+      return;
+   }
+
+   qsort (values, count, sizeof *values, cb_i64_cmp);
+   printf (" min=%.3f", values[0] / 1e6);
+   for (size_t i=0; i<sizeof percentiles / sizeof percentiles[0]; i++) {
+      size_t rank = (size_t)(percentiles[i] / 100.0 * count + 0.5);
+      if (rank)
+         rank--;
+      printf (" p%g=%.3f", percentiles[i], values[rank] / 1e6);
+   }
+   printf (" max=%.3f samples=%zu\n", values[count - 1] / 1e6, count);
+}
+
+// The request line of the connection, as far as it was captured.
+static void rqst_line (const struct webc_capture_conn_t *rec, char *dst, size_t dst_len)
+{
+   const struct webc_capture_chunk_t *chunk = chunk_first (rec);
+   size_t len = 0;
+
+   while (chunk && len < chunk->len &&
+          chunk->data[len] != '\r' && chunk->data[len] != '\n')
+      len++;
+   snprintf (dst, dst_len, "%.*s", (int)len, chunk ? chunk->data : "");
+}
+
+static bool report (const char *fname, double seconds)
+{
+   size_t errors = 0, late = 0, status_diffs = 0, size_diffs = 0, shown = 0;
+   int64_t *captured = calloc (g_nreplays + 1, sizeof *captured);
+   int64_t *replayed = calloc (g_nreplays + 1, sizeof *replayed);
+   int64_t *delta = calloc (g_nreplays + 1, sizeof *delta);
+   size_t count = 0;
+
+   if (!captured || !replayed || !delta) {
+      fprintf (stderr, "OOM error collecting the latencies\n");
+      free (captured);
+      free (replayed);
+      free (delta);
+      return false;
+   }
+
+   for (size_t i=0; i<g_nreplays; i++) {
+      const struct replay_t *replay = &g_replays[i];
+      late += replay->late;
+      if (replay->error) {
+         errors++;
+         continue;
+      }
+      status_diffs += replay->status != replay->rec->status;
+      size_diffs += replay->bytes != replay->rec->bytes_sent;
+      captured[count] = replay->rec->latency_ns;
+      replayed[count] = replay->latency_ns;
+      delta[count] = (int64_t)replay->latency_ns - (int64_t)replay->rec->latency_ns;
+      count++;
+   }
+
+   printf ("replay file=%s threads=%zu fast=%i\n", fname, g_threads, g_fast);
+   printf ("replay connections=%zu seconds=%.2f errors=%zu late=%zu "
+           "status_diffs=%zu size_diffs=%zu\n",
+           g_nreplays, seconds, errors, late, status_diffs, size_diffs);
+   percentiles_print ("captured_ms", captured, count);
+   percentiles_print ("replayed_ms", replayed, count);
+   percentiles_print ("delta_ms", delta, count);
+
+   for (size_t i=0; i<g_nreplays && shown<g_diffs; i++) {
+      const struct replay_t *replay = &g_replays[i];
+      char line[MAX_RQST_LINE];
+
+      if (!replay->error && replay->status == replay->rec->status &&
+          replay->bytes == replay->rec->bytes_sent)
+         continue;
+
+      rqst_line (replay->rec, line, sizeof line);
+      if (replay->error) {
+         printf ("replay diff id=%zu error=1 rqst=[%s]\n", replay->id, line);
+      } else {
+         printf ("replay diff id=%zu status=%u/%i bytes=%" PRIu64 "/%" PRIu64
+                 " rqst=[%s]\n", replay->id,
+                 replay->rec->status, replay->status,
+                 replay->rec->bytes_sent, replay->bytes, line);
+      }
+      shown++;
+   }
+
+   free (captured);
+   free (replayed);
+   free (delta);
+   return true;
+}
+
+/* *************************************************************** */
+
+static bool parse_size (const char *value, size_t *dst, size_t max, bool zero_ok)
+{
+   char *end;
+   unsigned long long tmp = strtoull (value, &end, 10);
+   if (!value[0] || *end || (!tmp && !zero_ok) || tmp > max)
+      return false;
+   *dst = tmp;
+   return true;
+}
+
+int main (int argc, char **argv)
+{
+   int ret = EXIT_FAILURE;
+   char *buf = NULL;
+   size_t buf_len = 0;
+   pthread_t *threads = NULL;
+   size_t started = 0;
+   const char *fname = NULL;
+
+   const char *opt_host = webc_util_cline_opt (argc, argv, "host");
+   const char *opt_port = webc_util_cline_opt (argc, argv, "port");
+   const char *opt_threads = webc_util_cline_opt (argc, argv, "threads");
+   const char *opt_fast = webc_util_cline_opt (argc, argv, "fast");
+   const char *opt_diffs = webc_util_cline_opt (argc, argv, "diffs");
+
+   bool opt_error = false;
+   for (size_t i=1; argv[i]; i++) {
+      if (!argv[i][0])
+         continue;
+      if (argv[i][0] != '-' && !fname) {
+         fname = argv[i];
+         continue;
+      }
+      fprintf (stderr, "Unknown option [%s]\n", argv[i]);
+      opt_error = true;
+   }
+
+   size_t port = 0;
+   if (!opt_host)
+      opt_host = "127.0.0.1";
+   if (!opt_port)
+      opt_port = DEFAULT_LISTEN_PORT;
+   if (!(parse_size (opt_port, &port, 65535, false))) {
+      fprintf (stderr, "Invalid port [%s]\n", opt_port);
+      opt_error = true;
+   }
+   if (opt_threads && !(parse_size (opt_threads, &g_threads, 1024, false))) {
+      fprintf (stderr, "Invalid number of threads [%s]\n", opt_threads);
+      opt_error = true;
+   }
+   if (opt_diffs && !(parse_size (opt_diffs, &g_diffs, SIZE_MAX, true))) {
+      fprintf (stderr, "Invalid number of diffs [%s]\n", opt_diffs);
+      opt_error = true;
+   }
+   g_fast = opt_fast != NULL;
+   if (!fname) {
+      fprintf (stderr, "No capture file given\n");
+      opt_error = true;
+   }
+
+   if (opt_error) {
+      fprintf (stderr, "Usage: %s [--host=<addr>] [--port=<n>] "
+                       "[--threads=<n>] [--fast] [--diffs=<n>] "
+                       "<capture-file>\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   memset (&g_addr, 0, sizeof g_addr);
+   g_addr.sin_family = AF_INET;
+   g_addr.sin_port = htons (port);
+   if ((inet_pton (AF_INET, opt_host, &g_addr.sin_addr))!=1) {
+      fprintf (stderr, "Invalid IPv4 address [%s]\n", opt_host);
+      return EXIT_FAILURE;
+   }
+
+   if (!(buf = capture_load (fname, &buf_len)) ||
+       !(replays_index (fname, buf, buf_len)))
+      goto errorexit;
+
+   if (!g_nreplays) {
+      fprintf (stderr, "[%s] holds no connections\n", fname);
+      goto errorexit;
+   }
+
+   if (g_threads > g_nreplays)
+      g_threads = g_nreplays;
+   if (!(threads = calloc (g_threads, sizeof *threads))) {
+      fprintf (stderr, "OOM error\n");
+      goto errorexit;
+   }
+
+   g_first_accept_ns = g_replays[0].rec->accept_ns;
+   g_start_ns = now_ns ();
+
+   for (size_t i=0; i<g_threads; i++) {
+      if ((pthread_create (&threads[i], NULL, worker_run, NULL))!=0) {
+         fprintf (stderr, "Failed to start thread %zu\n", i);
+         // The threads that did start play the whole capture.
+         break;
+      }
+      started++;
+   }
+   for (size_t i=0; i<started; i++)
+      pthread_join (threads[i], NULL);
+   if (!started)
+      goto errorexit;
+
+   if (!(report (fname, (now_ns () - g_start_ns) / 1e9)))
+      goto errorexit;
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   free (threads);
+   free (g_replays);
+   free (buf);
+   return ret;
+}
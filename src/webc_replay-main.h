@@ -0,0 +1,14 @@
+#ifndef H_REPLAY_MAIN
+#define H_REPLAY_MAIN
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#ifdef __cplusplus
+};
+#endif
+
+
+#endif
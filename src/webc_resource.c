@@ -1,8 +1,13 @@
 #define _POSIX_C_SOURCE 200809L
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
 
 #include <pthread.h>
+#include <sched.h>
 
 #include "webc_resource.h"
 #include "webc_handler.h"
@@ -13,7 +18,9 @@ struct res_rec_t {
    char                       *name;
    char                       *pattern;
    enum webc_pattern_type_t    type;
+   enum webc_method_t          method;
    webc_resource_handler_t    *handler;
+   atomic_size_t              *owner;
 };
 
 static void res_rec_del (struct res_rec_t *rec)
@@ -26,9 +33,11 @@ static void res_rec_del (struct res_rec_t *rec)
 }
 
 static struct res_rec_t *res_rec_new (const char               *name,
+                                      enum webc_method_t        method,
                                       const char               *pattern,
                                       enum webc_pattern_type_t  type,
-                                      webc_resource_handler_t  *handler)
+                                      webc_resource_handler_t  *handler,
+                                      atomic_size_t            *owner)
 {
    struct res_rec_t *ret = calloc (1, sizeof *ret);
    if (!ret)
@@ -42,131 +51,1079 @@ static struct res_rec_t *res_rec_new (const char               *name,
    }
 
    ret->type = type;
+   ret->method = method;
    ret->handler = handler;
+   ret->owner = owner;
 
    return ret;
 }
 
+/* *************************************************************** *
+ * The compiled route table. All the registered patterns are compiled, when
+ * the lock is released, into a radix tree of the prefix patterns, a radix
+ * tree of the reversed suffix patterns, a hash table of the exact patterns
+ * and a tree of the segments of the template patterns. A lookup walks each
+ * tree once along the resource and probes the hash table once, so its cost
+ * depends on the length of the resource and not on the number of routes.
+ *
+ * Each route is identified by its position in the list of routes, where the
+ * most recently added is 0. Where more than one pattern matches, the lowest
+ * position wins, which is the same precedence as a scan of the list.
+ * Every place a pattern ends keeps the best route for each method, so
+ * routes for different methods on the same pattern do not hide each other.
+ *
+ * A compiled table is never changed once it is published. Changes to the
+ * routes are compiled into a new table, which replaces the published one
+ * with a single atomic store, so lookups never take a lock. The old table
+ * is freed only after a grace period in which every lookup that might have
+ * seen it has finished (see rcu_synchronize()).
+ */
+
+#define NO_ROUTE     (SIZE_MAX)
+#define NMETHODS     (webc_method_PATCH + 1)
+
+// Routes for a pattern, by method, where webc_method_UNKNOWN is the route
+// for any method.
+typedef size_t method_routes_t[NMETHODS];
+
+static bool routes_set (method_routes_t **routes, enum webc_method_t method,
+                        size_t route)
+{
+   if (!*routes) {
+      if (!(*routes = malloc (sizeof **routes)))
+         return false;
+      for (size_t i=0; i<NMETHODS; i++)
+         (**routes)[i] = NO_ROUTE;
+   }
+   if (route < (**routes)[method])
+      (**routes)[method] = route;
+   return true;
+}
+
+static size_t routes_best (const method_routes_t *routes,
+                           enum webc_method_t method)
+{
+   if (!routes)
+      return NO_ROUTE;
+   size_t any = (*routes)[webc_method_UNKNOWN];
+   size_t specific = (*routes)[method];
+   return specific < any ? specific : any;
+}
+
+struct trie_node_t {
+   const char           *label;
+   size_t                label_len;
+   method_routes_t      *routes;
+   size_t                nchildren;
+   struct trie_node_t  **children;
+};
+
+struct exact_slot_t {
+   const char       *key;
+   size_t            key_len;
+   method_routes_t   routes;
+};
+
+// A node in the template tree stands for one segment. Literal segments are
+// children sorted by segment, ":name" segments share the one param child,
+// and a "*name" segment ends the pattern at its parent, in rest_routes.
+struct tmpl_node_t {
+   const char           *segment;
+   size_t                segment_len;
+   method_routes_t      *routes;
+   method_routes_t      *rest_routes;
+   size_t                nliterals;
+   struct tmpl_node_t  **literals;
+   struct tmpl_node_t   *param;
+};
+
+// The names of the captures of a template route, in order.
+struct tmpl_names_t {
+   size_t   ncaptures;
+   char     names[WEBC_RESOURCE_MAX_CAPTURES][WEBC_RESOURCE_MAX_NAME];
+};
+
+struct router_t {
+   struct res_rec_t    **routes;
+   size_t                nroutes;
+
+   struct trie_node_t    prefixes;
+   struct trie_node_t    suffixes;
+   char                **reversed;
+
+   struct exact_slot_t  *exact;
+   size_t                exact_mask;
+
+   struct tmpl_node_t    templates;
+   struct tmpl_names_t  *names;
+};
+
+static void trie_del (struct trie_node_t *node)
+{
+   for (size_t i=0; i<node->nchildren; i++) {
+      trie_del (node->children[i]);
+      free (node->children[i]);
+   }
+   free (node->children);
+   free (node->routes);
+}
+
+// The child of node whose label starts with c, or the position at which
+// such a child would be inserted.
+static size_t trie_child (const struct trie_node_t *node, unsigned char c,
+                          bool *found)
+{
+   size_t lo = 0, hi = node->nchildren;
+
+   while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      unsigned char mc = node->children[mid]->label[0];
+      if (mc == c) {
+         *found = true;
+         return mid;
+      }
+      if (mc < c)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   *found = false;
+   return lo;
+}
+
+static struct trie_node_t *trie_node_new (struct trie_node_t *parent,
+                                          size_t idx,
+                                          const char *label, size_t label_len)
+{
+   struct trie_node_t **tmp = realloc (parent->children,
+                                       (parent->nchildren + 1) * sizeof *tmp);
+   if (!tmp)
+      return NULL;
+   parent->children = tmp;
+
+   struct trie_node_t *ret = calloc (1, sizeof *ret);
+   if (!ret)
+      return NULL;
+
+   ret->label = label;
+   ret->label_len = label_len;
+
+   memmove (&parent->children[idx + 1], &parent->children[idx],
+            (parent->nchildren - idx) * sizeof *tmp);
+   parent->children[idx] = ret;
+   parent->nchildren++;
+
+   return ret;
+}
+
+// The labels point into key, which must outlive the tree.
+static bool trie_insert (struct trie_node_t *node, const char *key,
+                         size_t len, enum webc_method_t method, size_t route)
+{
+   while (len) {
+      bool found;
+      size_t idx = trie_child (node, key[0], &found);
+
+      if (!found) {
+         if (!(node = trie_node_new (node, idx, key, len)))
+            return false;
+         break;
+      }
+
+      struct trie_node_t *child = node->children[idx];
+      size_t common = 1;
+      while (common < child->label_len && common < len &&
+             child->label[common] == key[common])
+         common++;
+
+      // Split the edge so that the common part becomes a node of its own.
+      if (common < child->label_len) {
+         struct trie_node_t *mid = calloc (1, sizeof *mid);
+         if (!mid || !(mid->children = malloc (sizeof *mid->children))) {
+            free (mid);
+            return false;
+         }
+         mid->label = child->label;
+         mid->label_len = common;
+         mid->children[0] = child;
+         mid->nchildren = 1;
+         child->label += common;
+         child->label_len -= common;
+         node->children[idx] = mid;
+         child = mid;
+      }
+
+      node = child;
+      key += common;
+      len -= common;
+   }
+
+   return routes_set (&node->routes, method, route);
+}
+
+// The best route among the nodes along s (read backwards if reverse).
+static size_t trie_match (const struct trie_node_t *node, const char *s,
+                          size_t len, bool reverse, enum webc_method_t method)
+{
+   size_t best = routes_best (node->routes, method);
+   size_t pos = 0;
+
+   while (pos < len) {
+      bool found;
+      size_t idx = trie_child (node, reverse ? s[len - 1 - pos] : s[pos],
+                               &found);
+      if (!found)
+         break;
+
+      const struct trie_node_t *child = node->children[idx];
+      if (child->label_len > len - pos)
+         break;
+
+      size_t i = 1;
+      if (reverse) {
+         while (i < child->label_len &&
+                child->label[i] == s[len - 1 - pos - i])
+            i++;
+      } else {
+         while (i < child->label_len && child->label[i] == s[pos + i])
+            i++;
+      }
+      if (i < child->label_len)
+         break;
+
+      node = child;
+      pos += child->label_len;
+      size_t route = routes_best (node->routes, method);
+      if (route < best)
+         best = route;
+   }
+
+   return best;
+}
+
+static uint64_t exact_hash (const char *key, size_t len)
+{
+   uint64_t h = 14695981039346656037u;
+   for (size_t i=0; i<len; i++) {
+      h ^= (uint8_t)key[i];
+      h *= 1099511628211u;
+   }
+   return h;
+}
+
+static void exact_insert (struct router_t *router, const char *key,
+                          size_t len, enum webc_method_t method, size_t route)
+{
+   size_t slot = exact_hash (key, len) & router->exact_mask;
+
+   while (router->exact[slot].key) {
+      struct exact_slot_t *s = &router->exact[slot];
+      if (s->key_len == len && (memcmp (s->key, key, len))==0)
+         break;
+      slot = (slot + 1) & router->exact_mask;
+   }
+
+   struct exact_slot_t *s = &router->exact[slot];
+   if (!s->key) {
+      s->key = key;
+      s->key_len = len;
+      for (size_t i=0; i<NMETHODS; i++)
+         s->routes[i] = NO_ROUTE;
+   }
+   if (route < s->routes[method])
+      s->routes[method] = route;
+}
+
+static size_t exact_match (const struct router_t *router, const char *key,
+                           size_t len, enum webc_method_t method)
+{
+   size_t slot = exact_hash (key, len) & router->exact_mask;
+
+   while (router->exact[slot].key) {
+      const struct exact_slot_t *s = &router->exact[slot];
+      if (s->key_len == len && (memcmp (s->key, key, len))==0)
+         return routes_best (&s->routes, method);
+      slot = (slot + 1) & router->exact_mask;
+   }
+
+   return NO_ROUTE;
+}
+
 /* *************************************************************** */
 
-static struct res_rec_t **g_resources = NULL;
-static size_t g_resources_len = 0;
+// Checks a template pattern, and collects the names of its captures into
+// names if that is not NULL.
+static bool tmpl_parse (const char *pattern, struct tmpl_names_t *names)
+{
+   size_t ncaptures = 0;
+
+   for (const char *seg = pattern; seg; ) {
+      const char *end = strchr (seg, '/');
+      size_t len = end ? (size_t)(end - seg) : strlen (seg);
+
+      if (len && (seg[0] == ':' || seg[0] == '*')) {
+         if (len < 2 || len - 1 >= WEBC_RESOURCE_MAX_NAME ||
+             ncaptures >= WEBC_RESOURCE_MAX_CAPTURES ||
+             (seg[0] == '*' && end)) {
+            WEBC_UTIL_LOG ("Invalid template [%s]\n", pattern);
+            return false;
+         }
+         if (names) {
+            memcpy (names->names[ncaptures], &seg[1], len - 1);
+            names->names[ncaptures][len - 1] = 0;
+         }
+         ncaptures++;
+      }
+
+      seg = end ? &end[1] : NULL;
+   }
+
+   if (names)
+      names->ncaptures = ncaptures;
+
+   return true;
+}
+
+static void tmpl_del (struct tmpl_node_t *node)
+{
+   for (size_t i=0; i<node->nliterals; i++) {
+      tmpl_del (node->literals[i]);
+      free (node->literals[i]);
+   }
+   if (node->param) {
+      tmpl_del (node->param);
+      free (node->param);
+   }
+   free (node->literals);
+   free (node->routes);
+   free (node->rest_routes);
+}
+
+static int segment_cmp (const char *lhs, size_t lhs_len,
+                        const char *rhs, size_t rhs_len)
+{
+   int rc = memcmp (lhs, rhs, lhs_len < rhs_len ? lhs_len : rhs_len);
+   if (rc)
+      return rc;
+   return lhs_len < rhs_len ? -1 : lhs_len > rhs_len ? 1 : 0;
+}
+
+// The literal child of node for the segment, or the position at which it
+// would be inserted.
+static size_t tmpl_literal (const struct tmpl_node_t *node,
+                            const char *seg, size_t len, bool *found)
+{
+   size_t lo = 0, hi = node->nliterals;
+
+   while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      int rc = segment_cmp (node->literals[mid]->segment,
+                            node->literals[mid]->segment_len, seg, len);
+      if (rc == 0) {
+         *found = true;
+         return mid;
+      }
+      if (rc < 0)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   *found = false;
+   return lo;
+}
+
+// The segments point into pattern, which must outlive the tree.
+static bool tmpl_insert (struct tmpl_node_t *node, const char *pattern,
+                         enum webc_method_t method, size_t route)
+{
+   for (const char *seg = pattern; seg; ) {
+      const char *end = strchr (seg, '/');
+      size_t len = end ? (size_t)(end - seg) : strlen (seg);
+
+      if (len && seg[0] == '*')
+         return routes_set (&node->rest_routes, method, route);
+
+      if (len && seg[0] == ':') {
+         if (!node->param && !(node->param = calloc (1, sizeof *node->param)))
+            return false;
+         node = node->param;
+      } else {
+         bool found;
+         size_t idx = tmpl_literal (node, seg, len, &found);
+         if (!found) {
+            struct tmpl_node_t **tmp = realloc (node->literals,
+                                                (node->nliterals + 1) * sizeof *tmp);
+            if (!tmp)
+               return false;
+            node->literals = tmp;
+            struct tmpl_node_t *child = calloc (1, sizeof *child);
+            if (!child)
+               return false;
+            child->segment = seg;
+            child->segment_len = len;
+            memmove (&tmp[idx + 1], &tmp[idx],
+                     (node->nliterals - idx) * sizeof *tmp);
+            tmp[idx] = child;
+            node->nliterals++;
+         }
+         node = node->literals[idx];
+      }
+
+      seg = end ? &end[1] : NULL;
+   }
+
+   return routes_set (&node->routes, method, route);
+}
+
+struct tmpl_walk_t {
+   const char              *path;
+   size_t                   len;
+   enum webc_method_t       method;
+
+   size_t                   nspans;
+   size_t                   spans[WEBC_RESOURCE_MAX_CAPTURES][2];
+
+   size_t                   best;
+   size_t                   best_nspans;
+   size_t                   best_spans[WEBC_RESOURCE_MAX_CAPTURES][2];
+};
+
+static void tmpl_candidate (struct tmpl_walk_t *walk, size_t route,
+                            size_t rest_offset, bool rest)
+{
+   if (route >= walk->best)
+      return;
+
+   walk->best = route;
+   walk->best_nspans = walk->nspans;
+   memcpy (walk->best_spans, walk->spans, walk->nspans * sizeof walk->spans[0]);
+   if (rest && walk->nspans < WEBC_RESOURCE_MAX_CAPTURES) {
+      walk->best_spans[walk->nspans][0] = rest_offset;
+      walk->best_spans[walk->nspans][1] = walk->len - rest_offset;
+      walk->best_nspans++;
+   }
+}
+
+// Matches the segment of the path starting at pos against the children of
+// node; pos is past the end of the path once all segments are used. Every
+// node is at a fixed depth, so it is visited at most once per lookup.
+static void tmpl_match (const struct tmpl_node_t *node,
+                        struct tmpl_walk_t *walk, size_t pos)
+{
+   if (pos > walk->len) {
+      tmpl_candidate (walk, routes_best (node->routes, walk->method), 0, false);
+      tmpl_candidate (walk, routes_best (node->rest_routes, walk->method),
+                      walk->len, true);
+      return;
+   }
+
+   tmpl_candidate (walk, routes_best (node->rest_routes, walk->method),
+                   pos, true);
+
+   const char *seg = &walk->path[pos];
+   const char *end = memchr (seg, '/', walk->len - pos);
+   size_t seg_len = end ? (size_t)(end - seg) : walk->len - pos;
+   size_t next = end ? pos + seg_len + 1 : walk->len + 1;
+
+   bool found;
+   size_t idx = tmpl_literal (node, seg, seg_len, &found);
+   if (found)
+      tmpl_match (node->literals[idx], walk, next);
+
+   if (node->param && seg_len && walk->nspans < WEBC_RESOURCE_MAX_CAPTURES) {
+      walk->spans[walk->nspans][0] = pos;
+      walk->spans[walk->nspans][1] = seg_len;
+      walk->nspans++;
+      tmpl_match (node->param, walk, next);
+      walk->nspans--;
+   }
+}
+
+/* *************************************************************** */
+
+static void router_del (struct router_t *router)
+{
+   if (!router)
+      return;
+
+   trie_del (&router->prefixes);
+   trie_del (&router->suffixes);
+   tmpl_del (&router->templates);
+   for (size_t i=0; router->reversed && i<router->nroutes; i++) {
+      free (router->reversed[i]);
+   }
+   free (router->reversed);
+   free (router->exact);
+   free (router->names);
+   for (size_t i=0; router->routes && i<router->nroutes; i++) {
+      res_rec_del (router->routes[i]);
+   }
+   free (router->routes);
+   free (router);
+}
+
+static struct router_t *router_new (struct res_rec_t **recs, size_t nrecs)
+{
+   struct router_t *ret = calloc (1, sizeof *ret);
+   if (!ret)
+      return NULL;
+
+   size_t nslots = 8;
+   while (nslots < nrecs * 2)
+      nslots *= 2;
+   ret->exact_mask = nslots - 1;
+
+   ret->nroutes = nrecs;
+   if (!(ret->routes = calloc (nrecs + 1, sizeof *ret->routes)) ||
+       !(ret->reversed = calloc (nrecs + 1, sizeof *ret->reversed)) ||
+       !(ret->names = calloc (nrecs + 1, sizeof *ret->names)) ||
+       !(ret->exact = calloc (nslots, sizeof *ret->exact)))
+      goto errorexit;
+
+   for (size_t i=0; i<nrecs; i++) {
+      // The snapshot has its own copy of every route, so that the routes
+      // can be changed while it is still being read.
+      if (!(ret->routes[i] = res_rec_new (recs[i]->name, recs[i]->method,
+                                          recs[i]->pattern, recs[i]->type,
+                                          recs[i]->handler, recs[i]->owner)))
+         goto errorexit;
+
+      const char *pattern = ret->routes[i]->pattern;
+      enum webc_method_t method = ret->routes[i]->method;
+      size_t len = strlen (pattern);
+
+      switch (recs[i]->type) {
+
+         case pattern_SUFFIX:
+            if (!(ret->reversed[i] = malloc (len + 1)))
+               goto errorexit;
+            for (size_t j=0; j<len; j++)
+               ret->reversed[i][j] = pattern[len - 1 - j];
+            ret->reversed[i][len] = 0;
+            if (!(trie_insert (&ret->suffixes, ret->reversed[i], len,
+                               method, i)))
+               goto errorexit;
+            break;
+
+         case pattern_PREFIX:
+            if (!(trie_insert (&ret->prefixes, pattern, len, method, i)))
+               goto errorexit;
+            break;
+
+         case pattern_EXACT:
+            exact_insert (ret, pattern, len, method, i);
+            break;
+
+         case pattern_TEMPLATE:
+            if (!(tmpl_parse (pattern, &ret->names[i])) ||
+                !(tmpl_insert (&ret->templates, pattern, method, i)))
+               goto errorexit;
+            break;
+      }
+   }
+
+   return ret;
+
+errorexit:
+   router_del (ret);
+   return NULL;
+}
+
+/* *************************************************************** *
+ * Grace periods. A lookup counts itself in one of two reader counters,
+ * selected by the parity of the table's epoch, for as long as it uses the
+ * published router. A writer that has replaced the router flips the epoch
+ * and waits for the counter of the old parity to drain; it does this twice,
+ * since a reader that sampled the epoch just before the first flip may only
+ * count itself after the writer looked at that counter.
+ */
+
+struct webc_resource_table_t {
+   struct res_rec_t         **resources;
+   size_t                     resources_len;
+
+   struct router_t *_Atomic   router;
+   bool                       changed;
+   atomic_size_t             *owner;
 
-static pthread_mutex_t g_resources_lock;
-static bool lock_initialised = false;
+   pthread_mutex_t            lock;
+   bool                       lock_initialised;
+
+   atomic_uint                epoch;
+   atomic_size_t              readers[2];
+};
+
+static unsigned rcu_read_lock (webc_resource_table_t *table)
+{
+   unsigned idx = atomic_load (&table->epoch) & 1;
+   atomic_fetch_add (&table->readers[idx], 1);
+   return idx;
+}
+
+static void rcu_read_unlock (webc_resource_table_t *table, unsigned idx)
+{
+   atomic_fetch_sub (&table->readers[idx], 1);
+}
+
+static void rcu_synchronize (webc_resource_table_t *table)
+{
+   for (int i=0; i<2; i++) {
+      unsigned idx = atomic_fetch_add (&table->epoch, 1) & 1;
+      while (atomic_load (&table->readers[idx]))
+         sched_yield ();
+   }
+}
+
+/* *************************************************************** */
+
+static webc_resource_table_t g_global;
+
+static _Thread_local const struct webc_resource_match_t *g_match = NULL;
+
+static void table_free (webc_resource_table_t *table)
+{
+   if (table->lock_initialised)
+      pthread_mutex_destroy (&table->lock);
+   router_del (atomic_exchange (&table->router, NULL));
+   for (size_t i=0; i<table->resources_len; i++) {
+      res_rec_del (table->resources[i]);
+   }
+   free (table->resources);
+}
 
 static void webc_resource_global_handler_free (void)
 {
-   webc_resource_global_handler_unlock ();
-   pthread_mutex_destroy (&g_resources_lock);
-   for (size_t i=0; g_resources[i]; i++) {
-      res_rec_del (g_resources[i]);
+   table_free (&g_global);
+}
+
+static bool table_lock_init (webc_resource_table_t *table)
+{
+   pthread_mutexattr_t attr;
+   pthread_mutexattr_init (&attr);
+   pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+   bool ret = pthread_mutex_init (&table->lock, &attr) == 0;
+   pthread_mutexattr_destroy (&attr);
+   return table->lock_initialised = ret;
+}
+
+static webc_resource_table_t *table_get (webc_resource_table_t *table)
+{
+   return table ? table : &g_global;
+}
+
+webc_resource_table_t *webc_resource_table_new (void)
+{
+   webc_resource_table_t *ret = calloc (1, sizeof *ret);
+   if (!ret || !(table_lock_init (ret))) {
+      free (ret);
+      return NULL;
    }
-   free (g_resources);
+   return ret;
 }
 
-bool webc_resource_global_handler_lock (void)
+void webc_resource_table_del (webc_resource_table_t *table)
 {
-   if (!lock_initialised) {
-      pthread_mutexattr_t attr;
-      pthread_mutexattr_init (&attr);
-      pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
-      pthread_mutex_init (&g_resources_lock, &attr);
-      pthread_mutexattr_destroy (&attr);
+   if (!table || table == &g_global)
+      return;
+   table_free (table);
+   free (table);
+}
+
+bool webc_resource_table_lock (webc_resource_table_t *table)
+{
+   table = table_get (table);
+   if (table == &g_global && !g_global.lock_initialised) {
+      if (!(table_lock_init (&g_global)))
+         return false;
       atexit (webc_resource_global_handler_free);
-      lock_initialised = true;
    }
-   return pthread_mutex_lock (&g_resources_lock) == 0 ? true : false;
+   return pthread_mutex_lock (&table->lock) == 0 ? true : false;
 }
 
-bool webc_resource_global_handler_unlock (void)
+bool webc_resource_table_unlock (webc_resource_table_t *table)
 {
-   return pthread_mutex_unlock (&g_resources_lock) == 0 ? true : false;
+   bool ret = true;
+
+   table = table_get (table);
+
+   if (table->changed) {
+      struct router_t *router = router_new (table->resources,
+                                            table->resources_len);
+      if (router) {
+         struct router_t *old = atomic_exchange (&table->router, router);
+         table->changed = false;
+         if (old) {
+            rcu_synchronize (table);
+            router_del (old);
+         }
+      } else {
+         WEBC_UTIL_LOG ("OOM error compiling %zu routes\n",
+                        table->resources_len);
+         ret = false;
+      }
+   }
+
+   if (pthread_mutex_unlock (&table->lock) != 0)
+      ret = false;
+
+   return ret;
 }
 
 /* *************************************************************** */
 
-bool webc_resource_global_handler_add (const char                *name,
-                                       const char                *pattern,
-                                       enum webc_pattern_type_t   type,
-                                       webc_resource_handler_t   *handler)
+bool webc_resource_table_add (webc_resource_table_t      *table,
+                              const char                 *name,
+                              enum webc_method_t          method,
+                              const char                 *pattern,
+                              enum webc_pattern_type_t    type,
+                              webc_resource_handler_t    *handler)
 {
-   struct res_rec_t *rec = res_rec_new (name, pattern, type, handler);
+   table = table_get (table);
+
+   if ((unsigned)method >= NMETHODS ||
+       (type == pattern_TEMPLATE && !(tmpl_parse (pattern, NULL))))
+      return false;
+
+   struct res_rec_t *rec = res_rec_new (name, method, pattern, type, handler,
+                                        table->owner);
    if (!rec)
       return false;
 
-   struct res_rec_t **tmp = realloc (g_resources,
-                                    (g_resources_len + 2) * sizeof *tmp);
+   struct res_rec_t **tmp = realloc (table->resources,
+                                    (table->resources_len + 2) * sizeof *tmp);
    if (!tmp) {
       res_rec_del (rec);
       return false;
    }
 
-   g_resources = tmp;
+   table->resources = tmp;
 
-   g_resources[g_resources_len + 1] = NULL;
-   g_resources_len++;
+   table->resources[table->resources_len + 1] = NULL;
+   table->resources_len++;
 
-   memmove (&g_resources[1], g_resources,
-            (g_resources_len - 1) * sizeof g_resources[0]);
+   memmove (&table->resources[1], table->resources,
+            (table->resources_len - 1) * sizeof table->resources[0]);
 
-   g_resources[0] = rec;
+   table->resources[0] = rec;
+   table->changed = true;
 
    return true;
 }
 
+static bool rec_matches (const struct res_rec_t *rec, enum webc_method_t method,
+                         const char *pattern, enum webc_pattern_type_t type)
+{
+   return rec->type == type && rec->method == method &&
+          (strcmp (rec->pattern, pattern))==0;
+}
 
-webc_resource_handler_t *webc_resource_handler_find (const char *resource)
+bool webc_resource_table_remove (webc_resource_table_t      *table,
+                                 enum webc_method_t          method,
+                                 const char                 *pattern,
+                                 enum webc_pattern_type_t    type)
+{
+   size_t nremoved = 0;
+
+   table = table_get (table);
+
+   for (size_t i=0; i<table->resources_len; i++) {
+      if (rec_matches (table->resources[i], method, pattern, type)) {
+         res_rec_del (table->resources[i]);
+         nremoved++;
+      } else {
+         table->resources[i - nremoved] = table->resources[i];
+      }
+   }
+
+   if (!nremoved)
+      return false;
+
+   table->resources_len -= nremoved;
+   table->resources[table->resources_len] = NULL;
+   table->changed = true;
+
+   return true;
+}
+
+bool webc_resource_table_replace (webc_resource_table_t      *table,
+                                  const char                 *name,
+                                  enum webc_method_t          method,
+                                  const char                 *pattern,
+                                  enum webc_pattern_type_t    type,
+                                  webc_resource_handler_t    *handler)
+{
+   table = table_get (table);
+
+   for (size_t i=0; i<table->resources_len; i++) {
+      if (rec_matches (table->resources[i], method, pattern, type)) {
+         char *tmp = strdup (name);
+         if (!tmp)
+            return false;
+         free (table->resources[i]->name);
+         table->resources[i]->name = tmp;
+         table->resources[i]->handler = handler;
+         table->changed = true;
+         return true;
+      }
+   }
+
+   return webc_resource_table_add (table, name, method, pattern, type,
+                                   handler);
+}
+
+void webc_resource_table_owner (webc_resource_table_t *table,
+                                atomic_size_t *owner)
+{
+   table_get (table)->owner = owner;
+}
+
+bool webc_resource_table_remove_owner (webc_resource_table_t *table,
+                                       atomic_size_t *owner)
+{
+   size_t nremoved = 0;
+
+   table = table_get (table);
+
+   for (size_t i=0; i<table->resources_len; i++) {
+      if (table->resources[i]->owner == owner) {
+         res_rec_del (table->resources[i]);
+         nremoved++;
+      } else {
+         table->resources[i - nremoved] = table->resources[i];
+      }
+   }
+
+   if (!nremoved)
+      return false;
+
+   table->resources_len -= nremoved;
+   table->resources[table->resources_len] = NULL;
+   table->changed = true;
+
+   return true;
+}
+
+size_t webc_resource_table_list (webc_resource_table_t *table,
+                                 webc_resource_list_cb_t *fptr, void *ctx)
+{
+   table = table_get (table);
+
+   unsigned idx = rcu_read_lock (table);
+   const struct router_t *router = atomic_load (&table->router);
+   size_t ret = router ? router->nroutes : 0;
+
+   for (size_t i=0; i<ret; i++) {
+      const struct res_rec_t *rec = router->routes[i];
+      fptr (ctx, rec->name, rec->method, rec->pattern, rec->type, rec->handler);
+   }
+
+   rcu_read_unlock (table, idx);
+   return ret;
+}
+
+/* *************************************************************** */
+
+bool webc_resource_global_handler_lock (void)
+{
+   return webc_resource_table_lock (NULL);
+}
+
+bool webc_resource_global_handler_unlock (void)
+{
+   return webc_resource_table_unlock (NULL);
+}
+
+bool webc_resource_global_handler_add (const char                *name,
+                                       const char                *pattern,
+                                       enum webc_pattern_type_t   type,
+                                       webc_resource_handler_t   *handler)
+{
+   return webc_resource_table_add (NULL, name, webc_method_UNKNOWN,
+                                   pattern, type, handler);
+}
+
+bool webc_resource_global_handler_add_method (const char                *name,
+                                              enum webc_method_t         method,
+                                              const char                *pattern,
+                                              enum webc_pattern_type_t   type,
+                                              webc_resource_handler_t   *handler)
+{
+   return webc_resource_table_add (NULL, name, method, pattern, type, handler);
+}
+
+bool webc_resource_global_handler_remove (enum webc_method_t          method,
+                                          const char                 *pattern,
+                                          enum webc_pattern_type_t    type)
+{
+   return webc_resource_table_remove (NULL, method, pattern, type);
+}
+
+bool webc_resource_global_handler_replace (const char                *name,
+                                           enum webc_method_t         method,
+                                           const char                *pattern,
+                                           enum webc_pattern_type_t   type,
+                                           webc_resource_handler_t   *handler)
+{
+   return webc_resource_table_replace (NULL, name, method, pattern, type,
+                                       handler);
+}
+
+void webc_resource_global_handler_owner (atomic_size_t *owner)
+{
+   webc_resource_table_owner (NULL, owner);
+}
+
+bool webc_resource_global_handler_remove_owner (atomic_size_t *owner)
+{
+   return webc_resource_table_remove_owner (NULL, owner);
+}
+
+size_t webc_resource_global_handler_list (webc_resource_list_cb_t *fptr,
+                                          void *ctx)
+{
+   return webc_resource_table_list (NULL, fptr, ctx);
+}
+
+/* *************************************************************** */
+
+static webc_resource_handler_t *lookup (webc_resource_table_t *table,
+                                        const char *resource,
+                                        enum webc_method_t method,
+                                        struct webc_resource_match_t *match,
+                                        bool acquire)
 {
+   match->handler = NULL;
+   match->owner = NULL;
+   match->path = resource;
+   match->route[0] = 0;
+   match->ncaptures = 0;
+
    if (!resource)
-      return webc_handler_static_file;
+      return match->handler = webc_handler_static_file;
 
-   size_t res_len = strlen (resource);
+   if ((unsigned)method >= NMETHODS)
+      method = webc_method_UNKNOWN;
 
-   for (size_t i=0; g_resources[i]; i++) {
-      size_t pattern_len = strlen (g_resources[i]->pattern);
-      size_t cmp_len = res_len < pattern_len ? res_len : res_len - pattern_len;
+   table = table_get (table);
 
-      switch (g_resources[i]->type) {
+   unsigned idx = rcu_read_lock (table);
+   const struct router_t *router = atomic_load (&table->router);
 
-         case pattern_SUFFIX:
-            if ((strncmp (&resource[cmp_len],
-                          g_resources[i]->pattern, pattern_len))==0) {
-               WEBC_UTIL_LOG ("Matched suffix: [%s]: [%s]=>[%s]\n",
-                          g_resources[i]->pattern,
-                          resource,
-                          g_resources[i]->name);
-               return g_resources[i]->handler;
-            }
-            break;
+   if (router) {
+      size_t res_len = strlen (resource);
+      size_t route, tmp;
 
-         case pattern_PREFIX:
-            if (pattern_len > res_len)
-               break;
-            if ((strncmp (resource, g_resources[i]->pattern, pattern_len))==0) {
-               WEBC_UTIL_LOG ("Matched prefix: [%s]: [%s]=>[%s]\n",
-                          g_resources[i]->pattern,
-                          resource,
-                          g_resources[i]->name);
-               return g_resources[i]->handler;
-            }
-            break;
+      route = exact_match (router, resource, res_len, method);
+      if ((tmp = trie_match (&router->prefixes, resource, res_len, false,
+                             method)) < route)
+         route = tmp;
+      if ((tmp = trie_match (&router->suffixes, resource, res_len, true,
+                             method)) < route)
+         route = tmp;
 
-         case pattern_EXACT:
-            if ((strcmp (resource, g_resources[i]->pattern))==0) {
-               WEBC_UTIL_LOG ("Matched exact: [%s]: [%s]=>[%s]\n",
-                          g_resources[i]->pattern,
-                          resource,
-                          g_resources[i]->name);
-               return g_resources[i]->handler;
-            }
-            break;
+      struct tmpl_walk_t walk;
+      walk.path = resource;
+      walk.len = res_len;
+      walk.method = method;
+      walk.nspans = 0;
+      walk.best = route;
+      walk.best_nspans = 0;
+      tmpl_match (&router->templates, &walk, 0);
+
+      if (walk.best < route) {
+         route = walk.best;
+         const struct tmpl_names_t *names = &router->names[route];
+         for (size_t i=0; i<walk.best_nspans && i<names->ncaptures; i++) {
+            struct webc_resource_capture_t *cap = &match->captures[i];
+            memcpy (cap->name, names->names[i], sizeof cap->name);
+            cap->offset = walk.best_spans[i][0];
+            cap->length = walk.best_spans[i][1];
+            match->ncaptures++;
+         }
+      }
 
+      if (route != NO_ROUTE) {
+         match->handler = router->routes[route]->handler;
+         // The name is copied, cut short if need be, as the route can be
+         // freed once the table is out of use.
+         snprintf (match->route, sizeof match->route, "%s",
+                   router->routes[route]->name);
+         // The reference is taken while the table is still in use, so the
+         // owner cannot have been told that it has no routes left.
+         if (acquire && (match->owner = router->routes[route]->owner))
+            atomic_fetch_add (match->owner, 1);
       }
+   }
+
+   rcu_read_unlock (table, idx);
+
+   if (!match->handler) {
+      WEBC_UTIL_LOG ("No match for [%s], using handler_static_file()\n", resource);
+      match->handler = webc_handler_static_file;
+   }
+
+   return match->handler;
+}
+
+webc_resource_handler_t *webc_resource_handler_find (const char *resource)
+{
+   struct webc_resource_match_t match;
+   return lookup (NULL, resource, webc_method_UNKNOWN, &match, false);
+}
 
+webc_resource_handler_t *webc_resource_handler_match (const char *resource,
+                                                      enum webc_method_t method,
+                                                      struct webc_resource_match_t *match)
+{
+   return lookup (NULL, resource, method, match, true);
+}
+
+webc_resource_handler_t *webc_resource_table_find (webc_resource_table_t *table,
+                                                   const char *resource)
+{
+   struct webc_resource_match_t match;
+   return lookup (table, resource, webc_method_UNKNOWN, &match, false);
+}
+
+webc_resource_handler_t *webc_resource_table_match (webc_resource_table_t *table,
+                                                    const char *resource,
+                                                    enum webc_method_t method,
+                                                    struct webc_resource_match_t *match)
+{
+   return lookup (table, resource, method, match, true);
+}
+
+void webc_resource_match_release (struct webc_resource_match_t *match)
+{
+   if (match->owner)
+      atomic_fetch_sub (match->owner, 1);
+   match->owner = NULL;
+}
+
+void webc_resource_match_set (const struct webc_resource_match_t *match)
+{
+   g_match = match;
+}
+
+const struct webc_resource_match_t *webc_resource_match_current (void)
+{
+   return g_match;
+}
+
+const char *webc_resource_capture (const char *name, size_t *len)
+{
+   const struct webc_resource_match_t *match = g_match;
+
+   for (size_t i=0; match && i<match->ncaptures; i++) {
+      if ((strcmp (match->captures[i].name, name))==0) {
+         if (len)
+            *len = match->captures[i].length;
+         return &match->path[match->captures[i].offset];
+      }
    }
 
-   WEBC_UTIL_LOG ("No match for [%s], using handler_static_file()\n", resource);
-   return webc_handler_static_file;
+   return NULL;
 }
 
@@ -4,16 +4,28 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 
 #include "webc_util.h"
 #include "webc_header.h"
 
+// A pattern_TEMPLATE pattern is matched one '/'-separated segment at a
+// time. A segment ":name" matches any non-empty segment, and a final
+// segment "*name" matches the rest of the path (possibly empty); all other
+// segments must match exactly. For example "/users/:id/orders/*rest"
+// matches "/users/123/orders/2024/05", capturing "123" as id and "2024/05"
+// as rest.
 enum webc_pattern_type_t {
    pattern_SUFFIX,
    pattern_PREFIX,
-   pattern_EXACT
+   pattern_EXACT,
+   pattern_TEMPLATE
 };
 
+// The most captures a template can have, and the longest capture name.
+#define WEBC_RESOURCE_MAX_CAPTURES     (8)
+#define WEBC_RESOURCE_MAX_NAME         (32)
+
 typedef int (webc_resource_handler_t) (int                        fd,
                                        char                      *remote_addr,
                                        uint16_t                   remote_port,
@@ -24,12 +36,50 @@ typedef int (webc_resource_handler_t) (int                        fd,
                                        webc_header_t             *rsp_headers,
                                        char                      *vars);
 
+// Called by webc_resource_global_handler_list() for each route.
+typedef void (webc_resource_list_cb_t) (void                       *ctx,
+                                        const char                 *name,
+                                        enum webc_method_t          method,
+                                        const char                 *pattern,
+                                        enum webc_pattern_type_t    type,
+                                        webc_resource_handler_t    *handler);
+
+// A capture is a view into the path that was matched: the captured value
+// is the length bytes at path[offset], and is not terminated.
+struct webc_resource_capture_t {
+   char                             name[WEBC_RESOURCE_MAX_NAME];
+   size_t                           offset;
+   size_t                           length;
+};
+
+struct webc_resource_match_t {
+   webc_resource_handler_t         *handler;
+   atomic_size_t                   *owner;
+   const char                      *path;
+   char                             route[WEBC_RESOURCE_MAX_NAME];
+   size_t                           ncaptures;
+   struct webc_resource_capture_t   captures[WEBC_RESOURCE_MAX_CAPTURES];
+};
+
+// A set of routes. Each server (see webc_server.h) routes its requests
+// through a table, which by default is the process-wide table that the
+// webc_resource_global_*() functions and plugins change. The
+// webc_resource_table_*() functions take NULL for the process-wide table.
+typedef struct webc_resource_table_t webc_resource_table_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-   // Before _add() is called the _lock() function must be called. After all
-   // the _add() calls the caller must call the _unlock() function.
+   // Before _add(), _remove() or _replace() is called the _lock() function
+   // must be called. After all the changes the caller must call the
+   // _unlock() function, which compiles the routes and publishes them to
+   // webc_resource_handler_find(). Where more than one pattern matches a
+   // resource, the most recently added one is used.
+   //
+   // Routes can be changed this way while the server is running: lookups
+   // do not take the lock, and see either all of the changes made between
+   // _lock() and _unlock() or none of them.
    bool webc_resource_global_handler_lock (void);
    bool webc_resource_global_handler_add (const char *name,
                                           const char *pattern,
@@ -37,9 +87,107 @@ extern "C" {
                                           webc_resource_handler_t *handler);
    bool webc_resource_global_handler_unlock (void);
 
+   // As _add(), for requests with this method only. Routes added with
+   // webc_method_UNKNOWN, as _add() does, match every method.
+   bool webc_resource_global_handler_add_method (const char *name,
+                                                 enum webc_method_t method,
+                                                 const char *pattern,
+                                                 enum webc_pattern_type_t type,
+                                                 webc_resource_handler_t *handler);
+
+   // Removes every route with this method, pattern and type. Returns false
+   // if there was none.
+   bool webc_resource_global_handler_remove (enum webc_method_t method,
+                                             const char *pattern,
+                                             enum webc_pattern_type_t type);
+
+   // Points the route with this method, pattern and type at handler,
+   // keeping its precedence, or adds the route if there is none.
+   bool webc_resource_global_handler_replace (const char *name,
+                                              enum webc_method_t method,
+                                              const char *pattern,
+                                              enum webc_pattern_type_t type,
+                                              webc_resource_handler_t *handler);
+
+   // Routes added after this call, until it is called again with NULL,
+   // belong to owner, which counts the requests that are using them (see
+   // webc_resource_handler_match()). Once all the routes of an owner are
+   // removed and published, the count can only go down; when it reaches
+   // zero nothing uses the handlers any more.
+   void webc_resource_global_handler_owner (atomic_size_t *owner);
+
+   // Removes every route that belongs to owner. Returns false if there was
+   // none.
+   bool webc_resource_global_handler_remove_owner (atomic_size_t *owner);
+
+   // Calls fptr for each published route, most recently added first.
+   // Returns the number of routes.
+   size_t webc_resource_global_handler_list (webc_resource_list_cb_t *fptr,
+                                             void *ctx);
+
+   // The handler for resource, for a request with any method. Nothing
+   // keeps a handler that belongs to an owner valid after this returns;
+   // use webc_resource_handler_match() to call handlers.
    webc_resource_handler_t *webc_resource_handler_find (const char *resource);
 
+   // The handler for a request for resource with method, with the captures
+   // of a template route in match. match->path is resource, which must
+   // outlive the match, and match->route the name of the route, empty if
+   // there was none. If the route belongs to an owner the match holds a
+   // reference on it until webc_resource_match_release().
+   webc_resource_handler_t *webc_resource_handler_match (const char *resource,
+                                                         enum webc_method_t method,
+                                                         struct webc_resource_match_t *match);
+   void webc_resource_match_release (struct webc_resource_match_t *match);
+
+   // The match for the request that the calling thread is handling, which
+   // the caller of the handler sets. Handlers use this to read captures.
+   void webc_resource_match_set (const struct webc_resource_match_t *match);
+   const struct webc_resource_match_t *webc_resource_match_current (void);
+
+   // The value of the named capture for the current request, which is not
+   // terminated, with its length in *len. Returns NULL if there is no such
+   // capture.
+   const char *webc_resource_capture (const char *name, size_t *len);
+
+   // A table of its own, with no routes, for a server; as with the global
+   // table, a lookup that matches no route gets
+   // webc_handler_static_file(). The table must be out of use when it is
+   // deleted.
+   webc_resource_table_t *webc_resource_table_new (void);
+   void webc_resource_table_del (webc_resource_table_t *table);
 
+   // The functions above, on table.
+   bool webc_resource_table_lock (webc_resource_table_t *table);
+   bool webc_resource_table_unlock (webc_resource_table_t *table);
+   bool webc_resource_table_add (webc_resource_table_t *table,
+                                 const char *name,
+                                 enum webc_method_t method,
+                                 const char *pattern,
+                                 enum webc_pattern_type_t type,
+                                 webc_resource_handler_t *handler);
+   bool webc_resource_table_remove (webc_resource_table_t *table,
+                                    enum webc_method_t method,
+                                    const char *pattern,
+                                    enum webc_pattern_type_t type);
+   bool webc_resource_table_replace (webc_resource_table_t *table,
+                                     const char *name,
+                                     enum webc_method_t method,
+                                     const char *pattern,
+                                     enum webc_pattern_type_t type,
+                                     webc_resource_handler_t *handler);
+   void webc_resource_table_owner (webc_resource_table_t *table,
+                                   atomic_size_t *owner);
+   bool webc_resource_table_remove_owner (webc_resource_table_t *table,
+                                          atomic_size_t *owner);
+   size_t webc_resource_table_list (webc_resource_table_t *table,
+                                    webc_resource_list_cb_t *fptr, void *ctx);
+   webc_resource_handler_t *webc_resource_table_find (webc_resource_table_t *table,
+                                                      const char *resource);
+   webc_resource_handler_t *webc_resource_table_match (webc_resource_table_t *table,
+                                                       const char *resource,
+                                                       enum webc_method_t method,
+                                                       struct webc_resource_match_t *match);
 
 #ifdef __cplusplus
 };
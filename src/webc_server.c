@@ -0,0 +1,606 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include <pthread.h>
+
+#include "webc_server.h"
+#include "webc_accesslog.h"
+#include "webc_config.h"
+#include "webc_metrics.h"
+#include "webc_util.h"
+
+// The server stops accepting after this many accept() failures in a row.
+#define MAX_ACCEPT_ERRORS     (5)
+
+// An accepted connection, waiting for (or being served by) a thread.
+struct conn_t {
+   webc_server_t    *server;
+   int               fd;
+   char             *remote_addr;
+   uint16_t          remote_port;
+   uint64_t          accept_ns;
+   struct conn_t    *next;
+   // In the server's list of connections, from accept to close.
+   struct conn_t    *conns_prev;
+   struct conn_t    *conns_next;
+};
+
+struct webc_server_t {
+   struct webc_server_config_t   config;
+
+   int                           root_fd;
+   webc_fswatch_t               *fswatch;
+   webc_path_t                  *path;
+   webc_dircache_t              *dircache;
+
+   int                           wake_fd;
+   atomic_bool                   running;
+   atomic_bool                   stopping;
+   bool                          started;
+   pthread_t                     accept_thread;
+
+   // Protects everything below; cond is signalled whenever any of it
+   // changes.
+   pthread_mutex_t               lock;
+   pthread_cond_t                cond;
+   size_t                        nconns;
+   struct conn_t                *conns;
+   struct conn_t                *queue_head;
+   struct conn_t                *queue_tail;
+   bool                          closing;
+
+   pthread_t                    *workers;
+   size_t                        nworkers;
+};
+
+static _Thread_local webc_server_t *g_current = NULL;
+
+/* *************************************************************** */
+
+static void conn_del (struct conn_t *conn)
+{
+   if (conn) {
+      free (conn->remote_addr);
+      free (conn);
+   }
+}
+
+// Both called with the server locked.
+static void conns_add (webc_server_t *server, struct conn_t *conn)
+{
+   conn->conns_prev = NULL;
+   if ((conn->conns_next = server->conns))
+      server->conns->conns_prev = conn;
+   server->conns = conn;
+   server->nconns++;
+}
+
+static void conns_remove (webc_server_t *server, struct conn_t *conn)
+{
+   if (conn->conns_prev)
+      conn->conns_prev->conns_next = conn->conns_next;
+   else
+      server->conns = conn->conns_next;
+   if (conn->conns_next)
+      conn->conns_next->conns_prev = conn->conns_prev;
+   server->nconns--;
+   pthread_cond_broadcast (&server->cond);
+}
+
+// Closes a connection that has been served or could not be. The fd is
+// closed only once it is off the list, so that webc_server_wait() never
+// shuts down an fd that has been reused.
+static void conn_close (struct conn_t *conn)
+{
+   webc_server_t *server = conn->server;
+   int fd = conn->fd;
+
+   // The server may be deleted as soon as the count reaches zero, so it is
+   // not touched after this.
+   pthread_mutex_lock (&server->lock);
+   conns_remove (server, conn);
+   pthread_mutex_unlock (&server->lock);
+
+   close (fd);
+   conn_del (conn);
+}
+
+static void conn_serve (struct conn_t *conn)
+{
+   webc_server_t *server = conn->server;
+
+   g_current = server;
+   webc_serve_conn (server->config.routes, conn->fd,
+                    conn->remote_addr, conn->remote_port, conn->accept_ns);
+   g_current = NULL;
+
+   conn_close (conn);
+}
+
+static void *conn_thread (void *arg)
+{
+   conn_serve (arg);
+   return NULL;
+}
+
+static void *pool_thread (void *arg)
+{
+   webc_server_t *server = arg;
+
+   for (;;) {
+      pthread_mutex_lock (&server->lock);
+      while (!server->queue_head && !server->closing)
+         pthread_cond_wait (&server->cond, &server->lock);
+
+      struct conn_t *conn = server->queue_head;
+      if (conn) {
+         if (!(server->queue_head = conn->next))
+            server->queue_tail = NULL;
+      }
+      pthread_mutex_unlock (&server->lock);
+
+      if (!conn)
+         break;
+
+      conn_serve (conn);
+   }
+
+   return NULL;
+}
+
+// Hands conn to a thread. On failure the connection is closed.
+static void conn_dispatch (webc_server_t *server, struct conn_t *conn)
+{
+   pthread_mutex_lock (&server->lock);
+   conns_add (server, conn);
+   if (server->config.threads == webc_server_THREAD_POOL) {
+      if (server->queue_tail)
+         server->queue_tail->next = conn;
+      else
+         server->queue_head = conn;
+      server->queue_tail = conn;
+      pthread_cond_broadcast (&server->cond);
+      conn = NULL;
+   }
+   pthread_mutex_unlock (&server->lock);
+
+   if (!conn)
+      return;
+
+   pthread_attr_t attr;
+   pthread_t thread;
+   bool started = false;
+
+   if ((pthread_attr_init (&attr))==0) {
+      pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+      started = pthread_create (&thread, &attr, conn_thread, conn) == 0;
+      pthread_attr_destroy (&attr);
+   }
+
+   if (!started) {
+      WEBC_UTIL_LOG ("[%s:%u] Failed to start thread, closing client fd %i\n",
+                     conn->remote_addr, conn->remote_port, conn->fd);
+      conn_close (conn);
+   }
+}
+
+// Waits until fewer than max_conns connections are being served. Returns
+// false if the server is stopped in the meantime. The wait is in short
+// steps, since webc_server_stop() cannot signal the condition.
+static bool conns_wait (webc_server_t *server)
+{
+   bool ret = true;
+
+   pthread_mutex_lock (&server->lock);
+   while (server->nconns >= server->config.max_conns) {
+      if (atomic_load (&server->stopping)) {
+         ret = false;
+         break;
+      }
+      struct timespec ts;
+      clock_gettime (CLOCK_REALTIME, &ts);
+      ts.tv_nsec += 100 * 1000000;
+      if (ts.tv_nsec >= 1000000000) {
+         ts.tv_sec++;
+         ts.tv_nsec -= 1000000000;
+      }
+      pthread_cond_timedwait (&server->cond, &server->lock, &ts);
+   }
+   pthread_mutex_unlock (&server->lock);
+
+   return ret;
+}
+
+static void *accept_thread (void *arg)
+{
+   webc_server_t *server = arg;
+   struct pollfd pfds[WEBC_SERVER_MAX_LISTENERS + 1];
+   size_t nlisteners = server->config.nlisteners;
+   size_t errcount = 0;
+
+   for (size_t i=0; i<nlisteners; i++) {
+      pfds[i].fd = server->config.listeners[i].fd;
+      pfds[i].events = POLLIN;
+   }
+   pfds[nlisteners].fd = server->wake_fd;
+   pfds[nlisteners].events = POLLIN;
+
+   while (!atomic_load (&server->stopping) && errcount < MAX_ACCEPT_ERRORS) {
+      if (server->config.max_conns && !(conns_wait (server)))
+         break;
+
+      if ((poll (pfds, nlisteners + 1, -1)) < 0) {
+         if (errno == EINTR)
+            continue;
+         WEBC_UTIL_LOG ("poll() failed on the listeners: %m\n");
+         break;
+      }
+
+      if (pfds[nlisteners].revents)
+         break;
+
+      for (size_t i=0; i<nlisteners; i++) {
+         if (!pfds[i].revents)
+            continue;
+
+         struct conn_t *conn = calloc (1, sizeof *conn);
+         if (!conn) {
+            WEBC_UTIL_LOG ("OOM error accepting a connection\n");
+            errcount++;
+            continue;
+         }
+
+         conn->server = server;
+         conn->fd = webc_util_accept (pfds[i].fd, &conn->remote_addr,
+                                                  &conn->remote_port);
+         conn->accept_ns = webc_accesslog_now ();
+
+         if (conn->fd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                              errno == EINTR || errno == ECONNABORTED)) {
+            conn_del (conn);
+            continue;
+         }
+
+         if (conn->fd < 0 || !conn->remote_addr) {
+            errcount++;
+            webc_metrics_accept_error ();
+            WEBC_UTIL_LOG ("Failed to accept(), errcount=%zu\n", errcount);
+            if (conn->fd >= 0)
+               close (conn->fd);
+            conn_del (conn);
+            continue;
+         }
+
+         errcount = 0;
+         conn_dispatch (server, conn);
+      }
+   }
+
+   if (errcount >= MAX_ACCEPT_ERRORS)
+      WEBC_UTIL_LOG ("Aborting due to excessive error-count %zu\n", errcount);
+
+   atomic_store (&server->running, false);
+
+   // The pool drains what is queued, and then its threads end.
+   pthread_mutex_lock (&server->lock);
+   server->closing = true;
+   pthread_cond_broadcast (&server->cond);
+   pthread_mutex_unlock (&server->lock);
+
+   return NULL;
+}
+
+// The threads of the server block every signal. New threads inherit the
+// mask of their creator, so it is set around pthread_create().
+static void sigmask_block_all (sigset_t *old)
+{
+   sigset_t all;
+   sigfillset (&all);
+   pthread_sigmask (SIG_SETMASK, &all, old);
+}
+
+static void sigmask_restore (const sigset_t *old)
+{
+   pthread_sigmask (SIG_SETMASK, old, NULL);
+}
+
+/* *************************************************************** */
+
+void webc_server_config_init (struct webc_server_config_t *config)
+{
+   memset (config, 0, sizeof *config);
+   for (size_t i=0; i<WEBC_SERVER_MAX_LISTENERS; i++) {
+      config->listeners[i].backlog = atoi (DEFAULT_BACKLOG);
+      config->listeners[i].fd = -1;
+   }
+   config->root_fd = -1;
+   config->watch_root = true;
+   config->threads = SERVER_POOL_SIZE ? webc_server_THREAD_POOL
+                                      : webc_server_THREAD_PER_CONN;
+   config->pool_size = SERVER_POOL_SIZE;
+   config->max_conns = SERVER_MAX_CONNS;
+   config->drain_secs = SERVER_DRAIN_SECS;
+}
+
+webc_server_t *webc_server_new (const struct webc_server_config_t *config)
+{
+   webc_server_t *ret = NULL;
+   char *watch_path = NULL;
+   sigset_t oldmask;
+
+   if (config->nlisteners > WEBC_SERVER_MAX_LISTENERS ||
+       (config->threads == webc_server_THREAD_POOL && !config->pool_size)) {
+      WEBC_UTIL_LOG ("Invalid server configuration\n");
+      return NULL;
+   }
+
+   if (!(ret = calloc (1, sizeof *ret))) {
+      WEBC_UTIL_LOG ("OOM error creating server\n");
+      return NULL;
+   }
+
+   ret->config = *config;
+   ret->root_fd = -1;
+   ret->wake_fd = -1;
+   pthread_mutex_init (&ret->lock, NULL);
+   pthread_cond_init (&ret->cond, NULL);
+
+   if ((ret->wake_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+      WEBC_UTIL_LOG ("Failed to create eventfd: %m\n");
+      goto errorexit;
+   }
+
+   if (config->root_fd >= 0) {
+      ret->root_fd = fcntl (config->root_fd, F_DUPFD_CLOEXEC, 0);
+   } else if (config->root) {
+      ret->root_fd = open (config->root, O_PATH | O_DIRECTORY | O_CLOEXEC);
+   }
+   if ((config->root_fd >= 0 || config->root) && ret->root_fd < 0) {
+      WEBC_UTIL_LOG ("Failed to open web root [%s]: %m\n",
+                     config->root ? config->root : "(fd)");
+      goto errorexit;
+   }
+   ret->config.root = NULL;
+   ret->config.root_fd = -1;
+
+   if (ret->root_fd >= 0) {
+      // A root given as an fd is watched through its /proc link.
+      if (config->root_fd >= 0)
+         webc_util_sprintf (&watch_path, NULL, "/proc/self/fd/%i", ret->root_fd);
+      const char *watch_root = watch_path ? watch_path : config->root;
+
+      if (config->watch_root) {
+         sigmask_block_all (&oldmask);
+         ret->fswatch = webc_fswatch_new (watch_root);
+         sigmask_restore (&oldmask);
+         if (!ret->fswatch) {
+            WEBC_UTIL_LOG ("Failed to watch [%s] for changes, caches will use "
+                           "%i-second revalidation\n",
+                           watch_root, FSWATCH_TTL_SECS);
+         }
+      }
+
+      if (!(ret->path = webc_path_new (ret->root_fd, ret->fswatch)) ||
+          !(ret->dircache = webc_dircache_new (ret->fswatch)))
+         goto errorexit;
+   }
+
+   free (watch_path);
+   return ret;
+
+errorexit:
+   free (watch_path);
+   webc_server_del (ret);
+   return NULL;
+}
+
+void webc_server_del (webc_server_t *server)
+{
+   if (!server)
+      return;
+
+   // The watcher goes first, so that nothing calls into the caches while
+   // they are deleted.
+   webc_fswatch_del (server->fswatch);
+   webc_dircache_del (server->dircache);
+   webc_path_del (server->path);
+
+   for (size_t i=0; i<server->config.nlisteners; i++) {
+      if (server->config.listeners[i].fd >= 0)
+         close (server->config.listeners[i].fd);
+   }
+
+   if (server->root_fd >= 0)
+      close (server->root_fd);
+   if (server->wake_fd >= 0)
+      close (server->wake_fd);
+
+   free (server->workers);
+   pthread_cond_destroy (&server->cond);
+   pthread_mutex_destroy (&server->lock);
+   free (server);
+}
+
+bool webc_server_start (webc_server_t *server)
+{
+   bool error = true;
+   sigset_t oldmask;
+   bool masked = false;
+
+   if (!server || server->started)
+      return false;
+
+   for (size_t i=0; i<server->config.nlisteners; i++) {
+      struct webc_server_listener_t *l = &server->config.listeners[i];
+      if (l->fd < 0) {
+         if ((l->fd = webc_create_listener (l->port, l->backlog)) < 0) {
+            WEBC_UTIL_LOG ("Unable to listen on %u\n", l->port);
+            goto errorexit;
+         }
+         WEBC_UTIL_LOG ("Listening on %u q/%i\n", l->port, l->backlog);
+      }
+      // poll() may report a connection that is gone by the time it is
+      // accepted, so accept() must not block.
+      int flags = fcntl (l->fd, F_GETFL);
+      if (flags < 0 || (fcntl (l->fd, F_SETFL, flags | O_NONBLOCK)) < 0) {
+         WEBC_UTIL_LOG ("Failed to make listener %i non-blocking: %m\n", l->fd);
+         goto errorexit;
+      }
+   }
+
+   atomic_store (&server->stopping, false);
+   server->closing = false;
+
+   sigmask_block_all (&oldmask);
+   masked = true;
+
+   if (server->config.threads == webc_server_THREAD_POOL) {
+      if (!(server->workers = calloc (server->config.pool_size,
+                                      sizeof *server->workers))) {
+         WEBC_UTIL_LOG ("OOM error starting the thread pool\n");
+         goto errorexit;
+      }
+      for (size_t i=0; i<server->config.pool_size; i++) {
+         if ((pthread_create (&server->workers[i], NULL, pool_thread,
+                              server))!=0) {
+            WEBC_UTIL_LOG ("Failed to start pool thread %zu\n", i);
+            goto errorexit;
+         }
+         server->nworkers++;
+      }
+   }
+
+   atomic_store (&server->running, true);
+   if ((pthread_create (&server->accept_thread, NULL, accept_thread,
+                        server))!=0) {
+      WEBC_UTIL_LOG ("Failed to start the accepting thread\n");
+      atomic_store (&server->running, false);
+      goto errorexit;
+   }
+
+   server->started = true;
+   error = false;
+
+errorexit:
+   if (masked)
+      sigmask_restore (&oldmask);
+
+   if (error && server->nworkers) {
+      pthread_mutex_lock (&server->lock);
+      server->closing = true;
+      pthread_cond_broadcast (&server->cond);
+      pthread_mutex_unlock (&server->lock);
+      for (size_t i=0; i<server->nworkers; i++) {
+         pthread_join (server->workers[i], NULL);
+      }
+      server->nworkers = 0;
+      server->closing = false;
+   }
+
+   return !error;
+}
+
+void webc_server_stop (webc_server_t *server)
+{
+   if (!server)
+      return;
+
+   atomic_store (&server->stopping, true);
+
+   uint64_t one = 1;
+   ssize_t rc = write (server->wake_fd, &one, sizeof one);
+   (void)rc;
+}
+
+void webc_server_wait (webc_server_t *server)
+{
+   if (!server || !server->started)
+      return;
+
+   pthread_join (server->accept_thread, NULL);
+
+   struct timespec deadline;
+   clock_gettime (CLOCK_REALTIME, &deadline);
+   deadline.tv_sec += server->config.drain_secs;
+
+   pthread_mutex_lock (&server->lock);
+   while (server->nconns) {
+      if (!server->config.drain_secs)
+         pthread_cond_wait (&server->cond, &server->lock);
+      else if ((pthread_cond_timedwait (&server->cond, &server->lock,
+                                        &deadline))==ETIMEDOUT)
+         break;
+   }
+
+   // Shutting the sockets down fails the reads and writes of whatever is
+   // serving them, which then ends.
+   if (server->nconns) {
+      WEBC_UTIL_LOG ("Closing %zu connections still in progress after %u "
+                     "seconds\n", server->nconns, server->config.drain_secs);
+      for (struct conn_t *conn = server->conns; conn; conn = conn->conns_next) {
+         shutdown (conn->fd, SHUT_RDWR);
+      }
+   }
+   while (server->nconns)
+      pthread_cond_wait (&server->cond, &server->lock);
+   pthread_mutex_unlock (&server->lock);
+
+   for (size_t i=0; i<server->nworkers; i++) {
+      pthread_join (server->workers[i], NULL);
+   }
+   server->nworkers = 0;
+
+   server->started = false;
+}
+
+bool webc_server_running (webc_server_t *server)
+{
+   return server && atomic_load (&server->running);
+}
+
+int webc_server_listener_fd (webc_server_t *server, size_t n)
+{
+   if (!server || n >= server->config.nlisteners)
+      return -1;
+   return server->config.listeners[n].fd;
+}
+
+webc_server_t *webc_server_current (void)
+{
+   return g_current;
+}
+
+webc_resource_table_t *webc_server_routes (webc_server_t *server)
+{
+   return server ? server->config.routes : NULL;
+}
+
+webc_path_t *webc_server_path (webc_server_t *server)
+{
+   return server ? server->path : NULL;
+}
+
+webc_dircache_t *webc_server_dircache (webc_server_t *server)
+{
+   return server ? server->dircache : NULL;
+}
+
+webc_fswatch_t *webc_server_fswatch (webc_server_t *server)
+{
+   return server ? server->fswatch : NULL;
+}
+
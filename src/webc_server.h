@@ -0,0 +1,141 @@
+
+#ifndef H_SERVER
+#define H_SERVER
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "webc_resource.h"
+#include "webc_path.h"
+#include "webc_dircache.h"
+#include "webc_fswatch.h"
+
+/* A web server that can be embedded in another program. Each server has
+ * its own listeners, web root, threads, route table and caches over the
+ * root, so several can run in one process. The log, the access log, the
+ * metrics, the slow-request log, the capture file, the mime types, the
+ * bundle, the embedded files and the plugins are shared by every server
+ * in the process.
+ *
+ *    struct webc_server_config_t config;
+ *    webc_server_config_init (&config);
+ *    config.root = "www-root";
+ *    config.listeners[0].port = 8080;
+ *    config.nlisteners = 1;
+ *
+ *    webc_server_t *server = webc_server_new (&config);
+ *    if (server && webc_server_start (server)) {
+ *       ...
+ *       webc_server_stop (server);
+ *       webc_server_wait (server);
+ *    }
+ *    webc_server_del (server);
+ *
+ * The server's threads have every signal blocked, so signals are handled
+ * by the threads of the program that embeds it.
+ */
+
+#define WEBC_SERVER_MAX_LISTENERS   (8)
+
+typedef struct webc_server_t webc_server_t;
+
+enum webc_server_threads_t {
+   webc_server_THREAD_PER_CONN,     // A new thread for every connection
+   webc_server_THREAD_POOL,         // pool_size threads share the connections
+};
+
+struct webc_server_listener_t {
+   uint16_t                      port;
+   int                           backlog;
+   // A socket that is already listening, which the server takes over, or
+   // -1 for the server to listen on port.
+   int                           fd;
+};
+
+struct webc_server_config_t {
+   struct webc_server_listener_t listeners[WEBC_SERVER_MAX_LISTENERS];
+   size_t                        nlisteners;
+
+   // The web root: root_fd if it is not -1 (the caller keeps the fd),
+   // otherwise the directory root. With neither, resources that are not
+   // routed elsewhere are not found.
+   const char                   *root;
+   int                           root_fd;
+
+   // Watch the root for changes (see webc_fswatch.h), so that the caches
+   // over it need not revalidate on every request.
+   bool                          watch_root;
+
+   // A pool thread serves its connection until the response has been
+   // sent, so pool_size slow clients keep every other connection waiting.
+   // The pool does not protect against them: only the minimum transfer
+   // rate in webc_conn.h bounds how long each one holds its thread.
+   enum webc_server_threads_t    threads;
+   size_t                        pool_size;
+
+   // The most connections served at once; no more are accepted until one
+   // ends. 0 for no limit.
+   size_t                        max_conns;
+
+   // How long webc_server_wait() lets the connections in progress finish
+   // before shutting their sockets down. 0 to wait for as long as they
+   // take.
+   unsigned                      drain_secs;
+
+   // NULL for the process-wide table (see webc_resource.h). The table
+   // must outlive the server.
+   webc_resource_table_t        *routes;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Sets config to the defaults in webc_config.h, with no listeners and
+   // no web root.
+   void webc_server_config_init (struct webc_server_config_t *config);
+
+   // Opens the web root, and starts watching it. The config is copied.
+   webc_server_t *webc_server_new (const struct webc_server_config_t *config);
+
+   // Closes the listeners, and the root and its caches. The server must
+   // not be running: call webc_server_stop() and webc_server_wait() first.
+   void webc_server_del (webc_server_t *server);
+
+   // Listens, and starts accepting connections on a thread of its own.
+   bool webc_server_start (webc_server_t *server);
+
+   // Stops accepting connections. The connections being served are not
+   // interrupted. This only sets a flag and writes to an eventfd, so it
+   // may be called from a signal handler.
+   void webc_server_stop (webc_server_t *server);
+
+   // Waits for the accepting thread to end, after webc_server_stop() or
+   // when accepting fails too often, and then for every connection to be
+   // served, shutting down any still open after config.drain_secs.
+   void webc_server_wait (webc_server_t *server);
+
+   // True from webc_server_start() until the server stops accepting.
+   bool webc_server_running (webc_server_t *server);
+
+   // The fd of listener n, or -1; the server keeps ownership.
+   int webc_server_listener_fd (webc_server_t *server, size_t n);
+
+   // The server whose connection the calling thread is serving, or NULL.
+   // Handlers use this to reach the server's own tables and caches.
+   webc_server_t *webc_server_current (void);
+
+   // The server's route table (NULL for the process-wide table), and the
+   // resolver and caches over its root, any of which may be NULL.
+   webc_resource_table_t *webc_server_routes (webc_server_t *server);
+   webc_path_t *webc_server_path (webc_server_t *server);
+   webc_dircache_t *webc_server_dircache (webc_server_t *server);
+   webc_fswatch_t *webc_server_fswatch (webc_server_t *server);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
@@ -0,0 +1,202 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <pthread.h>
+
+#include "webc_slowlog.h"
+#include "webc_accesslog.h"
+#include "webc_resource.h"
+#include "webc_config.h"
+#include "webc_util.h"
+
+#define MAX_LINE_LEN       (256)
+#define MAX_HEADERS_LEN    (512)
+#define MAX_ADDR_LEN       (48)
+
+struct record_t {
+   struct timespec   when;
+   long              tid;
+   char              remote_addr[MAX_ADDR_LEN];
+   uint16_t          remote_port;
+   int               status;
+   uint64_t          bytes_received;
+   uint64_t          bytes_sent;
+   uint64_t          latency_ns;
+   uint64_t          stamps[webc_conn_NSTAMPS];
+   char              route[WEBC_RESOURCE_MAX_NAME];
+   char              rqst_line[MAX_LINE_LEN];
+   char              headers[MAX_HEADERS_LEN];
+};
+
+// Off is represented as a threshold no request can reach.
+atomic_uint_fast64_t webc_slowlog_threshold_g =
+   SLOWLOG_DEFAULT_THRESHOLD_MS ? SLOWLOG_DEFAULT_THRESHOLD_MS * 1000000ull
+                                : UINT64_MAX;
+
+static const char *g_headers[] = SLOWLOG_HEADERS;
+
+// Only slow requests take the lock, so it is not contended in the normal
+// run of things.
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct record_t g_records[SLOWLOG_SIZE];
+static size_t g_next = 0;
+static size_t g_count = 0;
+
+static const char *g_stamp_names[] = {
+   [webc_conn_ACCEPTED]    = "accepted",
+   [webc_conn_FIRST_BYTE]  = "first_byte",
+   [webc_conn_HEADERS]     = "headers",
+   [webc_conn_ROUTED]      = "routed",
+   [webc_conn_HANDLED]     = "handled",
+   [webc_conn_LAST_BYTE]   = "last_byte",
+};
+
+/* *************************************************************** */
+
+static bool header_wanted (const char *header)
+{
+   for (size_t i=0; i<sizeof g_headers/sizeof g_headers[0]; i++) {
+      size_t len = strlen (g_headers[i]);
+      if ((strnicmp (header, g_headers[i], len))==0 && header[len] == ':')
+         return true;
+   }
+   return false;
+}
+
+static void headers_copy (char *dst, size_t dst_len, char **rqst_headers)
+{
+   size_t len = 0;
+
+   dst[0] = 0;
+   for (size_t i=0; rqst_headers && i<MAX_HTTP_HEADERS; i++) {
+      if (!rqst_headers[i] || !rqst_headers[i][0])
+         break;
+      if (!(header_wanted (rqst_headers[i])))
+         continue;
+      int n = snprintf (&dst[len], dst_len - len, "   %s\n", rqst_headers[i]);
+      if (n < 0 || (size_t)n >= dst_len - len)
+         break;
+      len += n;
+   }
+}
+
+static bool record_print (FILE *outf, const struct record_t *rec)
+{
+   struct tm time_fields;
+   char stamp[32];
+
+   if (!(gmtime_r (&rec->when.tv_sec, &time_fields)) ||
+       !(strftime (stamp, sizeof stamp, "%Y-%m-%dT%H:%M:%S", &time_fields)))
+      return false;
+
+   fprintf (outf, "%s.%06liZ %.3fms %s:%u tid=%li status=%i "
+                  "in=%" PRIu64 " out=%" PRIu64 " route=%s\n"
+                  "   [%s]\n",
+            stamp, rec->when.tv_nsec / 1000, rec->latency_ns / 1e6,
+            rec->remote_addr, rec->remote_port, rec->tid, rec->status,
+            rec->bytes_received, rec->bytes_sent,
+            rec->route[0] ? rec->route : "-", rec->rqst_line);
+   fputs (rec->headers, outf);
+
+   // The stamps as offsets from accept(), leaving out stages not reached.
+   fputs ("  ", outf);
+   for (size_t i=0; i<webc_conn_NSTAMPS; i++) {
+      if (rec->stamps[i])
+         fprintf (outf, " %s=+%.3fms", g_stamp_names[i],
+                  (rec->stamps[i] - rec->stamps[webc_conn_ACCEPTED]) / 1e6);
+   }
+   fputs ("\n", outf);
+   return true;
+}
+
+/* *************************************************************** */
+
+void webc_slowlog_threshold_set (uint64_t ms)
+{
+   // Too large to hold in ns is as good as off, rather than a wrapped,
+   // small threshold.
+   atomic_store (&webc_slowlog_threshold_g,
+                 ms && ms <= UINT64_MAX / 1000000ull ? ms * 1000000ull
+                                                    : UINT64_MAX);
+}
+
+uint64_t webc_slowlog_threshold_get (void)
+{
+   uint64_t ns = atomic_load (&webc_slowlog_threshold_g);
+   return ns == UINT64_MAX ? 0 : ns / 1000000ull;
+}
+
+void webc_slowlog_record (const struct webc_conn_t *conn,
+                          const char *rqst_line, char **rqst_headers,
+                          const char *route, int status)
+{
+   struct record_t rec;
+   uint64_t end = conn->stamps[webc_conn_LAST_BYTE];
+
+   memset (&rec, 0, sizeof rec);
+   clock_gettime (CLOCK_REALTIME, &rec.when);
+   rec.tid = syscall (SYS_gettid);
+   snprintf (rec.remote_addr, sizeof rec.remote_addr, "%s",
+             conn->remote_addr ? conn->remote_addr : "-");
+   rec.remote_port = conn->remote_port;
+   rec.status = status;
+   rec.bytes_received = conn->bytes_received;
+   rec.bytes_sent = conn->bytes_sent;
+   rec.latency_ns = (end ? end : webc_accesslog_now ())
+                  - conn->stamps[webc_conn_ACCEPTED];
+   memcpy (rec.stamps, conn->stamps, sizeof rec.stamps);
+   snprintf (rec.route, sizeof rec.route, "%s", route ? route : "");
+   snprintf (rec.rqst_line, sizeof rec.rqst_line, "%s",
+             rqst_line ? rqst_line : "");
+   headers_copy (rec.headers, sizeof rec.headers, rqst_headers);
+
+   pthread_mutex_lock (&g_lock);
+   g_records[g_next] = rec;
+   g_next = (g_next + 1) % SLOWLOG_SIZE;
+   if (g_count < SLOWLOG_SIZE)
+      g_count++;
+   pthread_mutex_unlock (&g_lock);
+}
+
+bool webc_slowlog_dump (char **dst, size_t *dst_len)
+{
+   bool error = true;
+   char *buf = NULL;
+   size_t buf_len = 0;
+   FILE *outf = NULL;
+
+   if (!(outf = open_memstream (&buf, &buf_len)))
+      goto errorexit;
+
+   pthread_mutex_lock (&g_lock);
+   size_t first = (g_next + SLOWLOG_SIZE - g_count) % SLOWLOG_SIZE;
+   bool ok = true;
+   for (size_t i=0; ok && i<g_count; i++)
+      ok = record_print (outf, &g_records[(first + i) % SLOWLOG_SIZE]);
+   pthread_mutex_unlock (&g_lock);
+
+   int rc = fclose (outf);
+   outf = NULL;
+   if (!ok || rc != 0)
+      goto errorexit;
+
+   *dst = buf;
+   *dst_len = buf_len;
+   buf = NULL;
+   error = false;
+
+errorexit:
+   if (outf)
+      fclose (outf);
+   free (buf);
+   return !error;
+}
+
@@ -0,0 +1,53 @@
+
+#ifndef H_SLOWLOG
+#define H_SLOWLOG
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "webc_conn.h"
+
+/* The slow-request log. A request that takes at least the threshold, from
+ * accept() to the last byte sent, is recorded with its request line, the
+ * request headers named in SLOWLOG_HEADERS, the name of the route that
+ * served it, its phase stamps (webc_conn.h), the bytes read and sent and
+ * the id of the thread that served it. The last SLOWLOG_SIZE records
+ * (webc_config.h) are kept in memory, and shown by the slowlog admin
+ * endpoint.
+ *
+ * Requests under the threshold cost one relaxed atomic load and a
+ * compare, in WEBC_SLOWLOG_IS_SLOW().
+ */
+
+#define WEBC_SLOWLOG_IS_SLOW(latency_ns)  ((latency_ns) >=\
+      atomic_load_explicit (&webc_slowlog_threshold_g, memory_order_relaxed))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Read by WEBC_SLOWLOG_IS_SLOW(); use webc_slowlog_threshold_set().
+   extern atomic_uint_fast64_t webc_slowlog_threshold_g;
+
+   // The threshold in milliseconds; 0 turns the log off, as does a value
+   // too large to hold in nanoseconds.
+   void webc_slowlog_threshold_set (uint64_t ms);
+   uint64_t webc_slowlog_threshold_get (void);
+
+   // Records the request on conn. rqst_headers ends at the first NULL or
+   // empty header, and route may be NULL.
+   void webc_slowlog_record (const struct webc_conn_t *conn,
+                             const char *rqst_line, char **rqst_headers,
+                             const char *route, int status);
+
+   // The records, oldest first, as text in *dst, which the caller must
+   // free.
+   bool webc_slowlog_dump (char **dst, size_t *dst_len);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
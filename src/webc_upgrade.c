@@ -0,0 +1,339 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include "webc_upgrade.h"
+#include "webc_server.h"
+#include "webc_config.h"
+#include "webc_util.h"
+
+// systemd passes the sockets starting at this fd.
+#define LISTEN_FDS_START      (3)
+
+#define MAX_FDS               (WEBC_SERVER_MAX_LISTENERS)
+
+#define READY_BYTE            ('R')
+
+// The socket to the server being upgraded, until this one is ready.
+static int g_ready_fd = -1;
+
+/* *************************************************************** */
+
+static bool is_listener (int fd)
+{
+   int val = 0;
+   socklen_t len = sizeof val;
+   return getsockopt (fd, SOL_SOCKET, SO_ACCEPTCONN, &val, &len) == 0 && val;
+}
+
+static bool parse_fd (const char *s, int *fd)
+{
+   char *end;
+   long val = strtol (s, &end, 10);
+   if (!s[0] || *end || val < 0 || val > 65535)
+      return false;
+   *fd = (int)val;
+   return true;
+}
+
+static size_t inherit_systemd (int *fds, size_t max)
+{
+   const char *listen_pid = getenv ("LISTEN_PID");
+   const char *listen_fds = getenv ("LISTEN_FDS");
+   int pid, nfds;
+   size_t ret = 0;
+
+   if (!listen_pid || !listen_fds)
+      return 0;
+
+   bool mine = parse_fd (listen_pid, &pid) ? pid == getpid () : false;
+
+   // Not for any child process that this one starts.
+   unsetenv ("LISTEN_PID");
+   unsetenv ("LISTEN_FDS");
+   unsetenv ("LISTEN_FDNAMES");
+
+   if (!mine || !(parse_fd (listen_fds, &nfds)))
+      return 0;
+
+   for (int i=0; i<nfds; i++) {
+      int fd = LISTEN_FDS_START + i;
+      fcntl (fd, F_SETFD, FD_CLOEXEC);
+      if (!(is_listener (fd))) {
+         WEBC_UTIL_LOG ("Inherited fd %i is not a listening socket, "
+                        "ignoring it\n", fd);
+         continue;
+      }
+      if (ret >= max) {
+         WEBC_UTIL_LOG ("Too many inherited listeners, closing fd %i\n", fd);
+         close (fd);
+         continue;
+      }
+      fds[ret++] = fd;
+   }
+
+   WEBC_UTIL_LOG ("Inherited %zu listeners from socket activation\n", ret);
+   return ret;
+}
+
+static size_t inherit_upgrade (const char *upgrade_fd, int *fds, size_t max)
+{
+   int sock;
+   char byte = 0;
+   struct iovec iov = { &byte, 1 };
+   union {
+      struct cmsghdr align;
+      char buf[CMSG_SPACE (sizeof (int) * MAX_FDS)];
+   } control;
+   struct msghdr msg;
+   size_t ret = 0;
+
+   if (!(parse_fd (upgrade_fd, &sock))) {
+      WEBC_UTIL_LOG ("Invalid upgrade fd [%s]\n", upgrade_fd);
+      return 0;
+   }
+   fcntl (sock, F_SETFD, FD_CLOEXEC);
+
+   struct timeval tv = { UPGRADE_TIMEOUT_SECS, 0 };
+   setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+
+   memset (&msg, 0, sizeof msg);
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control.buf;
+   msg.msg_controllen = sizeof control.buf;
+
+   ssize_t rc;
+   while ((rc = recvmsg (sock, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+      ;
+   if (rc <= 0) {
+      WEBC_UTIL_LOG ("Failed to receive the listeners to upgrade: %m\n");
+      close (sock);
+      return 0;
+   }
+
+   for (struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg); cmsg;
+        cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+      if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+         continue;
+      size_t n = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+      for (size_t i=0; i<n; i++) {
+         int fd;
+         memcpy (&fd, CMSG_DATA (cmsg) + i * sizeof fd, sizeof fd);
+         if (ret < max && is_listener (fd))
+            fds[ret++] = fd;
+         else
+            close (fd);
+      }
+   }
+
+   if (msg.msg_flags & MSG_CTRUNC)
+      WEBC_UTIL_LOG ("Some of the listeners to upgrade were lost\n");
+
+   g_ready_fd = sock;
+
+   WEBC_UTIL_LOG ("Inherited %zu listeners from the upgraded server\n", ret);
+   return ret;
+}
+
+/* *************************************************************** */
+
+size_t webc_upgrade_inherit (const char *upgrade_fd, int *fds, size_t max)
+{
+   if (upgrade_fd)
+      return inherit_upgrade (upgrade_fd, fds, max);
+
+   return inherit_systemd (fds, max);
+}
+
+void webc_upgrade_ready (void)
+{
+   if (g_ready_fd < 0)
+      return;
+
+   char byte = READY_BYTE;
+   if ((write (g_ready_fd, &byte, 1)) != 1)
+      WEBC_UTIL_LOG ("Failed to tell the upgraded server to stop: %m\n");
+
+   close (g_ready_fd);
+   g_ready_fd = -1;
+}
+
+bool webc_upgrade_pidfile_write (const char *fname)
+{
+   bool error = true;
+   char *tmpname = NULL;
+   FILE *outf = NULL;
+
+   if (!(webc_util_sprintf (&tmpname, NULL, "%s.%i", fname, (int)getpid ()))) {
+      WEBC_UTIL_LOG ("OOM error writing the pidfile\n");
+      goto errorexit;
+   }
+
+   if (!(outf = fopen (tmpname, "w"))) {
+      WEBC_UTIL_LOG ("Failed to open [%s] for writing: %m\n", tmpname);
+      goto errorexit;
+   }
+
+   fprintf (outf, "%i\n", (int)getpid ());
+
+   int rc = fclose (outf);
+   outf = NULL;
+   if (rc != 0 || (rename (tmpname, fname))!=0) {
+      WEBC_UTIL_LOG ("Failed to write the pidfile [%s]: %m\n", fname);
+      remove (tmpname);
+      goto errorexit;
+   }
+
+   error = false;
+
+errorexit:
+   if (outf) {
+      fclose (outf);
+      remove (tmpname);
+   }
+   free (tmpname);
+   return !error;
+}
+
+void webc_upgrade_pidfile_remove (const char *fname)
+{
+   FILE *inf = fopen (fname, "r");
+   int pid = 0;
+
+   if (!inf)
+      return;
+
+   bool mine = fscanf (inf, "%i", &pid) == 1 && pid == (int)getpid ();
+   fclose (inf);
+
+   if (mine && (remove (fname))!=0)
+      WEBC_UTIL_LOG ("Failed to remove the pidfile [%s]: %m\n", fname);
+}
+
+bool webc_upgrade_exec (char *const *argv, const int *fds, size_t nfds)
+{
+   bool error = true;
+   int sv[2] = { -1, -1 };
+   char **child_argv = NULL;
+   char *opt = NULL;
+   size_t argc = 0, nargs = 0;
+   pid_t pid = -1;
+
+   if (!nfds || nfds > MAX_FDS) {
+      WEBC_UTIL_LOG ("Cannot upgrade with %zu listeners\n", nfds);
+      return false;
+   }
+
+   if ((socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv))!=0) {
+      WEBC_UTIL_LOG ("Failed to create the upgrade socket: %m\n");
+      goto errorexit;
+   }
+
+   while (argv[argc])
+      argc++;
+
+   // The arguments of this server, with the option for the socket in place
+   // of any it was itself started with.
+   if (!(child_argv = calloc (argc + 2, sizeof *child_argv)) ||
+       !(webc_util_sprintf (&opt, NULL, "--%s=%i", WEBC_UPGRADE_OPT, sv[1]))) {
+      WEBC_UTIL_LOG ("OOM error starting the upgrade\n");
+      goto errorexit;
+   }
+   for (size_t i=0; i<argc; i++) {
+      if (i && (strncmp (argv[i], "--", 2))==0 &&
+          (strncmp (&argv[i][2], WEBC_UPGRADE_OPT,
+                    strlen (WEBC_UPGRADE_OPT)))==0)
+         continue;
+      child_argv[nargs++] = argv[i];
+   }
+   child_argv[nargs++] = opt;
+
+   if ((pid = fork ()) < 0) {
+      WEBC_UTIL_LOG ("Failed to fork() for the upgrade: %m\n");
+      goto errorexit;
+   }
+
+   if (pid == 0) {
+      // Only async-signal-safe calls until the exec.
+      sigset_t none;
+      sigemptyset (&none);
+      sigprocmask (SIG_SETMASK, &none, NULL);
+      fcntl (sv[1], F_SETFD, 0);
+      execvp (child_argv[0], child_argv);
+      _exit (127);
+   }
+
+   close (sv[1]);
+   sv[1] = -1;
+
+   WEBC_UTIL_LOG ("Upgrading to [%s], pid %i\n", child_argv[0], (int)pid);
+
+   char byte = 0;
+   struct iovec iov = { &byte, 1 };
+   union {
+      struct cmsghdr align;
+      char buf[CMSG_SPACE (sizeof (int) * MAX_FDS)];
+   } control;
+   struct msghdr msg;
+
+   memset (&control, 0, sizeof control);
+   memset (&msg, 0, sizeof msg);
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control.buf;
+   msg.msg_controllen = CMSG_SPACE (sizeof (int) * nfds);
+
+   struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg);
+   cmsg->cmsg_level = SOL_SOCKET;
+   cmsg->cmsg_type = SCM_RIGHTS;
+   cmsg->cmsg_len = CMSG_LEN (sizeof (int) * nfds);
+   memcpy (CMSG_DATA (cmsg), fds, sizeof (int) * nfds);
+
+   ssize_t rc;
+   while ((rc = sendmsg (sv[0], &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+      ;
+   if (rc != 1) {
+      WEBC_UTIL_LOG ("Failed to send the listeners to the new server: %m\n");
+      goto errorexit;
+   }
+
+   struct pollfd pfd = { sv[0], POLLIN, 0 };
+   while ((rc = poll (&pfd, 1, UPGRADE_TIMEOUT_SECS * 1000)) < 0 &&
+          errno == EINTR)
+      ;
+   if (rc <= 0 || (read (sv[0], &byte, 1)) != 1 || byte != READY_BYTE) {
+      WEBC_UTIL_LOG ("The new server did not start\n");
+      goto errorexit;
+   }
+
+   WEBC_UTIL_LOG ("The new server, pid %i, is accepting connections\n",
+                  (int)pid);
+   error = false;
+
+errorexit:
+   if (error && pid > 0) {
+      // It must not go on accepting on the shared listeners.
+      kill (pid, SIGKILL);
+      waitpid (pid, NULL, 0);
+   }
+   if (sv[0] >= 0)
+      close (sv[0]);
+   if (sv[1] >= 0)
+      close (sv[1]);
+   free (child_argv);
+   free (opt);
+   return !error;
+}
+
@@ -0,0 +1,57 @@
+
+#ifndef H_UPGRADE
+#define H_UPGRADE
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Restarts without closing the listening sockets, so that connections
+ * queued in the backlog are not refused while the server is replaced.
+ *
+ * Listeners can be inherited in two ways. With systemd socket activation
+ * the sockets are fds 3 onwards, described by LISTEN_PID and LISTEN_FDS.
+ * On an upgrade (SIGUSR2 in webc_web-main) the running server starts a new
+ * copy of its binary with the same arguments plus --upgrade-fd=N, where N
+ * is one end of a Unix socketpair. The listening fds are sent over the
+ * socket with SCM_RIGHTS, and the new server answers once it is accepting
+ * on them. Only then does the old server stop accepting and drain its
+ * connections; if the new server fails to start the old one carries on.
+ */
+
+#define WEBC_UPGRADE_OPT      ("upgrade-fd")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Collects inherited listening sockets into fds, at most max of them,
+   // and returns how many there are: those from the server being upgraded
+   // if upgrade_fd (the value of --upgrade-fd) is not NULL, otherwise those
+   // from systemd, if any. The fds are made close-on-exec.
+   size_t webc_upgrade_inherit (const char *upgrade_fd, int *fds, size_t max);
+
+   // Tells the server being upgraded that this one is accepting
+   // connections. Does nothing if this server was not started by an
+   // upgrade.
+   void webc_upgrade_ready (void);
+
+   // Writes the pid of this process to fname, replacing the file so that
+   // readers never see a partial pid. Returns false on error.
+   bool webc_upgrade_pidfile_write (const char *fname);
+
+   // Removes fname if it still holds the pid of this process, that is if
+   // no upgrade has replaced it.
+   void webc_upgrade_pidfile_remove (const char *fname);
+
+   // Starts argv[0] with the arguments in argv and --upgrade-fd, hands it
+   // the nfds listening sockets in fds, and waits up to
+   // UPGRADE_TIMEOUT_SECS (webc_config.h) for it to be ready. Returns
+   // true if it is, in which case the caller should stop accepting.
+   bool webc_upgrade_exec (char *const *argv, const int *fds, size_t nfds);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
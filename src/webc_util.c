@@ -15,14 +15,17 @@
 #include <unistd.h>
 #include <netdb.h>
 
-#include <pthread.h>
-
 #include "webc_resource.h"
 #include "webc_util.h"
 #include "webc_config.h"
 #include "webc_header.h"
+#include "webc_conn.h"
+#include "webc_accesslog.h"
+#include "webc_metrics.h"
+#include "webc_slowlog.h"
+#include "webc_capture.h"
 
-static enum webc_method_t get_rqst_method (const char *rqst_line)
+enum webc_method_t webc_util_rqst_method (const char *rqst_line)
 {
    static const struct {
       const char *name;
@@ -49,7 +52,7 @@ static enum webc_method_t get_rqst_method (const char *rqst_line)
    return webc_method_UNKNOWN;
 }
 
-static enum webc_http_version_t get_rqst_version (const char *rqst_line)
+enum webc_http_version_t webc_util_rqst_version (const char *rqst_line)
 {
    static const struct {
       const char              *name;
@@ -76,7 +79,7 @@ static enum webc_http_version_t get_rqst_version (const char *rqst_line)
    return webc_http_version_UNKNOWN;
 }
 
-static char *get_rqst_resource (const char *rqst_line)
+char *webc_util_rqst_resource (const char *rqst_line)
 {
    char *start = strchr (rqst_line, ' ');
    if (!start)
@@ -113,7 +116,7 @@ static char *parse_urlencoded_string (const char *string, size_t len)
    return NULL;
 }
 
-static char *get_rqst_getvars (const char *rqst_line)
+char *webc_util_rqst_getvars (const char *rqst_line)
 {
    char *start = strchr (rqst_line, '?');
    if (!start)
@@ -179,12 +182,6 @@ int webc_accept_conn (int listenfd, size_t timeout,
                                char **remote_addr,
                                uint16_t *remote_port)
 {
-   struct sockaddr_in ret;
-   socklen_t retlen = sizeof ret;
-   int retval = -1;
-
-   memset (&ret, 0xff, sizeof ret);
-
    fd_set fds[3]; // Read/write/except
    struct timeval tv = { (long int)timeout , 0 };
    for (size_t i=0; i<sizeof fds/sizeof fds[0]; i++) {
@@ -199,6 +196,17 @@ int webc_accept_conn (int listenfd, size_t timeout,
       return -1;
    }
 
+   return webc_util_accept (listenfd, remote_addr, remote_port);
+}
+
+int webc_util_accept (int listenfd, char **remote_addr, uint16_t *remote_port)
+{
+   struct sockaddr_in ret;
+   socklen_t retlen = sizeof ret;
+   int retval = -1;
+
+   memset (&ret, 0xff, sizeof ret);
+
    retval = accept4 (listenfd, (struct sockaddr *)&ret, &retlen, SOCK_CLOEXEC);
    if (retval <= 0) {
       return -1;
@@ -227,49 +235,15 @@ int webc_accept_conn (int listenfd, size_t timeout,
    return retval;
 }
 
-
-struct thread_args_t {
-   int fd;
-   char *remote_addr;
-   uint16_t remote_port;
-};
-
-static void thread_args_del (struct thread_args_t *args)
-{
-   if (args) {
-      free (args->remote_addr);
-      free (args);
-   }
-}
-
-static struct thread_args_t *thread_args_new (int fd, const char *remote_addr,
-                                                      int16_t remote_port)
-{
-   struct thread_args_t *ret = NULL;
-
-   if (!(ret = calloc (1, sizeof *ret))) {
-      return NULL;
-   }
-
-   ret->fd = fd;
-   ret->remote_addr = strdup (remote_addr);
-   ret->remote_port = remote_port;
-
-   if (!ret->remote_addr) {
-      thread_args_del (ret);
-      ret = NULL;
-   }
-
-   return ret;
-}
-
 /* ****************************************************************** */
 
-static bool fd_read_line (int fd, char **dst, size_t *dstlen)
+bool webc_util_read_line (int fd, char **dst, size_t *dstlen)
 {
    char *line = NULL;
    size_t line_len = 0;
    char c;
+   bool complete = false;
+   struct webc_conn_t *conn = webc_conn_current ();
 
    free (*dst);
    *dst = NULL;
@@ -284,13 +258,21 @@ static bool fd_read_line (int fd, char **dst, size_t *dstlen)
       }
       line = tmp;
       line[line_len++] = c;
+      if (conn && !conn->bytes_received++)
+         webc_conn_stamp (conn, webc_conn_FIRST_BYTE);
       if (c == '\n' && line[line_len-2] == '\r') {
+         webc_capture_data (conn, line, line_len);
          line_len -= 2;
          line[line_len] = 0;
+         complete = true;
          break;
       }
    }
 
+   // What the client sent before it stopped sending is captured too.
+   if (!complete)
+      webc_capture_data (conn, line, line_len);
+
    *dst = line;
    *dstlen = line_len;
    return true;
@@ -405,13 +387,13 @@ const char *webc_get_http_rspstr (int status)
    return "HTTP/1.1 500 Internal Server Error\r\n";
 }
 
-static void *thread_func (void *ta)
+void webc_serve_conn (struct webc_resource_table_t *routes, int fd,
+                      char *remote_addr, uint16_t remote_port,
+                      uint64_t accept_ns)
 {
    int status = 500;
    const char *rsp_line = NULL;
 
-   struct thread_args_t *args = ta;
-
    enum webc_method_t method = 0;
    char *org_resource = NULL;
    char *resource = NULL;
@@ -419,6 +401,7 @@ static void *thread_func (void *ta)
    const char *content_type = NULL;
    enum webc_http_version_t version = 0;
    webc_resource_handler_t *webc_resource_handler = NULL;
+   struct webc_resource_match_t match = { NULL };
 
    char *rqst_line = NULL;
    size_t rqst_line_len = 0;
@@ -428,64 +411,73 @@ static void *thread_func (void *ta)
 
    webc_header_t *rsp_headers = NULL;
 
+   struct webc_conn_t conn;
+
    size_t i;
 
+   webc_conn_begin (&conn, fd, remote_addr, remote_port);
+   conn.stamps[webc_conn_ACCEPTED] = accept_ns;
+   webc_metrics_conn_begin ();
+
    memset (rqst_headers, 0, MAX_HTTP_HEADERS * sizeof rqst_headers[0]);
    memset (rqst_header_lens, 0, MAX_HTTP_HEADERS * sizeof rqst_header_lens[0]);
 
    if (!(rsp_headers = webc_header_new ())) {
-      WEBC_THRD_LOG (args->remote_addr, args->remote_port,
+      WEBC_THRD_LOG (remote_addr, remote_port,
                   "Failed to create header object\n");
       goto errorexit;
    }
 
-   if (!(fd_read_line (args->fd, &rqst_line, &rqst_line_len)) ||
+   if (!(webc_util_read_line (fd, &rqst_line, &rqst_line_len)) ||
        !rqst_line ||
        !rqst_line_len) {
-      WEBC_THRD_LOG (args->remote_addr, args->remote_port,
+      WEBC_THRD_LOG (remote_addr, remote_port,
                 "Malformed request line: [%s]. Aborting.\n", rqst_line);
       status = 400;
       goto errorexit;
    }
 
-   WEBC_TS_LOG ("[%s:%u] [%s]\n", args->remote_addr, args->remote_port, rqst_line);
+   WEBC_TS_LOG ("[%s:%u] [%s]\n", remote_addr, remote_port, rqst_line);
 
    for (i=0; i<MAX_HTTP_HEADERS; i++) {
-      if (!(fd_read_line (args->fd, &rqst_headers[i], &rqst_header_lens[i]))) {
-         WEBC_THRD_LOG (args->remote_addr, args->remote_port,
+      if (!(webc_util_read_line (fd, &rqst_headers[i], &rqst_header_lens[i]))) {
+         WEBC_THRD_LOG (remote_addr, remote_port,
                    "Unexpected end of rqst_headers");
          status = 400;
          goto errorexit;
       }
       if (rqst_header_lens[i]==0) {
          // Reached the empty line, everything after this is the message body
+         webc_conn_stamp (&conn, webc_conn_HEADERS);
          break;
       }
    }
 
    if (i >= MAX_HTTP_HEADERS) {
-      WEBC_THRD_LOG (args->remote_addr, args->remote_port,
+      WEBC_THRD_LOG (remote_addr, remote_port,
                 "Too many rqst_headers sent (%zu), ignoring the rest\n", i);
    }
 
 #if 0
-   WEBC_THRD_LOG (args->remote_addr, args->remote_port, "Collected all rqst_headers\n");
-   WEBC_THRD_LOG (args->remote_addr, args->remote_port,
+   WEBC_THRD_LOG (remote_addr, remote_port, "Collected all rqst_headers\n");
+   WEBC_THRD_LOG (remote_addr, remote_port,
              "rqst: [%s]\n", rqst_line);
 
    for (size_t i=0; rqst_headers[i]; i++) {
-      WEBC_THRD_LOG (args->remote_addr, args->remote_port,
+      WEBC_THRD_LOG (remote_addr, remote_port,
                 "header: [%s]\n", rqst_headers[i]);
    }
 #endif
 
-   method = get_rqst_method (rqst_line);
-   org_resource = get_rqst_resource (rqst_line);
-   version = get_rqst_version (rqst_line);
-   getvars = get_rqst_getvars (rqst_line);
-   webc_resource_handler = webc_resource_handler_find (org_resource);
+   method = webc_util_rqst_method (rqst_line);
+   org_resource = webc_util_rqst_resource (rqst_line);
+   version = webc_util_rqst_version (rqst_line);
+   getvars = webc_util_rqst_getvars (rqst_line);
+   webc_resource_handler = webc_resource_table_match (routes, org_resource,
+                                                      method, &match);
+   webc_conn_stamp (&conn, webc_conn_ROUTED);
 
-   WEBC_THRD_LOG (args->remote_addr, args->remote_port,
+   WEBC_THRD_LOG_AT (WEBC_LOG_DEBUG, remote_addr, remote_port,
                   "method        [%i]\n"
                   "org_resource  [%s]\n"
                   "version       [%i]\n"
@@ -493,7 +485,7 @@ static void *thread_func (void *ta)
                      method, org_resource, version, getvars);
 
    if (!method || !org_resource || !version || !webc_resource_handler) {
-      WEBC_THRD_LOG (args->remote_addr, args->remote_port,
+      WEBC_THRD_LOG (remote_addr, remote_port,
                 "Unrecognised method, version or resource [%s]\n",
                  rqst_line);
       status = 400;
@@ -501,7 +493,7 @@ static void *thread_func (void *ta)
    }
 
    if ((strstr (org_resource, ".."))!=NULL) {
-      WEBC_THRD_LOG (args->remote_addr, args->remote_port,
+      WEBC_THRD_LOG (remote_addr, remote_port,
                 "Attempt to access parent directory [%s]\n",
                  rqst_line);
       status = 403;
@@ -530,25 +522,41 @@ static void *thread_func (void *ta)
          // TODO: read the POSTed form data
       }
    }
-   status = webc_resource_handler (args->fd, args->remote_addr, args->remote_port,
+   // Each connection carries a single request.
+   webc_header_set (rsp_headers, webc_header_CONNECTION, "close");
+   webc_conn_server_timing (&conn, rsp_headers);
+   webc_resource_match_set (&match);
+   status = webc_resource_handler (fd, remote_addr, remote_port,
                                    method, version, resource,
                                    rqst_headers, rsp_headers,
                                    getvars);
+   webc_resource_match_set (NULL);
+   webc_conn_stamp (&conn, webc_conn_HANDLED);
 
-   WEBC_TS_LOG ("[%s:%u] =>[%i]\n", args->remote_addr, args->remote_port, status);
+   WEBC_TS_LOG ("[%s:%u] =>[%i]\n", remote_addr, remote_port, status);
 
 errorexit:
 
-   if (!status || status!=200) {
+   webc_resource_match_release (&match);
+
+   // Handlers send their own response for anything but an error.
+   if (status < 200 || status >= 400) {
       rsp_line = webc_get_http_rspstr (status);
-      write (args->fd, rsp_line, strlen (rsp_line));
-      write (args->fd, "\r\n\r\n", 4);
+      webc_conn_write (fd, rsp_line, strlen (rsp_line));
+      webc_conn_write (fd, "\r\n\r\n", 4);
       char outbuf[100];
       snprintf (outbuf, sizeof outbuf, "Error: %i\n", status);
-      write (args->fd, outbuf, strlen (outbuf));
-      write (args->fd, "\r\n\r\n", 4);
+      webc_conn_write (fd, outbuf, strlen (outbuf));
+      webc_conn_write (fd, "\r\n\r\n", 4);
    }
 
+   webc_accesslog_write (accept_ns, remote_addr, remote_port,
+                         method, org_resource, status, conn.bytes_sent);
+   webc_metrics_request (method, status, &conn);
+   if (WEBC_SLOWLOG_IS_SLOW (webc_accesslog_now () - accept_ns))
+      webc_slowlog_record (&conn, rqst_line, rqst_headers, match.route, status);
+   webc_capture_conn_end (&conn, status);
+
    free (rqst_line);
    free (org_resource);
    free (getvars);
@@ -558,56 +566,15 @@ errorexit:
    }
    webc_header_del (rsp_headers);
 
-   shutdown (args->fd, SHUT_RDWR);
-   close (args->fd);
-
-   WEBC_THRD_LOG (args->remote_addr, args->remote_port, "Ending thread\n");
-   thread_args_del (args);
-
-   return NULL;
-}
-
-bool webc_handle_conn (int fd, char *remote_addr, uint16_t remote_port)
-{
-   bool error = true;
-
-   pthread_attr_t attr;
-   pthread_t thread;
-   struct thread_args_t *args = NULL;
-
-   if (!(args = thread_args_new (fd, remote_addr, remote_port))) {
-      WEBC_UTIL_LOG ("[%s:%u] OOM error\n", remote_addr, remote_port);
-      goto errorexit;
-   }
-
-   if ((pthread_attr_init (&attr))!=0) {
-      WEBC_UTIL_LOG ("[%s:%u] Failed to initiliase thread attributes: %m\n",
-                  remote_addr, remote_port);
-      goto errorexit;
-   }
-   if ((pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED))!=0) {
-      WEBC_UTIL_LOG ("[%s:%u] Failed to set the thread to detached: %m\n",
-                  remote_addr, remote_port);
-      goto errorexit;
-   }
-   if ((pthread_create (&thread, &attr, thread_func, args))!=0) {
-      WEBC_UTIL_LOG ("[%s:%u] Failed to start thread\n", remote_addr, remote_port);
-      goto errorexit;
-   }
-
+   shutdown (fd, SHUT_RDWR);
 
-   error = false;
+   webc_conn_end (&conn);
+   webc_metrics_conn_end ();
 
-errorexit:
-   if (error) {
-      WEBC_UTIL_LOG ("Thread start failure: closing client fd %i\n", fd);
-      close (fd);
-      thread_args_del (args);
-   }
-   return !error;
+   WEBC_THRD_LOG_AT (WEBC_LOG_DEBUG, remote_addr, remote_port,
+                     "Ending connection\n");
 }
 
-
 bool webc_util_vsprintf (char **dst, size_t *dst_len, const char *fmts, va_list ap)
 {
    va_list ac;
@@ -646,6 +613,28 @@ bool webc_util_sprintf (char **dst, size_t *dst_len, const char *fmts, ...)
    return ret;
 }
 
+const char *webc_util_cline_opt (int argc, char **argv, const char *name)
+{
+   size_t namelen = strlen (name);
+
+   for (int i=1; i<argc && argv[i]; i++) {
+      if ((strncmp (argv[i], "--", 2))!=0)
+         continue;
+
+      char *value = &argv[i][2];
+      if ((strncmp (value, name, namelen))!=0 ||
+          (value[namelen] != '=' && value[namelen] != 0))
+         continue;
+
+      value += namelen;
+      if (*value == '=')
+         value++;
+      argv[i][0] = 0;
+      return value;
+   }
+   return NULL;
+}
+
 #if 1
 // These two must be commented out if your linker fails with "multiple
 // references" errors. Don't forget to comment them out in the util.h header
@@ -662,12 +651,12 @@ int stricmp (const char *s1, const char *s2)
 
 int strnicmp (const char *s1, const char *s2, size_t n)
 {
-   while (*s1 && *s2 && n--) {
-      int result = toupper (*s1++) - toupper (*s2++);
-      if (result)
+   for (; n; n--, s1++, s2++) {
+      int result = toupper ((unsigned char)*s1) - toupper ((unsigned char)*s2);
+      if (result || !*s1)
          return result;
    }
-   return *s1 - *s2;
+   return 0;
 }
 #endif
 
@@ -9,40 +9,31 @@
 #include <stdarg.h>
 #include <time.h>
 
-#define WEBC_UTIL_LOG(...)      do {\
-      fprintf (stderr, "%s:%d: ", __FILE__, __LINE__);\
-      fprintf (stderr, __VA_ARGS__);\
+#include "webc_log.h"
+
+struct webc_resource_table_t;
+
+// The records are written by a background thread (see webc_log.h). The
+// _AT variants log at the given level, the others at WEBC_LOG_INFO.
+#define WEBC_UTIL_LOG_AT(level,...)       do {\
+   if (WEBC_LOG_ENABLED (level))\
+      webc_log_util (__FILE__, __LINE__, __VA_ARGS__);\
 } while (0)
 
-#define WEBC_THRD_LOG(addr,port,...)      do {\
-      fprintf (stderr, "%s:%d: [%s:%u] ", __FILE__, __LINE__, addr, port);\
-      fprintf (stderr, __VA_ARGS__);\
+#define WEBC_THRD_LOG_AT(level,addr,port,...)      do {\
+   if (WEBC_LOG_ENABLED (level))\
+      webc_log_thrd (__FILE__, __LINE__, addr, port, __VA_ARGS__);\
 } while (0)
 
-#define WEBC_TS_LOG(...)        do {\
-   char template[] = "YYYYMMDDhhmmss";\
-   time_t now = time (NULL);\
-   struct tm *time_fields = localtime (&now);\
-   if (!time_fields) {\
-      WEBC_UTIL_LOG ("Failed to get local time: %m\n");\
-   } else {\
-      snprintf (template, sizeof template, "%04i"\
-                                           "%02i"\
-                                           "%02i"\
-                                           "%02i"\
-                                           "%02i"\
-                                           "%02i",\
-                                           time_fields->tm_year + 1900,\
-                                           time_fields->tm_mon + 1,\
-                                           time_fields->tm_mday,\
-                                           time_fields->tm_hour,\
-                                           time_fields->tm_min,\
-                                           time_fields->tm_sec);\
-      fprintf (stderr, "%s: ", template);\
-      fprintf (stderr, __VA_ARGS__);\
-   }\
+#define WEBC_TS_LOG_AT(level,...)         do {\
+   if (WEBC_LOG_ENABLED (level))\
+      webc_log_ts (__VA_ARGS__);\
 } while (0)
 
+#define WEBC_UTIL_LOG(...)                WEBC_UTIL_LOG_AT (WEBC_LOG_INFO, __VA_ARGS__)
+#define WEBC_THRD_LOG(addr,port,...)      WEBC_THRD_LOG_AT (WEBC_LOG_INFO, addr, port, __VA_ARGS__)
+#define WEBC_TS_LOG(...)                  WEBC_TS_LOG_AT (WEBC_LOG_INFO, __VA_ARGS__)
+
 
 
 enum webc_method_t {
@@ -82,6 +73,14 @@ extern "C" {
    bool webc_util_sprintf (char **dst, size_t *dst_len, const char *fmts, ...);
    bool webc_util_vsprintf (char **dst, size_t *dst_len, const char *fmts, va_list ap);
 
+   // The value of the command-line option --name=value in argv, "" for a
+   // bare --name, or NULL if it is not there. The name must
+   // match exactly, so --threadsX is not --threads. The argument found is
+   // blanked (its first character set to 0), so that the arguments still
+   // set once every option has been read are the unknown ones.
+   const char *webc_util_cline_opt (int argc, char **argv,
+                                   const char *name);
+
 #if 1
    // These two must be commented out if your linker fails with "multiple
    // references" errors. Don't forget to comment them out in the util.c
@@ -102,10 +101,35 @@ extern "C" {
                                   char **remote_addr,
                                   uint16_t *remote_port);
 
-   bool webc_handle_conn (int fd, char *remote_addr, uint16_t remote_port);
+   // As webc_accept_conn(), without waiting: for a listener that poll()
+   // reported readable.
+   int webc_util_accept (int listenfd, char **remote_addr,
+                                       uint16_t *remote_port);
+
+   // Reads the request on fd, a connection accepted at accept_ns (see
+   // webc_accesslog_now()), routes it through routes (NULL for the global
+   // table, see webc_resource.h), sends the response and shuts fd down;
+   // the caller closes it. The servers in webc_server.h call this on a
+   // thread of their own.
+   void webc_serve_conn (struct webc_resource_table_t *routes, int fd,
+                         char *remote_addr, uint16_t remote_port,
+                         uint64_t accept_ns);
 
    const char *webc_get_http_rspstr (int status);
 
+   // The request parser used by webc_serve_conn(), exposed for the
+   // benchmarks in bench/. The resource and the GET variables are
+   // returned in new strings, which the caller must free; the GET variables
+   // are NULL if there are none.
+   enum webc_method_t webc_util_rqst_method (const char *rqst_line);
+   enum webc_http_version_t webc_util_rqst_version (const char *rqst_line);
+   char *webc_util_rqst_resource (const char *rqst_line);
+   char *webc_util_rqst_getvars (const char *rqst_line);
+
+   // Reads one CRLF-terminated line from fd into *dst, without the CRLF,
+   // replacing (and freeing) whatever *dst held.
+   bool webc_util_read_line (int fd, char **dst, size_t *dstlen);
+
 
 #ifdef __cplusplus
 };
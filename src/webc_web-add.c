@@ -36,6 +36,40 @@ static int app_handler (int                      fd,
    return 200;
 }
 
+// An example of a templated route: the captures are read with
+// webc_resource_capture(), without parsing resource by hand.
+static int orders_handler (int                      fd,
+                           char                    *remote_addr,
+                           uint16_t                 remote_port,
+                           enum webc_method_t       method,
+                           enum webc_http_version_t version,
+                           const char              *resource,
+                           char                   **rqst_headers,
+                           webc_header_t           *rsp_headers,
+                           char                    *vars)
+{
+   (void)remote_addr;
+   (void)remote_port;
+   (void)method;
+   (void)version;
+   (void)resource;
+   (void)rqst_headers;
+   (void)vars;
+
+   size_t id_len = 0, rest_len = 0;
+   const char *id = webc_resource_capture ("id", &id_len);
+   const char *rest = webc_resource_capture ("rest", &rest_len);
+
+   webc_header_set (rsp_headers, webc_header_CONTENT_TYPE, "text/plain");
+   write (fd, webc_get_http_rspstr (200), strlen (webc_get_http_rspstr (200)));
+   webc_header_write (rsp_headers, fd);
+
+   dprintf (fd, "user [%.*s], orders [%.*s]\n", (int)id_len, id,
+                                                (int)rest_len, rest);
+
+   return 200;
+}
+
 bool webc_web_add_init (void)
 {
    /* All the initialisation you want to do on startup must go here. On
@@ -57,6 +91,15 @@ bool webc_web_add_load_handlers (void)
       return false;
    }
 
+   if (!(webc_resource_global_handler_add_method ("orders_handler",
+                                                  webc_method_GET,
+                                                  "/myapp/users/:id/orders/*rest",
+                                                  pattern_TEMPLATE,
+                                                  orders_handler))) {
+      WEBC_UTIL_LOG ("Failed to add handler [%s]\n", "/myapp/users/:id/orders");
+      return false;
+   }
+
    return true;
 }
 
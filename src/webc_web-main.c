@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,6 +7,7 @@
 #include <stdbool.h>
 #include <signal.h>
 #include <inttypes.h>
+#include <errno.h>
 #include <time.h>
 
 #include <sys/types.h>
@@ -20,34 +23,85 @@
 #include "webc_config.h"
 #include "webc_resource.h"
 #include "webc_handler.h"
+#include "webc_mime.h"
+#include "webc_server.h"
+#include "webc_bundle.h"
+#include "webc_embed.h"
+#include "webc_admin.h"
+#include "webc_plugin.h"
+#include "webc_accesslog.h"
+#include "webc_metrics.h"
+#include "webc_slowlog.h"
+#include "webc_capture.h"
+#include "webc_conn.h"
+#include "webc_upgrade.h"
 
-static volatile sig_atomic_t g_exit_program = 0;
 static size_t g_timeout = TIMEOUT_TO_SHUTDOWN;
 
-static void signal_handler (int n);
-static const char *read_cline_opt (int argc, char **argv, const char *name);
-
 int main (int argc, char **argv)
 {
    int ret = EXIT_FAILURE;
 
-   char *logfile_name = NULL;
-
    uint32_t portnum = 0;
    int backlog = 0;
-   int listenfd = -1;
-   uint8_t errcount = 0;
+   struct webc_server_config_t config;
+   webc_server_t *server = NULL;
+   char **upgrade_argv = NULL;
+   bool exiting = false;
+   bool upgraded = false;
+
+   // The signals are blocked in every thread and taken by the loop at the
+   // end of main() with sigtimedwait(), so they must be blocked before any
+   // thread is started. SIGINT and SIGTERM stop the server, SIGHUP reloads
+   // the plugins, SIGUSR1 moves the log on to a new file and SIGUSR2
+   // upgrades (see webc_upgrade.h).
+   sigset_t handled;
+   sigemptyset (&handled);
+   sigaddset (&handled, SIGINT);
+   sigaddset (&handled, SIGTERM);
+   sigaddset (&handled, SIGHUP);
+   sigaddset (&handled, SIGUSR1);
+   sigaddset (&handled, SIGUSR2);
+   if ((sigprocmask (SIG_BLOCK, &handled, NULL))!=0) {
+      WEBC_UTIL_LOG ("Failed to block signals: %m\n");
+      return EXIT_FAILURE;
+   }
+
+   webc_server_config_init (&config);
 
-   int clientfd = -1;
-   char *remote_addr = NULL;
-   uint16_t remote_port = 0;
+   // An upgrade starts the new server with these arguments, which
+   // webc_util_cline_opt() below blanks out as it goes.
+   if (!(upgrade_argv = calloc (argc + 1, sizeof *upgrade_argv))) {
+      WEBC_UTIL_LOG ("OOM error copying the arguments\n");
+      return EXIT_FAILURE;
+   }
+   for (int i=0; i<argc; i++) {
+      if (!(upgrade_argv[i] = strdup (argv[i]))) {
+         WEBC_UTIL_LOG ("OOM error copying the arguments\n");
+         goto errorexit;
+      }
+   }
 
    /* *************************************************************
     *  Handle the command line arguments
     */
-   const char *opt_portnum = read_cline_opt (argc, argv, "port");
-   const char *opt_logfile = read_cline_opt (argc, argv, "logfile");
-   const char *opt_backlog = read_cline_opt (argc, argv, "backlog");
+   const char *opt_portnum = webc_util_cline_opt (argc, argv, "port");
+   const char *opt_logfile = webc_util_cline_opt (argc, argv, "logfile");
+   const char *opt_backlog = webc_util_cline_opt (argc, argv, "backlog");
+   const char *opt_mimetypes = webc_util_cline_opt (argc, argv, "mimetypes");
+   const char *opt_bundle = webc_util_cline_opt (argc, argv, "bundle");
+   const char *opt_plugins = webc_util_cline_opt (argc, argv, "plugins");
+   const char *opt_loglevel = webc_util_cline_opt (argc, argv, "loglevel");
+   const char *opt_accesslog = webc_util_cline_opt (argc, argv, "accesslog");
+   const char *opt_server_timing = webc_util_cline_opt (argc, argv, "server-timing");
+   const char *opt_slowlog = webc_util_cline_opt (argc, argv, "slowlog");
+   const char *opt_capture = webc_util_cline_opt (argc, argv, "capture");
+   const char *opt_threads = webc_util_cline_opt (argc, argv, "threads");
+   const char *opt_max_conns = webc_util_cline_opt (argc, argv, "max-conns");
+   const char *opt_drain_secs = webc_util_cline_opt (argc, argv, "drain-secs");
+   const char *opt_admin_token = webc_util_cline_opt (argc, argv, "admin-token");
+   const char *opt_pidfile = webc_util_cline_opt (argc, argv, "pidfile");
+   const char *opt_upgrade_fd = webc_util_cline_opt (argc, argv, WEBC_UPGRADE_OPT);
 
    bool opt_unknown = false;
    for (size_t i=1; argv[i]; i++) {
@@ -58,7 +112,16 @@ int main (int argc, char **argv)
    }
    if (opt_unknown) {
       WEBC_UTIL_LOG ("Aborting\n");
-      return EXIT_FAILURE;
+      goto errorexit;
+   }
+
+   if (opt_loglevel) {
+      int level = webc_log_level_parse (opt_loglevel);
+      if (level < 0) {
+         WEBC_UTIL_LOG ("Unknown log level [%s], aborting\n", opt_loglevel);
+         goto errorexit;
+      }
+      webc_log_level_set (level);
    }
 
    if (!opt_portnum) {
@@ -74,68 +137,73 @@ int main (int argc, char **argv)
    if (!opt_logfile) {
       WEBC_UTIL_LOG ("No logfile specified, logging to stderr\n");
    } else {
-      int fd_logfile = -1;
-      static const char *template = ".YYYYMMDDhhmmss";
-      size_t logfile_namelen = 0;
-      int fd_stderr = -1;
-
-      time_t now = time (NULL);
-      struct tm *time_fields = localtime (&now);
-      if (!time_fields) {
-         WEBC_UTIL_LOG ("Failed to get local time: %m\n");
+      if (!(webc_log_file (opt_logfile))) {
+         WEBC_UTIL_LOG ("Cannot open logfile [%s]\n", opt_logfile);
          goto errorexit;
       }
+      printf ("Logging to [%s.YYYYMMDDhhmmss]\n", opt_logfile);
+   }
 
-      logfile_namelen = strlen (opt_logfile)
-                      + strlen (template)
-                      + 1;
-      if (!(logfile_name = malloc (logfile_namelen))) {
-         WEBC_UTIL_LOG ("OOM error constructing logfile name\n");
-         goto errorexit;
-      }
-      snprintf (logfile_name, logfile_namelen, "%s."     // prefix
-                                               "%04i"    // YYYY
-                                               "%02i"    // MM
-                                               "%02i"    // DD
-                                               "%02i"    // hh
-                                               "%02i"    // mm
-                                               "%02i",   // ss
-                                               opt_logfile,
-                                               time_fields->tm_year + 1900,
-                                               time_fields->tm_mon + 1,
-                                               time_fields->tm_mday,
-                                               time_fields->tm_hour,
-                                               time_fields->tm_min,
-                                               time_fields->tm_sec);
-
-      fd_logfile = open (logfile_name,
-                         O_WRONLY | O_CREAT,
-                         S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
-      if (fd_logfile < 0) {
-         WEBC_UTIL_LOG ("Cannot open logfile [%s]\n", logfile_name);
-         goto errorexit;
-      }
-      if ((fd_stderr = fileno (stderr)) < 0) {
-         WEBC_UTIL_LOG ("Unable to get file descriptors for stderr\n");
-         close (fd_logfile);
-         goto errorexit;
-      }
-      if ((dup2 (fd_logfile, fd_stderr)) != fd_stderr) {
-         WEBC_UTIL_LOG ("Failed to dup() file descriptors for logging: %m\n");
-         close (fd_logfile);
+   if (!(webc_log_start ())) {
+      WEBC_UTIL_LOG ("Failed to start the log writer\n");
+      goto errorexit;
+   }
+
+   if (opt_accesslog && !(webc_accesslog_open (opt_accesslog))) {
+      WEBC_UTIL_LOG ("Failed to open the access log [%s]\n", opt_accesslog);
+      goto errorexit;
+   }
+
+   // After an upgrade the old server is still writing to the capture.
+   if (opt_capture && !(webc_capture_open (opt_capture,
+                                           opt_upgrade_fd != NULL))) {
+      WEBC_UTIL_LOG ("Failed to open the capture file [%s]\n", opt_capture);
+      goto errorexit;
+   }
+
+   // Without a token the admin endpoints refuse every request.
+   if (opt_admin_token && !(webc_admin_token_load (opt_admin_token))) {
+      WEBC_UTIL_LOG ("Failed to load the admin token, aborting\n");
+      goto errorexit;
+   }
+
+   if (opt_server_timing)
+      webc_conn_server_timing_enable (true);
+
+   if (opt_slowlog) {
+      char *end;
+      unsigned long long ms = strtoull (opt_slowlog, &end, 10);
+      if (!opt_slowlog[0] || *end) {
+         WEBC_UTIL_LOG ("Invalid slowlog threshold [%s], aborting\n", opt_slowlog);
          goto errorexit;
       }
-      fflush (stdout);
-      fflush (stderr);
-      WEBC_UTIL_LOG ("Logging to [%s]\n", logfile_name);
-      printf ("Logging to [%s]\n", logfile_name);
+      webc_slowlog_threshold_set (ms);
+   }
+
+   if (opt_mimetypes && !(webc_mime_load (opt_mimetypes))) {
+      WEBC_UTIL_LOG ("Failed to load mime types from [%s]\n", opt_mimetypes);
+      goto errorexit;
    }
 
-   if ((chdir (DEFAULT_WEB_ROOT))!=0) {
-      WEBC_UTIL_LOG ("Failed to switch to web-root [%s]: %m\n", DEFAULT_WEB_ROOT);
+   if (opt_bundle && !(webc_bundle_open (opt_bundle))) {
+      WEBC_UTIL_LOG ("Failed to load bundle [%s]\n", opt_bundle);
       goto errorexit;
    }
 
+   // With embedded assets the site is in the binary, and the web root is
+   // only needed for what is not, so it is allowed to be missing.
+   bool embedded = webc_embed_count () > 0;
+   if (embedded)
+      WEBC_UTIL_LOG ("Serving %zu embedded files\n", webc_embed_count ());
+
+   config.root = DEFAULT_WEB_ROOT;
+   if ((access (DEFAULT_WEB_ROOT, X_OK))!=0) {
+      WEBC_UTIL_LOG ("Failed to open web-root [%s]: %m\n", DEFAULT_WEB_ROOT);
+      if (!embedded)
+         goto errorexit;
+      config.root = NULL;
+   }
+
    WEBC_UTIL_LOG ("Starting the web.c server\n");
 
    /* ************************************************************** */
@@ -149,13 +217,57 @@ int main (int argc, char **argv)
       goto errorexit;
    }
 
-   /* ************************************************************** */
+   if ((sscanf (opt_backlog, "%i", &backlog))!=1 || backlog <= 0) {
+      WEBC_UTIL_LOG ("Listen backlog [%s] is invalid\n", opt_backlog);
+      goto errorexit;
+   }
+
+   config.listeners[0].port = portnum;
+   config.listeners[0].backlog = backlog;
+   config.nlisteners = 1;
 
-   if ((signal (SIGINT, signal_handler))==SIG_ERR) {
-      WEBC_UTIL_LOG ("Failed to install signal handler: %m\n");
+   // Listeners handed over by an upgrade or by systemd replace --port.
+   int inherited[WEBC_SERVER_MAX_LISTENERS];
+   size_t ninherited = webc_upgrade_inherit (opt_upgrade_fd, inherited,
+                                             WEBC_SERVER_MAX_LISTENERS);
+   if (opt_upgrade_fd && !ninherited) {
+      WEBC_UTIL_LOG ("No listeners to upgrade, aborting\n");
+      goto errorexit;
+   }
+   if (ninherited) {
+      WEBC_UTIL_LOG ("Using %zu inherited listeners\n", ninherited);
+      for (size_t i=0; i<ninherited; i++) {
+         config.listeners[i].fd = inherited[i];
+         config.listeners[i].backlog = backlog;
+      }
+      config.nlisteners = ninherited;
+   }
+
+   // --threads=N serves connections from a pool of N threads, and 0 from
+   // a thread each.
+   if (opt_threads) {
+      if ((sscanf (opt_threads, "%zu", &config.pool_size))!=1) {
+         WEBC_UTIL_LOG ("Thread count [%s] is invalid\n", opt_threads);
+         goto errorexit;
+      }
+      config.threads = config.pool_size ? webc_server_THREAD_POOL
+                                        : webc_server_THREAD_PER_CONN;
+   }
+
+   if (opt_max_conns &&
+       (sscanf (opt_max_conns, "%zu", &config.max_conns))!=1) {
+      WEBC_UTIL_LOG ("Connection limit [%s] is invalid\n", opt_max_conns);
+      goto errorexit;
+   }
+
+   if (opt_drain_secs &&
+       (sscanf (opt_drain_secs, "%u", &config.drain_secs))!=1) {
+      WEBC_UTIL_LOG ("Drain timeout [%s] is invalid\n", opt_drain_secs);
       goto errorexit;
    }
 
+   /* ************************************************************** */
+
    if ((signal (SIGPIPE, SIG_IGN))==SIG_ERR) {
       WEBC_UTIL_LOG ("Failed to block SIGPIPE: %m\n");
       goto errorexit;
@@ -173,39 +285,74 @@ int main (int argc, char **argv)
       goto errorexit;
    }
 
+   // Packed sites replace the default handlers; each falls through to the
+   // next (embedded, bundle, filesystem) for what it does not have.
+   webc_resource_handler_t *packed = embedded ? webc_handler_embedded
+                                   : opt_bundle ? webc_handler_bundle
+                                   : NULL;
+
    if (!(webc_resource_global_handler_add ("handler_none",
                                       EXTENSION_NONE, pattern_SUFFIX,
-                                      webc_handler_none))) {
+                                      packed ? packed : webc_handler_none))) {
       WEBC_UTIL_LOG ("Failed to add handler [%s]\n", EXTENSION_NONE);
       goto errorexit;
    }
 
    if (!(webc_resource_global_handler_add ("handler_none",
                                       EXTENSION_DIR, pattern_SUFFIX,
-                                      webc_handler_dir))) {
+                                      packed ? packed : webc_handler_dir))) {
       WEBC_UTIL_LOG ("Failed to add handler [%s]\n", EXTENSION_DIR);
       goto errorexit;
    }
 
    if (!(webc_resource_global_handler_add ("handler_none",
                                       EXTENSION_TEXT, pattern_SUFFIX,
-                                      webc_handler_static_file))) {
+                                      packed ? packed : webc_handler_static_file))) {
       WEBC_UTIL_LOG ("Failed to add handler [%s]\n", EXTENSION_TEXT);
       goto errorexit;
    }
 
    if (!(webc_resource_global_handler_add ("handler_none",
                                       EXTENSION_HTML, pattern_SUFFIX,
-                                      webc_handler_html))) {
+                                      packed ? packed : webc_handler_html))) {
       WEBC_UTIL_LOG ("Failed to add handler [%s]\n", EXTENSION_HTML);
       goto errorexit;
    }
 
+   if (!(webc_resource_global_handler_add ("handler_admin",
+                                      ADMIN_PREFIX, pattern_PREFIX,
+                                      webc_admin_handler))) {
+      WEBC_UTIL_LOG ("Failed to add handler [%s]\n", ADMIN_PREFIX);
+      goto errorexit;
+   }
+
+   if (!(webc_resource_global_handler_add ("handler_metrics",
+                                      METRICS_PATH, pattern_EXACT,
+                                      webc_metrics_handler))) {
+      WEBC_UTIL_LOG ("Failed to add handler [%s]\n", METRICS_PATH);
+      goto errorexit;
+   }
+
    if (!(webc_web_add_load_handlers ())) {
       WEBC_UTIL_LOG ("Failed to run the user-supplied load-handlers\n");
       goto errorexit;
    }
 
+   // --plugins is a comma-separated list of shared objects.
+   for (const char *ptr = opt_plugins; ptr && *ptr; ) {
+      size_t len = strcspn (ptr, ",");
+      char *fname = NULL;
+      if (!(webc_util_sprintf (&fname, NULL, "%.*s", (int)len, ptr)) ||
+          !(webc_plugin_load (fname))) {
+         WEBC_UTIL_LOG ("Failed to load plugin [%.*s]\n", (int)len, ptr);
+         free (fname);
+         goto errorexit;
+      }
+      free (fname);
+      ptr += len;
+      ptr += (*ptr == ',');
+   }
+
    if (!(webc_resource_global_handler_unlock())) {
       WEBC_UTIL_LOG ("Failed to release global resource handler lock\n");
       goto errorexit;
@@ -213,89 +360,82 @@ int main (int argc, char **argv)
 
    /* ************************************************************** */
 
-   if ((listenfd = webc_create_listener (portnum, backlog)) < 0) {
-      WEBC_UTIL_LOG ("Unable to create a listener, aborting\n");
+   if (!(server = webc_server_new (&config)) ||
+       !(webc_server_start (server))) {
+      WEBC_UTIL_LOG ("Unable to start the server, aborting\n");
+      goto errorexit;
+   }
+
+   // Before the server being upgraded is told to exit, so that the
+   // pidfile always names a live server.
+   if (opt_pidfile && !(webc_upgrade_pidfile_write (opt_pidfile))) {
+      WEBC_UTIL_LOG ("Failed to write the pidfile [%s], aborting\n", opt_pidfile);
       goto errorexit;
    }
 
-   WEBC_UTIL_LOG ("Listening on %u q/%i\n", portnum, backlog);
+   webc_upgrade_ready ();
+
+   while (!exiting && webc_server_running (server)) {
+      webc_plugin_reap ();
+
+      struct timespec timeout = { (time_t)g_timeout, 0 };
+      int signum = sigtimedwait (&handled, NULL, &timeout);
 
-   errcount = 0;
-   while (!g_exit_program && errcount < 5) {
-      free (remote_addr);
-      remote_addr = NULL;
-      clientfd = webc_accept_conn (listenfd, g_timeout,
-                                            &remote_addr,
-                                            &remote_port);
-      if (clientfd == 0) { // Timeout
-         errcount = 0;
-         continue;
+      if (signum == SIGINT || signum == SIGTERM) {
+         WEBC_UTIL_LOG ("Stopping the server\n");
+         exiting = true;
       }
-      if (clientfd < 0) { // Error
-         errcount++;
-         WEBC_UTIL_LOG ("Failed to accept(), errcount=%" PRIu8 "\n", errcount);
-         continue;
+      if (signum == SIGHUP) {
+         WEBC_UTIL_LOG ("Reloading plugins\n");
+         webc_plugin_reload ();
       }
-
-      if (!(webc_handle_conn (clientfd, remote_addr, remote_port))) {
-         WEBC_UTIL_LOG ("Failed to start response thread for client [%s:%u]\n",
-                     remote_addr, remote_port);
-         goto errorexit;
+      if (signum == SIGUSR1)
+         webc_log_reopen ();
+      if (signum == SIGUSR2) {
+         int fds[WEBC_SERVER_MAX_LISTENERS];
+         size_t nfds = 0;
+         while (nfds < WEBC_SERVER_MAX_LISTENERS &&
+                (fds[nfds] = webc_server_listener_fd (server, nfds)) >= 0)
+            nfds++;
+         if ((webc_upgrade_exec (upgrade_argv, fds, nfds))) {
+            WEBC_UTIL_LOG ("Upgraded, finishing the connections in progress\n");
+            upgraded = true;
+            break;
+         }
+         WEBC_UTIL_LOG ("Upgrade failed, carrying on\n");
       }
-      clientfd = -1;
-      errcount = 0;
    }
 
-   if (!g_exit_program && errcount) {
-      WEBC_UTIL_LOG ("Aborting due to excessive error-count %" PRIu8 "\n", errcount);
+   webc_server_stop (server);
+   webc_server_wait (server);
+
+   if (!exiting && !upgraded) {
+      WEBC_UTIL_LOG ("The server stopped accepting connections, aborting\n");
       goto errorexit;
    }
 
+   // After an upgrade the pidfile names the new server; otherwise its
+   // removal tells a supervisor that this was not a crash.
+   if (opt_pidfile && !upgraded)
+      webc_upgrade_pidfile_remove (opt_pidfile);
+
    ret = EXIT_SUCCESS;
 
 errorexit:
 
-   free (logfile_name);
+   webc_server_stop (server);
+   webc_server_wait (server);
+   webc_server_del (server);
 
-   if (listenfd >= 0) {
-      shutdown (listenfd, SHUT_RDWR);
-      close (listenfd);
-   }
+   webc_bundle_close ();
 
-   if (clientfd >= 0) {
-      shutdown (listenfd, SHUT_RDWR);
-      close (clientfd);
-   }
+   webc_capture_close ();
+   webc_accesslog_close ();
+   webc_log_stop ();
 
-   free (remote_addr);
+   for (int i=0; upgrade_argv && i<argc; i++)
+      free (upgrade_argv[i]);
+   free (upgrade_argv);
 
    return ret;
 }
-
-
-static void signal_handler (int n)
-{
-   switch (n) {
-      case SIGINT:   g_exit_program = 1;
-   }
-}
-
-static const char *read_cline_opt (int argc, char **argv, const char *name)
-{
-   (void)argc;
-   size_t namelen = strlen (name);
-
-   for (size_t i=1; argv[i]; i++) {
-      if ((memcmp (argv[i], "--", 2))!=0)
-         continue;
-
-      if ((strncmp (&argv[i][2], name, namelen))==0) {
-         char *value = &argv[i][2+namelen];
-         if (*value == '=')
-            value++;
-         argv[i][0] = 0;
-         return value;
-      }
-   }
-   return NULL;
-}
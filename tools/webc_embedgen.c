@@ -0,0 +1,323 @@
+/* ***************************************************************************
+ * Build-time generator for the embedded assets. Walks a directory and
+ * writes, to stdout, a C source file with the contents of every regular
+ * file below it as a const array, the response header lines for each file
+ * (with the content type taken from a mime.types-style file), and a table
+ * of all of them sorted by path (see src/webc_embed.h).
+ *
+ *    webc_embedgen <mime.types> [dir]
+ *
+ * With no directory an empty table is written, so that the server always
+ * links.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <ctype.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include "../src/webc_mime.h"
+
+struct mime_t {
+   char *ext;
+   char *type;
+};
+
+struct file_t {
+   char *path;
+   char *fname;
+};
+
+static struct mime_t *g_mimes = NULL;
+static size_t g_nmimes = 0;
+
+static struct file_t *g_files = NULL;
+static size_t g_nfiles = 0;
+
+static bool mime_add (const char *ext, const char *type)
+{
+   struct mime_t *tmp = realloc (g_mimes, (g_nmimes + 1) * sizeof *tmp);
+   if (!tmp)
+      return false;
+   g_mimes = tmp;
+
+   g_mimes[g_nmimes].ext = strdup (ext);
+   g_mimes[g_nmimes].type = strdup (type);
+   if (!g_mimes[g_nmimes].ext || !g_mimes[g_nmimes].type)
+      return false;
+
+   g_nmimes++;
+   return true;
+}
+
+static bool mime_load (const char *fname)
+{
+   FILE *inf = fopen (fname, "r");
+   if (!inf) {
+      fprintf (stderr, "Failed to open [%s]: %m\n", fname);
+      return false;
+   }
+
+   char line[1024];
+   while ((fgets (line, sizeof line, inf))) {
+      char *tmp = strchr (line, '#');
+      if (tmp)
+         *tmp = 0;
+
+      char *saveptr = NULL;
+      char *type = strtok_r (line, " \t\r\n", &saveptr);
+      if (!type)
+         continue;
+
+      char *ext;
+      while ((ext = strtok_r (NULL, " \t\r\n", &saveptr))) {
+         for (char *s = ext; *s; s++)
+            *s = tolower (*s);
+         if (!(mime_add (ext, type))) {
+            fprintf (stderr, "OOM error\n");
+            fclose (inf);
+            return false;
+         }
+      }
+   }
+
+   fclose (inf);
+   return true;
+}
+
+// The same rules as webc_mime_type(): the extension after the last '.' in
+// the last path component, and later entries override earlier ones.
+static const char *mime_type (const char *path)
+{
+   const char *ext = strrchr (path, '.');
+   if (!ext || strchr (ext, '/') || !ext[1])
+      return WEBC_MIME_DEFAULT;
+   ext++;
+
+   for (size_t i=g_nmimes; i>0; i--) {
+      const char *lhs = g_mimes[i - 1].ext, *rhs = ext;
+      while (*lhs && *lhs == tolower ((unsigned char)*rhs)) {
+         lhs++;
+         rhs++;
+      }
+      if (!*lhs && !*rhs)
+         return g_mimes[i - 1].type;
+   }
+
+   return WEBC_MIME_DEFAULT;
+}
+
+static char *path_join (const char *lhs, const char *rhs)
+{
+   size_t len = strlen (lhs) + strlen (rhs) + 2;
+   char *ret = malloc (len);
+   if (ret)
+      snprintf (ret, len, "%s%s%s", lhs, lhs[0] ? "/" : "", rhs);
+   return ret;
+}
+
+// Adds every regular file below root/relpath. Symlinks to files are added
+// as files; symlinks to directories are skipped, as they may loop.
+static bool collect (const char *root, const char *relpath)
+{
+   bool error = true;
+   char *dirname = path_join (root, relpath);
+   DIR *dirp = NULL;
+   struct dirent *de;
+
+   if (!dirname || !(dirp = opendir (dirname))) {
+      fprintf (stderr, "Failed to open directory [%s]: %m\n",
+                       dirname ? dirname : relpath);
+      goto errorexit;
+   }
+
+   while ((de = readdir (dirp))) {
+      struct stat sb;
+
+      if ((strcmp (de->d_name, "."))==0 || (strcmp (de->d_name, ".."))==0)
+         continue;
+
+      char *child = path_join (relpath, de->d_name);
+      char *fname = child ? path_join (root, child) : NULL;
+      bool ok = fname != NULL;
+
+      if (ok && (lstat (fname, &sb))==0 && S_ISDIR (sb.st_mode)) {
+         ok = collect (root, child);
+      } else if (ok && (stat (fname, &sb))==0 && S_ISREG (sb.st_mode)) {
+         struct file_t *tmp = realloc (g_files, (g_nfiles + 1) * sizeof *tmp);
+         if ((ok = tmp != NULL)) {
+            g_files = tmp;
+            g_files[g_nfiles].path = child;
+            g_files[g_nfiles].fname = fname;
+            g_nfiles++;
+            child = fname = NULL;
+         }
+      }
+
+      free (child);
+      free (fname);
+      if (!ok)
+         goto errorexit;
+   }
+
+   error = false;
+
+errorexit:
+   if (dirp)
+      closedir (dirp);
+   free (dirname);
+   return !error;
+}
+
+static int cb_file_cmp (const void *lhs, const void *rhs)
+{
+   const struct file_t *flhs = lhs, *frhs = rhs;
+   return strcmp (flhs->path, frhs->path);
+}
+
+static void print_cstring (const char *s)
+{
+   putchar ('"');
+   for (; *s; s++) {
+      if (*s == '"' || *s == '\\')
+         putchar ('\\');
+      if (*s == '\r')
+         printf ("\\r");
+      else if (*s == '\n')
+         printf ("\\n");
+      else
+         putchar (*s);
+   }
+   putchar ('"');
+}
+
+// Writes the body of the file as an array, and returns its size and ETag.
+static bool print_body (size_t idx, const char *fname, uint64_t *size,
+                        char *etag, size_t etag_len)
+{
+   uint64_t hash = 14695981039346656037u;
+   FILE *inf = fopen (fname, "rb");
+   if (!inf) {
+      fprintf (stderr, "Failed to open [%s]: %m\n", fname);
+      return false;
+   }
+
+   printf ("static const unsigned char body_%zu[] = {", idx);
+
+   int c;
+   *size = 0;
+   while ((c = fgetc (inf)) != EOF) {
+      if (*size % 16 == 0)
+         printf ("\n   ");
+      printf ("0x%02x,", c);
+      hash ^= (uint8_t)c;
+      hash *= 1099511628211u;
+      (*size)++;
+   }
+   // Empty arrays are not allowed.
+   if (*size == 0)
+      printf ("\n   0x00,");
+   printf ("\n};\n\n");
+
+   bool ret = !ferror (inf);
+   fclose (inf);
+
+   snprintf (etag, etag_len, "\"%016" PRIx64 "\"", hash);
+   return ret;
+}
+
+int main (int argc, char **argv)
+{
+   int ret = EXIT_FAILURE;
+   char (*etags)[32] = NULL;
+   uint64_t *sizes = NULL;
+
+   if (argc != 2 && argc != 3) {
+      fprintf (stderr, "Usage: %s <mime.types> [dir]\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   if (!(mime_load (argv[1])))
+      goto errorexit;
+
+   if (argc == 3 && argv[2][0]) {
+      if (!(collect (argv[2], "")))
+         goto errorexit;
+      qsort (g_files, g_nfiles, sizeof *g_files, cb_file_cmp);
+   }
+
+   printf ("/* Generated from [%s] by tools/webc_embedgen.c. Do not edit. */\n\n",
+           argc == 3 ? argv[2] : "");
+   printf ("#include <stddef.h>\n\n");
+   printf ("#include \"webc_embed.h\"\n\n");
+
+   etags = calloc (g_nfiles + 1, sizeof *etags);
+   sizes = calloc (g_nfiles + 1, sizeof *sizes);
+   if (!etags || !sizes) {
+      fprintf (stderr, "OOM error\n");
+      goto errorexit;
+   }
+
+   for (size_t i=0; i<g_nfiles; i++) {
+      if (!(print_body (i, g_files[i].fname, &sizes[i], etags[i],
+                        sizeof etags[i])))
+         goto errorexit;
+   }
+
+   printf ("const size_t webc_embed_table_nentries = %zu;\n\n", g_nfiles);
+   printf ("const struct webc_embed_entry_t webc_embed_table[] = {\n");
+   for (size_t i=0; i<g_nfiles; i++) {
+      const char *type = mime_type (g_files[i].path);
+      bool attach = (strcmp (type, WEBC_MIME_DEFAULT))==0;
+      char head[1024];
+      int head_len = snprintf (head, sizeof head,
+                               "Content-Type: %s\r\n"
+                               "Content-Length: %" PRIu64 "\r\n"
+                               "ETag: %s\r\n"
+                               "%s",
+                               type, sizes[i], etags[i],
+                               attach ? "Content-Disposition: attachment;\r\n" : "");
+      if (head_len < 0 || (size_t)head_len >= sizeof head) {
+         fprintf (stderr, "Headers for [%s] are too long\n", g_files[i].path);
+         goto errorexit;
+      }
+
+      printf ("   {\n      ");
+      print_cstring (g_files[i].path);
+      printf (", %zu,\n      ", strlen (g_files[i].path));
+      print_cstring (head);
+      printf (", %i,\n", head_len);
+      printf ("      body_%zu, %" PRIu64 ",\n      ", i, sizes[i]);
+      print_cstring (etags[i]);
+      printf ("\n   },\n");
+   }
+   if (g_nfiles == 0)
+      printf ("   { NULL, 0, NULL, 0, NULL, 0, NULL },\n");
+   printf ("};\n");
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   free (etags);
+   free (sizes);
+   for (size_t i=0; i<g_nfiles; i++) {
+      free (g_files[i].path);
+      free (g_files[i].fname);
+   }
+   free (g_files);
+   for (size_t i=0; i<g_nmimes; i++) {
+      free (g_mimes[i].ext);
+      free (g_mimes[i].type);
+   }
+   free (g_mimes);
+
+   return ret;
+}
@@ -0,0 +1,235 @@
+/* ***************************************************************************
+ * Build-time generator for the built-in MIME table. Reads a mime.types-style
+ * file and writes, to stdout, a C source file containing a two-level
+ * ("hash and displace") perfect hash over all the extensions in the file.
+ *
+ * The runtime lookup is then:
+ *    bucket = hash (ext, 0) % nbuckets
+ *    slot   = hash (ext, seed[bucket]) % nslots
+ * followed by a single string compare.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <ctype.h>
+
+#include "../src/webc_mime.h"
+
+// Keys per first-level bucket, on average.
+#define KEYS_PER_BUCKET    (4)
+
+// Give up on a bucket after this many seeds.
+#define MAX_SEEDS          (1u << 24)
+
+struct entry_t {
+   char *ext;
+   char *type;
+   uint32_t bucket;
+};
+
+static struct entry_t *g_entries = NULL;
+static size_t g_nentries = 0;
+
+static bool entry_add (const char *ext, const char *type)
+{
+   for (size_t i=0; i<g_nentries; i++) {
+      // Later entries override earlier ones, like the runtime loader does.
+      if ((strcmp (g_entries[i].ext, ext))==0) {
+         char *tmp = strdup (type);
+         if (!tmp)
+            return false;
+         free (g_entries[i].type);
+         g_entries[i].type = tmp;
+         return true;
+      }
+   }
+
+   struct entry_t *tmp = realloc (g_entries, (g_nentries + 1) * sizeof *tmp);
+   if (!tmp)
+      return false;
+   g_entries = tmp;
+
+   g_entries[g_nentries].ext = strdup (ext);
+   g_entries[g_nentries].type = strdup (type);
+   if (!g_entries[g_nentries].ext || !g_entries[g_nentries].type)
+      return false;
+
+   g_nentries++;
+   return true;
+}
+
+static bool load_file (const char *fname)
+{
+   FILE *inf = fopen (fname, "r");
+   if (!inf) {
+      fprintf (stderr, "Failed to open [%s]: %m\n", fname);
+      return false;
+   }
+
+   char line[1024];
+   while ((fgets (line, sizeof line, inf))) {
+      char *tmp = strchr (line, '#');
+      if (tmp)
+         *tmp = 0;
+
+      char *saveptr = NULL;
+      char *type = strtok_r (line, " \t\r\n", &saveptr);
+      if (!type)
+         continue;
+
+      char *ext;
+      while ((ext = strtok_r (NULL, " \t\r\n", &saveptr))) {
+         for (char *s = ext; *s; s++)
+            *s = tolower (*s);
+         if (!(entry_add (ext, type))) {
+            fprintf (stderr, "OOM error\n");
+            fclose (inf);
+            return false;
+         }
+      }
+   }
+
+   fclose (inf);
+   return true;
+}
+
+static int cb_bucketsize (const void *lhs, const void *rhs)
+{
+   const size_t *l = lhs, *r = rhs;
+   return (int)r[1] - (int)l[1];
+}
+
+static void print_cstring (const char *s)
+{
+   putchar ('"');
+   for (; *s; s++) {
+      if (*s == '"' || *s == '\\')
+         putchar ('\\');
+      putchar (*s);
+   }
+   putchar ('"');
+}
+
+int main (int argc, char **argv)
+{
+   if (argc != 2) {
+      fprintf (stderr, "Usage: %s <mime.types>\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   if (!(load_file (argv[1])))
+      return EXIT_FAILURE;
+
+   size_t nbuckets = g_nentries / KEYS_PER_BUCKET + 1;
+   size_t nslots = g_nentries + g_nentries / 4 + 1;
+
+   uint32_t *seeds = calloc (nbuckets, sizeof *seeds);
+   int32_t *slots = malloc (nslots * sizeof *slots);
+   size_t (*buckets)[2] = calloc (nbuckets, sizeof *buckets);
+   size_t *trial = malloc ((g_nentries + 1) * sizeof *trial);
+   if (!seeds || !slots || !buckets || !trial) {
+      fprintf (stderr, "OOM error\n");
+      return EXIT_FAILURE;
+   }
+
+   for (size_t i=0; i<nslots; i++)
+      slots[i] = -1;
+
+   for (size_t i=0; i<nbuckets; i++)
+      buckets[i][0] = i;
+
+   for (size_t i=0; i<g_nentries; i++) {
+      const char *ext = g_entries[i].ext;
+      g_entries[i].bucket = webc_mime_hash (ext, strlen (ext), 0) % nbuckets;
+      buckets[g_entries[i].bucket][1]++;
+   }
+
+   // Place the largest buckets first, while the slot table is emptiest.
+   qsort (buckets, nbuckets, sizeof buckets[0], cb_bucketsize);
+
+   for (size_t b=0; b<nbuckets && buckets[b][1]; b++) {
+      size_t bucket = buckets[b][0];
+      bool placed = false;
+
+      for (uint32_t seed=1; seed<MAX_SEEDS && !placed; seed++) {
+         size_t ntrial = 0;
+         placed = true;
+         for (size_t i=0; i<g_nentries; i++) {
+            if (g_entries[i].bucket != bucket)
+               continue;
+            const char *ext = g_entries[i].ext;
+            size_t slot = webc_mime_hash (ext, strlen (ext), seed) % nslots;
+            bool taken = slots[slot] >= 0;
+            for (size_t j=0; j<ntrial && !taken; j++) {
+               if (trial[j] == slot)
+                  taken = true;
+            }
+            if (taken) {
+               placed = false;
+               break;
+            }
+            trial[ntrial++] = slot;
+         }
+         if (placed) {
+            size_t n = 0;
+            for (size_t i=0; i<g_nentries; i++) {
+               if (g_entries[i].bucket == bucket)
+                  slots[trial[n++]] = (int32_t)i;
+            }
+            seeds[bucket] = seed;
+         }
+      }
+
+      if (!placed) {
+         fprintf (stderr, "Failed to find a perfect hash for bucket %zu\n",
+                          bucket);
+         return EXIT_FAILURE;
+      }
+   }
+
+   printf ("/* Generated from [%s] by tools/webc_mimegen.c. Do not edit. */\n\n",
+           argv[1]);
+   printf ("#include <stddef.h>\n");
+   printf ("#include <stdint.h>\n\n");
+   printf ("#include \"webc_mime.h\"\n\n");
+   printf ("const size_t webc_mime_table_nentries = %zu;\n", g_nentries);
+   printf ("const size_t webc_mime_table_nbuckets = %zu;\n", nbuckets);
+   printf ("const size_t webc_mime_table_nslots = %zu;\n\n", nslots);
+
+   printf ("const uint32_t webc_mime_table_seeds[] = {\n");
+   for (size_t i=0; i<nbuckets; i++) {
+      printf ("   %" PRIu32 ",\n", seeds[i]);
+   }
+   printf ("};\n\n");
+
+   printf ("const struct webc_mime_entry_t webc_mime_table_slots[] = {\n");
+   for (size_t i=0; i<nslots; i++) {
+      if (slots[i] < 0) {
+         printf ("   { NULL, NULL },\n");
+         continue;
+      }
+      printf ("   { ");
+      print_cstring (g_entries[slots[i]].ext);
+      printf (", ");
+      print_cstring (g_entries[slots[i]].type);
+      printf (" },\n");
+   }
+   printf ("};\n");
+
+   free (trial);
+   free (buckets);
+   free (slots);
+   free (seeds);
+   for (size_t i=0; i<g_nentries; i++) {
+      free (g_entries[i].ext);
+      free (g_entries[i].type);
+   }
+   free (g_entries);
+
+   return EXIT_SUCCESS;
+}
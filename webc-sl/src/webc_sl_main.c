@@ -27,6 +27,7 @@
 #include "webc_config.h"
 #include "webc_resource.h"
 #include "webc_handler.h"
+#include "webc_server.h"
 
 #include "webc_sl.h"
 
@@ -70,12 +71,10 @@ int main (int argc, char **argv)
 
    uint32_t listen_port = 0;
    int backlog = 0;
-   int listenfd = -1;
-   uint8_t errcount = 0;
+   struct webc_server_config_t config;
+   webc_server_t *server = NULL;
 
-   int clientfd = -1;
-   char *remote_addr = NULL;
-   uint16_t remote_port = 0;
+   webc_server_config_init (&config);
 
    /* *************************************************************
     *  Handle the command line arguments
@@ -282,41 +281,26 @@ int main (int argc, char **argv)
 
    /* ************************************************************** */
 
-   if ((listenfd = webc_create_listener (listen_port, backlog)) < 0) {
-      WEBC_UTIL_LOG ("Unable to create a listener, aborting\n");
+   config.listeners[0].port = listen_port;
+   config.listeners[0].backlog = backlog;
+   config.nlisteners = 1;
+   config.root = ".";
+
+   if (!(server = webc_server_new (&config)) ||
+       !(webc_server_start (server))) {
+      WEBC_UTIL_LOG ("Unable to start the server, aborting\n");
       goto errorexit;
    }
 
-   WEBC_UTIL_LOG ("Listening on %u q/%i\n", listen_port, backlog);
-
-   errcount = 0;
-   while (!g_exit_program && errcount < 5) {
-      free (remote_addr);
-      remote_addr = NULL;
-      clientfd = webc_accept_conn (listenfd, g_timeout,
-                                            &remote_addr,
-                                            &remote_port);
-      if (clientfd == 0) { // Timeout
-         errcount = 0;
-         continue;
-      }
-      if (clientfd < 0) { // Error
-         errcount++;
-         WEBC_UTIL_LOG ("Failed to accept(), errcount=%" PRIu8 "\n", errcount);
-         continue;
-      }
-
-      if (!(webc_handle_conn (clientfd, remote_addr, remote_port))) {
-         WEBC_UTIL_LOG ("Failed to start response thread for client [%s:%u]\n",
-                     remote_addr, remote_port);
-         goto errorexit;
-      }
-      clientfd = -1;
-      errcount = 0;
+   while (!g_exit_program && webc_server_running (server)) {
+      sleep (g_timeout);
    }
 
-   if (!g_exit_program && errcount) {
-      WEBC_UTIL_LOG ("Aborting due to excessive error-count %" PRIu8 "\n", errcount);
+   webc_server_stop (server);
+   webc_server_wait (server);
+
+   if (!g_exit_program) {
+      WEBC_UTIL_LOG ("The server stopped accepting connections, aborting\n");
       goto errorexit;
    }
 
@@ -326,17 +310,9 @@ errorexit:
 
    free (logfile_name);
 
-   if (listenfd >= 0) {
-      shutdown (listenfd, SHUT_RDWR);
-      close (listenfd);
-   }
-
-   if (clientfd >= 0) {
-      shutdown (listenfd, SHUT_RDWR);
-      close (clientfd);
-   }
-
-   free (remote_addr);
+   webc_server_stop (server);
+   webc_server_wait (server);
+   webc_server_del (server);
 
    return ret;
 }